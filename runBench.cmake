@@ -0,0 +1,87 @@
+# run box86bench under box86, each benchmark in each mode, and collect the results in a JSON file
+# arguments checking
+if( NOT BENCH_PROGRAM )
+  message( FATAL_ERROR "Require BENCH_PROGRAM to be defined" )
+endif( NOT BENCH_PROGRAM )
+if( NOT BENCH_ARGS )
+  message( FATAL_ERROR "Require BENCH_ARGS to be defined" )
+endif( NOT BENCH_ARGS )
+if( NOT BENCH_OUTPUT )
+  message( FATAL_ERROR "Require BENCH_OUTPUT to be defined" )
+endif( NOT BENCH_OUTPUT )
+if( NOT BENCH_MODES )
+  set(BENCH_MODES interpreter)
+endif( NOT BENCH_MODES )
+
+set(ENV{BOX86_LOG} 0)
+set(ENV{BOX86_NOBANNER} 1)
+if( EXISTS ${CMAKE_SOURCE_DIR}/x86lib )
+  # we are inside box86 folder
+  set(ENV{LD_LIBRARY_PATH} ${CMAKE_SOURCE_DIR}/x86lib)
+else()
+  # we are inside build folder
+  set(ENV{LD_LIBRARY_PATH} ${CMAKE_SOURCE_DIR}/../x86lib)
+endif( EXISTS ${CMAKE_SOURCE_DIR}/x86lib )
+
+# list of the benchmarks
+execute_process(
+  COMMAND ${BENCH_PROGRAM} ${BENCH_ARGS} --list
+  OUTPUT_VARIABLE BENCH_LIST
+  ERROR_VARIABLE BENCH_ERROR
+  RESULT_VARIABLE BENCH_RESULT
+  OUTPUT_STRIP_TRAILING_WHITESPACE
+  )
+if( BENCH_RESULT )
+  message( FATAL_ERROR "Failed: ${BENCH_ARGS} --list exited != 0.\n${BENCH_ERROR}" )
+endif( BENCH_RESULT )
+string(REPLACE "\n" ";" BENCH_LIST "${BENCH_LIST}")
+
+set(BENCH_COMMIT "unknown")
+if( BENCH_SOURCE_DIR )
+  execute_process(
+    COMMAND git rev-parse --short HEAD
+    WORKING_DIRECTORY ${BENCH_SOURCE_DIR}
+    OUTPUT_VARIABLE BENCH_GIT
+    RESULT_VARIABLE BENCH_RESULT
+    OUTPUT_STRIP_TRAILING_WHITESPACE
+    ERROR_QUIET
+    )
+  if( NOT BENCH_RESULT )
+    set(BENCH_COMMIT ${BENCH_GIT})
+  endif( NOT BENCH_RESULT )
+endif( BENCH_SOURCE_DIR )
+
+# one process per benchmark and mode, so a crash only loses one result
+set(BENCH_JSON "")
+set(BENCH_FAILED "")
+foreach(mode ${BENCH_MODES})
+  if( mode STREQUAL "dynarec" )
+    set(ENV{BOX86_DYNAREC} 1)
+  else()
+    set(ENV{BOX86_DYNAREC} 0)
+  endif()
+  foreach(bench ${BENCH_LIST})
+    execute_process(
+      COMMAND ${BENCH_PROGRAM} ${BENCH_ARGS} ${bench}
+      OUTPUT_VARIABLE BENCH_LINE
+      ERROR_VARIABLE BENCH_ERROR
+      RESULT_VARIABLE BENCH_RESULT
+      OUTPUT_STRIP_TRAILING_WHITESPACE
+      )
+    if( BENCH_RESULT OR NOT BENCH_LINE MATCHES "^{.*}$" )
+      message( "Failed: ${bench} (${mode})\n${BENCH_ERROR}" )
+      list(APPEND BENCH_FAILED "\"${mode}/${bench}\"")
+    else()
+      message( "${mode}: ${BENCH_LINE}" )
+      string(REGEX REPLACE "^{" "{\"mode\": \"${mode}\", " BENCH_LINE "${BENCH_LINE}")
+      if( BENCH_JSON )
+        set(BENCH_JSON "${BENCH_JSON},\n")
+      endif( BENCH_JSON )
+      set(BENCH_JSON "${BENCH_JSON}    ${BENCH_LINE}")
+    endif()
+  endforeach()
+endforeach()
+
+string(REPLACE ";" ", " BENCH_FAILED "${BENCH_FAILED}")
+file(WRITE ${BENCH_OUTPUT} "{\n  \"format\": 1,\n  \"commit\": \"${BENCH_COMMIT}\",\n  \"results\": [\n${BENCH_JSON}\n  ],\n  \"failed\": [${BENCH_FAILED}]\n}\n")
+message( "Benchmark results written to ${BENCH_OUTPUT}" )
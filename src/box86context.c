@@ -19,55 +19,162 @@
 #include "threads.h"
 #include "x86trace.h"
 #include "signals.h"
-#ifdef DYNAREC
+#include "emu/x86predecode.h"
 #include <sys/mman.h>
+#ifdef DYNAREC
 #include "dynablock.h"
 
-#define MMAPSIZE (4*1024*1024)      // allocate 4Mo sized blocks
+#define MMAPSHIFT   22
+#define MMAPSIZE    (1<<MMAPSHIFT)  // allocate 4Mo sized chunks, aligned on their size
 #define MMAPBLOCK   256             // minimum size of a block
+#define MMAPUNITS   (MMAPSIZE/MMAPBLOCK)
+#define MMAPCLASSES 32              // free lists by size class of MMAPBLOCK step, bigger blocks go to the "large" list
+#define MMAPARENAS  8               // threads are spread on that many arenas
+
+// a free block, its size is also at the end of the block so the previous block can be found when coalescing
+typedef struct mmapfree_s {
+    struct mmapfree_s*  next;
+    struct mmapfree_s** pprev;
+    uint32_t            size;
+} mmapfree_t;
 
 typedef struct mmaplist_s {
-    void*         block;
-    uint8_t       map[MMAPSIZE/(8*MMAPBLOCK)];  // map of allocated sub-block
+    void*               block;
+    int                 arena;
+    uint32_t            bounds[MMAPUNITS/32];   // first and last MMAPBLOCK of each free block
 } mmaplist_t;
 
-// get first subblock free in map, stating at start. return -1 if no block, else first subblock free, filling size (in subblock unit)
-static int getFirstBlock(mmaplist_t *map, int start, int maxsize, int* size)
+typedef struct mmaparena_s {
+    pthread_mutex_t     mutex;
+    uintptr_t           cur;        // bump allocation in the current chunk
+    uintptr_t           end;
+    mmapfree_t*         freelist[MMAPCLASSES];
+    mmapfree_t*         large;
+    uint32_t            live;       // bytes allocated
+    uint32_t            holes;      // bytes in the free lists
+    uint32_t            chunks;
+} mmaparena_t;
+
+static __thread int mmap_arena = -1;
+static int mmap_next_arena = 0;
+static uint32_t mmap_large = 0;     // bytes in maps bigger than MMAPSIZE
+
+static mmaparena_t* getArena()
 {
-    #define ISFREE(A) (((map->map[(A)>>3]>>((A)&7))&1)?0:1)
-    if(start<0) start = 0;
-    while(start<MMAPSIZE/(8*MMAPBLOCK)) {   // still a chance...
-        if(ISFREE(start)) {
-            // free, now get size...
-            int end = start+1;
-            while(end<MMAPSIZE/(8*MMAPBLOCK)) {
-                if(!ISFREE(end) || (end-start==maxsize)) {
-                    if(size) *size = end-start;
-                    return start;
-                }
-                ++end;
-            }
-            if(size) *size = end-start;
-            return start;
-        }
-        ++start;
+    if(mmap_arena<0)
+        mmap_arena = __sync_fetch_and_add(&mmap_next_arena, 1)%MMAPARENAS;
+    return &my_context->mmaparenas[mmap_arena];
+}
+
+// create a new chunk for arena, aligned on MMAPSIZE (so owner can be found directly from the address)
+static uintptr_t newChunk(int arena)
+{
+    uint8_t* p = (uint8_t*)mmap(NULL, MMAPSIZE*2, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p==MAP_FAILED) {
+        dynarec_log(LOG_DEBUG, "Cannot create memory map of %d byte for dynarec chunk\n", MMAPSIZE);
+        return 0;
     }
-    return -1;
+    uint8_t* aligned = (uint8_t*)(((uintptr_t)p+MMAPSIZE-1)&~(MMAPSIZE-1));
+    if(aligned!=p)
+        munmap(p, aligned-p);
+    munmap(aligned+MMAPSIZE, p+MMAPSIZE-aligned);
+    mmaplist_t* chunk = (mmaplist_t*)calloc(1, sizeof(mmaplist_t));
+    chunk->block = aligned;
+    chunk->arena = arena;
+    my_context->mmapowner[(uintptr_t)aligned>>MMAPSHIFT] = chunk;
+    dynarec_log(LOG_DEBUG, "Ask for DynaRec Block Alloc at %p (arena %d)\n", aligned, arena);
+    return (uintptr_t)aligned;
+}
+
+#define BOUND(A)        (((A)&(MMAPSIZE-1))/MMAPBLOCK)
+#define ISBOUND(C, A)   ((C)->bounds[BOUND(A)>>5]&(1u<<(BOUND(A)&31)))
+#define SETBOUND(C, A)  (C)->bounds[BOUND(A)>>5] |= (1u<<(BOUND(A)&31))
+#define CLRBOUND(C, A)  (C)->bounds[BOUND(A)>>5] &= ~(1u<<(BOUND(A)&31))
+
+// put a free block in its free list, arena must be locked
+static void pushFree(mmaparena_t* arena, uintptr_t addr, uint32_t bsize)
+{
+    mmaplist_t* chunk = my_context->mmapowner[addr>>MMAPSHIFT];
+    mmapfree_t* f = (mmapfree_t*)addr;
+    f->size = bsize;
+    *(uint32_t*)(addr+bsize-sizeof(uint32_t)) = bsize;
+    SETBOUND(chunk, addr);
+    SETBOUND(chunk, addr+bsize-MMAPBLOCK);
+    int cls = bsize/MMAPBLOCK-1;
+    mmapfree_t** head = (cls<MMAPCLASSES)?&arena->freelist[cls]:&arena->large;
+    f->next = *head;
+    f->pprev = head;
+    if(f->next)
+        f->next->pprev = &f->next;
+    *head = f;
+    arena->holes += bsize;
+}
+
+// remove a free block from its free list, arena must be locked
+static void unlinkFree(mmaparena_t* arena, mmapfree_t* f)
+{
+    mmaplist_t* chunk = my_context->mmapowner[(uintptr_t)f>>MMAPSHIFT];
+    *f->pprev = f->next;
+    if(f->next)
+        f->next->pprev = f->pprev;
+    CLRBOUND(chunk, (uintptr_t)f);
+    CLRBOUND(chunk, (uintptr_t)f+f->size-MMAPBLOCK);
+    arena->holes -= f->size;
 }
 
-static void allocBlock(mmaplist_t *map, int start, int size)
+// get a free block of bsize from the free lists (splitting a large one if needed), arena must be locked
+static uintptr_t popFree(mmaparena_t* arena, uint32_t bsize)
 {
-    for(int i=0; i<size; ++i) {
-        map->map[start/8]|=(1<<(start&7));
-        ++start;
+    int cls = bsize/MMAPBLOCK-1;
+    if(cls<MMAPCLASSES && arena->freelist[cls]) {
+        mmapfree_t* f = arena->freelist[cls];
+        unlinkFree(arena, f);
+        return (uintptr_t)f;
     }
+    // first fit in the large list
+    for(mmapfree_t* f = arena->large; f; f = f->next)
+        if(f->size>=bsize) {
+            uint32_t fsize = f->size;
+            unlinkFree(arena, f);
+            if(fsize>bsize)
+                pushFree(arena, (uintptr_t)f+bsize, fsize-bsize);
+            return (uintptr_t)f;
+        }
+    return 0;
 }
-static void freeBlock(mmaplist_t *map, int start, int size)
+
+// give back a block, merging it with the free blocks around it, arena must be locked
+// the block goes back to the bump allocation if it ends there, and a chunk is unmapped once fully free
+static void releaseBlock(mmaparena_t* arena, uintptr_t addr, uint32_t bsize)
 {
-    for(int i=0; i<size; ++i) {
-        map->map[start/8]&=~(1<<(start&7));
-        ++start;
+    mmaplist_t* chunk = my_context->mmapowner[addr>>MMAPSHIFT];
+    uintptr_t base = (uintptr_t)chunk->block;
+    uintptr_t next = addr+bsize;
+    if(next<base+MMAPSIZE && ISBOUND(chunk, next)) {
+        mmapfree_t* f = (mmapfree_t*)next;
+        bsize += f->size;
+        unlinkFree(arena, f);
+    }
+    if(addr>base && ISBOUND(chunk, addr-MMAPBLOCK)) {
+        uint32_t psize = *(uint32_t*)(addr-sizeof(uint32_t));
+        addr -= psize;
+        bsize += psize;
+        unlinkFree(arena, (mmapfree_t*)addr);
+    }
+    if(arena->end==base+MMAPSIZE && addr+bsize==arena->cur) {
+        arena->cur = addr;
+        return;
+    }
+    if(bsize==MMAPSIZE) {
+        // chunk is empty, and it's not the current one
+        my_context->mmapowner[base>>MMAPSHIFT] = NULL;
+        munmap(chunk->block, MMAPSIZE);
+        free(chunk);
+        --arena->chunks;
+        dynarec_log(LOG_DEBUG, "Free DynaRec Block Alloc at %p (arena %d)\n", (void*)base, (int)(arena-my_context->mmaparenas));
+        return;
     }
+    pushFree(arena, addr, bsize);
 }
 
 uintptr_t AllocDynarecMap(int size, int nolinker)
@@ -78,62 +185,77 @@ uintptr_t AllocDynarecMap(int size, int nolinker)
             dynarec_log(LOG_DEBUG, "Cannot create dynamic map of %d bytes\n", size);
             return 0;
         }
+        __sync_fetch_and_add(&mmap_large, size);
         return (uintptr_t)p;
     }
-    pthread_mutex_lock(&my_context->mutex_mmap);
-    int bsize = (size+MMAPBLOCK-1)/MMAPBLOCK;
-    // look for free space
-    for(int i=0; i<my_context->mmapsize; ++i) {
-        int rsize = 0;
-        int start = 0;
-        do {
-            start = getFirstBlock(my_context->mmaplist+i, start, bsize, &rsize);
-            if(start!=-1 && rsize>=bsize) {
-                allocBlock(my_context->mmaplist+i, start, bsize);
-                uintptr_t ret = (uintptr_t)my_context->mmaplist[i].block + start*MMAPBLOCK;
-                pthread_mutex_unlock(&my_context->mutex_mmap);
-                return ret;
+    uint32_t bsize = ((size+MMAPBLOCK-1)/MMAPBLOCK)*MMAPBLOCK;
+    mmaparena_t* arena = getArena();
+    pthread_mutex_lock(&arena->mutex);
+    uintptr_t ret = popFree(arena, bsize);
+    if(!ret) {
+        if(arena->cur+bsize>arena->end) {
+            // no luck, add a new chunk! what is left of the current one goes to the free lists
+            uintptr_t p = newChunk(arena-my_context->mmaparenas);
+            if(!p) {
+                pthread_mutex_unlock(&arena->mutex);
+                return 0;
             }
-            if(start!=-1)
-                start += rsize;
-        } while (start!=-1);
-    }
-    // no luck, add a new one !
-    int i = my_context->mmapsize++;    // yeah, useful post incrementation
-    dynarec_log(LOG_DEBUG, "Ask for DynaRec Block Alloc #%d\n", my_context->mmapsize);
-    my_context->mmaplist = (mmaplist_t*)realloc(my_context->mmaplist, my_context->mmapsize*sizeof(mmaplist_t));
-    void* p = mmap(NULL, MMAPSIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if(p==MAP_FAILED) {
-        dynarec_log(LOG_DEBUG, "Cannot create memory map of %d byte for dynarec block #%d\n", MMAPSIZE, i);
-        --my_context->mmapsize;
-        pthread_mutex_unlock(&my_context->mutex_mmap);
-        return 0;
+            uintptr_t old = arena->cur;
+            uintptr_t oldend = arena->end;
+            arena->cur = p;
+            arena->end = p+MMAPSIZE;
+            ++arena->chunks;
+            if(oldend>old)
+                releaseBlock(arena, old, oldend-old);
+        }
+        ret = arena->cur;
+        arena->cur += bsize;
     }
-    my_context->mmaplist[i].block = p;
-    memset(my_context->mmaplist[i].map, 0, sizeof(my_context->mmaplist[i].map));
-    allocBlock(my_context->mmaplist+i, 0, bsize);
-    pthread_mutex_unlock(&my_context->mutex_mmap);
-    return (uintptr_t)p;
+    arena->live += bsize;
+    pthread_mutex_unlock(&arena->mutex);
+    return ret;
 }
 
 void FreeDynarecMap(uintptr_t addr, uint32_t size)
 {
     if(size>MMAPSIZE) {
         munmap((void*)addr, size);
+        __sync_fetch_and_sub(&mmap_large, size);
         return;
     }
-    pthread_mutex_lock(&my_context->mutex_mmap);
-    int bsize = (size+MMAPBLOCK-1)/MMAPBLOCK;
-    // look for free space
-    for(int i=0; i<my_context->mmapsize; ++i) {
-        if(addr>=(uintptr_t)my_context->mmaplist[i].block && ((uintptr_t)my_context->mmaplist[i].block+MMAPSIZE)>=addr+size) {
-            int start = (addr - (uintptr_t)my_context->mmaplist[i].block) / MMAPBLOCK;
-            freeBlock(my_context->mmaplist+i, start, bsize);
-            pthread_mutex_unlock(&my_context->mutex_mmap);
-            return;
-        }
+    mmaplist_t* chunk = my_context->mmapowner[addr>>MMAPSHIFT];
+    if(!chunk)
+        return;
+    uint32_t bsize = ((size+MMAPBLOCK-1)/MMAPBLOCK)*MMAPBLOCK;
+    mmaparena_t* arena = &my_context->mmaparenas[chunk->arena];
+    pthread_mutex_lock(&arena->mutex);
+    arena->live -= bsize;
+    releaseBlock(arena, addr, bsize);
+    pthread_mutex_unlock(&arena->mutex);
+}
+
+// bytes currently allocated for dynarec code (no lock, so just an estimation if other threads are allocating)
+uint32_t SizeDynarecMap()
+{
+    uint32_t ret = mmap_large;
+    for(int i=0; i<MMAPARENAS; ++i)
+        ret += my_context->mmaparenas[i].live;
+    return ret;
+}
+
+void PrintDynarecMapStats(int level)
+{
+    uint32_t live = 0, holes = 0, tail = 0, chunks = 0;
+    for(int i=0; i<MMAPARENAS; ++i) {
+        mmaparena_t* arena = &my_context->mmaparenas[i];
+        pthread_mutex_lock(&arena->mutex);
+        live += arena->live;
+        holes += arena->holes;
+        tail += arena->end-arena->cur;
+        chunks += arena->chunks;
+        pthread_mutex_unlock(&arena->mutex);
     }
-    pthread_mutex_unlock(&my_context->mutex_mmap);
+    dynarec_log(level, "Dynarec memory: %u chunk(s) of %dKB, live %u bytes, free %u bytes (%u fragmented in free lists)\n", chunks, MMAPSIZE/1024, live, holes+tail, holes);
 }
 
 // each dynmap is 64k of size
@@ -153,8 +275,13 @@ void addDBFromAddressRange(uintptr_t addr, uintptr_t size, int nolinker)
     uintptr_t end = ((addr+size-1)>>DYNAMAP_SHIFT);
     for (uintptr_t i=idx; i<=end; ++i) {
         if(!my_context->dynmap[i]) {
-            my_context->dynmap[i] = (dynmap_t*)calloc(1, sizeof(dynmap_t));
-            my_context->dynmap[i]->dynablocks = NewDynablockList(i<<DYNAMAP_SHIFT, i<<DYNAMAP_SHIFT, 1<<DYNAMAP_SHIFT, nolinker, 0);
+            dynmap_t* dynmap = (dynmap_t*)calloc(1, sizeof(dynmap_t));
+            dynmap->dynablocks = NewDynablockList(i<<DYNAMAP_SHIFT, 1<<DYNAMAP_SHIFT, nolinker);
+            if(!__sync_bool_compare_and_swap(&my_context->dynmap[i], NULL, dynmap)) {
+                // another thread was faster
+                FreeDynablockList(&dynmap->dynablocks);
+                free(dynmap);
+            }
         } else {
             ProtectkDynablockList(&my_context->dynmap[i]->dynablocks);
         }
@@ -192,6 +319,8 @@ void cleanDBFromAddressRange(uintptr_t addr, uintptr_t size, int destroy)
     }
 }
 
+#endif
+
 // Remove the Write flag from an adress range, so DB can be executed
 // no log, as it can be executed inside a signal handler
 void protectDB(uintptr_t addr, uintptr_t size)
@@ -210,10 +339,11 @@ void unprotectDB(uintptr_t addr, uintptr_t size)
     uintptr_t end = (addr+size+(box86_pagesize-1))&~(box86_pagesize-1);
     // should get "end" according to last block inside the window
     mprotect((void*)start, end-start, PROT_READ|PROT_WRITE|PROT_EXEC);
+#ifdef DYNAREC
     cleanDBFromAddressRange(start, end-start, 0);
-}
-
 #endif
+    cleanPredecodeRange(start, end-start);
+}
 
 EXPORTDYN
 void initAllHelpers(box86context_t* context)
@@ -298,9 +428,6 @@ box86context_t *NewBox86Context(int argc)
     pthread_mutex_init(&context->mutex_once, NULL);
     pthread_mutex_init(&context->mutex_once2, NULL);
     pthread_mutex_init(&context->mutex_trace, NULL);
-#ifndef DYNAREC
-    pthread_mutex_init(&context->mutex_lock, NULL);
-#endif
     pthread_mutex_init(&context->mutex_tls, NULL);
     pthread_mutex_init(&context->mutex_thread, NULL);
 #ifdef DYNAREC
@@ -310,8 +437,10 @@ box86context_t *NewBox86Context(int argc)
 
 #ifdef DYNAREC
     pthread_mutex_init(&context->mutex_blocks, NULL);
-    pthread_mutex_init(&context->mutex_mmap, NULL);
-    context->dynablocks = NewDynablockList(0, 0, 0, 0, 0);
+    context->mmaparenas = (mmaparena_t*)calloc(MMAPARENAS, sizeof(mmaparena_t));
+    for(int i=0; i<MMAPARENAS; ++i)
+        pthread_mutex_init(&context->mmaparenas[i].mutex, NULL);
+    context->dynablocks = NewDynablockList(0, 0, 0);
 #endif
     InitFTSMap(context);
 
@@ -373,15 +502,21 @@ void FreeBox86Context(box86context_t** context)
     dynarec_log(LOG_DEBUG, "Free global Dynarecblocks\n");
     if(ctx->dynablocks)
         FreeDynablockList(&ctx->dynablocks);
-    for (int i=0; i<ctx->mmapsize; ++i)
-        if(ctx->mmaplist[i].block)
-            munmap(ctx->mmaplist[i].block, MMAPSIZE);
-    free(ctx->mmaplist);
-    pthread_mutex_destroy(&ctx->mutex_blocks);
-    pthread_mutex_destroy(&ctx->mutex_mmap);
     dynarec_log(LOG_DEBUG, "Free dynamic Dynarecblocks\n");
     cleanDBFromAddressRange(0, 0xffffffff, 1);
+    ReleaseRetiredDynablocks(1);
+    PrintDynarecMapStats(LOG_INFO);
+    for (int i=0; i<MMAPOWNER_SIZE; ++i)
+        if(ctx->mmapowner[i]) {
+            munmap(ctx->mmapowner[i]->block, MMAPSIZE);
+            free(ctx->mmapowner[i]);
+        }
+    for(int i=0; i<MMAPARENAS; ++i)
+        pthread_mutex_destroy(&ctx->mmaparenas[i].mutex);
+    free(ctx->mmaparenas);
+    pthread_mutex_destroy(&ctx->mutex_blocks);
 #endif
+    FreePredecode();
     
     *context = NULL;                // bye bye my_context
 
@@ -426,9 +561,6 @@ void FreeBox86Context(box86context_t** context)
     pthread_mutex_destroy(&ctx->mutex_once);
     pthread_mutex_destroy(&ctx->mutex_once2);
     pthread_mutex_destroy(&ctx->mutex_trace);
-#ifndef DYNAREC
-    pthread_mutex_destroy(&ctx->mutex_lock);
-#endif
     pthread_mutex_destroy(&ctx->mutex_tls);
     pthread_mutex_destroy(&ctx->mutex_thread);
 #ifdef DYNAREC
@@ -487,6 +619,7 @@ void add_neededlib(needed_libs_t* needed, library_t* lib)
         needed->libs = (library_t**)realloc(needed->libs, needed->cap*sizeof(library_t*));
     }
     needed->libs[needed->size++] = lib;
+    SymbolScopeChanged();
 }
 
 void free_neededlib(needed_libs_t* needed)
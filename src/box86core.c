@@ -0,0 +1,346 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "debug.h"
+#include "box86context.h"
+#include "x86emu.h"
+#include "x86run.h"
+#include "emu/x86emu_private.h"
+#include "emu/x86run_private.h"
+#include "emu/x87emu_private.h"
+#include "emu/x86predecode.h"
+#include "box86core.h"
+
+// libbox86core: the interpreter alone. This file provide the globals and the few functions
+// the emu files need from the rest of box86 (loader, librarian, tls, syscalls...)
+
+int box86_log = LOG_NONE;
+int box86_pagesize = 0;
+int box86_predecode = 0;
+int trace_xmm = 0;
+int trace_emm = 0;
+uintptr_t trace_start = 0, trace_end = 0;
+uint16_t default_fs = 0;
+box86context_t *my_context = NULL;
+FILE* ftrace = NULL;
+
+#define CORE_STACK  (1024*1024)
+
+typedef struct coremap_s {
+    uint32_t    addr;
+    uint32_t    size;
+} coremap_t;
+
+struct box86core_s {
+    x86emu_t*   emu;
+    coremap_t*  maps;
+    int         nmaps;
+    int         capmaps;
+    uint32_t    segbase[2]; // base of FS and GS
+};
+
+static __thread box86core_t* current_core = NULL;   // core running on this thread
+
+// *** stubs of the box86 parts not in the core
+
+// INT 0x80 and INT 3 stop the run, the caller handle them
+void x86Syscall(x86emu_t *emu)
+{
+    ++emu->core_icount;
+    emu->core_stop = BOX86CORE_SYSCALL;
+    emu->quit = 1;
+}
+void x86Int3(x86emu_t* emu)
+{
+    ++emu->core_icount;
+    emu->core_stop = BOX86CORE_INT3;
+    emu->quit = 1;
+}
+
+void* GetSegmentBase(uint32_t desc)
+{
+    box86core_t* core = current_core;
+    if(!core || !desc)
+        return NULL;
+    x86emu_t* emu = core->emu;
+    if(desc==emu->segs[_FS])
+        return (void*)(uintptr_t)core->segbase[0];
+    if(desc==emu->segs[_GS])
+        return (void*)(uintptr_t)core->segbase[1];
+    return NULL;
+}
+
+void Push16(x86emu_t *emu, uint16_t v)
+{
+    R_ESP -= 2;
+    *((uint16_t*)R_ESP) = v;
+}
+uint16_t Pop16(x86emu_t *emu)
+{
+    uint16_t* st = ((uint16_t*)(R_ESP));
+    R_ESP += 2;
+    return *st;
+}
+
+int GetTID()
+{
+    return syscall(SYS_gettid);
+}
+
+int DynaRun(x86emu_t *emu)
+{
+    return Run(emu, 0);
+}
+
+// there is no elf, no native lib and no signal in the core
+elfheader_t* FindElfAddress(box86context_t *context, uintptr_t addr) {return NULL;}
+const char* ElfName(elfheader_t* head) {return NULL;}
+const char* FindNearestSymbolName(elfheader_t* h, void* p, uintptr_t* start, uint32_t* sz) {return NULL;}
+const char* GetNameOffset(lib_t *maplib, void* offs) {return NULL;}
+void protectDB(uintptr_t addr, uintptr_t size) {}
+uint32_t RunFunctionWithEmu(x86emu_t *emu, int QuitOnLongJump, uintptr_t fnc, int nargs, ...)
+{
+    printf_log(LOG_NONE, "libbox86core: RunFunctionWithEmu(%p) not supported\n", (void*)fnc);
+    emu->quit = 1;
+    return 0;
+}
+x86emu_t* x86emu_fork(x86emu_t* e, int forktype)
+{
+    printf_log(LOG_NONE, "libbox86core: fork not supported\n");
+    return e;
+}
+int my_setcontext(x86emu_t* emu, void* ucp)
+{
+    printf_log(LOG_NONE, "libbox86core: setcontext not supported\n");
+    emu->uc_link = NULL;
+    emu->quit = 1;
+    return -1;
+}
+
+int CoreBreakpoint(x86emu_t* emu, uintptr_t addr)
+{
+    for(int i=0; i<emu->core_nbp; ++i)
+        if(emu->core_bp[i]==addr)
+            return 1;
+    return 0;
+}
+
+// *** API
+
+static void coreInit()
+{
+    if(my_context)
+        return;
+    if(!ftrace)
+        ftrace = stderr;
+    box86_pagesize = sysconf(_SC_PAGESIZE);
+    if(!box86_pagesize)
+        box86_pagesize = 4096;
+    my_context = (box86context_t*)calloc(1, sizeof(box86context_t));
+}
+
+box86core_t* box86core_new()
+{
+    coreInit();
+    box86core_t* core = (box86core_t*)calloc(1, sizeof(box86core_t));
+    uint32_t stack = box86core_map(core, 0, CORE_STACK, PROT_READ|PROT_WRITE);
+    if(!stack) {
+        free(core);
+        return NULL;
+    }
+    core->emu = NewX86Emu(my_context, 0, stack, CORE_STACK, 0);
+    return core;
+}
+
+void box86core_free(box86core_t* core)
+{
+    if(!core)
+        return;
+    FreeX86Emu(&core->emu);
+    for(int i=0; i<core->nmaps; ++i) {
+        munmap((void*)(uintptr_t)core->maps[i].addr, core->maps[i].size);
+        forgetPredecodeRange(core->maps[i].addr, core->maps[i].size);
+    }
+    free(core->maps);
+    free(core);
+}
+
+uint32_t box86core_map(box86core_t* core, uint32_t addr, uint32_t size, int prot)
+{
+    if(!size)
+        return 0;
+    size = (size+box86_pagesize-1)&~(box86_pagesize-1);
+    int flags = MAP_PRIVATE|MAP_ANONYMOUS;
+    if(addr) {
+        #ifdef MAP_FIXED_NOREPLACE
+        flags |= MAP_FIXED_NOREPLACE;
+        #endif
+    } else {
+        #ifdef MAP_32BIT
+        flags |= MAP_32BIT;
+        #endif
+    }
+    void* p = mmap((void*)(uintptr_t)addr, size, prot, flags, -1, 0);
+    if(p==MAP_FAILED)
+        return 0;
+    if((addr && (uintptr_t)p!=addr) || ((uintptr_t)p+size-1)>0xffffffffLL) {
+        // the kernel ignored the hint, or the mapping is not reachable from x86 code
+        munmap(p, size);
+        return 0;
+    }
+    if(core->nmaps==core->capmaps) {
+        core->capmaps += 8;
+        core->maps = (coremap_t*)realloc(core->maps, core->capmaps*sizeof(coremap_t));
+    }
+    forgetPredecodeRange((uintptr_t)p, size);    // in case something was pre-decoded at this address before
+    core->maps[core->nmaps].addr = (uintptr_t)p;
+    core->maps[core->nmaps].size = size;
+    ++core->nmaps;
+    return (uintptr_t)p;
+}
+
+static int isMapped(box86core_t* core, uint32_t addr, uint32_t size)
+{
+    for(int i=0; i<core->nmaps; ++i)
+        if(addr>=core->maps[i].addr && (uint64_t)addr+size<=(uint64_t)core->maps[i].addr+core->maps[i].size)
+            return 1;
+    return 0;
+}
+
+int box86core_write(box86core_t* core, uint32_t addr, const void* src, uint32_t size)
+{
+    if(!isMapped(core, addr, size))
+        return -1;
+    memcpy((void*)(uintptr_t)addr, src, size);
+    forgetPredecodeRange(addr, size);   // no write protection in the core, the pre-decoded blocks must be dropped here
+    return 0;
+}
+
+int box86core_read(box86core_t* core, uint32_t addr, void* dst, uint32_t size)
+{
+    if(!isMapped(core, addr, size))
+        return -1;
+    memcpy(dst, (void*)(uintptr_t)addr, size);
+    return 0;
+}
+
+uint32_t box86core_get_reg(box86core_t* core, box86core_reg_t reg)
+{
+    x86emu_t* emu = core->emu;
+    switch(reg) {
+        case BOX86CORE_EIP: return R_EIP;
+        case BOX86CORE_EFLAGS:
+            CHECK_FLAGS(emu);
+            PackFlags(emu);
+            return emu->packed_eflags.x32;
+        case BOX86CORE_FS: return emu->segs[_FS];
+        case BOX86CORE_GS: return emu->segs[_GS];
+        default:
+            if(reg>=BOX86CORE_EAX && reg<=BOX86CORE_EDI)
+                return emu->regs[reg].dword[0];
+    }
+    return 0;
+}
+
+void box86core_set_reg(box86core_t* core, box86core_reg_t reg, uint32_t val)
+{
+    x86emu_t* emu = core->emu;
+    switch(reg) {
+        case BOX86CORE_EIP: R_EIP = val; break;
+        case BOX86CORE_EFLAGS:
+            emu->packed_eflags.x32 = (val & 0x3F7FD7) | 0x2;
+            UnpackFlags(emu);
+            RESET_FLAGS(emu);
+            break;
+        case BOX86CORE_FS:
+        case BOX86CORE_GS:
+            emu->segs[(reg==BOX86CORE_FS)?_FS:_GS] = val;
+            emu->segs_clean[(reg==BOX86CORE_FS)?_FS:_GS] = 0;
+            break;
+        default:
+            if(reg>=BOX86CORE_EAX && reg<=BOX86CORE_EDI)
+                emu->regs[reg].dword[0] = val;
+    }
+}
+
+void box86core_set_segbase(box86core_t* core, box86core_reg_t seg, uint32_t base)
+{
+    if(seg!=BOX86CORE_FS && seg!=BOX86CORE_GS)
+        return;
+    int s = (seg==BOX86CORE_FS)?_FS:_GS;
+    core->segbase[s==_GS] = base;
+    core->emu->segs_offs[s] = base;
+    core->emu->segs_clean[s] = 1;
+}
+
+void box86core_get_xmm(box86core_t* core, int i, void* val)
+{
+    memcpy(val, &core->emu->xmm[i&7], 16);
+}
+void box86core_set_xmm(box86core_t* core, int i, const void* val)
+{
+    memcpy(&core->emu->xmm[i&7], val, 16);
+}
+void box86core_get_mmx(box86core_t* core, int i, void* val)
+{
+    memcpy(val, &core->emu->mmx[i&7], 8);
+}
+double box86core_get_st(box86core_t* core, int i)
+{
+    x86emu_t* emu = core->emu;
+    return ST(i).d;
+}
+
+int box86core_add_breakpoint(box86core_t* core, uint32_t addr)
+{
+    x86emu_t* emu = core->emu;
+    if(emu->core_nbp==BOX86CORE_MAXBP)
+        return -1;
+    emu->core_bp[emu->core_nbp++] = addr;
+    return 0;
+}
+
+int box86core_del_breakpoint(box86core_t* core, uint32_t addr)
+{
+    x86emu_t* emu = core->emu;
+    for(int i=0; i<emu->core_nbp; ++i)
+        if(emu->core_bp[i]==addr) {
+            emu->core_bp[i] = emu->core_bp[--emu->core_nbp];
+            return 0;
+        }
+    return -1;
+}
+
+box86core_stop_t box86core_run(box86core_t* core, uint64_t count)
+{
+    x86emu_t* emu = core->emu;
+    emu->quit = 0;
+    emu->error = 0;
+    emu->core_stop = BOX86CORE_QUIT;
+    emu->core_ilimit = count?(emu->core_icount+count):0;
+    box86core_t* prev = current_core;
+    current_core = core;
+    Run(emu, 0);
+    current_core = prev;
+    if(emu->error & (ERR_UNIMPL|ERR_ILLEGAL)) {
+        R_EIP = emu->old_ip;
+        return BOX86CORE_ERROR;
+    }
+    return emu->core_stop;
+}
+
+uint64_t box86core_icount(box86core_t* core)
+{
+    return core->emu->core_icount;
+}
+
+void box86core_set_predecode(int on)
+{
+    box86_predecode = on;
+}
@@ -18,6 +18,7 @@
 #include "dynablock_private.h"
 #include "dynarec_private.h"
 #include "elfloader.h"
+#include "dynacache.h"
 #ifdef ARM
 #include "dynarec_arm.h"
 #else
@@ -26,9 +27,29 @@
 
 #include "khash.h"
 
-KHASH_MAP_INIT_INT(dynablocks, dynablock_t*)
-
 KHASH_SET_INIT_INT(mark)
+KHASH_MAP_INIT_INT(icsite, uint32_t*)
+
+// direct map of a dynablocklist is split in chunks, allocated on demand
+#define DIRECT_SHIFT    6
+#define DIRECT_SIZE     (1<<DIRECT_SHIFT)
+#define DIRECT_MASK     (DIRECT_SIZE-1)
+
+// lock-free hash, for dynablocklist without text (so no direct map possible)
+// keys are never removed (a removed block just leave a NULL), and a new bigger table is chained when one is full
+#define DYNAHASH_BITS   6
+
+typedef struct dynahash_slot_s {
+    uintptr_t           addr;
+    dynablock_t*        block;
+} dynahash_slot_t;
+
+typedef struct dynahash_s {
+    int                 bits;
+    int                 count;
+    dynahash_t*         next;
+    dynahash_slot_t     slots[0];
+} dynahash_t;
 
 uint32_t X31_hash_code(void* addr, int len)
 {
@@ -39,83 +60,506 @@ uint32_t X31_hash_code(void* addr, int len)
 	return (uint32_t)h;
 }
 
-dynablocklist_t* NewDynablockList(uintptr_t base, uintptr_t text, int textsz, int nolinker, int direct)
+/*
+    Eviction of translated code, when BOX86_DYNAREC_CACHE_MAX is set
+    Only blocks with marks can be evicted, as all the blocks linked to them are known and can be unlinked
+    (blocks without marks are from elf code, so their size is bounded anyway).
+    A clock goes over all evictable blocks: a block executed since last pass get its counter halved,
+    a block not executed since last pass is evicted.
+*/
+volatile int                dynablock_evict = 0;
+static dynablock_t**        clock_ring = NULL;
+static int                  clock_sz = 0;
+static int                  clock_cap = 0;
+static int                  clock_hand = 0;
+static uint32_t             clock_floor = 0;    // no new eviction until code size is over that (if eviction cannot free enough)
+static pthread_mutex_t      clock_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void clockAdd(dynablock_t* db)
+{
+    pthread_mutex_lock(&clock_mutex);
+    if(!db->clock && !db->gone) {
+        if(clock_sz==clock_cap) {
+            clock_cap += 256;
+            clock_ring = (dynablock_t**)realloc(clock_ring, clock_cap*sizeof(dynablock_t*));
+        }
+        clock_ring[clock_sz++] = db;
+        db->clock = clock_sz;
+    }
+    pthread_mutex_unlock(&clock_mutex);
+}
+
+// need clock_mutex to be locked
+static void clockRemoveLocked(dynablock_t* db)
+{
+    int idx = db->clock-1;
+    dynablock_t* last = clock_ring[--clock_sz];
+    clock_ring[idx] = last;
+    last->clock = idx+1;
+    db->clock = 0;
+}
+
+static void clockRemove(dynablock_t* db)
+{
+    pthread_mutex_lock(&clock_mutex);
+    if(db->clock)
+        clockRemoveLocked(db);
+    pthread_mutex_unlock(&clock_mutex);
+}
+
+// check if eviction is needed, after a new block is created
+static void checkEvict()
+{
+    uint32_t size = SizeDynarecMap();
+    if(size<=box86_dynarec_cache_max)
+        clock_floor = 0;
+    else if(size>clock_floor)
+        dynablock_evict = 1;
+}
+
+void EvictDynablocks()
+{
+    dynablock_evict = 0;
+    uint32_t size = SizeDynarecMap();
+    uint32_t target = box86_dynarec_cache_max - box86_dynarec_cache_max/8;
+    if(size<=box86_dynarec_cache_max)
+        return;
+    int n = 0;
+    uint32_t freed = 0;
+    pthread_mutex_lock(&clock_mutex);
+    int todo = clock_sz*2;  // 2 full turns max
+    while(size-freed>target && clock_sz && todo--) {
+        if(clock_hand>=clock_sz)
+            clock_hand = 0;
+        dynablock_t* db = clock_ring[clock_hand];
+        if(db->exec) {
+            db->exec >>= 1;
+            ++clock_hand;
+            continue;
+        }
+        // cold block, evict it (clock_hand now points to the block swapped in its place)
+        clockRemoveLocked(db);
+        pthread_mutex_unlock(&clock_mutex);
+        freed += db->size;
+        ++n;
+        FreeDynablock(db);
+        pthread_mutex_lock(&clock_mutex);
+    }
+    // memory is only released later, so don't try again until code size grows
+    clock_floor = size + box86_dynarec_cache_max/16;
+    pthread_mutex_unlock(&clock_mutex);
+    dynarec_log(LOG_INFO, "Evicted %d Dynablocks (%u bytes), translated code size was %u bytes\n", n, freed, size);
+}
+
+/*
+    Deferred freeing of dynablocks (and dynablocklists)
+    Each thread running dynarec code publish the "epoch" it started with. A freed dynablock is first unlinked
+    and removed from its list, then retired with the current epoch, and only released when all threads
+    still running dynarec code started after it was retired.
+*/
+typedef void (*retirefree_t)(void*);
+
+typedef struct dynaepoch_s {
+    volatile uint32_t   epoch;  // 0 when thread is not using dynablocks
+    volatile int        used;
+    struct dynaepoch_s* next;
+} dynaepoch_t;
+
+typedef struct retired_s {
+    void*               p;
+    retirefree_t        f;
+    uint32_t            epoch;
+} retired_t;
+
+static volatile uint32_t    dynablock_epoch = 1;
+static dynaepoch_t* volatile epoch_list = NULL;
+static __thread dynaepoch_t* thread_epoch = NULL;
+static __thread int         thread_level = 0;
+static pthread_key_t        epoch_key;
+static pthread_once_t       epoch_key_once = PTHREAD_ONCE_INIT;
+static retired_t*           retired = NULL;
+static int                  retired_sz = 0;
+static int                  retired_cap = 0;
+static int                  retired_since = 0;
+
+static void epoch_destroy(void* p)
+{
+    dynaepoch_t* e = (dynaepoch_t*)p;
+    e->epoch = 0;
+    __sync_synchronize();
+    e->used = 0;
+}
+static void epoch_key_alloc()
+{
+    pthread_key_create(&epoch_key, epoch_destroy);
+}
+
+static dynaepoch_t* getThreadEpoch()
+{
+    if(thread_epoch)
+        return thread_epoch;
+    // recycle a slot from a dead thread, or create a new one
+    dynaepoch_t* e = epoch_list;
+    while(e && !(!e->used && __sync_bool_compare_and_swap(&e->used, 0, 1)))
+        e = e->next;
+    if(!e) {
+        e = (dynaepoch_t*)calloc(1, sizeof(dynaepoch_t));
+        e->used = 1;
+        do {
+            e->next = epoch_list;
+        } while(!__sync_bool_compare_and_swap(&epoch_list, e->next, e));
+    }
+    pthread_once(&epoch_key_once, epoch_key_alloc);
+    pthread_setspecific(epoch_key, e);
+    thread_epoch = e;
+    return e;
+}
+
+int DynablockGetLevel()
+{
+    return thread_level;
+}
+
+void DynablockSetLevel(int level)
+{
+    thread_level = level;
+    if(!level && thread_epoch)
+        thread_epoch->epoch = 0;
+}
+
+void DynablockEnter()
+{
+    if(!thread_level++) {
+        dynaepoch_t* e = getThreadEpoch();
+        e->epoch = dynablock_epoch;
+        __sync_synchronize();
+    }
+}
+
+void DynablockLeave()
+{
+    if(thread_level && !--thread_level) {
+        __sync_synchronize();
+        thread_epoch->epoch = 0;
+    }
+}
+
+int DynablockRefresh()
+{
+    if(thread_level!=1)
+        return 0;   // nested, keep the oldest epoch
+    uint32_t epoch = dynablock_epoch;
+    int changed = (thread_epoch->epoch!=epoch);
+    if(changed) {
+        thread_epoch->epoch = epoch;
+        __sync_synchronize();
+    }
+    return changed;
+}
+
+// oldest epoch still in use, 0 if none
+static uint32_t oldestEpoch()
+{
+    uint32_t ret = 0;
+    for(dynaepoch_t* e = epoch_list; e; e = e->next) {
+        uint32_t epoch = e->epoch;
+        if(epoch && (!ret || epoch<ret))
+            ret = epoch;
+    }
+    return ret;
+}
+
+// need mutex_blocks to be locked
+static void releaseRetired(int force)
+{
+    __sync_synchronize();
+    uint32_t oldest = force?0:oldestEpoch();
+    int j = 0;
+    for(int i=0; i<retired_sz; ++i) {
+        if(!oldest || retired[i].epoch<oldest)
+            retired[i].f(retired[i].p);
+        else
+            retired[j++] = retired[i];
+    }
+    retired_sz = j;
+    retired_since = 0;
+}
+
+static void retire(void* p, retirefree_t f)
+{
+    pthread_mutex_lock(&my_context->mutex_blocks);
+    if(retired_sz==retired_cap) {
+        retired_cap += 64;
+        retired = (retired_t*)realloc(retired, retired_cap*sizeof(retired_t));
+    }
+    retired[retired_sz].p = p;
+    retired[retired_sz].f = f;
+    retired[retired_sz].epoch = __sync_fetch_and_add(&dynablock_epoch, 1);
+    ++retired_sz;
+    if(++retired_since>=16)
+        releaseRetired(0);
+    pthread_mutex_unlock(&my_context->mutex_blocks);
+}
+
+void ReleaseRetiredDynablocks(int force)
+{
+    pthread_mutex_lock(&my_context->mutex_blocks);
+    releaseRetired(force);
+    if(force) {
+        free(retired);
+        retired = NULL;
+        retired_cap = 0;
+        free(clock_ring);
+        clock_ring = NULL;
+        clock_sz = clock_cap = 0;
+    }
+    pthread_mutex_unlock(&my_context->mutex_blocks);
+}
+
+static uint32_t hashAddr(uintptr_t addr, int bits)
+{
+    return (uint32_t)(addr*2654435761u)>>(32-bits);
+}
+
+static dynahash_t* newDynahash(int bits)
+{
+    dynahash_t* h = (dynahash_t*)calloc(1, sizeof(dynahash_t)+(1<<bits)*sizeof(dynahash_slot_t));
+    h->bits = bits;
+    return h;
+}
+
+// lock-free lookup
+static dynablock_t* getDynablock(dynablocklist_t* dynablocks, uintptr_t addr)
+{
+    if(dynablocks->direct) {
+        if(addr<dynablocks->text || addr>=dynablocks->text+dynablocks->textsz)
+            return NULL;
+        uintptr_t off = addr-dynablocks->text;
+        dynablock_t** chunk = dynablocks->direct[off>>DIRECT_SHIFT];
+        return chunk?chunk[off&DIRECT_MASK]:NULL;
+    }
+    for(dynahash_t* h = dynablocks->hash; h; h = h->next) {
+        int mask = (1<<h->bits)-1;
+        uint32_t idx = hashAddr(addr, h->bits);
+        for(int i=0; i<=mask; ++i, idx=(idx+1)&mask) {
+            uintptr_t k = h->slots[idx].addr;
+            if(!k)
+                break;
+            if(k==addr) {
+                dynablock_t* db = h->slots[idx].block;
+                if(db)
+                    return db;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+// try to put block in a slot, return the block actually in the slot
+static dynablock_t* publishBlock(dynablock_t** slot, dynablock_t* block)
+{
+    dynablock_t* old;
+    while(!(old = *slot))
+        if(__sync_bool_compare_and_swap(slot, NULL, block))
+            return block;
+    return old;
+}
+
+// lock-free insert, return the block at addr (may not be block if some other thread was faster)
+static dynablock_t* insertDynablock(dynablocklist_t* dynablocks, uintptr_t addr, dynablock_t* block)
+{
+    if(dynablocks->direct) {
+        uintptr_t off = addr-dynablocks->text;
+        dynablock_t*** pchunk = &dynablocks->direct[off>>DIRECT_SHIFT];
+        if(!*pchunk) {
+            dynablock_t** chunk = (dynablock_t**)calloc(DIRECT_SIZE, sizeof(dynablock_t*));
+            if(!__sync_bool_compare_and_swap(pchunk, NULL, chunk))
+                free(chunk);
+        }
+        return publishBlock(&(*pchunk)[off&DIRECT_MASK], block);
+    }
+    dynahash_t** ph = &dynablocks->hash;
+    int bits = DYNAHASH_BITS;
+    while(1) {
+        if(!*ph) {
+            dynahash_t* h = newDynahash(bits);
+            if(!__sync_bool_compare_and_swap(ph, NULL, h))
+                free(h);
+        }
+        dynahash_t* h = *ph;
+        int mask = (1<<h->bits)-1;
+        int full = (h->count >= (mask+1)*3/4);
+        uint32_t idx = hashAddr(addr, h->bits);
+        for(int i=0; i<=mask; ++i, idx=(idx+1)&mask) {
+            uintptr_t k = h->slots[idx].addr;
+            if(!k) {
+                if(full)
+                    break;  // no new key in this one
+                if(__sync_bool_compare_and_swap(&h->slots[idx].addr, 0, addr)) {
+                    __sync_fetch_and_add(&h->count, 1);
+                    k = addr;
+                } else
+                    k = h->slots[idx].addr;
+            }
+            if(k==addr)
+                return publishBlock(&h->slots[idx].block, block);
+        }
+        bits = h->bits+1;
+        ph = &h->next;
+    }
+}
+
+static void removeDynablock(dynablocklist_t* dynablocks, dynablock_t* db)
+{
+    uintptr_t addr = (uintptr_t)db->x86_addr;
+    if(dynablocks->direct) {
+        if(addr<dynablocks->text || addr>=dynablocks->text+dynablocks->textsz)
+            return;
+        uintptr_t off = addr-dynablocks->text;
+        dynablock_t** chunk = dynablocks->direct[off>>DIRECT_SHIFT];
+        if(chunk)
+            __sync_bool_compare_and_swap(&chunk[off&DIRECT_MASK], db, NULL);
+        return;
+    }
+    for(dynahash_t* h = dynablocks->hash; h; h = h->next) {
+        int mask = (1<<h->bits)-1;
+        uint32_t idx = hashAddr(addr, h->bits);
+        for(int i=0; i<=mask; ++i, idx=(idx+1)&mask) {
+            uintptr_t k = h->slots[idx].addr;
+            if(!k)
+                break;
+            if(k==addr) {
+                __sync_bool_compare_and_swap(&h->slots[idx].block, db, NULL);
+                break;
+            }
+        }
+    }
+}
+
+// get a snapshot of all the blocks of a list (in a malloc'd array), return the number of blocks
+static int getAllDynablocks(dynablocklist_t* dynablocks, dynablock_t*** list)
+{
+    int n = 0, cap = 0;
+    *list = NULL;
+    #define GO(A)   if(A) {if(n==cap) {cap+=64; *list=(dynablock_t**)realloc(*list, cap*sizeof(dynablock_t*));} (*list)[n++] = A;}
+    if(dynablocks->direct) {
+        for(int i=0; i<(dynablocks->textsz+DIRECT_MASK)>>DIRECT_SHIFT; ++i) {
+            dynablock_t** chunk = dynablocks->direct[i];
+            if(chunk)
+                for(int j=0; j<DIRECT_SIZE; ++j) {
+                    dynablock_t* db = chunk[j];
+                    GO(db);
+                }
+        }
+    }
+    for(dynahash_t* h = dynablocks->hash; h; h = h->next)
+        for(int i=0; i<(1<<h->bits); ++i) {
+            dynablock_t* db = h->slots[i].block;
+            GO(db);
+        }
+    #undef GO
+    return n;
+}
+
+dynablocklist_t* NewDynablockList(uintptr_t text, int textsz, int nolinker)
 {
     dynablocklist_t* ret = (dynablocklist_t*)calloc(1, sizeof(dynablocklist_t));
-    ret->blocks = (nolinker && direct)?NULL:kh_init(dynablocks);
-    ret->base = base;
     ret->text = text;
     ret->textsz = textsz;
     ret->nolinker = nolinker;
-    pthread_rwlock_init(&ret->rwlock_blocks, NULL);
-    if(direct && textsz) {
-        ret->direct = (dynablock_t**)calloc(textsz, sizeof(dynablock_t*));
+    if(textsz) {
+        ret->direct = (dynablock_t***)calloc((textsz+DIRECT_MASK)>>DIRECT_SHIFT, sizeof(dynablock_t**));
         if(!ret->direct) {printf_log(LOG_NONE, "Warning, fail to create direct block for dynablock @%p\n", (void*)text);}
     }
     return ret;
 }
 
+static void releaseDynablock(void* p)
+{
+    dynablock_t* db = (dynablock_t*)p;
+    // only the father free the DynarecMap
+    if(!db->father) {
+        dynarec_log(LOG_DEBUG, " -- FreeDyrecMap(%p, %d)\n", db->block, db->size);
+        FreeDynarecMap((uintptr_t)db->block, db->size);
+    }
+    free(db->sons);
+    free(db->table);
+    free(db);
+}
+
+// remove a block from its list, and unlink everything linked to it (sons are not handled)
+static void unlinkDynablock(dynablock_t* db)
+{
+    // remove from the list
+    removeDynablock(db->parent, db);
+
+    // marks are also changed by running threads when they link blocks
+    pthread_mutex_lock(&my_context->mutex_blocks);
+    if(db->marks) {
+        // Follow mark and set arm_linker instead
+        khint_t k;
+        kh_foreach_key(db->marks, k,
+            void** p = (void**)(uintptr_t)k;
+            dynarec_log(LOG_DEBUG, " -- resettable(%p)\n", p);
+            resettable(p);
+        );
+        // free mark
+        kh_destroy(mark, db->marks);
+        db->marks = NULL;
+    }
+    for(int i=0; i<db->tablesz; i+=4) {
+        dynablock_t* p = (dynablock_t*)db->table[i+3];
+        dynarec_log(LOG_DEBUG, "  -- table[%d+3] = %p ", i, p);
+        if(p && p!=db && p->marks) {
+            khint_t kd = kh_get(mark, p->marks, (uintptr_t)(&db->table[i+0]));
+            if(kd!=kh_end(p->marks)) {
+                kh_del(mark, p->marks, kd);
+                dynarec_log(LOG_DEBUG, "cleaned");
+            }
+            else {dynarec_log(LOG_DEBUG, "not found");}
+        }
+        dynarec_log(LOG_DEBUG, "\n");
+    }
+    pthread_mutex_unlock(&my_context->mutex_blocks);
+}
+
 void FreeDynablock(dynablock_t* db)
 {
     if(db) {
+        if(!__sync_bool_compare_and_swap(&db->gone, 0, 1))
+            return; // already freed by another thread
+        if(db->clock)
+            clockRemove(db);
         dynarec_log(LOG_DEBUG, "FreeDynablock(%p), db->block=%p x86=%p:%p father=%p, tablesz=%d, %swith %d son(s)\n", db, db->block, db->x86_addr, db->x86_addr+db->x86_size, db->father, db->tablesz, db->marks?"with marks, ":"", db->sons_size);
         db->done = 0;
-        // remove from direct if there
-        uintptr_t startdb = db->parent->text;
-        uintptr_t enddb = db->parent->text + db->parent->textsz;
-        if(db->parent->direct) {
-            uintptr_t addr = (uintptr_t)db->x86_addr;
-            if(addr>=startdb && addr<enddb)
-                db->parent->direct[addr-startdb] = NULL;
-        }
-       // remove from hash if there
-	if (db->parent->blocks) {
-            khint_t kdb;
-            kdb = kh_get(dynablocks, db->parent->blocks, (uintptr_t) db->x86_addr - db->parent->base);
-            if(kdb!=kh_end(db->parent->blocks))
-                kh_del(dynablocks, db->parent->blocks, kdb);
-	}
-
-        if(db->marks) {
-            // Follow mark and set arm_linker instead
-            khint_t k;
-            kh_foreach_key(db->marks, k,
-                void** p = (void**)(uintptr_t)k;
-                dynarec_log(LOG_DEBUG, " -- resettable(%p)\n", p);
-                resettable(p);
-            );
-            // free mark
-            kh_destroy(mark, db->marks);
-            db->marks = NULL;
-        }
-        for(int i=0; i<db->tablesz; i+=4) {
-            dynablock_t* p = (dynablock_t*)db->table[i+3];
-            dynarec_log(LOG_DEBUG, "  -- table[%d+3] = %p ", i, p);
-            if(p && p!=db && p->marks) {
-                khint_t kd = kh_get(mark, p->marks, (uintptr_t)(&db->table[i+0]));
-                if(kd!=kh_end(p->marks)) {
-                    kh_del(mark, p->marks, kd);
-                    dynarec_log(LOG_DEBUG, "cleaned");
-                }
-                else {dynarec_log(LOG_DEBUG, "not found");}
-            }
-            dynarec_log(LOG_DEBUG, "\n");
-        }
+        unlinkDynablock(db);
         // remove and free the sons
         for (int i=0; i<db->sons_size; ++i) {
             dynablock_t *son = db->sons[i];
             db->sons[i] = NULL;
             FreeDynablock(son);
         }
-        // only the father free the DynarecMap
-        if(!db->father) {
-            dynarec_log(LOG_DEBUG, " -- FreeDyrecMap(%p, %d)\n", db->block, db->size);
-            FreeDynarecMap((uintptr_t)db->block, db->size);
-        }
-        free(db->sons);
-        free(db->table);
-        free(db);
+        // some thread may still be running the block, so actual free is deferred
+        retire(db, releaseDynablock);
+    }
+}
+
+static void releaseDynablockList(void* p)
+{
+    dynablocklist_t* dynablocks = (dynablocklist_t*)p;
+    if(dynablocks->direct) {
+        for(int i=0; i<(dynablocks->textsz+DIRECT_MASK)>>DIRECT_SHIFT; ++i)
+            free(dynablocks->direct[i]);
+        free(dynablocks->direct);
+    }
+    dynahash_t* h = dynablocks->hash;
+    while(h) {
+        dynahash_t* next = h->next;
+        free(h);
+        h = next;
     }
+    free(dynablocks);
 }
 
 void FreeDynablockList(dynablocklist_t** dynablocks)
@@ -124,32 +568,15 @@ void FreeDynablockList(dynablocklist_t** dynablocks)
         return;
     if(!*dynablocks)
         return;
-    dynarec_log(LOG_DEBUG, "Free %d Blocks from Dynablocklist (with %d buckets, nolinker=%d) %s\n", (*dynablocks)->blocks?kh_size((*dynablocks)->blocks):0, (*dynablocks)->blocks?kh_n_buckets((*dynablocks)->blocks):0, (*dynablocks)->nolinker, ((*dynablocks)->direct)?" With Direct mapping enabled":"");
-    dynablock_t* db;
-    if((*dynablocks)->blocks) {
-        // create a list of the parent db to delete (because there are sons in the middle that will be invalid if father is removed)
-        dynablock_t** list = (dynablock_t**)calloc(kh_size((*dynablocks)->blocks), sizeof(dynablock_t*));
-        int n = 0;
-        kh_foreach_value((*dynablocks)->blocks, db, 
-            if(!db->father) list[n++] = db;
-        );
-        for (int i=0; i<n; ++i)
+    dynablock_t** list;
+    int n = getAllDynablocks(*dynablocks, &list);
+    dynarec_log(LOG_DEBUG, "Free %d Blocks from Dynablocklist (nolinker=%d) %s\n", n, (*dynablocks)->nolinker, ((*dynablocks)->direct)?" With Direct mapping":"");
+    // free only the fathers (because there are sons in the middle that will be invalid if father is removed)
+    for (int i=0; i<n; ++i)
+        if(!list[i]->father)
             FreeDynablock(list[i]);
-        kh_destroy(dynablocks, (*dynablocks)->blocks);
-        (*dynablocks)->blocks = NULL;
-        free(list);
-    }
-    if((*dynablocks)->direct) {
-        for (int i=0; i<(*dynablocks)->textsz; ++i) {
-            if((*dynablocks)->direct[i] && !(*dynablocks)->direct[i]->father) 
-                FreeDynablock((*dynablocks)->direct[i]);
-        }
-        free((*dynablocks)->direct);
-    }
-    (*dynablocks)->direct = 0;
-    pthread_rwlock_destroy(&(*dynablocks)->rwlock_blocks);
-
-    free(*dynablocks);
+    free(list);
+    retire(*dynablocks, releaseDynablockList);
     *dynablocks = NULL;
 }
 
@@ -159,6 +586,7 @@ void MarkDynablock(dynablock_t* db)
         if(db->father)
             db = db->father;    // mark only father
         if(db->marks && !db->need_test) {
+            pthread_mutex_lock(&my_context->mutex_blocks);
             // Follow mark and set arm_linker instead
             khint_t k;
             kh_foreach_key(db->marks, k,
@@ -167,6 +595,7 @@ void MarkDynablock(dynablock_t* db)
             );
             // free mark
             kh_clear(mark, db->marks);
+            pthread_mutex_unlock(&my_context->mutex_blocks);
         }
         db->need_test = 1;
     }
@@ -183,6 +612,7 @@ void ProtectDynablock(dynablock_t* db)
 
 void RemoveMark(void** table)
 {
+    pthread_mutex_lock(&my_context->mutex_blocks);
     // remove old value if any
     dynablock_t *old = (dynablock_t*)table[3];
     if(old && old->father)
@@ -193,12 +623,14 @@ void RemoveMark(void** table)
             kh_del(mark, old->marks, kd);
     }
     table[3] = NULL;
+    pthread_mutex_unlock(&my_context->mutex_blocks);
 }
 
 // source is linked to dest (i.e. source->table[x] = dest->block), so add a "mark" in dest, add a "linked" info to source
 void AddMark(dynablock_t* source, dynablock_t* dest, void** table)
 {
     int ret;
+    pthread_mutex_lock(&my_context->mutex_blocks);
     // remove old value if any
     dynablock_t *old = (dynablock_t*)table[3];
     if(old && old->father)
@@ -216,6 +648,7 @@ void AddMark(dynablock_t* source, dynablock_t* dest, void** table)
         table[3] = (void*)dest;
     } else
         table[3] = NULL;
+    pthread_mutex_unlock(&my_context->mutex_blocks);
 }
 
 void MarkDynablockList(dynablocklist_t** dynablocks)
@@ -226,18 +659,12 @@ void MarkDynablockList(dynablocklist_t** dynablocks)
         return;
     if(!(*dynablocks)->nolinker)
         return;
-    dynarec_log(LOG_DEBUG, "Marked %d Blocks from Dynablocklist (with %d buckets, nolinker=%d) %p:0x%x %s\n", (*dynablocks)->blocks?(kh_size((*dynablocks)->blocks)):0, (*dynablocks)->blocks?(kh_n_buckets((*dynablocks)->blocks)):0, (*dynablocks)->nolinker, (void*)(*dynablocks)->text, (*dynablocks)->textsz, ((*dynablocks)->direct)?" With Direct mapping enabled":"");
-    dynablock_t* db;
-    if((*dynablocks)->blocks) {
-        kh_foreach_value((*dynablocks)->blocks, db, 
-            MarkDynablock(db);
-        );
-    }
-    if((*dynablocks)->direct) {
-        for (int i=0; i<(*dynablocks)->textsz; ++i) {
-            MarkDynablock((*dynablocks)->direct[i]);
-        }
-    }
+    dynablock_t** list;
+    int n = getAllDynablocks(*dynablocks, &list);
+    dynarec_log(LOG_DEBUG, "Marked %d Blocks from Dynablocklist (nolinker=%d) %p:0x%x %s\n", n, (*dynablocks)->nolinker, (void*)(*dynablocks)->text, (*dynablocks)->textsz, ((*dynablocks)->direct)?" With Direct mapping":"");
+    for (int i=0; i<n; ++i)
+        MarkDynablock(list[i]);
+    free(list);
 }
 
 void ProtectkDynablockList(dynablocklist_t** dynablocks)
@@ -246,18 +673,12 @@ void ProtectkDynablockList(dynablocklist_t** dynablocks)
         return;
     if(!*dynablocks)
         return;
-    dynarec_log(LOG_DEBUG, "Protect %d Blocks from Dynablocklist (with %d buckets, nolinker=%d) %p:0x%x %s\n", (*dynablocks)->blocks?(kh_size((*dynablocks)->blocks)):0, (*dynablocks)->blocks?(kh_n_buckets((*dynablocks)->blocks)):0, (*dynablocks)->nolinker, (void*)(*dynablocks)->text, (*dynablocks)->textsz, ((*dynablocks)->direct)?" With Direct mapping enabled":"");
-    dynablock_t* db;
-    if((*dynablocks)->blocks) {
-        kh_foreach_value((*dynablocks)->blocks, db, 
-            ProtectDynablock(db);
-        );
-    }
-    if((*dynablocks)->direct) {
-        for (int i=0; i<(*dynablocks)->textsz; ++i) {
-            ProtectDynablock((*dynablocks)->direct[i]);
-        }
-    }
+    dynablock_t** list;
+    int n = getAllDynablocks(*dynablocks, &list);
+    dynarec_log(LOG_DEBUG, "Protect %d Blocks from Dynablocklist (nolinker=%d) %p:0x%x %s\n", n, (*dynablocks)->nolinker, (void*)(*dynablocks)->text, (*dynablocks)->textsz, ((*dynablocks)->direct)?" With Direct mapping":"");
+    for (int i=0; i<n; ++i)
+        ProtectDynablock(list[i]);
+    free(list);
 }
 
 uintptr_t StartDynablockList(dynablocklist_t* db)
@@ -272,44 +693,6 @@ uintptr_t EndDynablockList(dynablocklist_t* db)
         return db->text+db->textsz;
     return 0;
 }
-void FreeDirectDynablock(dynablocklist_t* dynablocks, uintptr_t addr, uintptr_t size)
-{
-    if(!dynablocks)
-        return;
-    uintptr_t startdb = dynablocks->text;
-    uintptr_t enddb = startdb + dynablocks->textsz;
-    uintptr_t start = addr;
-    uintptr_t end = addr+size;
-    if(start<startdb)
-        start = startdb;
-    if(end>enddb)
-        end = enddb;
-    if(end>startdb && start<enddb)
-        for(uintptr_t i = start; i<end; ++i)
-            if(dynablocks->direct[i-startdb]) {
-                FreeDynablock(dynablocks->direct[i-startdb]);
-            }
-}
-void MarkDirectDynablock(dynablocklist_t* dynablocks, uintptr_t addr, uintptr_t size)
-{
-    if(!dynablocks)
-        return;
-    if(!dynablocks->nolinker)
-        return;
-    uintptr_t startdb = dynablocks->text;
-    uintptr_t enddb = startdb + dynablocks->textsz;
-    uintptr_t start = addr;
-    uintptr_t end = addr+size;
-    if(start<startdb)
-        start = startdb;
-    if(end>enddb)
-        end = enddb;
-    if(end>startdb && start<enddb)
-        for(uintptr_t i = start; i<end; ++i)
-            if(dynablocks->direct[i-startdb]) {
-                MarkDynablock(dynablocks->direct[i-startdb]);
-            }
-}
 
 void ProtectDirectDynablock(dynablocklist_t* dynablocks, uintptr_t addr, uintptr_t size)
 {
@@ -331,30 +714,18 @@ void FreeRangeDynablock(dynablocklist_t* dynablocks, uintptr_t addr, uintptr_t s
 {
     if(!dynablocks)
         return;
-    if(dynablocks->direct)
-        FreeDirectDynablock(dynablocks, addr, size);
-    if(dynablocks->blocks) {
-        dynablock_t* db;
-        uintptr_t s, e;
-        int ret;
-        khint_t k;
-        kh_dynablocks_t *blocks = kh_init(dynablocks);
-        // copy in a temporary list
-        kh_foreach_value(dynablocks->blocks, db, 
-            s = (uintptr_t)db->x86_addr;
-            e = (uintptr_t)db->x86_addr+db->x86_size-1;
-            if((s>=addr && s<(addr+size)) || (e>=addr && e<(addr+size))) {
-                //ProtectDynablock(db);
-                k = kh_put(dynablocks, blocks, s, &ret);
-                kh_value(blocks, k) = db;
-            }
-        );
-        // purge the list
-        kh_foreach_value(blocks, db,
+    dynablock_t** list;
+    int n = getAllDynablocks(dynablocks, &list);
+    uintptr_t s, e;
+    // sons will be freed by their father
+    for (int i=0; i<n; ++i) {
+        dynablock_t* db = list[i];
+        s = (uintptr_t)db->x86_addr;
+        e = (uintptr_t)db->x86_addr+db->x86_size-1;
+        if(((s>=addr && s<(addr+size)) || (e>=addr && e<(addr+size))) && !db->father)
             FreeDynablock(db);
-        );
-        kh_destroy(dynablocks, blocks);
     }
+    free(list);
 }
 void MarkRangeDynablock(dynablocklist_t* dynablocks, uintptr_t addr, uintptr_t size)
 {
@@ -362,45 +733,35 @@ void MarkRangeDynablock(dynablocklist_t* dynablocks, uintptr_t addr, uintptr_t s
         return;
     if(!dynablocks->nolinker)
         return;
-    if(dynablocks->direct)
-        MarkDirectDynablock(dynablocks, addr, size);
-    if(dynablocks->blocks) {
-        dynablock_t* db;
-        uintptr_t s, e;
-        kh_foreach_value(dynablocks->blocks, db, 
-            s = (uintptr_t)db->x86_addr;
-            e = (uintptr_t)db->x86_addr+db->x86_size-1;
-            if((s>=addr && s<(addr+size)) || (e>=addr && e<(addr+size)))
-                MarkDynablock(db);
-        );
+    dynablock_t** list;
+    int n = getAllDynablocks(dynablocks, &list);
+    uintptr_t s, e;
+    for (int i=0; i<n; ++i) {
+        dynablock_t* db = list[i];
+        s = (uintptr_t)db->x86_addr;
+        e = (uintptr_t)db->x86_addr+db->x86_size-1;
+        if((s>=addr && s<(addr+size)) || (e>=addr && e<(addr+size)))
+            MarkDynablock(db);
     }
+    free(list);
 }
 
 dynablock_t* FindDynablockDynablocklist(void* addr, dynablocklist_t* dynablocks)
 {
     if(!dynablocks)
         return NULL;
-    if(dynablocks->direct)
-        for(int i=0; i<dynablocks->textsz; ++i) {
-            dynablock_t* db;
-            if((db = dynablocks->direct[i])) {
-                uintptr_t s = (uintptr_t)db->block;
-                uintptr_t e = (uintptr_t)db->block+db->size;
-                if((uintptr_t)addr>=s && (uintptr_t)addr<e)
-                    return db->father?db->father:db;
-            }
-        }
-    if(dynablocks->blocks) {
-        dynablock_t* db;
-        uintptr_t s, e;
-        kh_foreach_value(dynablocks->blocks, db, 
-            s = (uintptr_t)db->block;
-            e = (uintptr_t)db->block+db->size;
-                if((uintptr_t)addr>=s && (uintptr_t)addr<e)
-                    return db->father?db->father:db;
-        );
+    dynablock_t** list;
+    dynablock_t* ret = NULL;
+    int n = getAllDynablocks(dynablocks, &list);
+    for (int i=0; i<n && !ret; ++i) {
+        dynablock_t* db = list[i];
+        uintptr_t s = (uintptr_t)db->block;
+        uintptr_t e = (uintptr_t)db->block+db->size;
+        if((uintptr_t)addr>=s && (uintptr_t)addr<e)
+            ret = db->father?db->father:db;
     }
-    return NULL;
+    free(list);
+    return ret;
 }
 
 dynablock_t* FindDynablockFromNativeAddress(void* addr)
@@ -419,87 +780,159 @@ dynablock_t* FindDynablockFromNativeAddress(void* addr)
     return ret;
 }
 
-void ConvertHash2Direct(dynablocklist_t* dynablocks)
+static uint32_t profile_nodb = 0;  // interpretor used outside of any dynablocklist
+
+void ProfileDynablockInterp(dynablock_t* db)
+{
+    if(db)
+        ++db->interp;
+    else
+        ++profile_nodb;
+}
+
+// counters of the inline caches, by x86 address of the indirect jump. Never freed, so they survive the block (and are summed if it's rebuilt)
+static kh_icsite_t*     icsites = NULL;
+static pthread_mutex_t  icsites_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+uint32_t* ProfileICSite(uintptr_t addr)
 {
-    if(dynablocks->textsz==0 || dynablocks->text==0 || !dynablocks->blocks)
-        return; // nothing to do
-    // create the new set
-    dynablock_t **direct = (dynablock_t**)calloc(dynablocks->textsz, sizeof(dynablock_t*));
-    kh_dynablocks_t *blocks = kh_init(dynablocks);
-    // transfert
     int ret;
-    khint_t k;
-    dynablock_t* db;
-    uintptr_t key;
-    uintptr_t start = dynablocks->text;
-    uintptr_t end = start + dynablocks->textsz;
-    kh_foreach(dynablocks->blocks, key, db,
-        key += dynablocks->base;
-        if(key>=start && key<end)
-            direct[key-start] = db;
-        else {
-            k = kh_put(dynablocks, blocks, key-dynablocks->base, &ret);
-            if(ret) {   // don't try to insert if already done...
-                kh_value(blocks, k) = db;
-            }
+    pthread_mutex_lock(&icsites_mutex);
+    if(!icsites)
+        icsites = kh_init(icsite);
+    khint_t k = kh_put(icsite, icsites, addr, &ret);
+    if(ret)
+        kh_value(icsites, k) = (uint32_t*)calloc(2, sizeof(uint32_t));
+    uint32_t* cnt = kh_value(icsites, k);
+    pthread_mutex_unlock(&icsites_mutex);
+    return cnt;
+}
+
+typedef struct icsite_s {
+    uintptr_t   addr;
+    uint32_t    count;
+    uint32_t    miss;
+} icsite_t;
+
+static int compareICSite(const void* a, const void* b)
+{
+    const icsite_t* sa = (const icsite_t*)a;
+    const icsite_t* sb = (const icsite_t*)b;
+    if(sa->miss!=sb->miss)
+        return (sa->miss<sb->miss)?1:-1;
+    if(sa->count!=sb->count)
+        return (sa->count<sb->count)?1:-1;
+    return (sa->addr<sb->addr)?-1:((sa->addr>sb->addr)?1:0);
+}
+
+#define IC_MAXDUMP  32   // only the sites with the most misses are printed
+
+// indirect jumps, sorted by misses of their inline cache
+static void dumpICSites()
+{
+    if(!icsites || !kh_size(icsites))
+        return;
+    icsite_t* list = (icsite_t*)calloc(kh_size(icsites), sizeof(icsite_t));
+    int n = 0;
+    uint64_t count = 0, miss = 0;
+    uintptr_t addr;
+    uint32_t* cnt;
+    kh_foreach(icsites, addr, cnt,
+        if(cnt[0]) {
+            list[n].addr = addr;
+            list[n].count = cnt[0];
+            list[n].miss = cnt[1];
+            count += cnt[0];
+            miss += cnt[1];
+            ++n;
         }
     );
-    // destroy old and do the swap (should swap before destroy, but hash access is always behind mutex)
-    kh_destroy(dynablocks, dynablocks->blocks);
-    dynablocks->blocks = NULL;
-    dynablocks->direct = direct;
-    // unlock
-    pthread_rwlock_unlock(&dynablocks->rwlock_blocks);
-    // move the one that doesn't fit to other dynablocks
-    // first check if everything can be moved
-    int ok = 1;
-    kh_foreach(blocks, key, db,
-        key += dynablocks->base;
-        dynablocklist_t *newdbs = getDBFromAddress(key);   // will crash if no dynablocks is found
-        if(!newdbs)
-            ok = 0;
-        else {
-            if(newdbs->direct) {
-                if(newdbs->direct[key-newdbs->text])
-                    ok = 0;
-            } else {
-                khint_t k;
-                pthread_rwlock_rdlock(&newdbs->rwlock_blocks);
-                k = kh_get(dynablocks, newdbs->blocks, key-newdbs->base);
-                if(k!=kh_end(newdbs->blocks))
-                    ok = 0;
-                pthread_rwlock_unlock(&newdbs->rwlock_blocks);
+    qsort(list, n, sizeof(icsite_t), compareICSite);
+    printf_log(LOG_NONE, "Dynarec indirect jumps: %d sites, %llu jumps, %llu missed the inline cache (%.1f%%)\n", n, count, miss, count?(miss*100.0/count):0.0);
+    printf_log(LOG_NONE, "%10s %10s %10s  %s\n", "jumps", "misses", "x86", "function");
+    for(int i=0; i<n && i<IC_MAXDUMP; ++i)
+        printf_log(LOG_NONE, "%10u %10u %p  %s\n", list[i].count, list[i].miss, (void*)list[i].addr, getAddrFunctionName(list[i].addr));
+    free(list);
+}
+
+static int compareProfile(const void* a, const void* b)
+{
+    const dynablock_t* da = *(const dynablock_t**)a;
+    const dynablock_t* db = *(const dynablock_t**)b;
+    uint64_t ca = (uint64_t)da->hits+da->interp;
+    uint64_t cb = (uint64_t)db->hits+db->interp;
+    if(ca!=cb)
+        return (ca<cb)?1:-1;
+    return (da->x86_addr<db->x86_addr)?-1:((da->x86_addr>db->x86_addr)?1:0);
+}
+
+static void addProfiled(dynablocklist_t* dynablocks, dynablock_t*** list, int* n, int* cap)
+{
+    dynablock_t** all;
+    int sz = getAllDynablocks(dynablocks, &all);
+    for(int i=0; i<sz; ++i)
+        if(all[i]->hits || all[i]->interp) {
+            if(*n==*cap) {
+                *cap += 256;
+                *list = (dynablock_t**)realloc(*list, (*cap)*sizeof(dynablock_t*));
             }
+            (*list)[(*n)++] = all[i];
         }
-    );
-    if(ok) {
-        kh_foreach(blocks, key, db,
-            key += dynablocks->base;
-            dynablocklist_t *newdbs = getDBFromAddress(key);   // will crash if no dynablocks is found
-            if(newdbs->direct) {
-                newdbs->direct[key-newdbs->text] = db;
-            } else {
-                khint_t k;
-                int ret;
-                pthread_rwlock_wrlock(&newdbs->rwlock_blocks);
-                k = kh_put(dynablocks, newdbs->blocks, key-newdbs->base, &ret);
-                kh_value(newdbs->blocks, k) = db;
-                pthread_rwlock_unlock(&newdbs->rwlock_blocks);
+    free(all);
+}
+
+void DumpDynablockProfile(const char* filename)
+{
+    dynablock_t** list = NULL;
+    int n = 0, cap = 0;
+    for(int idx=0; idx<DYNAMAP_SIZE; ++idx)
+        if(my_context->dynmap[idx])
+            addProfiled(my_context->dynmap[idx]->dynablocks, &list, &n, &cap);
+    if(my_context->dynablocks)
+        addProfiled(my_context->dynablocks, &list, &n, &cap);
+    qsort(list, n, sizeof(dynablock_t*), compareProfile);
+    uint64_t hits = 0, interp = profile_nodb;
+    for(int i=0; i<n; ++i) {
+        hits += list[i]->hits;
+        interp += list[i]->interp;
+    }
+    printf_log(LOG_NONE, "Dynarec profile: %d blocks, %llu block entries, %llu interpretor fallbacks (%u outside of any block)\n", n, hits, interp, profile_nodb);
+    if(cstack_stats[0])
+        printf_log(LOG_NONE, "Dynarec return stack: %u RET, %u returned directly in the caller block (%.1f%%), %u missed\n", cstack_stats[0], cstack_stats[0]-cstack_stats[1], (cstack_stats[0]-cstack_stats[1])*100.0/cstack_stats[0], cstack_stats[1]);
+    printf_log(LOG_NONE, "%10s %10s %10s %6s %6s  %s\n", "hits", "interp", "x86", "x86sz", "armsz", "function");
+    for(int i=0; i<n; ++i) {
+        dynablock_t* db = list[i];
+        printf_log(LOG_NONE, "%10u %10u %p %6d %6d  %s\n", db->hits, db->interp, db->x86_addr, db->x86_size, db->father?0:db->size, getAddrFunctionName((uintptr_t)db->x86_addr));
+    }
+    dumpICSites();
+    if(filename) {
+        FILE* f = fopen(filename, "w");
+        if(!f) {
+            printf_log(LOG_NONE, "Warning, cannot open \"%s\" to save Dynarec profile\n", filename);
+        } else {
+            // folded format: one line per block, "elf;function;address count"
+            for(int i=0; i<n; ++i) {
+                dynablock_t* db = list[i];
+                elfheader_t* h = FindElfAddress(my_context, (uintptr_t)db->x86_addr);
+                uintptr_t start = 0;
+                uint32_t sz = 0;
+                const char* symbname = FindNearestSymbolName(h, db->x86_addr, &start, &sz);
+                if(!symbname || (uintptr_t)db->x86_addr<start || ((uintptr_t)db->x86_addr>=start+sz && sz))
+                    symbname = "???";
+                const char* elfname = h?ElfName(h):"???";
+                if(db->hits)
+                    fprintf(f, "%s;%s;%p %u\n", elfname, symbname, db->x86_addr, db->hits);
+                if(db->interp)
+                    fprintf(f, "%s;%s;%p;[interpretor] %u\n", elfname, symbname, db->x86_addr, db->interp);
             }
-        );
-        kh_destroy(dynablocks, blocks);
-    } else {
-        pthread_rwlock_wrlock(&dynablocks->rwlock_blocks);
-        dynablocks->blocks = blocks;
-        dynarec_log(LOG_DEBUG, "Cannot convert dynablocks(%p) to pure direct\n", (void*)dynablocks->text);
+            if(profile_nodb)
+                fprintf(f, "???;[interpretor] %u\n", profile_nodb);
+            fclose(f);
+        }
     }
-
+    free(list);
 }
 
-// a block is 4096 byte, so get a low magic size or no block will get "direct" treatment
-#define MAGIC_SIZE  8
-#define MAGIC_SIZE2 16
-
 dynablock_t *AddNewDynablock(dynablocklist_t* dynablocks, uintptr_t addr, int with_marks, int* created)
 {
     if(!dynablocks) {
@@ -507,78 +940,38 @@ dynablock_t *AddNewDynablock(dynablocklist_t* dynablocks, uintptr_t addr, int wi
         *created = 0;
         return NULL;
     }
-    khint_t k;
-    int ret;
-    dynablock_t* block = NULL;
-    // first, check if it exist in direct access mode
-    if(dynablocks->direct && (addr>=dynablocks->text) && (addr<(dynablocks->text+dynablocks->textsz))) {
-        block = dynablocks->direct[addr-dynablocks->text];
-        if(block) {
-            dynarec_log(LOG_DUMP, "Block already exist in Direct Map\n");
-            *created = 0;
-            return block;
-        }
+    if(dynablocks->textsz && ((addr<dynablocks->text) || (addr>=(dynablocks->text+dynablocks->textsz)))) {
+        // out-of-bound, use the correct dynablocklist
+        return AddNewDynablock(getDBFromAddress(addr), addr, with_marks, created);
     }
-    
-    if(dynablocks->blocks) {
-        pthread_rwlock_rdlock(&dynablocks->rwlock_blocks);
-        // check again, in case it's been converted to direct in another thread
-        if(dynablocks->blocks) {
-            // check if the block exist
-            khint_t k;
-            k = kh_get(dynablocks, dynablocks->blocks, addr-dynablocks->base);
-            if(k!=kh_end(dynablocks->blocks)) {
-                block = kh_value(dynablocks->blocks, k);
-                pthread_rwlock_unlock(&dynablocks->rwlock_blocks);
-                dynarec_log(LOG_DUMP, "Block already exist in Hash Map\n");
-                *created = 0;
-                return block;
-            }
-        }
-        pthread_rwlock_unlock(&dynablocks->rwlock_blocks);
+    // first, check if it exist
+    dynablock_t* block = getDynablock(dynablocks, addr);
+    if(block) {
+        dynarec_log(LOG_DUMP, "Block already exist in Dynablocklist\n");
+        *created = 0;
+        return block;
     }
     if (!*created)
         return block;
-    
-    // Lock as write now!
-    if(dynablocks->blocks)
-        pthread_rwlock_wrlock(&dynablocks->rwlock_blocks);
-    // create and add new block
+
+    // create an empty block first, so if other thread want to execute the same block, they can, but using interpretor path
     dynarec_log(LOG_DUMP, "Ask for DynaRec Block creation @%p\n", (void*)addr);
-    if(dynablocks->direct && (addr>=dynablocks->text) && (addr<(dynablocks->text+dynablocks->textsz))) {
-        block = dynablocks->direct[addr-dynablocks->text] = (dynablock_t*)calloc(1, sizeof(dynablock_t));
-    } else {
-        if(dynablocks->textsz && ((addr<dynablocks->text) || (addr>=(dynablocks->text+dynablocks->textsz)))) {
-            if(dynablocks->blocks)
-                pthread_rwlock_unlock(&dynablocks->rwlock_blocks);
-            //dynarec_log(LOG_INFO, "Warning: Refused to create a Direct Block that is out-of-bound: dynablocks=%p (%p:%p), addr=%p\n", dynablocks, (void*)(dynablocks->text), (void*)(dynablocks->text+dynablocks->textsz), (void*)addr);
-            //*created = 0;
-            //return NULL;
-            return AddNewDynablock(getDBFromAddress(addr), addr, with_marks, created);
-        }
-        k = kh_put(dynablocks, dynablocks->blocks, addr-dynablocks->base, &ret);
-        if(!ret) {
-            // Ooops, block is already there? retreive it and bail out
-            dynarec_log(LOG_DUMP, "Block already exist in Hash Map\n");
-            block = kh_value(dynablocks->blocks, k);    
-            if(dynablocks->blocks)
-                pthread_rwlock_unlock(&dynablocks->rwlock_blocks);
-            *created = 0;
-            return block;
-        }
-        block = kh_value(dynablocks->blocks, k) = (dynablock_t*)calloc(1, sizeof(dynablock_t));
-        // check if size of hash map == magic size, if yes, convert to direct before unlocking
-        if(!dynablocks->direct && dynablocks->textsz && kh_size(dynablocks->blocks)>=MAGIC_SIZE && kh_size(dynablocks->blocks)<(MAGIC_SIZE2))
-            ConvertHash2Direct(dynablocks);
-    }
+    block = (dynablock_t*)calloc(1, sizeof(dynablock_t));
     block->parent = dynablocks;
+    block->x86_addr = (void*)addr;
     // add mark if needed
     if(with_marks)
         block->marks = kh_init(mark);
-
-    // create an empty block first, so if other thread want to execute the same block, they can, but using interpretor path
-    if(dynablocks->blocks)
-        pthread_rwlock_unlock(&dynablocks->rwlock_blocks);
+    dynablock_t* ret = insertDynablock(dynablocks, addr, block);
+    if(ret!=block) {
+        // Ooops, another thread was faster
+        dynarec_log(LOG_DUMP, "Block already exist in Dynablocklist\n");
+        if(block->marks)
+            kh_destroy(mark, block->marks);
+        free(block);
+        *created = 0;
+        return ret;
+    }
 
     *created = 1;
     return block;
@@ -597,25 +990,19 @@ static dynablock_t* internalDBGetBlock(x86emu_t* emu, uintptr_t addr, int create
         dynablocks = current->parent;    
         if(!(addr>=dynablocks->text && addr<(dynablocks->text+dynablocks->textsz)))
             dynablocks = NULL;
-        else if(dynablocks->direct && (addr>=dynablocks->text) && (addr<(dynablocks->text+dynablocks->textsz))) {
-            block = dynablocks->direct[addr-dynablocks->text];
-            if(block)
-                return block;
-        }
     }
     // nope, lets do the long way
     if(!dynablocks)
         dynablocks = GetDynablocksFromAddress(emu->context, addr);
     if(!dynablocks)
         return NULL;
-    // check direct first, without lock
-    if(dynablocks->direct && (addr>=dynablocks->text) && (addr<(dynablocks->text+dynablocks->textsz)))
-        block = dynablocks->direct[addr-dynablocks->text];
+    // lock-free lookup first
+    block = getDynablock(dynablocks, addr);
     if(block)
         return block;
 
     int created = create;
-    block = AddNewDynablock(dynablocks, addr, (dynablocks->nolinker)&&(dynablocks->direct), &created);
+    block = AddNewDynablock(dynablocks, addr, dynablocks->nolinker || box86_dynarec_tier, &created);
     if(!created || !create)
         return block;   // existing block...
 
@@ -623,9 +1010,17 @@ static dynablock_t* internalDBGetBlock(x86emu_t* emu, uintptr_t addr, int create
         pthread_mutex_lock(&my_context->mutex_dyndump);
     // fill the block
     block->x86_addr = (void*)addr;
-    FillBlock(block);
+    if(!box86_dynarec_cache || !DynaCacheLoad(block)) {
+        block->tier = box86_dynarec_tier?1:0;
+        FillBlock(block);
+    }
     if(box86_dynarec_dump)
         pthread_mutex_unlock(&my_context->mutex_dyndump);
+    if(box86_dynarec_cache_max && block->done) {
+        if(block->parent->nolinker && block->block)
+            clockAdd(block);
+        checkEvict();
+    }
 
     dynarec_log(LOG_DEBUG, " --- DynaRec Block %s @%p:%p (%p, 0x%x bytes, %swith %d son(s))\n", created?"created":"recycled", (void*)addr, (void*)(addr+block->x86_size), block->block, block->size, block->marks?"with Marks, ":"", block->sons_size);
 
@@ -654,3 +1049,34 @@ dynablock_t* DBGetBlock(x86emu_t* emu, uintptr_t addr, int create, dynablock_t**
     } 
     return db;
 }
+
+dynablock_t* DBTierBlock(x86emu_t* emu, dynablock_t* db)
+{
+    if(db->father || db->tier!=1 || db->tiercount>0 || !db->done || db->gone)
+        return db;
+    if(!__sync_bool_compare_and_swap(&db->tier, 1, 2))
+        return db;  // another thread is already on it
+    dynablocklist_t* dynablocks = db->parent;
+    uintptr_t addr = (uintptr_t)db->x86_addr;
+    dynarec_log(LOG_DEBUG, "Recompiling hot block %p @%p:%p (%d x86 instructions) as a superblock\n", db, db->x86_addr, db->x86_addr+db->x86_size, db->isize);
+    // remove the old block, everything linked to it will go through the linker again
+    // (threads still running it, or with it in their cstack, hold an older epoch)
+    FreeDynablock(db);
+    int created = 1;
+    dynablock_t* block = AddNewDynablock(dynablocks, addr, 1, &created);
+    if(!created)
+        return block;   // another thread was faster
+    if(box86_dynarec_dump)
+        pthread_mutex_lock(&my_context->mutex_dyndump);
+    block->tier = 2;
+    FillBlock(block);
+    if(box86_dynarec_dump)
+        pthread_mutex_unlock(&my_context->mutex_dyndump);
+    if(box86_dynarec_cache_max && block->done) {
+        if(block->parent->nolinker && block->block)
+            clockAdd(block);
+        checkEvict();
+    }
+    dynarec_log(LOG_DEBUG, " --- DynaRec Superblock created @%p:%p (%p, 0x%x bytes, %d x86 instructions, with %d son(s))\n", (void*)addr, (void*)(addr+block->x86_size), block->block, block->size, block->isize, block->sons_size);
+    return block;
+}
@@ -2,7 +2,7 @@
 #define __DYNABLOCK_PRIVATE_H_
 
 typedef struct dynablocklist_s  dynablocklist_t;
-typedef struct kh_dynablocks_s  kh_dynablocks_t;
+typedef struct dynahash_s       dynahash_t;
 typedef struct kh_mark_s        kh_mark_t;
 
 typedef struct dynablock_s {
@@ -22,16 +22,22 @@ typedef struct dynablock_s {
     int             sons_size;
     dynablock_t*    father; // set only in the case of a son
     int             nolinker;
+    uint32_t        exec;   // set by the block at each entry (nolinker blocks only), aged by the eviction clock
+    int             clock;  // index+1 in the eviction clock, 0 if not evictable
+    int             gone;   // already freed (and waiting to be released)
+    uint32_t        hits;   // number of time the block was entered (only with BOX86_DYNAREC_PROFILE)
+    uint32_t        interp; // number of time the interpretor was used instead of the block (only with BOX86_DYNAREC_PROFILE)
+    int             tier;   // 0: not tiered, 1: first translation (with countdown), 2: recompiled as a superblock
+    int32_t         tiercount;  // countdown of executions before recompilation
 } dynablock_t;
 
+// lookup and insertion are lock-free (CAS), and freed block are only released when no thread can use them
 typedef struct dynablocklist_s {
-    kh_dynablocks_t     *blocks;
-    pthread_rwlock_t    rwlock_blocks;
-    uintptr_t           base;
     uintptr_t           text;
     int                 textsz;
     int                 nolinker;    // in case this dynablock can disapear (also, block memory are allocated with a temporary scheme)
-    dynablock_t         **direct;    // direct mapping (waste of space, so not always there)
+    dynablock_t         ***direct;   // direct mapping, by chunk allocated on demand (only if textsz!=0)
+    dynahash_t          *hash;       // lock-free hash, when there is no text
 } dynablocklist_t;
 
 #endif //__DYNABLOCK_PRIVATE_H_
\ No newline at end of file
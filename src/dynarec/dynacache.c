@@ -0,0 +1,376 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <elf.h>
+
+#include "debug.h"
+#include "box86context.h"
+#include "dynablock.h"
+#include "dynablock_private.h"
+#include "dynarec_private.h"
+#include "dynacache.h"
+#include "elfloader.h"
+#include "elfs/elfloader_private.h"
+#include "khash.h"
+
+#ifdef ARM
+void arm_linker() EXPORTDYN;
+#endif
+
+/*
+    The persistent cache is one file per elf (and per load address), in the BOX86_DYNAREC_CACHE folder.
+    The file start with a header describing the elf, box86 and the dynarec options (if any of this
+    changed, the file is reset), followed by entries appended as blocks are created.
+    An entry is a dynacache_entry_t followed by the x86 bytes of the block (padded to 4), the arm code,
+    the x86 address of each jump table slot, the relocations and the sons (x86 address, arm offset).
+*/
+
+#define DYNACACHE_MAGIC     "BOX86DC2"
+#define DYNACACHE_ENTRY     0x31454344  // "DCE1"
+
+typedef struct dynacache_header_s {
+    char        magic[8];
+    uint32_t    box86_size;     // box86 binary identity: native address of helpers are embedded in the blocks
+    uint32_t    box86_mtime;
+    uint32_t    elf_size;       // elf identity
+    uint32_t    elf_mtime;
+    uint32_t    base;           // load address of the elf: the blocks embed absolute x86 addresses
+    uint32_t    delta;          // load delta of the elf
+    uint32_t    flags;          // dynarec options that change the generated code
+} dynacache_header_t;
+
+typedef struct dynacache_entry_s {
+    uint32_t    magic;
+    uint32_t    total;          // total size of the entry, header included
+    uint32_t    x86_addr;
+    uint32_t    x86_size;
+    uint32_t    hash;           // X31 hash of the x86 bytes
+    uint32_t    size;           // size of the arm code
+    uint32_t    isize;
+    uint32_t    tablesz;
+    uint32_t    relocs_sz;
+    uint32_t    sons_size;
+} dynacache_entry_t;
+
+KHASH_MAP_INIT_INT(dynacache, uint32_t)
+
+typedef struct dynacache_s {
+    int                 fd;
+    kh_dynacache_t      *index;     // x86 address -> offset of the entry in the file
+    pthread_mutex_t     mutex;
+    int                 loaded;
+    int                 stored;
+    int                 rejected;
+} dynacache_t;
+
+#define ALIGN4(A)   (((A)+3)&~3)
+
+static uint32_t dynacache_flags()
+{
+    uint32_t flags = box86_dynarec_linker?1:0;
+#ifdef HAVE_TRACE
+    if(box86_dynarec_trace)
+        flags |= 2;
+#endif
+    if(box86_dynarec_profile)
+        flags |= 4;
+    if(box86_dynarec_cache_max)
+        flags |= 8;
+#ifdef ARM
+    flags |= (arm_vfp&0xff)<<8;
+    flags |= (arm_swap?1:0)<<16;
+    flags |= (arm_div?1:0)<<17;
+#endif
+    return flags;
+}
+
+dynacache_t* NewDynaCache(elfheader_t* h)
+{
+    if(!box86_dynarec_cache || !h || !h->path || !h->path[0] || !my_context->box86path)
+        return NULL;
+    struct stat st_elf, st_box86;
+    if(stat(h->path, &st_elf) || stat(my_context->box86path, &st_box86))
+        return NULL;
+    dynacache_header_t head;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, DYNACACHE_MAGIC, sizeof(head.magic));
+    head.box86_size = st_box86.st_size;
+    head.box86_mtime = st_box86.st_mtime;
+    head.elf_size = st_elf.st_size;
+    head.elf_mtime = st_elf.st_mtime;
+    head.base = (uintptr_t)h->memory;
+    head.delta = h->delta;
+    head.flags = dynacache_flags();
+    // one file per elf and load address
+    const char* name = strrchr(h->path, '/');
+    name = name?(name+1):h->path;
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s/%s-%08x-%08x.dyncache", box86_dynarec_cache, name, X31_hash_code(h->path, strlen(h->path)), head.base);
+    int fd = open(filename, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+    if(fd<0) {
+        dynarec_log(LOG_INFO, "Cannot open dynarec cache \"%s\" (error=%s)\n", filename, strerror(errno));
+        return NULL;
+    }
+    dynacache_t* cache = (dynacache_t*)calloc(1, sizeof(dynacache_t));
+    cache->fd = fd;
+    cache->index = kh_init(dynacache);
+    pthread_mutex_init(&cache->mutex, NULL);
+    // other box86 instance may be using the same file
+    flock(fd, LOCK_EX);
+    dynacache_header_t old;
+    off_t end = lseek(fd, 0, SEEK_END);
+    if(end>=(off_t)sizeof(old) && pread(fd, &old, sizeof(old), 0)==sizeof(old) && !memcmp(&old, &head, sizeof(head))) {
+        // build the index
+        dynacache_entry_t e;
+        uint32_t offs = sizeof(head);
+        int ret;
+        while(offs+sizeof(e)<=end && pread(fd, &e, sizeof(e), offs)==sizeof(e)
+         && e.magic==DYNACACHE_ENTRY && e.total>=sizeof(e) && offs+e.total<=end) {
+            khint_t k = kh_put(dynacache, cache->index, e.x86_addr, &ret);
+            kh_value(cache->index, k) = offs;  // last one win
+            offs += e.total;
+        }
+        if(offs!=end) {
+            dynarec_log(LOG_INFO, "Dynarec cache \"%s\" truncated (0x%x/0x%x)\n", filename, offs, (uint32_t)end);
+            if(ftruncate(fd, offs)) {}
+        }
+    } else {
+        // new or outdated file, start from scratch
+        if(ftruncate(fd, 0) || pwrite(fd, &head, sizeof(head), 0)!=sizeof(head)) {
+            dynarec_log(LOG_INFO, "Cannot initialize dynarec cache \"%s\" (error=%s)\n", filename, strerror(errno));
+            flock(fd, LOCK_UN);
+            FreeDynaCache(&cache);
+            return NULL;
+        }
+    }
+    flock(fd, LOCK_UN);
+    dynarec_log(LOG_INFO, "Dynarec cache \"%s\" opened for %s, %d block(s) available\n", filename, h->name, kh_size(cache->index));
+    return cache;
+}
+
+void FreeDynaCache(dynacache_t** cache)
+{
+    if(!cache || !*cache)
+        return;
+    dynacache_t* c = *cache;
+    dynarec_log(LOG_INFO, "Dynarec cache closed: %d block(s) loaded, %d stored, %d rejected\n", c->loaded, c->stored, c->rejected);
+    close(c->fd);
+    kh_destroy(dynacache, c->index);
+    pthread_mutex_destroy(&c->mutex);
+    free(c);
+    *cache = NULL;
+}
+
+static dynacache_t* getDynaCache(dynablock_t* block, elfheader_t** elf)
+{
+    if(!box86_dynarec_cache || !block || block->parent->nolinker)
+        return NULL;    // only "static" code is cached
+    elfheader_t* h = FindElfAddress(my_context, (uintptr_t)block->x86_addr);
+    if(!h || !h->dynacache)
+        return NULL;
+    if(elf)
+        *elf = h;
+    return h->dynacache;
+}
+
+// change the immediate of a MOVW/MOVT pair
+static void patch_mov32(uint32_t* p, uint32_t val)
+{
+    p[0] = (p[0]&0xfff0f000) | ((val&0xf000)<<4) | (val&0x0fff);
+    val >>= 16;
+    p[1] = (p[1]&0xfff0f000) | ((val&0xf000)<<4) | (val&0x0fff);
+}
+
+static void reject_entry(dynacache_t* cache, uintptr_t addr)
+{
+    pthread_mutex_lock(&cache->mutex);
+    khint_t k = kh_get(dynacache, cache->index, addr);
+    if(k!=kh_end(cache->index))
+        kh_del(dynacache, cache->index, k);
+    ++cache->rejected;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+int DynaCacheLoad(dynablock_t* block)
+{
+    elfheader_t* h = NULL;
+    dynacache_t* cache = getDynaCache(block, &h);
+    if(!cache)
+        return 0;
+    uintptr_t addr = (uintptr_t)block->x86_addr;
+    pthread_mutex_lock(&cache->mutex);
+    khint_t k = kh_get(dynacache, cache->index, addr);
+    if(k==kh_end(cache->index)) {
+        pthread_mutex_unlock(&cache->mutex);
+        return 0;
+    }
+    uint32_t offs = kh_value(cache->index, k);
+    pthread_mutex_unlock(&cache->mutex);
+    // read the entry
+    dynacache_entry_t e;
+    if(pread(cache->fd, &e, sizeof(e), offs)!=sizeof(e) || e.magic!=DYNACACHE_ENTRY || e.x86_addr!=addr) {
+        reject_entry(cache, addr);
+        return 0;
+    }
+    uint32_t sz = e.total - sizeof(e);
+    uint8_t* data = (uint8_t*)malloc(sz);
+    if(!data || pread(cache->fd, data, sz, offs+sizeof(e))!=sz) {
+        free(data);
+        reject_entry(cache, addr);
+        return 0;
+    }
+    uint8_t* x86 = data;
+    uint8_t* arm = x86 + ALIGN4(e.x86_size);
+    uint32_t* ips = (uint32_t*)(arm + e.size);
+    dynarec_reloc_t* relocs = (dynarec_reloc_t*)(ips + e.tablesz/4);
+    uint32_t* sons = (uint32_t*)(relocs + e.relocs_sz);
+    // validate the entry against the current x86 code
+    int ok = e.x86_size && e.size && ((e.tablesz&3)==0)
+        && (e.x86_size<sz) && (e.size<sz) && (e.tablesz<sz) && (e.relocs_sz<sz) && (e.sons_size<sz)
+        && ((uint8_t*)(sons + e.sons_size*2) == data + sz)
+        && IsAddressInElfSpace(h, addr+e.x86_size-1)
+        && (X31_hash_code(x86, e.x86_size) == e.hash)
+        && !memcmp(x86, (void*)addr, e.x86_size);
+    for (uint32_t i=0; ok && i<e.relocs_sz; ++i)
+        if((relocs[i].offset+8>e.size) || (relocs[i].offset&3)
+         || (relocs[i].type==RELOC_TABLE && relocs[i].value>=e.tablesz)
+         || (relocs[i].type==RELOC_ARM && relocs[i].value>=e.size)
+         || (relocs[i].type!=RELOC_TABLE && relocs[i].type!=RELOC_ARM && relocs[i].type!=RELOC_EXEC))
+            ok = 0;
+    for (uint32_t i=0; ok && i<e.sons_size; ++i)
+        if(sons[i*2+0]<=addr || sons[i*2+0]>=addr+e.x86_size || sons[i*2+1]>=e.size)
+            ok = 0;
+    if(!ok) {
+        dynarec_log(LOG_DEBUG, "Dynarec cache entry for %p rejected\n", (void*)addr);
+        free(data);
+        reject_entry(cache, addr);
+        return 0;
+    }
+    void* p = (void*)AllocDynarecMap(e.size, 0);
+    if(!p) {
+        free(data);
+        return 0;
+    }
+    memcpy(p, arm, e.size);
+    // rebuild the jump table, everything goes through the linker for now
+    uintptr_t* table = NULL;
+    if(e.tablesz) {
+        table = (uintptr_t*)calloc(e.tablesz, sizeof(uintptr_t));
+        for (uint32_t i=0; i<e.tablesz/4; ++i) {
+            table[i*4+2] = (uintptr_t)block;
+            tableupdate(arm_linker, ips[i], (void**)&table[i*4]);
+        }
+    }
+    // and relocate what need to be
+    for (uint32_t i=0; i<e.relocs_sz; ++i) {
+        uintptr_t val;
+        switch(relocs[i].type) {
+            case RELOC_TABLE: val = (uintptr_t)&table[relocs[i].value]; break;
+            case RELOC_EXEC: val = (uintptr_t)&block->exec; break;
+            default: val = (uintptr_t)p+relocs[i].value; break;
+        }
+        patch_mov32((uint32_t*)(p+relocs[i].offset), val);
+    }
+    __clear_cache(p, p+e.size);   // need to clear the cache before execution...
+    block->table = table;
+    block->tablesz = e.tablesz;
+    block->size = e.size;
+    block->isize = e.isize;
+    block->block = p;
+    block->nolinker = box86_dynarec_linker?0:1;
+    block->need_test = 0;
+    block->x86_size = e.x86_size;
+    if(box86_dynarec_largest<block->x86_size)
+        box86_dynarec_largest = block->x86_size;
+    block->hash = (block->nolinker)?e.hash:0;
+    // fill sons if any
+    if(e.sons_size) {
+        dynablock_t** blocksons = (dynablock_t**)calloc(e.sons_size, sizeof(dynablock_t*));
+        int sons_size = 0;
+        for (uint32_t i=0; i<e.sons_size; ++i) {
+            int created = 1;
+            dynablock_t *son = AddNewDynablock(block->parent, sons[i*2+0], 0, &created);
+            if(created) {    // avoid breaking a working block! also, block could be outside this parent...
+                son->block = p+sons[i*2+1];
+                son->x86_addr = (void*)sons[i*2+0];
+                son->x86_size = addr+e.x86_size-sons[i*2+0];
+                son->father = block;
+                son->done = 1;
+                blocksons[sons_size++] = son;
+            }
+        }
+        if(sons_size) {
+            block->sons = blocksons;
+            block->sons_size = sons_size;
+        } else
+            free(blocksons);
+    }
+    free(data);
+    pthread_mutex_lock(&cache->mutex);
+    ++cache->loaded;
+    pthread_mutex_unlock(&cache->mutex);
+    dynarec_log(LOG_DEBUG, " --- DynaRec Block loaded from cache @%p:%p (%p, 0x%x bytes, with %d son(s))\n", (void*)addr, (void*)(addr+block->x86_size), block->block, block->size, block->sons_size);
+    block->done = 1;
+    return 1;
+}
+
+void DynaCacheStore(dynablock_t* block, dynarec_reloc_t* relocs, int relocs_sz)
+{
+    elfheader_t* h = NULL;
+    dynacache_t* cache = getDynaCache(block, &h);
+    if(!cache || !block->block || !block->x86_size)
+        return;
+    uintptr_t addr = (uintptr_t)block->x86_addr;
+    if(!IsAddressInElfSpace(h, addr+block->x86_size-1))
+        return;
+    dynacache_entry_t e;
+    memset(&e, 0, sizeof(e));
+    e.magic = DYNACACHE_ENTRY;
+    e.x86_addr = addr;
+    e.x86_size = block->x86_size;
+    e.hash = X31_hash_code(block->x86_addr, block->x86_size);
+    e.size = block->size;
+    e.isize = block->isize;
+    e.tablesz = block->tablesz;
+    e.relocs_sz = relocs_sz;
+    e.sons_size = block->sons_size;
+    e.total = sizeof(e) + ALIGN4(e.x86_size) + e.size + e.tablesz + e.relocs_sz*sizeof(dynarec_reloc_t) + e.sons_size*2*sizeof(uint32_t);
+    uint8_t* data = (uint8_t*)calloc(1, e.total);
+    memcpy(data, &e, sizeof(e));
+    uint8_t* x86 = data + sizeof(e);
+    uint8_t* arm = x86 + ALIGN4(e.x86_size);
+    uint32_t* ips = (uint32_t*)(arm + e.size);
+    dynarec_reloc_t* r = (dynarec_reloc_t*)(ips + e.tablesz/4);
+    uint32_t* sons = (uint32_t*)(r + e.relocs_sz);
+    memcpy(x86, block->x86_addr, e.x86_size);
+    memcpy(arm, block->block, e.size);
+    for (uint32_t i=0; i<e.tablesz/4; ++i)
+        ips[i] = block->table[i*4+1];
+    if(relocs_sz)
+        memcpy(r, relocs, relocs_sz*sizeof(dynarec_reloc_t));
+    for (int i=0; i<block->sons_size; ++i) {
+        sons[i*2+0] = (uintptr_t)block->sons[i]->x86_addr;
+        sons[i*2+1] = (uintptr_t)block->sons[i]->block - (uintptr_t)block->block;
+    }
+    pthread_mutex_lock(&cache->mutex);
+    flock(cache->fd, LOCK_EX);
+    off_t offs = lseek(cache->fd, 0, SEEK_END);
+    if(pwrite(cache->fd, data, e.total, offs)==e.total) {
+        int ret;
+        khint_t k = kh_put(dynacache, cache->index, addr, &ret);
+        kh_value(cache->index, k) = offs;
+        ++cache->stored;
+    } else if(ftruncate(cache->fd, offs)) {}  // remove partial write
+    flock(cache->fd, LOCK_UN);
+    pthread_mutex_unlock(&cache->mutex);
+    free(data);
+}
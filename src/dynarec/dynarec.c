@@ -3,6 +3,7 @@
 #include <pthread.h>
 #include <errno.h>
 #include <setjmp.h>
+#include <string.h>
 
 #include "debug.h"
 #include "box86context.h"
@@ -15,10 +16,12 @@
 #include "callback.h"
 #include "emu/x86run_private.h"
 #include "x86trace.h"
+#include "emu/x86predecode.h"
 #include "threads.h"
 #ifdef DYNAREC
 #include "dynablock.h"
 #include "dynablock_private.h"
+#include "dynarec_private.h"
 #endif
 
 #ifdef ARM
@@ -51,8 +54,38 @@ void resettable(void** table)
 }
 
 #ifdef DYNAREC
+uint32_t cstack_stats[2] = {0};
+
+void CStackReset(x86emu_t* emu)
+{
+    emu->cstacki = 0;
+    memset(emu->cstack, 0, sizeof(emu->cstack));
+}
+
+#ifdef ARM
+// entry i of the cstack, with the same 8 bytes alignement as the one used by the dynarec (see cstack_push)
+static uint32_t* cstackEntry(x86emu_t* emu, int i)
+{
+    uintptr_t p = (uintptr_t)emu->cstack;
+    if(((uintptr_t)emu)&4)
+        p += 4;
+    return (uint32_t*)(p+i*8);
+}
+
+// push a pair x86 return address / native address, like the CALL of a dynablock
+static void cstackPush(x86emu_t* emu, uintptr_t x86ip, uintptr_t native)
+{
+    uint32_t* p = cstackEntry(emu, emu->cstacki);
+    p[0] = x86ip;
+    p[1] = native;
+    emu->cstacki = (emu->cstacki+1)&CSTACKMASK;
+}
+#endif
+
 void* UpdateLinkTable(x86emu_t* emu, void** table, uintptr_t addr)
 {
+    if(box86_dynarec_test)
+        return arm_epilog_fast; // one block at a time, no linking
     dynablock_t* current = (dynablock_t*)table[2];
     if(current->father)
         current = current->father;
@@ -90,6 +123,19 @@ void* UpdateLinkTable(x86emu_t* emu, void** table, uintptr_t addr)
     }
     return block->block;
 }
+
+// all the ways of the inline cache of an indirect jump missed: link a free way (or else, each way in turn) to addr
+void* UpdateLinkTableIC(x86emu_t* emu, void** table, uintptr_t addr)
+{
+    static uint32_t next = 0;
+    int way = -1;
+    for(int i=0; i<IC_WAYS && way<0; ++i)
+        if(!table[i*4+1])
+            way = i;
+    if(way<0)
+        way = __sync_fetch_and_add(&next, 1)%IC_WAYS;
+    return UpdateLinkTable(emu, &table[way*4], addr);
+}
 #endif
 
 void DynaCall(x86emu_t* emu, uintptr_t addr)
@@ -97,6 +143,10 @@ void DynaCall(x86emu_t* emu, uintptr_t addr)
     // prepare setjump for signal handling
     emu_jmpbuf_t *ejb = NULL;
     int jmpbuf_reset = 0;
+    int pdlevel = PredecodeGetLevel();
+#ifdef DYNAREC
+    int dblevel = DynablockGetLevel();
+#endif
     if(emu->type == EMUTYPE_MAIN) {
         ejb = GetJmpBuf();
         if(!ejb->jmpbuf_ok) {
@@ -106,6 +156,7 @@ void DynaCall(x86emu_t* emu, uintptr_t addr)
             setjmp((struct __jmp_buf_tag*)ejb->jmpbuf);
         }
     }
+    PredecodeSetLevel(pdlevel); // in case of a longjmp
 #ifdef DYNAREC
     if(!box86_dynarec)
 #endif
@@ -121,22 +172,44 @@ void DynaCall(x86emu_t* emu, uintptr_t addr)
         PushExit(emu);
         R_EIP = addr;
         emu->df = d_none;
+        DynablockSetLevel(dblevel); // in case of a longjmp
+        if(!dblevel)
+            CStackReset(emu);   // dynablocks may have been freed while the thread was not using them
+        // the final RET of the function will match that entry, and not an entry of the caller
+        int old_cstacki = emu->cstacki;
+        #ifdef ARM
+        cstackPush(emu, (uintptr_t)GetExit(), (uintptr_t)arm_epilog);
+        #endif
         dynablock_t* block = NULL;
         dynablock_t* current = NULL;
+        DynablockEnter();
         while(!emu->quit) {
+            if(dynablock_evict)
+                EvictDynablocks();
+            if(DynablockRefresh()) {
+                current = NULL;
+                CStackReset(emu);   // native addresses in the cstack may be gone
+            }
             block = DBGetBlock(emu, R_EIP, 1, &current);
+            if(box86_dynarec_tier && block)
+                block = DBTierBlock(emu, block);
             current = (block && !block->parent->nolinker)?block:NULL;
             if(!block || !block->block || !block->done) {
                 // no block, of block doesn't have DynaRec content (yet, temp is not null)
                 // Use interpreter (should use single instruction step...)
                 dynarec_log(LOG_DEBUG, "Calling Interpretor @%p, emu=%p\n", (void*)R_EIP, emu);
+                if(box86_dynarec_profile)
+                    ProfileDynablockInterp(block);
                 Run(emu, 1);
             } else {
                 dynarec_log(LOG_DEBUG, "Calling DynaRec Block @%p (%p) of %d x86 instructions (nolinker=%d, father=%p) emu=%p\n", (void*)R_EIP, block->block, block->isize ,block->parent->nolinker, block->father, emu);
                 CHECK_FLAGS(emu);
                 // block is here, let's run it!
                 #ifdef ARM
-                arm_prolog(emu, block->block);
+                if(box86_dynarec_test)
+                    DynaTestBlock(emu, block);
+                else
+                    arm_prolog(emu, block->block);
                 #endif
             }
             if(emu->fork) {
@@ -153,11 +226,14 @@ void DynaCall(x86emu_t* emu, uintptr_t addr)
                 }
             }
         }
+        DynablockLeave();
         emu->quit = 0;  // reset Quit flags...
         emu->df = d_none;
         if(emu->quitonlongjmp && emu->longjmp) {
             emu->longjmp = 0;   // don't change anything because of the longjmp
+            CStackReset(emu);
         } else {
+            emu->cstacki = old_cstacki; // callers entries are back on top, even if the calls and returns didn't match
             R_EBX = old_ebx;
             R_EDI = old_edi;
             R_ESI = old_esi;
@@ -177,6 +253,10 @@ int DynaRun(x86emu_t* emu)
     // prepare setjump for signal handling
     emu_jmpbuf_t *ejb = NULL;
     int jmpbuf_reset = 1;
+    int pdlevel = PredecodeGetLevel();
+#ifdef DYNAREC
+    int dblevel = DynablockGetLevel();
+#endif
     if(emu->type == EMUTYPE_MAIN) {
         ejb = GetJmpBuf();
         if(!ejb->jmpbuf_ok) {
@@ -186,6 +266,7 @@ int DynaRun(x86emu_t* emu)
             setjmp((struct __jmp_buf_tag*)ejb->jmpbuf);
         }
     }
+    PredecodeSetLevel(pdlevel); // in case of a longjmp
 #ifdef DYNAREC
     if(!box86_dynarec)
 #endif
@@ -194,19 +275,36 @@ int DynaRun(x86emu_t* emu)
     else {
         dynablock_t* block = NULL;
         dynablock_t* current = NULL;
+        DynablockSetLevel(dblevel); // in case of a longjmp
+        if(!dblevel)
+            CStackReset(emu);   // dynablocks may have been freed while the thread was not using them
+        DynablockEnter();
         while(!emu->quit) {
+            if(dynablock_evict)
+                EvictDynablocks();
+            if(DynablockRefresh()) {
+                current = NULL;
+                CStackReset(emu);   // native addresses in the cstack may be gone
+            }
             block = DBGetBlock(emu, R_EIP, 1, &current);
+            if(box86_dynarec_tier && block)
+                block = DBTierBlock(emu, block);
             current = (block && !block->parent->nolinker)?block:NULL;
             if(!block || !block->block || !block->done) {
                 // no block, of block doesn't have DynaRec content (yet, temp is not null)
                 // Use interpreter (should use single instruction step...)
                 dynarec_log(LOG_DEBUG, "Running Interpretor @%p, emu=%p\n", (void*)R_EIP, emu);
+                if(box86_dynarec_profile)
+                    ProfileDynablockInterp(block);
                 Run(emu, 1);
             } else {
                 dynarec_log(LOG_DEBUG, "Running DynaRec Block @%p (%p) of %d x86 insts (nolinker=%d, father=%p) emu=%p\n", (void*)R_EIP, block->block, block->isize, block->parent->nolinker, block->father, emu);
                 // block is here, let's run it!
                 #ifdef ARM
-                arm_prolog(emu, block->block);
+                if(box86_dynarec_test)
+                    DynaTestBlock(emu, block);
+                else
+                    arm_prolog(emu, block->block);
                 #endif
             }
             if(emu->fork) {
@@ -223,6 +321,7 @@ int DynaRun(x86emu_t* emu)
                 }
             }
         }
+        DynablockLeave();
     }
     // clear the setjmp
     if(ejb && jmpbuf_reset)
@@ -19,7 +19,9 @@
 #include "dynablock_private.h"
 #include "dynarec_arm.h"
 #include "dynarec_arm_private.h"
+#include "arm_emitter.h"
 #include "elfloader.h"
+#include "dynacache.h"
 
 void printf_x86_instruction(zydis_dec_t* dec, instruction_x86_t* inst, const char* name) {
     uint8_t *ip = (uint8_t*)inst->addr;
@@ -35,7 +37,8 @@ void printf_x86_instruction(zydis_dec_t* dec, instruction_x86_t* inst, const cha
             dynarec_log(LOG_NONE, "%s%p: %s", (box86_dynarec_dump>1)?"\e[1m":"", ip, DecodeX86Trace(dec, inst->addr));
         } else {
             dynarec_log(LOG_NONE, "%s%p: ", (box86_dynarec_dump>1)?"\e[1m":"", ip);
-            for(int i=0; i<inst->size; ++i) {
+            int sz = inst->trace?((ip[0]==0xE9)?5:2):inst->size;    // followed jump skip some bytes
+            for(int i=0; i<sz; ++i) {
                 dynarec_log(LOG_NONE, "%02X ", ip[i]);
             }
             dynarec_log(LOG_NONE, " %s", name);
@@ -81,6 +84,33 @@ uintptr_t get_closest_next(dynarec_arm_t *dyn, uintptr_t addr) {
     }
     return best;
 }
+void add_reloc(dynarec_arm_t *dyn, uint32_t type, uint32_t value) {
+    if(dyn->relocs_sz == dyn->relocs_cap) {
+        dyn->relocs_cap += 16;
+        dyn->relocs = (dynarec_reloc_t*)realloc(dyn->relocs, dyn->relocs_cap*sizeof(dynarec_reloc_t));
+    }
+    dyn->relocs[dyn->relocs_sz].type = type;
+    dyn->relocs[dyn->relocs_sz].offset = dyn->arm_size;
+    dyn->relocs[dyn->relocs_sz].value = value;
+    ++dyn->relocs_sz;
+}
+// ARM condition for x86 condition cc (low nibble of Jcc/SETcc/CMOVcc) when ARM flags are NF_xxx natflags, -1 if not possible
+int native_cond(int natflags, int cc)
+{
+    static const int sub_cond[16] = {
+        cVS, cVC, cCC, cCS, cEQ, cNE, cLS, cHI,  // O NO B AE E NE BE A (ARM carry is the inverted x86 CF)
+        cMI, cPL, -1, -1, cLT, cGE, cLE, cGT     // S NS P NP L GE LE G
+    };
+    switch(natflags) {
+        case NF_SUB:
+            return sub_cond[cc&15];
+        case NF_LOGIC:
+            if((cc&15)==0x4 || (cc&15)==0x5 || (cc&15)==0x8 || (cc&15)==0x9)
+                return sub_cond[cc&15];
+            return -1;
+    }
+    return -1;
+}
 int is_nops(dynarec_arm_t *dyn, uintptr_t addr, int n)
 {
     #define PK(A) (*((uint8_t*)(addr+(A))))
@@ -114,7 +144,7 @@ int is_nops(dynarec_arm_t *dyn, uintptr_t addr, int n)
 
 uint32_t needed_flags(dynarec_arm_t *dyn, int ninst, uint32_t setf, int recurse)
 {
-    if(recurse == 10)
+    if(recurse == ((dyn->tier>1)?32:10))
         return X_PEND;
     if(ninst == dyn->size)
         return X_ALL; // no more instructions, or too many jmp loop, stop
@@ -170,6 +200,18 @@ void* FillBlock(dynablock_t* block) {
     dynarec_arm_t helper = {0};
     helper.nolinker = box86_dynarec_linker?(block->parent->nolinker):1;
     helper.start = addr;
+    if(box86_dynarec_profile) {
+        helper.profile = (uintptr_t)&block->hits;
+        helper.nocache = 1; // counter address is in the code
+    }
+    if(box86_dynarec_cache_max && block->parent->nolinker)
+        helper.exec = (uintptr_t)&block->exec;  // only those blocks can be evicted
+    helper.tier = block->tier;
+    if(block->tier==1) {
+        block->tiercount = box86_dynarec_tier;
+        helper.tiercount = (uintptr_t)&block->tiercount;
+        helper.nocache = 1; // countdown address is in the code
+    }
     arm_pass0(&helper, addr);
     if(!helper.size) {
         dynarec_log(LOG_DEBUG, "Warning, null-sized dynarec block (%p)\n", (void*)addr);
@@ -196,7 +238,9 @@ void* FillBlock(dynablock_t* block) {
                     if(helper.insts[i2].x86.addr==j)
                         k=i2;
                 }
-                if(k!=-1)   // -1 if not found, mmm, probably wrong, exit anyway
+                // -1 if not found, mmm, probably wrong, exit anyway
+                // a followed jump (superblock) keeps the state, no barrier needed
+                if(k!=-1 && !(helper.insts[i].x86.trace && k==i+1))
                     helper.insts[k].x86.barrier = 1;
                 helper.insts[i].x86.jmp_insts = k;
             }
@@ -207,6 +251,24 @@ void* FillBlock(dynablock_t* block) {
             if((helper.insts[i].x86.need_flags&X_PEND) && (helper.insts[i].x86.state_flags==SF_MAYSET))
                 helper.insts[i].x86.need_flags = X_ALL;
         }
+    // a cmp/test directly followed by a conditionnal instruction can keep its flags in ARM flags
+    // if nothing after the conditionnal need the x86 flags (pending flags are still stored)
+    if(!(my_context->dec && box86_dynarec_trace))
+        for(int i=0; i+1<helper.size; ++i) {
+            instruction_x86_t* prod = &helper.insts[i].x86;
+            instruction_x86_t* cond = &helper.insts[i+1].x86;
+            if(!prod->natflags || !cond->natcond || cond->barrier==1)
+                continue;
+            if(native_cond(prod->natflags, cond->natcond-1)==-1)
+                continue;
+            uint32_t after = needed_flags(&helper, i+2, X_ALL, 0);
+            if(cond->jmp)
+                after |= (cond->jmp_insts==-1)?X_PEND:needed_flags(&helper, cond->jmp_insts, X_ALL, 1);
+            if(after&X_ALL)
+                continue;
+            prod->need_flags = (prod->need_flags|after)&X_PEND;
+            prod->usenat = cond->usenat = 1;
+        }
     
     // pass 2, instruction size
     arm_pass2(&helper, addr);
@@ -280,6 +342,9 @@ void* FillBlock(dynablock_t* block) {
     }
     if(block->parent->nolinker)
         protectDB((uintptr_t)block->x86_addr, block->x86_size);
+    if(box86_dynarec_cache && !helper.nocache)
+        DynaCacheStore(block, helper.relocs, helper.relocs_sz);
+    free(helper.relocs);
     block->done = 1;
     return (void*)block;
 }
\ No newline at end of file
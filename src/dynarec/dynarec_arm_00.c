@@ -19,6 +19,7 @@
 #include "dynarec_arm.h"
 #include "dynarec_arm_private.h"
 #include "arm_printer.h"
+#include "../tools/bridge_private.h"
 
 #include "dynarec_arm_functions.h"
 #include "dynarec_arm_helper.h"
@@ -28,9 +29,12 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
     uint8_t nextop, opcode;
     uintptr_t natcall;
     int retn;
+    int slotreg;
+    uintptr_t slot;
     uint8_t gd, ed;
     int8_t i8;
     int32_t i32, j32, tmp;
+    int cno, cyes;
     uint8_t u8;
     uint8_t gb1, gb2, eb1, eb2;
     uint32_t u32;
@@ -42,6 +46,8 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
     MAYUSE(eb2);
     MAYUSE(tmp);
     MAYUSE(j32);
+    MAYUSE(cno);
+    MAYUSE(cyes);
 
     switch(opcode) {
         case 0x00:
@@ -483,6 +489,7 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
             GETGD;
             GETEDH(x1);
             emit_cmp32(dyn, ninst, ed, gd, x3, x12);
+            NATFLAGS(NF_SUB);
             break;
         case 0x3A:
             INST_NAME("CMP Gb, Eb");
@@ -499,6 +506,7 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
             GETGD;
             GETEDH(x2);
             emit_cmp32(dyn, ninst, gd, ed, x3, x12);
+            NATFLAGS(NF_SUB);
             break;
         case 0x3C:
             INST_NAME("CMP AL, Ib");
@@ -522,6 +530,7 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
             } else {
                 emit_cmp32_0(dyn, ninst, xEAX, x3, x12);
             }
+            NATFLAGS(NF_SUB);
             break;
         case 0x3E:
             INST_NAME("DS:");
@@ -691,17 +700,17 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
             i8 = F8S;   \
             BARRIER(2); \
             JUMP(addr+i8);\
-            GETFLAGS;   \
+            GETCOND(GETFLAGS, NO, YES); \
             if(dyn->insts) {    \
                 if(dyn->insts[ninst].x86.jmp_insts==-1) {   \
                     /* out of the block */                  \
                     i32 = dyn->insts[ninst+1].address-(dyn->arm_size+8); \
-                    Bcond(NO, i32);     \
+                    Bcond(cno, i32);    \
                     jump_to_linker(dyn, addr+i8, 0, ninst); \
                 } else {    \
                     /* inside the block */  \
                     i32 = dyn->insts[dyn->insts[ninst].x86.jmp_insts].address-(dyn->arm_size+8);    \
-                    Bcond(YES, i32);    \
+                    Bcond(cyes, i32);   \
                 }   \
             }
 
@@ -974,6 +983,7 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
                             emit_cmp32_0(dyn, ninst, ed, x3, x12);
                         }
                     }
+                    NATFLAGS(NF_SUB);
                     break;
             }
             break;
@@ -992,6 +1002,7 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
             GETGD;
             GETEDH(x1);
             emit_test32(dyn, ninst, ed, gd, x3, x12);
+            NATFLAGS(NF_LOGIC);
             break;
         case 0x86:
             INST_NAME("(LOCK)XCHG Eb, Gb");
@@ -1202,15 +1213,17 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
         case 0x9C:
             INST_NAME("PUSHF");
             READFLAGS(X_ALL);
-            CALL(PackFlags, -1, 0);
-            LDR_IMM9(x1, xEmu, offsetof(x86emu_t, packed_eflags.x32));
+            pack_flags(dyn, ninst, x1, x2);
             PUSH(xESP, (1<<x1));
             break;
         case 0x9D:
             INST_NAME("POPF");
             SETFLAGS(X_ALL, SF_SET);
             POP(xESP, (1<<x1));
-            CALL(arm_popf, -1, 0);
+            MOV32(x2, 0x3F7FD7);
+            AND_REG_LSL_IMM5(x1, x1, x2, 0);
+            ORR_IMM8(x1, x1, 2, 0);   // mask off res2 and res3 and on res1
+            unpack_flags(dyn, ninst, x1, x2);
             MOVW(x1, d_none);
             STR_IMM9(x1, xEmu, offsetof(x86emu_t, df));
             break;
@@ -1313,6 +1326,7 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
             i32 = F32S;
             MOV32(x2, i32);
             emit_test32(dyn, ninst, xEAX, x2, x3, x12);
+            NATFLAGS(NF_LOGIC);
             break;
         case 0xAA:
             INST_NAME("STOSB");
@@ -2053,32 +2067,78 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
                 printf_log(LOG_NONE, "Warning, jump to 0x0 at %p (%p)\n", (void*)addr, (void*)(addr-1));
                 #endif
             }
-            if(isNativeCall(dyn, addr+i32, &natcall, &retn)) {
+            if(isNativeCall(dyn, addr+i32, &natcall, &retn, &slotreg, &slot)) {
+                dyn->nocache = 1;   // bridge address is not the same from one run to another
                 BARRIER(1);
                 BARRIER_NEXT(1);
-                MOV32(x2, addr);
-                PUSH(xESP, 1<<x2);
-                MESSAGE(LOG_DUMP, "Native Call to %s (retn=%d)\n", GetNativeName(GetNativeFnc(natcall-1)), retn);
-                // calling a native function
-                MOV32(x12, natcall); // read the 0xCC
-                STM(xEmu, (1<<4)|(1<<5)|(1<<6)|(1<<7)|(1<<8)|(1<<9)|(1<<10)|(1<<11)|(1<<12));
-                CALL_(x86Int3, -1, 0);
-                LDM(xEmu, (1<<4)|(1<<5)|(1<<6)|(1<<7)|(1<<8)|(1<<9)|(1<<10)|(1<<11)|(1<<12));
-                MOV32(x3, natcall+2+4+4);
-                CMPS_REG_LSL_IMM5(xEIP, x3, 0);
-                B_MARK(cNE);    // Not the expected address, exit dynarec block
-                POP(xESP, (1<<xEIP));   // pop the return address
-                if(retn) {
-                    ADD_IMM8(xESP, xESP, retn);
+                onebridge_t* bridge = (onebridge_t*)(natcall-1);
+                if(slotreg>=0) {
+                    // call to a PLT entry: check the GOT slot still goes to the bridge (it can be changed by lazy binding or dlopen)
+                    MOV32(x3, slot);
+                    if(slotreg) {
+                        LDR_REG_LSL_IMM5(x3, slotreg, x3, 0);
+                    } else {
+                        LDR_IMM9(x3, x3, 0);
+                    }
+                    MOV32(x2, natcall-1);
+                    CMPS_REG_LSL_IMM5(x3, x2, 0);
+                    B_MARK2(cNE);
+                }
+                // without trace of the calls, the wrapper (or even the native function) can be called directly
+                const char* sig = (box86_log<LOG_DEBUG)?GetDirectSignature((void*)bridge->w):NULL;
+                if(sig) {
+                    MESSAGE(LOG_DUMP, "Direct Native Call to %s (%s, retn=%d)\n", GetNativeName(GetNativeFnc(natcall-1)), sig, retn);
+                    call_direct(dyn, ninst, bridge->f, sig);
+                    if(retn) {
+                        ADD_IMM8(xESP, xESP, retn);
+                    }
+                    MOVW(x1, d_none);
+                    STR_IMM9(x1, xEmu, offsetof(x86emu_t, df));
+                    if(slotreg>=0) {
+                        B_NEXT(c__);
+                    }
+                } else {
+                    MOV32(x2, addr);
+                    PUSH(xESP, 1<<x2);
+                    MESSAGE(LOG_DUMP, "Native Call to %s (retn=%d)\n", GetNativeName(GetNativeFnc(natcall-1)), retn);
+                    // calling a native function
+                    if(box86_log<LOG_DEBUG) {
+                        // the wrapper, as x86Int3 would do
+                        MOV32(x12, natcall+2+4+4);
+                        STM(xEmu, (1<<4)|(1<<5)|(1<<6)|(1<<7)|(1<<8)|(1<<9)|(1<<10)|(1<<11)|(1<<12));
+                        MOVW(x1, d_none);
+                        STR_IMM9(x1, xEmu, offsetof(x86emu_t, df));
+                        MOV32(x1, bridge->f);
+                        CALL_(bridge->w, -1, 0);
+                    } else {
+                        MOV32(x12, natcall); // read the 0xCC
+                        STM(xEmu, (1<<4)|(1<<5)|(1<<6)|(1<<7)|(1<<8)|(1<<9)|(1<<10)|(1<<11)|(1<<12));
+                        CALL_(x86Int3, -1, 0);
+                    }
+                    LDM(xEmu, (1<<4)|(1<<5)|(1<<6)|(1<<7)|(1<<8)|(1<<9)|(1<<10)|(1<<11)|(1<<12));
+                    MOV32(x3, natcall+2+4+4);
+                    CMPS_REG_LSL_IMM5(xEIP, x3, 0);
+                    B_MARK(cNE);    // Not the expected address, exit dynarec block
+                    POP(xESP, (1<<xEIP));   // pop the return address
+                    if(retn) {
+                        ADD_IMM8(xESP, xESP, retn);
+                    }
+                    MOV32(x3, addr);
+                    CMPS_REG_LSL_IMM5(xEIP, x3, 0);
+                    B_MARK(cNE);    // Not the expected address again
+                    LDR_IMM9(x1, xEmu, offsetof(x86emu_t, quit));
+                    CMPS_IMM8(x1, 1);
+                    B_NEXT(cNE);    // not quitting, so lets continue
+                    MARK;
+                    jump_to_epilog(dyn, 0, xEIP, ninst);
+                }
+                if(slotreg>=0) {
+                    MARK2;
+                    // the GOT slot changed: regular call to the PLT entry
+                    MOV32(x2, addr);
+                    PUSH(xESP, 1<<x2);
+                    jump_to_epilog(dyn, addr+i32, 0, ninst);
                 }
-                MOV32(x3, addr);
-                CMPS_REG_LSL_IMM5(xEIP, x3, 0);
-                B_MARK(cNE);    // Not the expected address again
-                LDR_IMM9(x1, xEmu, offsetof(x86emu_t, quit));
-                CMPS_IMM8(x1, 1);
-                B_NEXT(cNE);    // not quitting, so lets continue
-                MARK;
-                jump_to_epilog(dyn, 0, xEIP, ninst);
             } else if ((i32==0) && ((PK(0)>=0x58) && (PK(0)<=0x5F))) {
                 MESSAGE(LOG_DUMP, "Hack for Call 0, Pop reg\n");
                 u8 = F8;
@@ -2108,7 +2168,6 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
             break;
         case 0xE9:
         case 0xEB:
-            BARRIER(1);
             if(opcode==0xE9) {
                 INST_NAME("JMP Id");
                 i32 = F32S;
@@ -2117,6 +2176,15 @@ uintptr_t dynarec00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
                 i32 = F8S;
             }
             JUMP(addr+i32);
+            if(dyn->tier>1 && i32>0 && i32<SUPERBLOCK_MAXSKIP && dyn->traced<SUPERBLOCK_MAXJMP) {
+                // superblock: follow the jump, translation continue at destination with the same state
+                if(dyn->insts)
+                    dyn->insts[ninst].x86.trace = 1;
+                ++dyn->traced;
+                addr += i32;
+                break;
+            }
+            BARRIER(1);
             if(dyn->insts) {
                 if(dyn->insts[ninst].x86.jmp_insts==-1) {
                     // out of the block
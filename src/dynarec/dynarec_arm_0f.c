@@ -55,6 +55,7 @@ uintptr_t dynarec0F(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
     uint8_t opcode = F8;
     uint8_t nextop, u8;
     int32_t i32, i32_, j32;
+    int cno, cyes;
     uint8_t gd, ed;
     uint8_t wback, wb1, wb2;
     uint8_t eb1, eb2;
@@ -66,6 +67,8 @@ uintptr_t dynarec0F(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
     int fixedaddress;
     int parity;
     MAYUSE(s0);
+    MAYUSE(cno);
+    MAYUSE(cyes);
     MAYUSE(q1);
     MAYUSE(v2);
     MAYUSE(gb2);
@@ -432,15 +435,15 @@ uintptr_t dynarec0F(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
         
         #define GO(GETFLAGS, NO, YES, F)    \
             READFLAGS(F);                   \
-            GETFLAGS;   \
+            GETCOND(GETFLAGS, NO, YES); \
             nextop=F8;  \
             GETGD;      \
             if((nextop&0xC0)==0xC0) {   \
                 ed = xEAX+(nextop&7);   \
-                MOV_REG_COND(YES, gd, ed); \
+                MOV_REG_COND(cyes, gd, ed); \
             } else { \
                 addr = geted(dyn, addr, ninst, nextop, &ed, x2, &fixedaddress, 4095, 0);    \
-                LDR_IMM9_COND(YES, gd, ed, fixedaddress); \
+                LDR_IMM9_COND(cyes, gd, ed, fixedaddress); \
             }
 
         case 0x40:
@@ -1146,17 +1149,17 @@ uintptr_t dynarec0F(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
             i32_ = F32S;    \
             BARRIER(2);     \
             JUMP(addr+i32_);\
-            GETFLAGS;   \
+            GETCOND(GETFLAGS, NO, YES); \
             if(dyn->insts) {    \
                 if(dyn->insts[ninst].x86.jmp_insts==-1) {   \
                     /* out of the block */                  \
                     i32 = dyn->insts[ninst+1].address-(dyn->arm_size+8); \
-                    Bcond(NO, i32);     \
+                    Bcond(cno, i32);    \
                     jump_to_linker(dyn, addr+i32_, 0, ninst); \
                 } else {    \
                     /* inside the block */  \
                     i32 = dyn->insts[dyn->insts[ninst].x86.jmp_insts].address-(dyn->arm_size+8);    \
-                    Bcond(YES, i32);    \
+                    Bcond(cyes, i32);   \
                 }   \
             }
 
@@ -1269,10 +1272,10 @@ uintptr_t dynarec0F(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
         #undef GO
         #define GO(GETFLAGS, NO, YES, F)    \
             READFLAGS(F);                   \
-            GETFLAGS;   \
+            GETCOND(GETFLAGS, NO, YES); \
             nextop=F8;  \
-            MOVW_COND(NO, x3, 0); \
-            MOVW_COND(YES, x3, 1);  \
+            MOVW_COND(cno, x3, 0); \
+            MOVW_COND(cyes, x3, 1);  \
             if((nextop&0xC0)==0xC0) { \
                 ed = (nextop&7);    \
                 eb1 = xEAX+(ed&3);  \
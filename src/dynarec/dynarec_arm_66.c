@@ -560,15 +560,19 @@ uintptr_t dynarec66(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst,
         case 0x9C:
             INST_NAME("PUSHF (16b)");
             READFLAGS(X_ALL);
-            CALL(PackFlags, -1, 0);
-            LDR_IMM9(x1, xEmu, offsetof(x86emu_t, packed_eflags.x32));
+            pack_flags(dyn, ninst, x1, x2);
             STRHB_IMM8(x1, xESP, -2);
             break;
         case 0x9D:
             INST_NAME("POPF (16b)");
             SETFLAGS(X_ALL, SF_SET);    // lower 16bits is all flags handled in dynarec
             LDRHA_IMM8(x1, xESP, 2);
-            CALL(arm_popf16, -1, 0);
+            MOVW(x2, 0x7FD7);
+            AND_REG_LSL_IMM5(x1, x1, x2, 0);
+            ORR_IMM8(x1, x1, 2, 0);   // mask off res2 and res3 and on res1
+            LDR_IMM9(x2, xEmu, offsetof(x86emu_t, packed_eflags.x32));
+            BFI(x2, x1, 0, 16);
+            unpack_flags(dyn, ninst, x2, x1);
             MOVW(x1, d_none);
             STR_IMM9(x1, xEmu, offsetof(x86emu_t, df));
             break;
@@ -24,20 +24,89 @@
 #include "dynarec_arm.h"
 #include "dynarec_arm_private.h"
 #include "dynarec_arm_functions.h"
+#include "wrapper.h"
+#include "khash.h"
 
-void arm_popf(x86emu_t* emu, uint32_t f)
+KHASH_MAP_INIT_INT(directw, const char*)
+
+// wrappers that only forward their arguments from the x86 stack, with up to 4 integer and 4 float arguments,
+// and returning nothing or an integer: the native function can be called directly from a block
+#define GO(A) {A, #A},
+static const struct {
+    wrapper_t   w;
+    const char* sig;
+} directwrappers[] = {
+    GO(vFv) GO(vFi) GO(vFu) GO(vFL) GO(vFp) GO(iFv) GO(iFi) GO(iFu) GO(iFL) GO(iFp) GO(uFv) GO(uFi)
+    GO(uFu) GO(uFp) GO(LFv) GO(LFu) GO(LFp) GO(pFv) GO(pFi) GO(pFu) GO(pFL) GO(pFp) GO(vFii)
+    GO(vFiu) GO(vFip) GO(vFui) GO(vFuu) GO(vFup) GO(vFLp) GO(vFpi) GO(vFpu) GO(vFpL) GO(vFpp)
+    GO(iFii) GO(iFiu) GO(iFip) GO(iFui) GO(iFuu) GO(iFup) GO(iFLi) GO(iFLp) GO(iFpi) GO(iFpu)
+    GO(iFpL) GO(iFpp) GO(uFiu) GO(uFui) GO(uFuu) GO(uFup) GO(uFpi) GO(uFpu) GO(uFpL) GO(uFpp)
+    GO(LFii) GO(LFLp) GO(LFpL) GO(LFpp) GO(pFii) GO(pFiu) GO(pFiL) GO(pFip) GO(pFui) GO(pFuu)
+    GO(pFup) GO(pFLL) GO(pFLp) GO(pFpi) GO(pFpu) GO(pFpL) GO(pFpp) GO(vFiii) GO(vFiip) GO(vFiui)
+    GO(vFiuu) GO(vFiup) GO(vFipi) GO(vFipu) GO(vFipp) GO(vFuii) GO(vFuiu) GO(vFuip) GO(vFuui)
+    GO(vFuuu) GO(vFuup) GO(vFupi) GO(vFupu) GO(vFupp) GO(vFLpL) GO(vFpii) GO(vFpiu) GO(vFpip)
+    GO(vFpui) GO(vFpuu) GO(vFpup) GO(vFpLi) GO(vFpLL) GO(vFpLp) GO(vFppi) GO(vFppu) GO(vFppL)
+    GO(vFppp) GO(iFiii) GO(iFiiu) GO(iFiiL) GO(iFiip) GO(iFiuu) GO(iFiup) GO(iFipi) GO(iFipu)
+    GO(iFipp) GO(iFuii) GO(iFuip) GO(iFuui) GO(iFuuu) GO(iFuup) GO(iFupp) GO(iFpii) GO(iFpiu)
+    GO(iFpiL) GO(iFpip) GO(iFpui) GO(iFpuu) GO(iFpuL) GO(iFpup) GO(iFpLi) GO(iFpLL) GO(iFpLp)
+    GO(iFppi) GO(iFppu) GO(iFppL) GO(iFppp) GO(uFipu) GO(uFuip) GO(uFuui) GO(uFuuu) GO(uFuup)
+    GO(uFupi) GO(uFupu) GO(uFupp) GO(uFpii) GO(uFpiu) GO(uFpip) GO(uFpui) GO(uFpuu) GO(uFpup)
+    GO(uFpLp) GO(uFppi) GO(uFppu) GO(uFppp) GO(LFpii) GO(LFpLi) GO(LFpLp) GO(LFppi) GO(pFiii)
+    GO(pFiiu) GO(pFiip) GO(pFiup) GO(pFipi) GO(pFipu) GO(pFipp) GO(pFuii) GO(pFuui) GO(pFuuu)
+    GO(pFupi) GO(pFupu) GO(pFpii) GO(pFpiu) GO(pFpiL) GO(pFpip) GO(pFpui) GO(pFpuu) GO(pFpup)
+    GO(pFpLL) GO(pFpLp) GO(pFppi) GO(pFppu) GO(pFppL) GO(pFppp) GO(vFiiii) GO(vFiiip) GO(vFiipp)
+    GO(vFiuip) GO(vFiuuu) GO(vFiupu) GO(vFipii) GO(vFipup) GO(vFippp) GO(vFuiii) GO(vFuiip)
+    GO(vFuiui) GO(vFuiuu) GO(vFuiup) GO(vFuipi) GO(vFuipu) GO(vFuipp) GO(vFuuii) GO(vFuuiu)
+    GO(vFuuip) GO(vFuuui) GO(vFuuuu) GO(vFuuup) GO(vFuupi) GO(vFuupp) GO(vFupii) GO(vFuppi)
+    GO(vFpiii) GO(vFpiiu) GO(vFpiip) GO(vFpiuu) GO(vFpiup) GO(vFpipi) GO(vFpipu) GO(vFpipp)
+    GO(vFpuip) GO(vFpuui) GO(vFpuuu) GO(vFpuup) GO(vFpupp) GO(vFpLLL) GO(vFppii) GO(vFppiu)
+    GO(vFppiL) GO(vFppip) GO(vFppui) GO(vFppuu) GO(vFppup) GO(vFpppi) GO(vFpppu) GO(vFpppL)
+    GO(vFpppp) GO(iFiiii) GO(iFiiiu) GO(iFiiip) GO(iFiiLi) GO(iFiipi) GO(iFiipu) GO(iFiipp)
+    GO(iFiuii) GO(iFiuui) GO(iFiupp) GO(iFipii) GO(iFipip) GO(iFipui) GO(iFipup) GO(iFipLi)
+    GO(iFippi) GO(iFippu) GO(iFippp) GO(iFuipu) GO(iFuipp) GO(iFupup) GO(iFuppi) GO(iFuppp)
+    GO(iFpiii) GO(iFpiiu) GO(iFpiiL) GO(iFpiip) GO(iFpiuu) GO(iFpiup) GO(iFpipi) GO(iFpipp)
+    GO(iFpuii) GO(iFpuiu) GO(iFpuiL) GO(iFpuip) GO(iFpuui) GO(iFpuuu) GO(iFpuup) GO(iFpuLp)
+    GO(iFpupi) GO(iFpupu) GO(iFpupp) GO(iFpLpi) GO(iFppii) GO(iFppiu) GO(iFppip) GO(iFppui)
+    GO(iFppuu) GO(iFppup) GO(iFppLi) GO(iFppLL) GO(iFppLp) GO(iFpppi) GO(iFpppu) GO(iFpppL)
+    GO(iFpppp) GO(uFippu) GO(uFuuuu) GO(uFpipp) GO(uFpuip) GO(uFpuuu) GO(uFpuup) GO(uFpupp)
+    GO(uFppiu) GO(uFppip) GO(uFppup) GO(uFpppi) GO(uFpppp) GO(LFippp) GO(LFpLLp) GO(LFpLpp)
+    GO(LFppii) GO(LFppip) GO(LFpppi) GO(LFpppp) GO(pFiiii) GO(pFiiiu) GO(pFiiuu) GO(pFiiup)
+    GO(pFiipi) GO(pFipii) GO(pFipip) GO(pFippu) GO(pFuiii) GO(pFpiii) GO(pFpiip) GO(pFpiuu)
+    GO(pFpipp) GO(pFpuii) GO(pFpuip) GO(pFpuuu) GO(pFpupi) GO(pFpupu) GO(pFpLip) GO(pFppii)
+    GO(pFppiu) GO(pFppiL) GO(pFppip) GO(pFppuu) GO(pFppup) GO(pFpppi) GO(pFpppu) GO(pFpppL)
+    GO(pFpppp)
+#ifdef __ARM_PCS_VFP
+    GO(vFf) GO(iFf) GO(vFif) GO(vFuf) GO(vFfi) GO(vFff) GO(vFfp) GO(vFpf) GO(iFpf) GO(vFiff)
+    GO(vFuif) GO(vFuuf) GO(vFuff) GO(vFfff) GO(vFfpp) GO(vFpif) GO(vFpff) GO(iFuff) GO(iFfff)
+    GO(iFpfu) GO(iFpff) GO(pFppf) GO(vFifff) GO(vFuifi) GO(vFuiff) GO(vFuuuf) GO(vFufff) GO(vFffff)
+    GO(vFpifi) GO(vFppfi) GO(iFuuff) GO(uFifff) GO(pFffff) GO(vFiffff) GO(vFuifff) GO(vFuffff)
+    GO(vFpiiff) GO(vFpffff) GO(vFppiff) GO(vFiffiff) GO(vFuiffff) GO(vFuuuuff) GO(vFuuffff)
+    GO(vFuffiip) GO(vFpppiff) GO(vFiiffffp) GO(vFuipffff) GO(vFuuuufff) GO(vFuuuffff) GO(pFifffppp)
+    GO(pFpppfffi)
+#endif
+};
+#undef GO
+
+static kh_directw_t*    directw = NULL;
+static pthread_once_t   directw_once = PTHREAD_ONCE_INIT;
+
+static void directw_init()
 {
-    emu->packed_eflags.x32 = (f & 0x3F7FD7) | 0x2; // mask off res2 and res3 and on res1
-    UnpackFlags(emu);
-    RESET_FLAGS(emu);
+    directw = kh_init(directw);
+    int ret;
+    for(int i=0; i<sizeof(directwrappers)/sizeof(directwrappers[0]); ++i) {
+        khint_t k = kh_put(directw, directw, (uintptr_t)directwrappers[i].w, &ret);
+        kh_value(directw, k) = directwrappers[i].sig;
+    }
 }
 
-void arm_popf16(x86emu_t* emu, uint32_t f)
+const char* GetDirectSignature(void* w)
 {
-    emu->packed_eflags.x32 &= 0xffff0000;
-    emu->packed_eflags.x32 |= (f & 0x7FD7) | 0x2; // mask off res2 and res3 and on res1
-    UnpackFlags(emu);
-    RESET_FLAGS(emu);
+    pthread_once(&directw_once, directw_init);
+    khint_t k = kh_get(directw, directw, (uintptr_t)w);
+    if(k==kh_end(directw))
+        return NULL;
+    return kh_value(directw, k);
 }
 
 void arm_fstp(x86emu_t* emu, void* p)
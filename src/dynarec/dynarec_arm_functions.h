@@ -3,8 +3,6 @@
 
 typedef struct x86emu_s x86emu_t;
 
-void arm_popf(x86emu_t* emu, uint32_t f);
-void arm_popf16(x86emu_t* emu, uint32_t f);
 void arm_fstp(x86emu_t* emu, void* p);
 
 void arm_print_armreg(x86emu_t* emu, uintptr_t reg, uintptr_t n);
@@ -34,6 +32,9 @@ void arm_fprem1(x86emu_t* emu);
 
 void arm_ud(x86emu_t* emu);
 
+// signature of the wrapper if the native function can be called directly from a block (like "iFpp"), NULL if not
+const char* GetDirectSignature(void* w);
+
 // Get an FPU single scratch reg
 int fpu_get_scratch_single(dynarec_arm_t* dyn);
 // Get an FPU double scratch reg
@@ -15,6 +15,8 @@
 #include "callback.h"
 #include "emu/x86run_private.h"
 #include "x86trace.h"
+#include "elfloader.h"
+#include "dynablock.h"
 #include "dynarec_arm.h"
 #include "dynarec_arm_private.h"
 #include "arm_printer.h"
@@ -282,29 +284,50 @@ void jump_to_linker(dynarec_arm_t* dyn, uintptr_t ip, int reg, int ninst)
         } else {
             MOV32_(xEIP, ip);
         }
+        int ways = ip?1:IC_WAYS;
         uintptr_t* table = 0;
         if(dyn->tablesz) {
             table = &dyn->table[dyn->tablei];
-            table[0] = (uintptr_t)arm_linker;
-            table[1] = ip;
+            for(int i=0; i<ways; ++i) {
+                table[i*4+0] = (uintptr_t)arm_linker;
+                table[i*4+1] = ip;
+            }
         }
-        dyn->tablei+=4; // smart linker or not, we keep table correctly alligned for LDREXD/STREXD access
-        MOV32_(x1, (uintptr_t)table);
-        // TODO: This is not thread safe.
-        if(!ip) {   // no IP, jump address in a reg, so need smart linker
-            MARK;
-            LDREXD(x2, x1); // load dest address in x2 and planned ip in x3
-            CMPS_REG_LSL_IMM5(xEIP, x3, 0);
-            BXcond(cEQ, x2);
-            MOV32_(x2, (uintptr_t)arm_linker);
-            MOV_REG(x3, x12);
-            STREXD(x12, x2, x1); // nope, putting back linker & IP in place
-            // x12 now contain success / falure for write
-            CMPS_IMM8(x12, 1);
-            MOV_REG(x12, x3);   // put back IP in place...
-            B_MARK(cEQ);
-            BX(x2); // go to linker
+        int tablei = dyn->tablei;
+        MAYUSE(tablei);
+        dyn->tablei+=4*ways; // smart linker or not, we keep table correctly alligned for LDREXD/STREXD access
+        if(!ip) {   // no IP, jump address in a reg: inline cache
+            uintptr_t site = 0; // hits and misses counters of the site, when profiling
+            if(dyn->profile) {
+                PASS3(site = (uintptr_t)ProfileICSite(dyn->insts[ninst].x86.addr));
+                MOV32_(x2, site);
+                LDR_IMM9(x3, x2, 0);
+                ADD_IMM8(x3, x3, 1);
+                STR_IMM9(x3, x2, 0);
+            }
+            PASS3(add_reloc(dyn, RELOC_TABLE, tablei));
+            MOV32_(x1, (uintptr_t)table);
+            for(int i=0; i<ways; ++i) {
+                if(i) {
+                    ADD_IMM8(x1, x1, 4*sizeof(uintptr_t));
+                }
+                LDREXD(x2, x1); // load dest address in x2 and planned ip in x3
+                CMPS_REG_LSL_IMM5(xEIP, x3, 0);
+                BXcond(cEQ, x2);    // can be the arm_linker, if the block has been unlinked: x1 is the slot to update
+            }
+            // miss of all the ways
+            if(dyn->profile) {
+                MOV32_(x2, site);
+                LDR_IMM9(x3, x2, 4);
+                ADD_IMM8(x3, x3, 1);
+                STR_IMM9(x3, x2, 4);
+            }
+            SUB_IMM8(x1, x1, 4*sizeof(uintptr_t)*(ways-1));
+            MOV32_(x2, (uintptr_t)arm_linker_ic);
+            BX(x2);
         } else {
+            PASS3(add_reloc(dyn, RELOC_TABLE, tablei));
+            MOV32_(x1, (uintptr_t)table);
             LDR_IMM9(x2, x1, 0);
             BX(x2); // jump
         }
@@ -414,7 +437,10 @@ void iret_to_epilog(dynarec_arm_t* dyn, int ninst)
     STR_IMM9(x1, xEmu, offsetof(x86emu_t, segs_clean[_CS]));
     // POP EFLAGS
     POP(xESP, (1<<x1));
-    CALL(arm_popf, -1, (1<<xEIP));
+    MOV32(x2, 0x3F7FD7);
+    AND_REG_LSL_IMM5(x1, x1, x2, 0);
+    ORR_IMM8(x1, x1, 2, 0);   // mask off res2 and res3 and on res1
+    unpack_flags(dyn, ninst, x1, x2);
     MOVW(x1, d_none);
     STR_IMM9(x1, xEmu, offsetof(x86emu_t, df));
     // Ret....
@@ -471,13 +497,24 @@ void grab_fsdata(dynarec_arm_t* dyn, uintptr_t addr, int ninst, int reg)
     MESSAGE(LOG_DUMP, "----FS: Offset\n");
 }
 
-int isNativeCall(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t* calladdress, int* retn)
+int isNativeCall(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t* calladdress, int* retn, int* slotreg, uintptr_t* slot)
 {
+    if(slotreg) *slotreg = -1;
     if(!addr)
         return 0;
     if(PK(0)==0xff && PK(1)==0x25) {  // absolute jump, maybe the GOT
         uintptr_t a1 = (PK32(2));   // need to add a check to see if the address is from the GOT !
+        if(slotreg) *slotreg = 0;
+        if(slot) *slot = a1;
         addr = *(uint32_t*)a1; 
+    } else if(PK(0)==0xff && PK(1)==0xa3) { // jmp [ebx+disp32], PLT of PIC code: ebx is the GOT of the elf
+        elfheader_t* h = FindElfAddress(my_context, addr);
+        uintptr_t got = h?GetElfGOT(h):0;
+        if(!got)
+            return 0;
+        if(slotreg) *slotreg = xEBX;
+        if(slot) *slot = PK32(2);
+        addr = *(uint32_t*)(got+(int32_t)PK32(2));
     }
     if(addr<0x10000)    // too low, that is suspicious
         return 0;
@@ -491,6 +528,38 @@ int isNativeCall(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t* calladdress, int
     return 0;
 }
 
+// call directly the native function fnc of a bridge from a block, the wrapper having the signature sig (see GetDirectSignature)
+// the arguments are loaded from the x86 stack, the CALL itself is not done (so no return address)
+void call_direct(dynarec_arm_t* dyn, int ninst, uintptr_t fnc, const char* sig)
+{
+    MESSAGE(LOG_DUMP, "Direct call %s-----\n", sig);
+    // x86 regs in emu, in case the function use a callback. EBX..EDI are in callee saved regs
+    STM(xEmu, (1<<4)|(1<<5)|(1<<6)|(1<<7)|(1<<8)|(1<<9)|(1<<10)|(1<<11)|(1<<12));
+    PUSH(xSP, (1<<xEmu)|(1<<x12));  // keep the stack 8 bytes aligned
+    fpu_pushcache(dyn, ninst, x3);
+    int ni = 0, nf = 0;
+    for(int i=2, off=0; sig[i] && sig[i]!='v'; ++i, off+=4) {
+        if(sig[i]=='f') {
+            VLDR_32(nf, xESP, off);
+            ++nf;
+        } else {
+            LDR_IMM9(ni, xESP, off);
+            ++ni;
+        }
+    }
+    MOV32(x12, fnc);
+    BLX(x12);
+    if(sig[0]!='v') {
+        MOV_REG(x1, 0);
+    }
+    fpu_popcache(dyn, ninst, x3);
+    POP(xSP, (1<<xEmu)|(1<<x12));
+    if(sig[0]!='v') {
+        MOV_REG(xEAX, x1);
+    }
+    MESSAGE(LOG_DUMP, "-----Direct call %s\n", sig);
+}
+
 // x87 stuffs
 static void x87_reset(dynarec_arm_t* dyn, int ninst)
 {
@@ -1217,6 +1286,7 @@ void cstack_push(dynarec_arm_t* dyn, int ninst, uintptr_t x86ip, uintptr_t armip
     STR_IMM9(s2, xEmu, offsetof(x86emu_t, cstacki));
     // push the pair of address
     MOV32(s2, x86ip);
+    PASS3(if(x86ip) add_reloc(dyn, RELOC_ARM, armip-dyn->arm_start));
     MOV32_(s2+1, armip);
     STRD_REG(s2, xEmu, s1);
     MESSAGE(LOG_DUMP, "--------------CStack PUSH\n");
@@ -1226,6 +1296,12 @@ void cstack_push(dynarec_arm_t* dyn, int ninst, uintptr_t x86ip, uintptr_t armip
 void cstack_pop(dynarec_arm_t* dyn, int ninst, int s0, int s1, int s2)
 {
     MESSAGE(LOG_DUMP, "CStack POP----------------\n");
+    if(dyn->profile) {
+        MOV32(s1, (uintptr_t)&cstack_stats[0]);
+        LDR_IMM9(s2, s1, 0);
+        ADD_IMM8(s2, s2, 1);
+        STR_IMM9(s2, s1, 0);
+    }
     // load current indice
     LDR_IMM9(s1, xEmu, offsetof(x86emu_t, cstacki));
     // decrement (mod mask) and save back index
@@ -1241,5 +1317,39 @@ void cstack_pop(dynarec_arm_t* dyn, int ninst, int s0, int s1, int s2)
     LDRD_REG(s2, xEmu, s1);
     CMPS_REG_LSL_IMM5(s0, s2, 0);
     BXcond(cEQ, s2+1);
+    if(dyn->profile) {
+        // missed, the caller will go through the epilog
+        MOV32(s1, (uintptr_t)&cstack_stats[1]);
+        LDR_IMM9(s2, s1, 0);
+        ADD_IMM8(s2, s2, 1);
+        STR_IMM9(s2, s1, 0);
+    }
     MESSAGE(LOG_DUMP, "----------------CStack POP\n");
-}
\ No newline at end of file
+}
+
+void pack_flags(dynarec_arm_t* dyn, int ninst, int s1, int s2)
+{
+    MESSAGE(LOG_DUMP, "Pack Flags----------------\n");
+    MOVW(s1, 1<<F_res1);
+    for(int i=F_CF; i<F_LAST; ++i) {
+        if(i==F_res1 || i==F_res2 || i==F_res3 || i==F_IOPL+1 || i==F_dummy)
+            continue;   // constant or not used
+        LDR_IMM9(s2, xEmu, offsetof(x86emu_t, flags[i]));
+        ORR_REG_LSL_IMM5(s1, s1, s2, i);
+    }
+    STR_IMM9(s1, xEmu, offsetof(x86emu_t, packed_eflags.x32));
+    MESSAGE(LOG_DUMP, "----------------Pack Flags\n");
+}
+
+void unpack_flags(dynarec_arm_t* dyn, int ninst, int s1, int s2)
+{
+    MESSAGE(LOG_DUMP, "Unpack Flags----------------\n");
+    STR_IMM9(s1, xEmu, offsetof(x86emu_t, packed_eflags.x32));
+    for(int i=F_CF; i<F_LAST; ++i) {
+        if(i==F_IOPL+1)
+            continue;   // IOPL is 2 bits
+        UBFX(s2, s1, i, (i==F_IOPL)?2:1);
+        STR_IMM9(s2, xEmu, offsetof(x86emu_t, flags[i]));
+    }
+    MESSAGE(LOG_DUMP, "----------------Unpack Flags\n");
+}
@@ -188,6 +188,8 @@
 #define GETMARKSEG ((dyn->insts)?dyn->insts[ninst].markseg:(dyn->arm_size+4))
 #define MARKLOCK if(dyn->insts) {dyn->insts[ninst].marklock = (uintptr_t)dyn->arm_size;}
 #define GETMARKLOCK ((dyn->insts)?dyn->insts[ninst].marklock:(dyn->arm_size+4))
+#define MARKTIER if(dyn->insts) {dyn->insts[ninst].marktier = (uintptr_t)dyn->arm_size;}
+#define GETMARKTIER ((dyn->insts)?dyn->insts[ninst].marktier:(dyn->arm_size+4))
 
 // Branch to MARK if cond (use j32)
 #define B_MARK(cond)    \
@@ -213,6 +215,10 @@
 #define B_MARKLOCK(cond)    \
     j32 = GETMARKLOCK-(dyn->arm_size+8);   \
     Bcond(cond, j32)
+// Branch to MARKTIER if cond (use j32)
+#define B_MARKTIER(cond)    \
+    j32 = GETMARKTIER-(dyn->arm_size+8);   \
+    Bcond(cond, j32)
 
 #define IFX(A)  if(dyn->insts && (dyn->insts[ninst].x86.need_flags&(A)))
 #define IFXX(A) if(dyn->insts && (dyn->insts[ninst].x86.need_flags==(A)))
@@ -294,6 +300,24 @@
 #ifndef BARRIER_NEXT
 #define BARRIER_NEXT(A)
 #endif
+#ifndef NATFLAGS
+#define NATFLAGS(A)
+#endif
+#ifndef NATCOND
+#define NATCOND(A)
+#endif
+// get the ARM conditions cno/cyes of a conditionnal opcode (x86 condition in the low nibble)
+// directly from the ARM flags left by the cmp/test just before if possible, or else using GETFLAGS
+#define GETCOND(GETFLAGS, NO, YES)                      \
+    NATCOND(opcode&0x0f);                               \
+    if(dyn->insts && dyn->insts[ninst].x86.usenat) {    \
+        cyes = native_cond(dyn->insts[ninst-1].x86.natflags, opcode&0x0f); \
+        cno = cyes^(1<<28);                             \
+    } else {                                            \
+        GETFLAGS;                                       \
+        cno = NO;                                       \
+        cyes = YES;                                     \
+    }
 #define UFLAG_OP1(A) if(dyn->insts && dyn->insts[ninst].x86.need_flags) {STR_IMM9(A, 0, offsetof(x86emu_t, op1));}
 #define UFLAG_OP2(A) if(dyn->insts && dyn->insts[ninst].x86.need_flags) {STR_IMM9(A, 0, offsetof(x86emu_t, op2));}
 #define UFLAG_OP12(A1, A2) if(dyn->insts && dyn->insts[ninst].x86.need_flags) {STR_IMM9(A1, 0, offsetof(x86emu_t, op1));STR_IMM9(A2, 0, offsetof(x86emu_t, op2));}
@@ -309,6 +333,7 @@
 
 void arm_epilog();
 void* arm_linker(x86emu_t* emu, void** table, uintptr_t addr);
+void* arm_linker_ic(x86emu_t* emu, void** table, uintptr_t addr);
 
 #ifndef STEPNAME
 #define STEPNAME3(N,M) N##M
@@ -349,6 +374,7 @@ void* arm_linker(x86emu_t* emu, void** table, uintptr_t addr);
 #define grab_fsdata     STEPNAME(grab_fsdata_)
 #define grab_tlsdata    STEPNAME(grab_tlsdata_)
 #define isNativeCall    STEPNAME(isNativeCall_)
+#define call_direct     STEPNAME(call_direct_)
 #define emit_cmp8       STEPNAME(emit_cmp8)
 #define emit_cmp16      STEPNAME(emit_cmp16)
 #define emit_cmp32      STEPNAME(emit_cmp32)
@@ -440,6 +466,8 @@ void* arm_linker(x86emu_t* emu, void** table, uintptr_t addr);
 #endif
 #define cstack_push     STEPNAME(cstack_push)
 #define cstack_pop      STEPNAME(cstack_pop)
+#define pack_flags      STEPNAME(pack_flags)
+#define unpack_flags    STEPNAME(unpack_flags)
 
 
 // get the single reg that from the double "reg" (so Dx[idx])
@@ -466,7 +494,10 @@ void iret_to_epilog(dynarec_arm_t* dyn, int ninst);
 void call_c(dynarec_arm_t* dyn, int ninst, void* fnc, int reg, int ret, uint32_t mask);
 void grab_fsdata(dynarec_arm_t* dyn, uintptr_t addr, int ninst, int reg);
 void grab_tlsdata(dynarec_arm_t* dyn, uintptr_t addr, int ninst, int reg);
-int isNativeCall(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t* calladdress, int* retn);
+// is addr a bridge, or a PLT entry that goes to a bridge? slotreg is -1 if it's a bridge, or else the GOT slot read by the PLT entry
+// is at slot (slotreg is 0) or at xEBX+slot (slotreg is xEBX), as the slot can change, it must be checked
+int isNativeCall(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t* calladdress, int* retn, int* slotreg, uintptr_t* slot);
+void call_direct(dynarec_arm_t* dyn, int ninst, uintptr_t fnc, const char* sig);
 void emit_lock(dynarec_arm_t* dyn, uintptr_t addr, int ninst);
 void emit_unlock(dynarec_arm_t* dyn, uintptr_t addr, int ninst);
 void emit_cmp8(dynarec_arm_t* dyn, int ninst, int s1, int s2, int s3, int s4);
@@ -611,6 +642,12 @@ void cstack_push(dynarec_arm_t* dyn, int ninst, uintptr_t x86ip, uintptr_t armip
 // POP a x86/native couple of address from cstack, and generate the jump is x86 address is s0, use s1, s2 and s2+1 as scratch
 void cstack_pop(dynarec_arm_t* dyn, int ninst, int s0, int s1, int s2);
 
+// Inline PUSHF/POPF/IRET only: the flags stay unpacked in emu->flags everywhere else
+// Pack emu->flags in a x86 EFLAGS in s1 (and in emu->packed_eflags), using s2 as scratch. Flags must be up to date
+void pack_flags(dynarec_arm_t* dyn, int ninst, int s1, int s2);
+// Unpack the x86 EFLAGS s1 (already masked) to emu->flags (and emu->packed_eflags), using s2 as scratch
+void unpack_flags(dynarec_arm_t* dyn, int ninst, int s1, int s2);
+
 #if STEP < 2
 #define PASS2(A)
 #else
@@ -32,6 +32,7 @@ void arm_pass(dynarec_arm_t* dyn, uintptr_t addr)
     int need_epilog = 1;
     dyn->tablei = 0;
     dyn->sons_size = 0;
+    dyn->traced = 0;
     // Clean up (because there are multiple passes)
     dyn->state_flags = 0;
     fpu_reset(dyn, ninst);
@@ -45,6 +46,33 @@ void arm_pass(dynarec_arm_t* dyn, uintptr_t addr)
         }
         NEW_INST;
         fpu_reset_scratch(dyn);
+        if(!ninst && dyn->profile) {
+            MESSAGE(LOG_DUMP, "PROFILE ----\n");
+            MOV32(x1, dyn->profile);
+            LDR_IMM9(x2, x1, 0);
+            ADD_IMM8(x2, x2, 1);
+            STR_IMM9(x2, x1, 0);
+        }
+        if(dyn->exec && (!ninst || (dyn->insts && dyn->insts[ninst].x86.barrier==1))) {
+            // mark the block as used for the eviction clock, also at the entries of the sons, as linked blocks don't go through DBGetBlock
+            MESSAGE(LOG_DUMP, "EXEC ----\n");
+            PASS3(add_reloc(dyn, RELOC_EXEC, 0));
+            MOV32_(x1, dyn->exec);
+            MOVW(x2, 1);
+            STR_IMM9(x2, x1, 0);
+        }
+        if(!ninst && dyn->tiercount) {
+            // count down, and exit to get recompiled when reaching 0
+            int32_t j32;
+            MESSAGE(LOG_DUMP, "TIER ----\n");
+            MOV32(x1, dyn->tiercount);
+            LDR_IMM9(x2, x1, 0);
+            SUBS_IMM8(x2, x2, 1);
+            STR_IMM9(x2, x1, 0);
+            B_MARKTIER(cGT);    // exit when <=0, as other threads can decrement too
+            jump_to_epilog(dyn, ip, 0, ninst);
+            MARKTIER;
+        }
 #ifdef HAVE_TRACE
         if(my_context->dec && box86_dynarec_trace) {
         if((trace_end == 0) 
@@ -9,6 +9,8 @@
 #define JUMP(A)         dyn->insts[ninst].x86.jmp = A
 #define BARRIER(A)      dyn->insts[ninst].x86.barrier = A
 #define BARRIER_NEXT(A) if(ninst+1<dyn->size) dyn->insts[ninst+1].x86.barrier = A
+#define NATFLAGS(A)     dyn->insts[ninst].x86.natflags = A
+#define NATCOND(A)      dyn->insts[ninst].x86.natcond = 1+(A)
 
 #define NEW_INST \
     dyn->insts[ninst].x86.addr = ip; \
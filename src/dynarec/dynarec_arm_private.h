@@ -14,6 +14,7 @@ typedef struct instruction_arm_s {
     uintptr_t           markf;
     uintptr_t           markseg;
     uintptr_t           marklock;
+    uintptr_t           marktier;
 } instruction_arm_t;
 
 typedef struct dynarec_arm_s {
@@ -45,10 +46,25 @@ typedef struct dynarec_arm_s {
     uintptr_t*          sons_x86;   // the x86 address of potential dynablock sons
     void**              sons_arm;   // the arm address of potential dynablock sons
     int                 sons_size;  // number of potential dynablock sons
+    dynarec_reloc_t*    relocs;     // MOV32_ to patch if the block is moved
+    int                 relocs_sz;
+    int                 relocs_cap;
+    int                 nocache;    // block use some volatile native address, so cannot be saved in the persistent cache
+    uintptr_t           profile;    // address of the execution counter of the block (0 if not profiling)
+    uintptr_t           exec;       // address of the eviction counter of the block, set at each entry (0 if no eviction)
+    int                 tier;       // 1: first tier, 2: superblock (follow jumps, wider flags analysis)
+    uintptr_t           tiercount;  // address of the tier countdown of the block (0 if none)
+    int                 traced;     // number of jumps followed in the superblock
 } dynarec_arm_t;
 
+// superblocks follow forward unconditionnal jumps, up to that many, and not too far
+#define SUPERBLOCK_MAXJMP   8
+#define SUPERBLOCK_MAXSKIP  1024
+
 void add_next(dynarec_arm_t *dyn, uintptr_t addr);
 uintptr_t get_closest_next(dynarec_arm_t *dyn, uintptr_t addr);
 int is_nops(dynarec_arm_t *dyn, uintptr_t addr, int n);
+void add_reloc(dynarec_arm_t *dyn, uint32_t type, uint32_t value);
+int native_cond(int natflags, int cc);
 
 #endif //__DYNAREC_ARM_PRIVATE_H_
\ No newline at end of file
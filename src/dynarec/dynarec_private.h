@@ -18,6 +18,9 @@
 #define SF_MAYSET   3
 #define SF_SUBSET   4
 
+#define NF_SUB      1   // ARM NZCV from a SUBS: all x86 conditions but parity (ARM carry is inverted)
+#define NF_LOGIC    2   // ARM NZ from an ANDS: only ZF and SF conditions
+
 typedef struct instruction_x86_s {
     uintptr_t   addr;   //address of the instruction
     int32_t     size;   // size of the instruction
@@ -28,8 +31,27 @@ typedef struct instruction_x86_s {
     uint32_t    set_flags;  // 0 or combination of X_?F
     uint32_t    need_flags; // calculated
     int         state_flags; // One of SF_XXX state
+    int         trace;  // unconditionnal jump followed in a superblock, translation continue at destination
+    int         natflags;   // NF_xxx: ARM flags still hold x86 flags after the instruction (cmp/test)
+    int         natcond;    // 1+x86 condition of a Jcc/SETcc/CMOVcc that can use ARM flags (0 if none)
+    int         usenat;     // flags are kept in ARM flags between the instruction and its neighbour (calculated)
 } instruction_x86_t;
 
+// inline cache of an indirect jump (jmp/call through a register or memory): that many slots of the jump table,
+// each with its own target, tested in turn. A miss of all of them goes to arm_linker_ic that fill a slot
+#define IC_WAYS     4
+
+// relocation types, for the MOV32_ that needs patching when a block is moved (persistent cache)
+#define RELOC_TABLE 1   // value is the index in the jump table
+#define RELOC_ARM   2   // value is an offset inside the arm block
+#define RELOC_EXEC  3   // value is unused, the address is the exec counter of the block
+
+typedef struct dynarec_reloc_s {
+    uint32_t    type;   // one of RELOC_xxx
+    uint32_t    offset; // offset in the arm block of the MOVW/MOVT pair
+    uint32_t    value;
+} dynarec_reloc_t;
+
 void printf_x86_instruction(zydis_dec_t* dec, instruction_x86_t* inst, const char* name);
 void tableupdate(void* jumpto, uintptr_t ref, void** table);
 void resettable(void** table);
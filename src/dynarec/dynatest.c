@@ -0,0 +1,547 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "debug.h"
+#include "box86context.h"
+#include "dynablock.h"
+#include "dynablock_private.h"
+#include "x86run.h"
+#include "x86trace.h"
+#include "dynarec.h"
+#include "emu/x86emu_private.h"
+#include "emu/x86run_private.h"
+
+// BOX86_DYNAREC_TEST: each dynablock is first run by the interpretor, on a copy of the emu and one instruction
+// at a time, then the memory written is put back and the block is run for real. States are compared after that.
+// The memory an instruction can write is saved before the instruction (so it can be put back after the interpretor run),
+// instructions with side effects (int, syscall, in/out...) can't be run twice, so blocks with them are not tested.
+// The memory is put back by copying the saved bytes, so a write done by another thread to the same memory while the
+// interpretor runs the block is lost: tests of multi-threaded programs can change their behaviour.
+
+#define TEST_MAXSTEPS   (1<<20)         // instructions run by the interpretor in a block, before giving up
+#define TEST_TRACE      256             // last instructions kept for the report
+#define TEST_MAXMEM     65536           // memory chunks saved for a block
+#define TEST_MAXPOOL    (16*1024*1024)  // memory saved for a block
+#define TEST_STACK      4096            // stack under ESP saved for a block
+#define TEST_MAXREPORT  16              // max number of detailed reports
+#define TEST_LISTING    32              // instructions listed in a report, around the probable divergent one
+
+#ifdef ARM
+void arm_prolog(x86emu_t* emu, void* addr);
+#endif
+
+typedef struct testmem_s {
+    uintptr_t   addr;
+    uint32_t    size;
+    uint32_t    orig;   // offset in the pool of the original bytes
+    uint32_t    res;    // offset in the pool of the bytes after the interpretor
+} testmem_t;
+
+typedef struct teststep_s {
+    uint32_t    ip;         // address of the instruction
+    uint32_t    regs[8];    // state after the instruction
+    uint32_t    eip;
+    uint32_t    flags;
+} teststep_t;
+
+typedef struct dynatest_s {
+    x86emu_t    ref;        // copy of the emu, for the interpretor
+    testmem_t*  mem;
+    int         memsz;
+    int         memcap;
+    uint8_t*    pool;
+    uint32_t    poolsz;
+    uint32_t    poolcap;
+    teststep_t  init;       // state before the block
+    teststep_t  trace[TEST_TRACE];  // ring buffer of the last instructions run
+    uint32_t    nsteps;
+} dynatest_t;
+
+static __thread dynatest_t* thread_test = NULL;
+static pthread_mutex_t mutex_report = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t test_tested = 0;
+static uint32_t test_diverged = 0;
+static uint32_t test_skipped = 0;
+static uint32_t test_partial = 0;
+
+// flags that are compared (AF is left out, it's undefined after many opcodes)
+#define TEST_FLAGS  ((1<<F_CF)|(1<<F_PF)|(1<<F_ZF)|(1<<F_SF)|(1<<F_DF)|(1<<F_OF))
+
+// one bit per opcode with a ModRM byte, for the 1 byte opcodes
+static const uint16_t modrm1[16] = {
+    0x0F0F, 0x0F0F, 0x0F0F, 0x0F0F, 0x0000, 0x0000, 0x0A0C, 0x0000,
+    0xFFFF, 0x0000, 0x0000, 0x0000, 0x00F3, 0xFF0F, 0x0000, 0xC0C0
+};
+
+static uint32_t testFlags(x86emu_t* emu)
+{
+    CHECK_FLAGS(emu);
+    PackFlags(emu);
+    return emu->packed_eflags.x32;
+}
+
+static void testState(x86emu_t* emu, teststep_t* s)
+{
+    for(int i=0; i<8; ++i)
+        s->regs[i] = emu->regs[i].dword[0];
+    s->eip = R_EIP;
+    s->flags = testFlags(emu);
+}
+
+// save size bytes at addr, return 1 if too much memory is saved already
+static int testSave(dynatest_t* t, uintptr_t addr, uint32_t size)
+{
+    // already saved by one of the last instructions?
+    for(int i=t->memsz-1; i>=0 && i>=t->memsz-16; --i)
+        if(t->mem[i].addr==addr && t->mem[i].size>=size)
+            return 0;
+    if(t->memsz==TEST_MAXMEM || t->poolsz+2*size>TEST_MAXPOOL)
+        return 1;
+    if(t->memsz==t->memcap) {
+        t->memcap += 256;
+        t->mem = (testmem_t*)realloc(t->mem, t->memcap*sizeof(testmem_t));
+    }
+    while(t->poolsz+2*size>t->poolcap) {
+        t->poolcap += 64*1024;
+        t->pool = (uint8_t*)realloc(t->pool, t->poolcap);
+    }
+    // the address is not checked yet (the interpretor will), so read it without risking a SEGV
+    struct iovec local = {t->pool+t->poolsz, size};
+    struct iovec remote = {(void*)addr, size};
+    ssize_t r = process_vm_readv(getpid(), &local, 1, &remote, 1, 0);
+    if(r<=0)
+        return 0;   // not readable, so not writable either
+    testmem_t* m = &t->mem[t->memsz++];
+    m->addr = addr;
+    m->size = r;
+    m->orig = t->poolsz;
+    m->res = 0;
+    t->poolsz += r;
+    return 0;
+}
+
+static int testModRM(dynatest_t* t, x86emu_t* emu, uint8_t* p, uintptr_t seg, uint32_t size, int opsize, int bt)
+{
+    uint8_t m = *(p++);
+    if((m&0xC0)==0xC0)
+        return 0;
+    uintptr_t base;
+    if((m&7)==4) {
+        uint8_t sib = *(p++);
+        if((sib&7)==5 && !(m&0xC0)) {
+            base = *(uint32_t*)p;
+            p+=4;
+        } else
+            base = emu->regs[sib&7].dword[0];
+        if(((sib>>3)&7)!=4)
+            base += emu->regs[(sib>>3)&7].dword[0] << (sib>>6);
+    } else if((m&0xC7)==5) {
+        base = *(uint32_t*)p;
+        p+=4;
+    } else
+        base = emu->regs[m&7].dword[0];
+    if((m&0xC0)==0x40)
+        base += *(int8_t*)p;
+    else if((m&0xC0)==0x80)
+        base += *(int32_t*)p;
+    if(bt) {
+        // bit offset from the Gd register can be outside the operand
+        int32_t off = emu->regs[(m>>3)&7].sdword[0];
+        base += (opsize==2)?((((int16_t)off)>>4)*2):((off>>5)*4);
+    }
+    return testSave(t, (uint32_t)(seg+base), size);
+}
+
+// save the memory the instruction at EIP can write, return 1 if the instruction can't be tested
+static int testPrepare(dynatest_t* t, x86emu_t* emu)
+{
+    uint8_t* p = (uint8_t*)R_EIP;
+    int opsize = 4;
+    int rep = 0;
+    uintptr_t seg = 0;
+    int prefix = 1;
+    while(prefix) {
+        switch(*p) {
+            case 0x66: opsize = 2; ++p; break;
+            case 0x67: return 1;    // 16bits addressing not handled
+            case 0xF2:
+            case 0xF3: rep = 1; ++p; break;
+            case 0xF0:
+            case 0x26:
+            case 0x2E:
+            case 0x36:
+            case 0x3E: ++p; break;
+            case 0x64: seg = GetSegmentBaseEmu(emu, _FS); ++p; break;
+            case 0x65: seg = GetSegmentBaseEmu(emu, _GS); ++p; break;
+            default: prefix = 0;
+        }
+    }
+    uint8_t op = *(p++);
+    if(op==0x0F) {
+        op = *(p++);
+        switch(op) {
+            case 0x00:
+            case 0x01:
+            case 0x04:
+            case 0x05:
+            case 0x06:
+            case 0x07:
+            case 0x08:
+            case 0x09:
+            case 0x0A:
+            case 0x0B:
+            case 0x0C:
+            case 0x30:
+            case 0x31:
+            case 0x32:
+            case 0x33:
+            case 0x34:
+            case 0x35:
+                return 1;   // system, invalid or not deterministic (rdtsc)
+            case 0x0D:
+            case 0x0E:
+            case 0x18 ... 0x1F:
+            case 0x77:
+            case 0x80 ... 0x8F:
+            case 0xA0 ... 0xA2:
+            case 0xA8:
+            case 0xA9:
+            case 0xC8 ... 0xCF:
+                return 0;   // no memory written
+            case 0x38:
+            case 0x3A:
+                ++p;
+                return testModRM(t, emu, p, seg, 16, opsize, 0);
+            case 0xA3:
+            case 0xAB:
+            case 0xB3:
+            case 0xBB:
+                return testModRM(t, emu, p, seg, 4, opsize, 1);
+            case 0xAE:
+                return testModRM(t, emu, p, seg, (((*p)>>3)&7)?16:512, opsize, 0);    // FXSAVE
+            case 0xF7:
+                return testSave(t, R_EDI, 16);  // MASKMOVQ / MASKMOVDQU
+            default:
+                return testModRM(t, emu, p, seg, 16, opsize, 0);
+        }
+    }
+    switch(op) {
+        case 0x6C ... 0x6F:
+        case 0x9A:
+        case 0xCC ... 0xCE:
+        case 0xE4 ... 0xE7:
+        case 0xEC ... 0xEF:
+        case 0xF1:
+        case 0xF4:
+            return 1;   // int, in/out, hlt, far call
+        case 0x8D:
+            return 0;   // LEA
+        case 0xA2:
+        case 0xA3:
+            return testSave(t, seg+*(uint32_t*)p, 4);
+        case 0xA4:
+        case 0xA5:
+        case 0xAA:
+        case 0xAB: {
+                // MOVS / STOS write at EDI
+                uint32_t sz = (op&1)?opsize:1;
+                uint32_t n = rep?R_ECX:1;
+                if(!n)
+                    return 0;
+                if((uint64_t)n*sz>TEST_MAXPOOL/2)
+                    return 1;
+                uintptr_t start = ACCESS_FLAG(F_DF)?(R_EDI-(n-1)*sz):R_EDI;
+                return testSave(t, start, n*sz);
+            }
+        case 0xD9:
+            return testModRM(t, emu, p, seg, ((((*p)>>3)&7)==6)?28:16, opsize, 0);     // FNSTENV
+        case 0xDD:
+            return testModRM(t, emu, p, seg, ((((*p)>>3)&7)==6)?108:16, opsize, 0);    // FNSAVE
+    }
+    if(modrm1[op>>4]&(1<<(op&15)))
+        return testModRM(t, emu, p, seg, 16, opsize, 0);
+    return 0;
+}
+
+// put back the memory as it was before the interpretor, last saved first
+static void testUndo(dynatest_t* t)
+{
+    for(int i=t->memsz-1; i>=0; --i) {
+        testmem_t* m = &t->mem[i];
+        if(memcmp((void*)m->addr, t->pool+m->orig, m->size))
+            memcpy((void*)m->addr, t->pool+m->orig, m->size);
+    }
+}
+
+static zydis_dec_t* testDecoder()
+{
+    static int init = 0;
+    static zydis_dec_t* dec = NULL;
+    if(init)
+        return dec;
+    init = 1;
+    if(my_context->dec)
+        dec = InitX86TraceDecoder(my_context);
+    else if(!my_context->zydis && !InitX86Trace(my_context)) {
+        // keep the decoder for us, it's not a trace
+        dec = my_context->dec;
+        my_context->dec = NULL;
+    }
+    return dec;
+}
+
+static void testPrintInst(uint32_t ip, uint32_t next, const char* mark)
+{
+    zydis_dec_t* dec = testDecoder();
+    if(dec) {
+        printf_log(LOG_NONE, "%s%p: %s\n", mark, (void*)ip, DecodeX86Trace(dec, ip));
+        return;
+    }
+    // no Zydis, print the bytes
+    int len = (next>ip && next-ip<=15)?(next-ip):8;
+    char buff[64] = {0};
+    for(int i=0; i<len; ++i)
+        sprintf(buff+i*3, "%02X ", ((uint8_t*)ip)[i]);
+    printf_log(LOG_NONE, "%s%p: %s\n", mark, (void*)ip, buff);
+}
+
+static const char* regname[8] = {"EAX", "ECX", "EDX", "EBX", "ESP", "EBP", "ESI", "EDI"};
+
+// state after step i of the trace (-1 is the state before the block)
+static teststep_t* testStep(dynatest_t* t, int i)
+{
+    return (i<0)?&t->init:&t->trace[i%TEST_TRACE];
+}
+
+// print the divergence, with the registers, x87/MMX/SSE and memory if ref is not NULL
+static void testReport(dynatest_t* t, x86emu_t* emu, x86emu_t* ref, testmem_t* badmem, dynablock_t* father, teststep_t* interp, int nsteps, const char* what)
+{
+    pthread_mutex_lock(&mutex_report);
+    uint32_t n = __sync_add_and_fetch(&test_diverged, 1);
+    if(n>TEST_MAXREPORT) {
+        if(n==TEST_MAXREPORT+1)
+            printf_log(LOG_NONE, "BOX86_DYNAREC_TEST: too many divergences, not reporting them anymore\n");
+        pthread_mutex_unlock(&mutex_report);
+        return;
+    }
+    printf_log(LOG_NONE, "BOX86_DYNAREC_TEST: divergence (%s) in block %p-%p, entered at %p, after %d instruction(s)\n",
+        what, father->x86_addr, father->x86_addr+father->x86_size, (void*)t->init.eip, nsteps);
+    // registers, and for each register the last instruction of the interpretor that changed it
+    int first = nsteps;
+    uint32_t dyn[10];
+    for(int i=0; i<8; ++i)
+        dyn[i] = emu->regs[i].dword[0];
+    dyn[8] = R_EIP;
+    dyn[9] = testFlags(emu);
+    int oldest = (nsteps>TEST_TRACE)?(nsteps-TEST_TRACE):0;
+    for(int r=0; r<10; ++r) {
+        uint32_t a = (r<8)?interp->regs[r]:((r==8)?interp->eip:interp->flags);
+        uint32_t mask = (r==9)?TEST_FLAGS:0xffffffff;
+        if(!((a^dyn[r])&mask))
+            continue;
+        printf_log(LOG_NONE, "  %-6s interpretor=0x%08x dynarec=0x%08x\n", (r<8)?regname[r]:((r==8)?"EIP":"EFLAGS"), a, dyn[r]);
+        if(r==8)
+            continue;
+        for(int i=nsteps-1; i>=oldest; --i) {
+            teststep_t* s = testStep(t, i);
+            teststep_t* prev = (i==oldest && oldest)?NULL:testStep(t, i-1);
+            if(!prev)
+                break;
+            uint32_t v = (r<8)?s->regs[r]:s->flags;
+            uint32_t pv = (r<8)?prev->regs[r]:prev->flags;
+            if((v^pv)&mask) {
+                if(i<first)
+                    first = i;
+                break;
+            }
+        }
+    }
+    if(ref) {
+        for(int i=0; i<ref->fpu_stack && i<8; ++i)
+            if(memcmp(&ref->fpu[(ref->top+i)&7], &emu->fpu[(emu->top+i)&7], sizeof(ref->fpu[0])))
+                printf_log(LOG_NONE, "  ST%d    interpretor=%g dynarec=%g\n", i, ref->fpu[(ref->top+i)&7].d, emu->fpu[(emu->top+i)&7].d);
+        if(ref->top!=emu->top || ref->fpu_stack!=emu->fpu_stack)
+            printf_log(LOG_NONE, "  x87 top/stack interpretor=%d/%d dynarec=%d/%d\n", ref->top, ref->fpu_stack, emu->top, emu->fpu_stack);
+        for(int i=0; i<8; ++i) {
+            if(ref->mmx[i].q!=emu->mmx[i].q)
+                printf_log(LOG_NONE, "  MM%d    interpretor=0x%016llx dynarec=0x%016llx\n", i, ref->mmx[i].q, emu->mmx[i].q);
+            if(memcmp(&ref->xmm[i], &emu->xmm[i], sizeof(ref->xmm[i])))
+                printf_log(LOG_NONE, "  XMM%d   interpretor=%016llx%016llx dynarec=%016llx%016llx\n", i, ref->xmm[i].q[1], ref->xmm[i].q[0], emu->xmm[i].q[1], emu->xmm[i].q[0]);
+        }
+    }
+    if(badmem) {
+        for(uint32_t j=0; j<badmem->size; ++j)
+            if(((uint8_t*)badmem->addr)[j]!=t->pool[badmem->res+j]) {
+                printf_log(LOG_NONE, "  memory @%p: interpretor=0x%02x dynarec=0x%02x\n", (void*)(badmem->addr+j), t->pool[badmem->res+j], ((uint8_t*)badmem->addr)[j]);
+                break;
+            }
+    }
+    if(first<nsteps)
+        testPrintInst(testStep(t, first)->ip, testStep(t, first)->eip, "  probable first divergent instruction ");
+    // instructions run by the interpretor
+    int start = ((first<nsteps)?first:nsteps) - TEST_LISTING;
+    if(start<oldest)
+        start = oldest;
+    int end = (first<nsteps)?(first+TEST_LISTING):nsteps;
+    if(end>nsteps)
+        end = nsteps;
+    printf_log(LOG_NONE, "  instructions run by the interpretor (%d to %d):\n", start, end-1);
+    for(int i=start; i<end; ++i)
+        testPrintInst(testStep(t, i)->ip, testStep(t, i)->eip, (i==first)?"  => ":"     ");
+    pthread_mutex_unlock(&mutex_report);
+}
+
+static void testCompareFull(dynatest_t* t, x86emu_t* emu, x86emu_t* ref, dynablock_t* father, int nsteps)
+{
+    char what[256] = {0};
+    teststep_t interp;
+    testState(ref, &interp);
+    for(int i=0; i<8; ++i)
+        if(interp.regs[i]!=emu->regs[i].dword[0]) {
+            strcat(what, "regs ");
+            break;
+        }
+    if((interp.flags^testFlags(emu))&TEST_FLAGS)
+        strcat(what, "flags ");
+    if(ref->top!=emu->top || ref->fpu_stack!=emu->fpu_stack)
+        strcat(what, "x87 ");
+    else
+        for(int i=0; i<ref->fpu_stack && i<8; ++i)
+            if(memcmp(&ref->fpu[(ref->top+i)&7], &emu->fpu[(emu->top+i)&7], sizeof(ref->fpu[0]))) {
+                strcat(what, "x87 ");
+                break;
+            }
+    if(memcmp(ref->mmx, emu->mmx, sizeof(ref->mmx)))
+        strcat(what, "mmx ");
+    if(memcmp(ref->xmm, emu->xmm, sizeof(ref->xmm)))
+        strcat(what, "sse ");
+    testmem_t* badmem = NULL;
+    for(int i=0; i<t->memsz && !badmem; ++i) {
+        testmem_t* m = &t->mem[i];
+        uintptr_t addr = m->addr;
+        uint32_t size = m->size;
+        if(i==0) {
+            // the stack: only what is above ESP matter
+            if(R_ESP>=addr+size)
+                continue;
+            if(R_ESP>addr) {
+                size -= R_ESP-addr;
+                addr = R_ESP;
+            }
+        }
+        if(memcmp((void*)addr, t->pool+m->res+(addr-m->addr), size))
+            badmem = m;
+    }
+    if(badmem)
+        strcat(what, "memory ");
+    if(!what[0])
+        return;
+    what[strlen(what)-1] = '\0';
+    testReport(t, emu, ref, badmem, father, &interp, nsteps, what);
+}
+
+static dynatest_t* getTest()
+{
+    if(!thread_test)
+        thread_test = (dynatest_t*)calloc(1, sizeof(dynatest_t));
+    return thread_test;
+}
+
+void DynaTestBlock(x86emu_t* emu, dynablock_t* block)
+{
+    dynatest_t* t = getTest();
+    dynablock_t* father = block->father?block->father:block;
+    uintptr_t start = (uintptr_t)father->x86_addr;
+    uintptr_t end = start+father->x86_size;
+    // copy of the emu for the interpretor
+    testState(emu, &t->init);
+    x86emu_t* ref = &t->ref;
+    memcpy(ref, emu, sizeof(x86emu_t));
+    for (int i=0; i<8; ++i)
+        ref->sbiidx[i] = &ref->regs[i];
+    ref->sbiidx[4] = &ref->zero;
+    t->memsz = 0;
+    t->poolsz = 0;
+    t->nsteps = 0;
+    int ok = !testSave(t, R_ESP-TEST_STACK, TEST_STACK);  // always 1st chunk
+    while(ok) {
+        if(testPrepare(t, ref)) {
+            ok = 0;
+            break;
+        }
+        uint32_t ip = ref->ip.dword[0];
+        RunTest(ref);
+        if(ref->quit || ref->error || ref->fork) {
+            ok = 0;
+            break;
+        }
+        teststep_t* s = &t->trace[(t->nsteps++)%TEST_TRACE];
+        s->ip = ip;
+        testState(ref, s);
+        if(ref->ip.dword[0]<start || ref->ip.dword[0]>=end)
+            break;  // exit of the block
+        if(t->nsteps==TEST_MAXSTEPS)
+            ok = 0;
+    }
+    if(ok) {
+        // keep the memory as the interpretor left it
+        for(int i=0; i<t->memsz; ++i) {
+            testmem_t* m = &t->mem[i];
+            m->res = t->poolsz;
+            memcpy(t->pool+m->res, (void*)m->addr, m->size);
+            t->poolsz += m->size;
+        }
+    }
+    testUndo(t);
+    // now, the real run. Without return stack, a RET of the block exits to the dispatcher instead of jumping to a caller block
+    CStackReset(emu);
+    #ifdef ARM
+    arm_prolog(emu, block->block);
+    #endif
+    if(!ok) {
+        __sync_fetch_and_add(&test_skipped, 1);
+        return;
+    }
+    __sync_fetch_and_add(&test_tested, 1);
+    if(emu->quit)
+        return;
+    CHECK_FLAGS(emu);
+    if(R_EIP==ref->ip.dword[0]) {
+        testCompareFull(t, emu, ref, father, t->nsteps);
+        return;
+    }
+    // the dynablock stopped elsewhere, compare with the interpretor at the same point if possible (only registers and flags)
+    int oldest = (t->nsteps>TEST_TRACE)?(t->nsteps-TEST_TRACE):0;
+    for(int i=oldest; i<t->nsteps; ++i) {
+        teststep_t* s = testStep(t, i);
+        if(s->eip==R_EIP) {
+            int diff = (s->flags^testFlags(emu))&TEST_FLAGS;
+            for(int r=0; r<8; ++r)
+                if(s->regs[r]!=emu->regs[r].dword[0])
+                    diff = 1;
+            if(diff)
+                testReport(t, emu, NULL, NULL, father, s, i+1, "regs or flags, block exited early");
+            else
+                __sync_fetch_and_add(&test_partial, 1);
+            return;
+        }
+    }
+    if(R_EIP<start || R_EIP>=end) {
+        teststep_t interp;
+        testState(ref, &interp);
+        testReport(t, emu, NULL, NULL, father, &interp, t->nsteps, "exit address");
+    } else
+        __sync_fetch_and_add(&test_partial, 1);
+}
+
+void DynaTestStats()
+{
+    printf_log(LOG_NONE, "BOX86_DYNAREC_TEST: %u block runs compared (%u only partially), %u divergence(s), %u block runs not testable\n",
+        test_tested, test_partial, test_diverged, test_skipped);
+}
@@ -10,6 +10,7 @@
 #include <link.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 
 #include "box86version.h"
 #include "elfloader.h"
@@ -29,8 +30,11 @@
 #include "box86stack.h"
 #ifdef DYNAREC
 #include "dynablock.h"
+#include "dynacache.h"
 #endif
 #include "../emu/x86emu_private.h"
+#include "../emu/x86predecode.h"
+#include "../tools/bridge_private.h"
 #include "x86tls.h"
 
 void* my__IO_2_1_stderr_ = NULL;
@@ -63,11 +67,14 @@ void FreeElfHeader(elfheader_t** head)
     if(!head || !*head)
         return;
     elfheader_t *h = *head;
+    if(h->text && box86_predecode)
+        forgetPredecodeRange(h->text, h->textsz);
 #ifdef DYNAREC
     if(h->text) {
         dynarec_log(LOG_INFO, "Free Dynarec block for %s\n", h->path);
         cleanDBFromAddressRange(h->text, h->textsz, 1);
     }
+    FreeDynaCache(&h->dynacache);
 #endif
     free(h->name);
     free(h->path);
@@ -79,6 +86,8 @@ void FreeElfHeader(elfheader_t** head)
     free(h->DynStr);
     free(h->SymTab);
     free(h->DynSym);
+    free(h->symres);
+    free(h->nearindex);
 
     FreeElfMemory(h);
     free(h);
@@ -251,6 +260,43 @@ void FreeElfMemory(elfheader_t* head)
     }
 }
 
+// read filesz bytes of f at offset in dest. The pages fully inside the segment are mapped from the file
+// (MAP_PRIVATE, so they are shared with other processes until written, by relocations for example), only
+// the partial pages at both ends are read, the memory around them (like the bss) is left untouched
+static int loadSegment(FILE* f, char* dest, uint32_t offset, uint32_t filesz)
+{
+    uintptr_t pagemask = (box86_pagesize?box86_pagesize:4096)-1;
+    uintptr_t mstart = ((uintptr_t)dest + pagemask)&~pagemask;
+    uintptr_t mend = ((uintptr_t)dest + filesz)&~pagemask;
+    if(mend>mstart && (((uintptr_t)dest^offset)&pagemask)==0) {
+        void* p = mmap((void*)mstart, mend-mstart
+            , PROT_READ | PROT_WRITE | PROT_EXEC
+            , MAP_PRIVATE | MAP_FIXED
+            , fileno(f), offset + (mstart-(uintptr_t)dest));
+        if(p!=MAP_FAILED) {
+            printf_log(LOG_DEBUG, "Mapped 0x%x bytes of file @%p\n", mend-mstart, p);
+            // the parts before and after the mapping
+            uint32_t head = mstart-(uintptr_t)dest;
+            uint32_t tail = (uintptr_t)dest+filesz-mend;
+            if(head) {
+                if(fseeko64(f, offset, SEEK_SET)==-1 || fread(dest, head, 1, f)!=1)
+                    return 1;
+            }
+            if(tail) {
+                if(fseeko64(f, offset+filesz-tail, SEEK_SET)==-1 || fread((void*)mend, tail, 1, f)!=1)
+                    return 1;
+            }
+            return 0;
+        }
+        printf_log(LOG_DEBUG, "Cannot map file @%p (errno=%d/%s), reading it\n", (void*)mstart, errno, strerror(errno));
+        // a failed MAP_FIXED may have removed the anonymous memory
+        mmap((void*)mstart, mend-mstart, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    }
+    if(fseeko64(f, offset, SEEK_SET)==-1 || fread(dest, filesz, 1, f)!=1)
+        return 1;
+    return 0;
+}
+
 int LoadElfMemory(FILE* f, box86context_t* context, elfheader_t* head)
 {
     for (int i=0; i<head->numPHEntries; ++i) {
@@ -258,9 +304,8 @@ int LoadElfMemory(FILE* f, box86context_t* context, elfheader_t* head)
             Elf32_Phdr * e = &head->PHEntries[i];
             char* dest = (char*)e->p_paddr + head->delta;
             printf_log(LOG_DEBUG, "Loading block #%i @%p (0x%x/0x%x)\n", i, dest, e->p_filesz, e->p_memsz);
-            fseeko64(f, e->p_offset, SEEK_SET);
             if(e->p_filesz) {
-                if(fread(dest, e->p_filesz, 1, f)!=1) {
+                if(loadSegment(f, dest, e->p_offset, e->p_filesz)) {
                     printf_log(LOG_NONE, "Fail to read PT_LOAD part #%d (size=%d)\n", i, e->p_filesz);
                     return 1;
                 }
@@ -291,6 +336,10 @@ int LoadElfMemory(FILE* f, box86context_t* context, elfheader_t* head)
                 memset(dest+e->p_filesz, 0, e->p_memsz - e->p_filesz);
         }
     }
+#ifdef DYNAREC
+    if(box86_dynarec_cache && !head->dynacache)
+        head->dynacache = NewDynaCache(head);
+#endif
     return 0;
 }
 
@@ -301,15 +350,10 @@ int ReloadElfMemory(FILE* f, box86context_t* context, elfheader_t* head)
             Elf32_Phdr * e = &head->PHEntries[i];
             char* dest = (char*)e->p_paddr + head->delta;
             printf_log(LOG_DEBUG, "Re-loading block #%i @%p (0x%x/0x%x)\n", i, dest, e->p_filesz, e->p_memsz);
-            int ret = fseeko64(f, e->p_offset, SEEK_SET);
-            if(ret==-1) {printf_log(LOG_NONE, "Fail to (re)seek PT_LOAD part #%d (offset=%d, errno=%d/%s)\n", i, e->p_offset, errno, strerror(errno)); return 1;}
             if(e->p_filesz) {
-                ssize_t r = -1;
-                #ifdef DYNAREC
-                unprotectDB((uintptr_t)dest, e->p_memsz);
-                #endif
-                if((r=fread(dest, e->p_filesz, 1, f))!=1) {
-                    printf_log(LOG_NONE, "Fail to (re)read PT_LOAD part #%d (dest=%p, size=%d, return=%d, feof=%d/ferror=%d/%s)\n", i, dest, e->p_filesz, r, feof(f), ferror(f), strerror(ferror(f)));
+                unprotectDB((uintptr_t)dest, e->p_memsz);   // also for the pre-decoded blocks, the remap doesn't fault
+                if(loadSegment(f, dest, e->p_offset, e->p_filesz)) {
+                    printf_log(LOG_NONE, "Fail to (re)read PT_LOAD part #%d (dest=%p, offset=%d, size=%d, feof=%d/ferror=%d/%s)\n", i, dest, e->p_offset, e->p_filesz, feof(f), ferror(f), strerror(ferror(f)));
                     return 1;
                 }
             }
@@ -322,8 +366,51 @@ int ReloadElfMemory(FILE* f, box86context_t* context, elfheader_t* head)
     return 0;
 }
 
+static uint32_t reloc_stats[2] = {0};   // relocations, global symbols found in the memoization
+static uint64_t reloc_time = 0;         // in us
+
+static uint64_t relocNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+// resolve global symbol symidx of head (local_maplib first, if any), memoized while the symbols in scope don't change
+static void resolveGlobalSymbol(lib_t *maplib, lib_t *local_maplib, elfheader_t* head, int symidx, const char* symname, uintptr_t* offs, uintptr_t* end)
+{
+    uint32_t scope = GetSymbolScope();
+    if(!head->symres || head->symres_scope!=scope || head->symres_maplib!=maplib || head->symres_local!=local_maplib) {
+        if(!head->symres)
+            head->symres = (symres_t*)calloc(head->numDynSym, sizeof(symres_t));
+        else
+            memset(head->symres, 0, head->numDynSym*sizeof(symres_t));
+        head->symres_scope = scope;
+        head->symres_maplib = maplib;
+        head->symres_local = local_maplib;
+    }
+    symres_t* r = &head->symres[symidx];
+    if(r->done) {
+        ++reloc_stats[1];
+        *offs = r->offs;
+        *end = r->end;
+        return;
+    }
+    if(local_maplib)
+        GetGlobalSymbolStartEnd(local_maplib, symname, offs, end);
+    if(!*offs && !*end)
+        GetGlobalSymbolStartEnd(maplib, symname, offs, end);
+    // a lib may have been loaded while resolving, the memoization is only valid if it's not the case
+    if(GetSymbolScope()==scope) {
+        r->offs = *offs;
+        r->end = *end;
+        r->done = 1;
+    }
+}
+
 int RelocateElfREL(lib_t *maplib, lib_t *local_maplib, elfheader_t* head, int cnt, Elf32_Rel *rel)
 {
+    reloc_stats[0] += cnt;
     for (int i=0; i<cnt; ++i) {
         int t = ELF32_R_TYPE(rel[i].r_info);
         Elf32_Sym *sym = &head->DynSym[ELF32_R_SYM(rel[i].r_info)];
@@ -347,10 +434,7 @@ int RelocateElfREL(lib_t *maplib, lib_t *local_maplib, elfheader_t* head, int cn
             // so weak symbol are the one left
             if(!offs && !end) {
                 h_tls = NULL;
-                if(local_maplib)
-                    GetGlobalSymbolStartEnd(local_maplib, symname, &offs, &end);
-                if(!offs && !end)
-                    GetGlobalSymbolStartEnd(maplib, symname, &offs, &end);
+                resolveGlobalSymbol(maplib, local_maplib, head, ELF32_R_SYM(rel[i].r_info), symname, &offs, &end);
             }
         }
         uintptr_t globoffs, globend;
@@ -508,6 +592,7 @@ int RelocateElfREL(lib_t *maplib, lib_t *local_maplib, elfheader_t* head, int cn
 
 int RelocateElfRELA(lib_t *maplib, lib_t *local_maplib, elfheader_t* head, int cnt, Elf32_Rela *rela)
 {
+    reloc_stats[0] += cnt;
     for (int i=0; i<cnt; ++i) {
         Elf32_Sym *sym = &head->DynSym[ELF32_R_SYM(rela[i].r_info)];
         const char* symname = SymName(head, sym);
@@ -538,7 +623,7 @@ int RelocateElfRELA(lib_t *maplib, lib_t *local_maplib, elfheader_t* head, int c
     }
     return 0;
 }
-int RelocateElf(lib_t *maplib, lib_t *local_maplib, elfheader_t* head)
+static int relocateElf(lib_t *maplib, lib_t *local_maplib, elfheader_t* head)
 {
     if(head->rel) {
         int cnt = head->relsz / head->relent;
@@ -558,7 +643,7 @@ int RelocateElf(lib_t *maplib, lib_t *local_maplib, elfheader_t* head)
     return 0;
 }
 
-int RelocateElfPlt(lib_t *maplib, lib_t *local_maplib, elfheader_t* head)
+static int relocateElfPlt(lib_t *maplib, lib_t *local_maplib, elfheader_t* head)
 {
     if(pltResolver==~0) {
         pltResolver = AddBridge(my_context->system, vFE, PltResolver, 0);
@@ -590,6 +675,32 @@ int RelocateElfPlt(lib_t *maplib, lib_t *local_maplib, elfheader_t* head)
     return 0;
 }
 
+int RelocateElf(lib_t *maplib, lib_t *local_maplib, elfheader_t* head)
+{
+    uint64_t t = relocNow();
+    int ret = relocateElf(maplib, local_maplib, head);
+    t = relocNow() - t;
+    reloc_time += t;
+    printf_log(LOG_DEBUG, "Relocation of %s done in %.2fms\n", head->name, t/1000.);
+    return ret;
+}
+
+int RelocateElfPlt(lib_t *maplib, lib_t *local_maplib, elfheader_t* head)
+{
+    uint64_t t = relocNow();
+    int ret = relocateElfPlt(maplib, local_maplib, head);
+    t = relocNow() - t;
+    reloc_time += t;
+    printf_log(LOG_DEBUG, "PLT Relocation of %s done in %.2fms\n", head->name, t/1000.);
+    return ret;
+}
+
+void PrintRelocationStats()
+{
+    printf_log(LOG_INFO, "Relocations: %u applied in %.2fms, %u global symbols found in elf memoization, %u/%u lookups found in global index\n",
+        reloc_stats[0], reloc_time/1000., reloc_stats[1], symbol_stats[1], symbol_stats[0]);
+}
+
 void CalcStack(elfheader_t* elf, uint32_t* stacksz, int* stackalign)
 {
     if(*stacksz < elf->stacksz)
@@ -720,6 +831,202 @@ void AddSymbols(lib_t *maplib, kh_mapsymbols_t* mapsymbols, kh_mapsymbols_t* wea
     
 }
 
+// AddSymbols filter for DynSym entries
+static int isDynSymExported(Elf32_Sym* sym)
+{
+    int type = ELF32_ST_TYPE(sym->st_info);
+    return (type==STT_OBJECT || type==STT_FUNC || type==STT_COMMON || type==STT_TLS  || type==STT_NOTYPE)
+        && (sym->st_other==0) && (sym->st_shndx!=0 && sym->st_shndx<=65521);
+}
+
+int ElfHasSymbolHash(elfheader_t* h)
+{
+    return h->DynSym && h->DynStr && (h->gnuhash || h->hash);
+}
+
+static uint32_t gnuHash(const char* name)
+{
+    uint32_t hash = 5381;
+    for(const unsigned char* p = (const unsigned char*)name; *p; ++p)
+        hash = hash*33 + *p;
+    return hash;
+}
+
+static uint32_t sysvHash(const char* name)
+{
+    uint32_t hash = 0;
+    for(const unsigned char* p = (const unsigned char*)name; *p; ++p) {
+        hash = (hash<<4) + *p;
+        uint32_t g = hash & 0xf0000000;
+        if(g)
+            hash ^= g>>24;
+        hash &= ~g;
+    }
+    return hash;
+}
+
+// is DynSym entry idx the symbol name, with a bind that goes in the map "weak"?
+static int isSymbolMatch(elfheader_t* h, uint32_t idx, const char* name, int weak)
+{
+    if(idx>=(uint32_t)h->numDynSym)
+        return 0;
+    Elf32_Sym* sym = &h->DynSym[idx];
+    int bind = ELF32_ST_BIND(sym->st_info);
+    if(bind==STB_LOCAL || (bind==STB_WEAK)!=(weak!=0))
+        return 0;
+    return isDynSymExported(sym) && !strcmp(h->DynStr+sym->st_name, name);
+}
+
+int ElfGetSymbol(elfheader_t* h, const char* name, int weak, uintptr_t* offs, uint32_t* sz)
+{
+    int found = -1; // like with AddSymbols, the last one wins
+    if(h->gnuhash) {
+        uint32_t* table = (uint32_t*)(h->gnuhash + h->delta);
+        uint32_t nbuckets = table[0];
+        uint32_t symoffset = table[1];
+        uint32_t bloomsz = table[2];
+        uint32_t bloomshift = table[3];
+        uint32_t* bloom = &table[4];
+        uint32_t* buckets = &bloom[bloomsz];
+        uint32_t* chain = &buckets[nbuckets];
+        uint32_t h1 = gnuHash(name);
+        // bloom filter first, most of the lookups stop here
+        uint32_t word = bloom[(h1/32)%bloomsz];
+        uint32_t mask = (1u<<(h1%32)) | (1u<<((h1>>bloomshift)%32));
+        if((word&mask)!=mask)
+            return 0;
+        uint32_t idx = buckets[h1%nbuckets];
+        if(idx<symoffset)
+            return 0;
+        while(1) {
+            uint32_t h2 = chain[idx-symoffset];
+            if((h1|1)==(h2|1) && isSymbolMatch(h, idx, name, weak))
+                found = idx;
+            if(h2&1)
+                break;
+            ++idx;
+        }
+    } else if(h->hash) {
+        uint32_t* table = (uint32_t*)(h->hash + h->delta);
+        uint32_t nbucket = table[0];
+        uint32_t* bucket = &table[2];
+        uint32_t* chain = &bucket[nbucket];
+        for(uint32_t idx = bucket[sysvHash(name)%nbucket]; idx; idx = chain[idx])
+            if((int)idx>found && isSymbolMatch(h, idx, name, weak))
+                found = idx;
+    }
+    if(found<0)
+        return 0;
+    Elf32_Sym* sym = &h->DynSym[found];
+    *offs = (ELF32_ST_TYPE(sym->st_info)==STT_TLS)?sym->st_value:(sym->st_value + h->delta);
+    *sz = sym->st_size;
+    return 1;
+}
+
+void AddLocalSymbols(kh_mapsymbols_t* localsymbols, elfheader_t* h)
+{
+    for (int i=0; i<h->numSymTab; ++i) {
+        Elf32_Sym* sym = &h->SymTab[i];
+        int type = ELF32_ST_TYPE(sym->st_info);
+        if(ELF32_ST_BIND(sym->st_info)==STB_LOCAL
+        && (type==STT_OBJECT || type==STT_FUNC || type==STT_COMMON || type==STT_TLS  || type==STT_NOTYPE)
+        && (sym->st_other==0) && (sym->st_shndx!=0))
+            AddSymbol(localsymbols, h->StrTab+sym->st_name, (type==STT_TLS)?sym->st_value:(sym->st_value + h->delta), sym->st_size);
+    }
+    for (int i=0; i<h->numDynSym; ++i) {
+        Elf32_Sym* sym = &h->DynSym[i];
+        if(ELF32_ST_BIND(sym->st_info)==STB_LOCAL && isDynSymExported(sym))
+            AddSymbol(localsymbols, h->DynStr+sym->st_name, (ELF32_ST_TYPE(sym->st_info)==STT_TLS)?sym->st_value:(sym->st_value + h->delta), sym->st_size);
+    }
+}
+
+// x86 copies of string functions that are redirected to the native ones (BOX86_NATIVE_STRFUNC)
+typedef struct strfunc_s {
+    const char* name;
+    wrapper_t   w;
+    void*       f;
+} strfunc_t;
+
+static const strfunc_t strfuncs[] = {
+    {"memcpy",  pFppL, memcpy},
+    {"memmove", pFppL, memmove},
+    {"memset",  pFpiL, memset},
+    {"memcmp",  iFppL, memcmp},
+    {"strlen",  LFp,   strlen},
+    {"strcmp",  iFpp,  strcmp},
+    {"strncmp", iFppL, strncmp},
+    {"strcpy",  pFpp,  strcpy},
+    {"strchr",  pFpi,  strchr},
+};
+
+// is name in the ':' separated list of BOX86_NATIVE_STRFUNC? (names prefixed with '-' are removed, else only the listed names are kept)
+static int strfuncAllowed(const char* name)
+{
+    if(!box86_native_strfunc_list)
+        return 1;
+    int whitelist = 0;
+    int listed = 0;
+    size_t l = strlen(name);
+    const char* p = box86_native_strfunc_list;
+    while(*p) {
+        const char* e = strchrnul(p, ':');
+        int black = (*p=='-');
+        const char* n = p+black;
+        if(!black)
+            whitelist = 1;
+        if((size_t)(e-n)==l && !strncmp(n, name, l)) {
+            if(black)
+                return 0;
+            listed = 1;
+        }
+        p = (*e)?(e+1):e;
+    }
+    return whitelist?listed:1;
+}
+
+static int redirectStrFunc(elfheader_t* h, const char* symname, Elf32_Sym* sym)
+{
+    if(ELF32_ST_TYPE(sym->st_info)!=STT_FUNC || !sym->st_shndx || sym->st_shndx>=SHN_LORESERVE)
+        return 0;
+    // local or hidden functions can use a register calling convention, or just be something else with the same name
+    int bind = ELF32_ST_BIND(sym->st_info);
+    if((bind!=STB_GLOBAL && bind!=STB_WEAK) || ELF32_ST_VISIBILITY(sym->st_other)!=STV_DEFAULT)
+        return 0;
+    if(sym->st_size<sizeof(onebridge_t))
+        return 0;   // not enough room for the bridge
+    for(int j=0; j<sizeof(strfuncs)/sizeof(strfuncs[0]); ++j)
+        if(!strcmp(symname, strfuncs[j].name)) {
+            if(!strfuncAllowed(symname))
+                return 0;
+            uintptr_t offs = sym->st_value + h->delta;
+            if(GetNativeFnc(offs))
+                return 0;   // already done (it's an alias)
+            onebridge_t* b = (onebridge_t*)offs;
+            b->CC = 0xCC;
+            b->S = 'S'; b->C = 'C';
+            b->w = strfuncs[j].w;
+            b->f = (uintptr_t)strfuncs[j].f;
+            b->C3 = 0xC3;
+            b->N = 0;
+            printf_log(LOG_INFO, "Redirecting x86 %s of %s (%p, %d bytes) to native %s\n", symname, ElfName(h), (void*)offs, sym->st_size, symname);
+            return 1;
+        }
+    return 0;
+}
+
+void RedirectStrFunctions(elfheader_t* h)
+{
+    if(!box86_native_strfunc)
+        return;
+    int cnt = 0;
+    for (int i=0; i<h->numSymTab; ++i)
+        cnt += redirectStrFunc(h, h->StrTab+h->SymTab[i].st_name, &h->SymTab[i]);
+    for (int i=0; i<h->numDynSym; ++i)
+        cnt += redirectStrFunc(h, h->DynStr+h->DynSym[i].st_name, &h->DynSym[i]);
+    if(cnt)
+        printf_log(LOG_INFO, "%d x86 string function(s) of %s redirected to native\n", cnt, ElfName(h));
+}
+
 /*
 $ORIGIN – Provides the directory the object was loaded from. This token is typical
 used for locating dependencies in unbundled packages. For more details of this
@@ -871,6 +1178,15 @@ void* GetElfDelta(elfheader_t* h)
     return (void*)h->delta;
 }
 
+uintptr_t GetElfGOT(elfheader_t* h)
+{
+    if(h->pltgot)
+        return h->pltgot+h->delta;
+    if(h->gotplt)
+        return h->gotplt+h->delta;
+    return 0;
+}
+
 uint32_t GetBaseSize(elfheader_t* h)
 {
     return h->memsz;
@@ -898,42 +1214,105 @@ elfheader_t* FindElfAddress(box86context_t *context, uintptr_t addr)
     return NULL;
 }
 
+static int compareNearSym(const void* a, const void* b)
+{
+    const nearsym_t* sa = (const nearsym_t*)a;
+    const nearsym_t* sb = (const nearsym_t*)b;
+    if(sa->offs!=sb->offs)
+        return (sa->offs<sb->offs)?-1:1;
+    // same address: keep SymTab / DynSym order, the first one is the one found
+    return sa->order-sb->order;
+}
+
+static __thread int near_noalloc = 0;   // in a signal handler, the index must not be built (malloc may be the one interrupted)
+
+void SetNearestSymbolNoAlloc(int on)
+{
+    near_noalloc = on;
+}
+
+// NULL if the index cannot be built
+static nearindex_t* getNearIndex(elfheader_t* h)
+{
+    nearindex_t* index = h->nearindex;
+    if(index)
+        return index;
+    int n = h->numSymTab + h->numDynSym;
+    index = (nearindex_t*)malloc(sizeof(nearindex_t)+n*sizeof(nearsym_t));
+    if(!index)
+        return NULL;
+    nearsym_t* syms = index->syms;
+    for (int i=0; i<h->numSymTab; ++i) {
+        syms[i].offs = h->SymTab[i].st_value + h->delta;
+        syms[i].sz = h->SymTab[i].st_size;
+        syms[i].name = h->StrTab+h->SymTab[i].st_name;
+        syms[i].order = i;
+    }
+    for (int i=0; i<h->numDynSym; ++i) {
+        syms[h->numSymTab+i].offs = h->DynSym[i].st_value + h->delta;
+        syms[h->numSymTab+i].sz = h->DynSym[i].st_size;
+        syms[h->numSymTab+i].name = h->DynStr+h->DynSym[i].st_name;
+        syms[h->numSymTab+i].order = h->numSymTab+i;
+    }
+    // qsort is not stable, so the original order is used to sort same address symbols (see compareNearSym)
+    qsort(syms, n, sizeof(nearsym_t), compareNearSym);
+    // only the first symbol of an address can be found
+    int j = 0;
+    for (int i=0; i<n; ++i)
+        if(!j || syms[i].offs!=syms[j-1].offs)
+            syms[j++] = syms[i];
+    index->size = j;
+    if(!__sync_bool_compare_and_swap(&h->nearindex, NULL, index)) {
+        // another thread was faster
+        free(index);
+        index = h->nearindex;
+    }
+    return index;
+}
+
 const char* FindNearestSymbolName(elfheader_t* h, void* p, uintptr_t* start, uint32_t* sz)
 {
     uintptr_t addr = (uintptr_t)p;
 
-    uint32_t distance = 0x7fffffff;
     const char* ret = NULL;
     uintptr_t s = 0;
     uint32_t size = 0;
     if(!h)
         return ret;
 
-    for (int i=0; i<h->numSymTab && distance!=0; ++i) {   
-        const char * symname = h->StrTab+h->SymTab[i].st_name;
-        uintptr_t offs = h->SymTab[i].st_value + h->delta;
-
-        if(offs<=addr) {
-            if(distance>addr-offs) {
+    nearindex_t* index = near_noalloc?h->nearindex:getNearIndex(h);
+    if(!index) {
+        // no index, scan all the symbols
+        uint32_t distance = 0x7fffffff;
+        for (int i=0; i<h->numSymTab+h->numDynSym && distance!=0; ++i) {
+            Elf32_Sym* sym = (i<h->numSymTab)?&h->SymTab[i]:&h->DynSym[i-h->numSymTab];
+            uintptr_t offs = sym->st_value + h->delta;
+            if(offs<=addr && distance>addr-offs) {
                 distance = addr-offs;
-                ret = symname;
+                ret = ((i<h->numSymTab)?h->StrTab:h->DynStr)+sym->st_name;
                 s = offs;
-                size = h->SymTab[i].st_size;
+                size = sym->st_size;
             }
         }
+        if(start)
+            *start = s;
+        if(sz)
+            *sz = size;
+        return ret;
     }
-    for (int i=0; i<h->numDynSym && distance!=0; ++i) {   
-        const char * symname = h->DynStr+h->DynSym[i].st_name;
-        uintptr_t offs = h->DynSym[i].st_value + h->delta;
-
-        if(offs<=addr) {
-            if(distance>addr-offs) {
-                distance = addr-offs;
-                ret = symname;
-                s = offs;
-                size = h->DynSym[i].st_size;
-            }
-        }
+    // last symbol with offs<=addr
+    int lo = 0, hi = index->size;
+    while(lo<hi) {
+        int mid = (lo+hi)/2;
+        if(index->syms[mid].offs<=addr)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    if(lo && addr-index->syms[lo-1].offs<0x7fffffff) {
+        ret = index->syms[lo-1].name;
+        s = index->syms[lo-1].offs;
+        size = index->syms[lo-1].sz;
     }
 
     if(start)
@@ -3,10 +3,31 @@
 
 #ifdef DYNAREC
 typedef struct dynablocklist_s dynablocklist_t;
+typedef struct dynacache_s dynacache_t;
 #endif
 
 typedef struct library_s library_t;
 typedef struct needed_libs_s needed_libs_t;
+typedef struct lib_s lib_t;
+
+// sorted index of the symbols by address, for FindNearestSymbolName
+typedef struct nearsym_s {
+    uintptr_t   offs;
+    uint32_t    sz;
+    const char* name;
+    int         order;  // index in SymTab then DynSym
+} nearsym_t;
+typedef struct nearindex_s {
+    int         size;
+    nearsym_t   syms[0];
+} nearindex_t;
+
+// a global symbol of DynSym already resolved by the relocations
+typedef struct symres_s {
+    uintptr_t   offs;
+    uintptr_t   end;
+    int         done;
+} symres_t;
 
 #include <pthread.h>
 
@@ -30,6 +51,8 @@ struct elfheader_s {
     int         numDynamic;
     char*       DynStrTab;
     int         szDynStrTab;
+    uintptr_t   gnuhash;    // DT_GNU_HASH (0 if none)
+    uintptr_t   hash;       // DT_HASH (0 if none)
 
     intptr_t    delta;  // should be 0
 
@@ -79,6 +102,15 @@ struct elfheader_s {
 
     library_t   *lib;
     needed_libs_t *neededlibs;
+
+    nearindex_t * volatile nearindex;   // built on first use, then shared by all threads
+    symres_t    *symres;        // memoization of the resolved DynSym (numDynSym entries)
+    uint32_t    symres_scope;   // symbol scope, maplib and local_maplib used for symres
+    lib_t       *symres_maplib;
+    lib_t       *symres_local;
+#ifdef DYNAREC
+    dynacache_t *dynacache; // persistent dynarec cache for this elf (NULL if not used)
+#endif
 };
 
 #define R_386_NONE	0
@@ -212,6 +212,10 @@ elfheader_t* ParseElfHeader(FILE* f, const char* name, int exec)
                     h->DynStrTab = (char*)(h->Dynamic[i].d_un.d_ptr);
                 else if(h->Dynamic[i].d_tag == DT_STRSZ)
                     h->szDynStrTab = h->Dynamic[i].d_un.d_val;
+                else if(h->Dynamic[i].d_tag == DT_GNU_HASH)
+                    h->gnuhash = h->Dynamic[i].d_un.d_ptr;
+                else if(h->Dynamic[i].d_tag == DT_HASH)
+                    h->hash = h->Dynamic[i].d_un.d_ptr;
             }
             if(h->rel) {
                 if(h->relent != sizeof(Elf32_Rel)) {
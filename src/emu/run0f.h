@@ -29,8 +29,17 @@
             NEXT;
 
         _0f_0x0B:                      /* UD2 */
+            #ifdef BOX86CORE
+            // no signal handling in the core, stop on the opcode
+            emu->old_ip = R_EIP;
+            R_EIP = ip;
+            emu->quit = 1;
+            emu->error |= ERR_ILLEGAL;
+            goto fini;
+            #else
             kill(getpid(), SIGILL);              // this is undefined instruction
             NEXT;
+            #endif
         _0f_0x10:                      /* MOVUPS Gx,Ex */
             nextop = F8;
             GET_EX;
@@ -198,7 +207,7 @@
                         if(EM->ub[i]&128)
                             GM.ub[i] = 0;
                         else
-                            GM.ub[i] = eax1.ub[EM->ub[i]&7];
+                            GM.ub[i] = eam1.ub[EM->ub[i]&7];
                     }
                     break;
                 case 0x04:  /* PMADDUBSW Gm,Em */
@@ -373,38 +382,32 @@
         _0f_0x54:                      /* ANDPS Gx, Ex */
             nextop = F8;
             GET_EX;
-            for(int i=0; i<4; ++i)
-                GX.ud[i] &= EX->ud[i];
+            sse_pand(&GX, EX);
             NEXT;
         _0f_0x55:                      /* ANDNPS Gx, Ex */
             nextop = F8;
             GET_EX;
-            for(int i=0; i<4; ++i)
-                GX.ud[i] = (~GX.ud[i]) & EX->ud[i];
+            sse_pandn(&GX, EX);
             NEXT;
         _0f_0x56:                      /* ORPS Gx, Ex */
             nextop = F8;
             GET_EX;
-            for(int i=0; i<4; ++i)
-                GX.ud[i] |= EX->ud[i];
+            sse_por(&GX, EX);
             NEXT;
         _0f_0x57:                      /* XORPS Gx, Ex */
             nextop = F8;
             GET_EX;
-            for(int i=0; i<4; ++i)
-                GX.ud[i] ^= EX->ud[i];
+            sse_pxor(&GX, EX);
             NEXT;
         _0f_0x58:                      /* ADDPS Gx, Ex */
             nextop = F8;
             GET_EX;
-            for(int i=0; i<4; ++i)
-                GX.f[i] += EX->f[i];
+            sse_addps(&GX, EX);
             NEXT;
         _0f_0x59:                      /* MULPS Gx, Ex */
             nextop = F8;
             GET_EX;
-            for(int i=0; i<4; ++i)
-                GX.f[i] *= EX->f[i];
+            sse_mulps(&GX, EX);
             NEXT;
         _0f_0x5A:                      /* CVTPS2PD Gx, Ex */
             nextop = F8;
@@ -423,128 +426,82 @@
         _0f_0x5C:                      /* SUBPS Gx, Ex */
             nextop = F8;
             GET_EX;
-            for(int i=0; i<4; ++i)
-                GX.f[i] -= EX->f[i];
+            sse_subps(&GX, EX);
             NEXT;
         _0f_0x5D:                      /* MINPS Gx, Ex */
             nextop = F8;
             GET_EX;
-            for(int i=0; i<4; ++i) {
-                if (isnan(GX.f[i]) || isnan(EX->f[i]) || isless(EX->f[i], GX.f[i]))
-                    GX.f[i] = EX->f[i];
-            }
+            sse_minps(&GX, EX);
             NEXT;
         _0f_0x5E:                      /* DIVPS Gx, Ex */
             nextop = F8;
             GET_EX;
-            for(int i=0; i<4; ++i)
-                GX.f[i] /= EX->f[i];
+            sse_divps(&GX, EX);
             NEXT;
         _0f_0x5F:                      /* MAXPS Gx, Ex */
             nextop = F8;
             GET_EX;
-            for(int i=0; i<4; ++i) {
-                if (isnan(GX.f[i]) || isnan(EX->f[i]) || isgreater(EX->f[i], GX.f[i]))
-                    GX.f[i] = EX->f[i];
-            }
+            sse_maxps(&GX, EX);
             NEXT;
         _0f_0x60:                      /* PUNPCKLBW Gm, Em */
             nextop = F8;
             GET_EM;
-            GM.ub[7] = EM->ub[3];
-            GM.ub[6] = GM.ub[3];
-            GM.ub[5] = EM->ub[2];
-            GM.ub[4] = GM.ub[2];
-            GM.ub[3] = EM->ub[1];
-            GM.ub[2] = GM.ub[1];
-            GM.ub[1] = EM->ub[0];
+            mmx_punpcklbw(&GM, EM);
             NEXT;
         _0f_0x61:                      /* PUNPCKLWD Gm, Em */
             nextop = F8;
             GET_EM;
-            GM.uw[3] = EM->uw[1];
-            GM.uw[2] = GM.uw[1];
-            GM.uw[1] = EM->uw[0];
+            mmx_punpcklwd(&GM, EM);
             NEXT;
         _0f_0x62:                      /* PUNPCKLDQ Gm, Em */
             nextop = F8;
             GET_EM;
-            GM.ud[1] = EM->ud[0];
+            mmx_punpckldq(&GM, EM);
             NEXT;
         _0f_0x63:                      /* PACKSSWB Gm, Em */
             nextop = F8;
             GET_EM;
-            GM.sb[0] = (GM.sw[0] > 127) ? 127 : ((GM.sw[0] < -128) ? -128 : GM.sw[0]);
-            GM.sb[1] = (GM.sw[1] > 127) ? 127 : ((GM.sw[1] < -128) ? -128 : GM.sw[1]);
-            GM.sb[2] = (GM.sw[2] > 127) ? 127 : ((GM.sw[2] < -128) ? -128 : GM.sw[2]);
-            GM.sb[3] = (GM.sw[3] > 127) ? 127 : ((GM.sw[3] < -128) ? -128 : GM.sw[3]);
-            GM.sb[4] = (EM->sw[0] > 127) ? 127 : ((EM->sw[0] < -128) ? -128 : EM->sw[0]);
-            GM.sb[5] = (EM->sw[1] > 127) ? 127 : ((EM->sw[1] < -128) ? -128 : EM->sw[1]);
-            GM.sb[6] = (EM->sw[2] > 127) ? 127 : ((EM->sw[2] < -128) ? -128 : EM->sw[2]);
-            GM.sb[7] = (EM->sw[3] > 127) ? 127 : ((EM->sw[3] < -128) ? -128 : EM->sw[3]);
+            mmx_packsswb(&GM, EM);
             NEXT;
         _0f_0x64:                       /* PCMPGTB Gm,Em */
             nextop = F8;
             GET_EM;
-            for (int i = 0; i < 8; i++) {
-                GM.ub[i] = (GM.sb[i] > EM->sb[i]) ? 0xFF : 0;
-            }
+            mmx_pcmpgtb(&GM, EM);
             NEXT;
         _0f_0x65:                       /* PCMPGTW Gm,Em */
             nextop = F8;
             GET_EM;
-            for (int i = 0; i < 4; i++) {
-                GM.uw[i] = (GM.sw[i] > EM->sw[i]) ? 0xFFFF : 0;
-            }
+            mmx_pcmpgtw(&GM, EM);
             NEXT;
         _0f_0x66:                       /* PCMPGTD Gm,Em */
             nextop = F8;
             GET_EM;
-            for (int i = 0; i < 2; i++) {
-                GM.ud[i] = (GM.sd[i] > EM->sd[i]) ? 0xFFFFFFFF : 0;
-            }
+            mmx_pcmpgtd(&GM, EM);
             NEXT;
         _0f_0x67:                       /* PACKUSWB Gm, Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<4; ++i)
-                GM.ub[i] = (GM.sw[i]<0)?0:((GM.sw[i]>0xff)?0xff:GM.sw[i]);
-            for(int i=0; i<4; ++i)
-                GM.ub[4+i] = (EM->sw[i]<0)?0:((EM->sw[i]>0xff)?0xff:EM->sw[i]);
+            mmx_packuswb(&GM, EM);
             NEXT;
         _0f_0x68:                       /* PUNPCKHBW Gm,Em */
             nextop = F8;
             GET_EM;
-            if(EM==&GM) {eam1 = GM; EM = &eam1;}   // copy is needed
-            for(int i=0; i<4; ++i)
-                GM.ub[2 * i] = GM.ub[i + 4];
-            for(int i=0; i<4; ++i)
-                GM.ub[2 * i + 1] = EM->ub[i + 4];
+            mmx_punpckhbw(&GM, EM);
             NEXT;
         _0f_0x69:                       /* PUNPCKHWD Gm,Em */
             nextop = F8;
             GET_EM;
-            if(EM==&GM) {eam1 = GM; EM = &eam1;}   // copy is needed
-            for(int i=0; i<2; ++i)
-                GM.uw[2 * i] = GM.uw[i + 2];
-            for(int i=0; i<2; ++i)
-                GM.uw[2 * i + 1] = EM->uw[i + 2];
+            mmx_punpckhwd(&GM, EM);
             NEXT;
         _0f_0x6A:                       /* PUNPCKHDQ Gm,Em */
             nextop = F8;
             GET_EM;
-            if(EM==&GM) {eam1 = GM; EM = &eam1;}   // copy is needed
-            GM.ud[0] = GM.ud[1];
-            GM.ud[1] = EM->ud[1];
+            mmx_punpckhdq(&GM, EM);
             NEXT;
         _0f_0x6B:                       /* PACKSSDW Gm,Em */
             nextop = F8;
             GET_EM;
-            if(EM==&GM) {eam1 = GM; EM = &eam1;}   // copy is needed
-            for(int i=0; i<2; ++i)
-                GM.sw[i] = (GM.sd[i]<-32768)?-32768:((GM.sd[i]>32767)?32767:GM.sd[i]);
-            for(int i=0; i<2; ++i)
-                GM.sw[2+i] = (EM->sd[i]<-32768)?-32768:((EM->sd[i]>32767)?32767:EM->sd[i]);
+            mmx_packssdw(&GM, EM);
             NEXT;
 
         _0f_0x6E:                      /* MOVD Gm, Ed */
@@ -560,10 +517,7 @@
         _0f_0x70:                       /* PSHUFW Gm, Em, Ib */
             nextop = F8;
             GET_EM;
-            tmp8u = F8;
-            if(EM==&GM) {eam1 = GM; EM = &eam1;}   // copy is needed
-            for(int i=0; i<4; ++i)
-                GM.uw[i] = EM->uw[(tmp8u>>(i*2))&3];
+            mmx_pshufw(&GM, EM, F8);
             NEXT;
         _0f_0x71:  /* GRP */
             nextop = F8;
@@ -642,23 +596,17 @@
         _0f_0x74:                       /* PCMPEQB Gm,Em */
             nextop = F8;
             GET_EM;
-            for (int i = 0; i < 8; i++) {
-                GM.ub[i] = (GM.sb[i] == EM->sb[i]) ? 0xFF : 0;
-            }
+            mmx_pcmpeqb(&GM, EM);
             NEXT;
         _0f_0x75:                       /* PCMPEQW Gm,Em */
             nextop = F8;
             GET_EM;
-            for (int i = 0; i < 4; i++) {
-                GM.uw[i] = (GM.sw[i] == EM->sw[i]) ? 0xFFFF : 0;
-            }
+            mmx_pcmpeqw(&GM, EM);
             NEXT;
         _0f_0x76:                       /* PCMPEQD Gm,Em */
             nextop = F8;
             GET_EM;
-            for (int i = 0; i < 2; i++) {
-                GM.ud[i] = (GM.sd[i] == EM->sd[i]) ? 0xFFFFFFFF : 0;
-            }
+            mmx_pcmpeqd(&GM, EM);
             NEXT;
         _0f_0x77:                      /* EMMS */
             // empty MMX, FPU now usable
@@ -1093,10 +1041,7 @@
         _0f_0xD5:                   /* PMULLW Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<4; ++i) {
-                tmp32s = (int32_t)GM.sw[i] * EM->sw[i];
-                GM.sw[i] = tmp32s;
-            }
+            mmx_pmullw(&GM, EM);
             NEXT;
 
         _0f_0xD7:                   /* PMOVMSKB Gd,Em */
@@ -1113,18 +1058,12 @@
         _0f_0xD8:                   /* PSUBUSB Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<8; ++i) {
-                tmp32s = (int32_t)GM.ub[i] - EM->ub[i];
-                GM.ub[i] = (tmp32s < 0) ? 0 : tmp32s;
-            }
+            mmx_psubusb(&GM, EM);
             NEXT;
         _0f_0xD9:                   /* PSUBUSW Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<4; ++i) {
-                tmp32s = (int32_t)GM.uw[i] - EM->uw[i];
-                GM.uw[i] = (tmp32s < 0) ? 0 : tmp32s;
-            }
+            mmx_psubusw(&GM, EM);
             NEXT;
 
         _0f_0xDB:                   /* PAND Gm,Em */
@@ -1135,18 +1074,12 @@
         _0f_0xDC:                   /* PADDUSB Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<8; ++i) {
-                tmp32u = (uint32_t)GM.ub[i] + EM->ub[i];
-                GM.ub[i] = (tmp32u>255) ? 255 : tmp32u;
-            }
+            mmx_paddusb(&GM, EM);
             NEXT;
         _0f_0xDD:                   /* PADDUSW Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<4; ++i) {
-                tmp32u = (uint32_t)GM.uw[i] + EM->uw[i];
-                GM.uw[i] = (tmp32u>65535) ? 65535 : tmp32u;
-            }
+            mmx_paddusw(&GM, EM);
             NEXT;
 
         _0f_0xDF:                   /* PANDN Gm,Em */
@@ -1157,8 +1090,7 @@
         _0f_0xE0:                   /* PAVGB Gm, Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<8; ++i)
-                    GM.ub[i] = ((uint32_t)GM.ub[i]+EM->ub[i]+1)>>1;
+            mmx_pavgb(&GM, EM);
             NEXT;
         _0f_0xE1:                   /* PSRAW Gm, Em */
             nextop = F8;
@@ -1194,18 +1126,12 @@
         _0f_0xE4:                   /* PMULHUW Gm, Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<4; ++i) {
-                tmp32u = (int32_t)GM.uw[i] * EM->uw[i];
-                GM.uw[i] = (tmp32u>>16)&0xffff;
-            }
+            mmx_pmulhuw(&GM, EM);
             NEXT;
         _0f_0xE5:                   /* PMULHW Gm, Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<4; ++i) {
-                tmp32s = (int32_t)GM.sw[i] * EM->sw[i];
-                GM.uw[i] = (tmp32s>>16)&0xffff;
-            }
+            mmx_pmulhw(&GM, EM);
             NEXT;
 
         _0f_0xE7:                   /* MOVNTQ Em,Gm */
@@ -1218,24 +1144,17 @@
         _0f_0xE8:                   /* PSUBSB Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<8; ++i) {
-                tmp32s = (int32_t)GM.sb[i] - EM->sb[i];
-                GM.sb[i] = (tmp32s>127)?127:((tmp32s<-128)?-128:tmp32s);
-            }
+            mmx_psubsb(&GM, EM);
             NEXT;
         _0f_0xE9:                   /* PSUBSW Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<4; ++i) {
-                tmp32s = (int32_t)GM.sw[i] - EM->sw[i];
-                GM.sw[i] = (tmp32s>32767)?32767:((tmp32s<-32768)?-32768:tmp32s);
-            }
+            mmx_psubsw(&GM, EM);
             NEXT;
         _0f_0xEA:                   /* PMINSW Gm,Em */
             nextop = F8;
             GET_EM;
-            for (int i=0; i<4; ++i)
-                GM.sw[i] = (GM.sw[i]<EM->sw[i])?GM.sw[i]:EM->sw[i];
+            mmx_pminsw(&GM, EM);
             NEXT;
         _0f_0xEB:                   /* POR Gm, Em */
             nextop = F8;
@@ -1245,24 +1164,17 @@
         _0f_0xEC:                   /* PADDSB Gm, Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<8; ++i) {
-                tmp32s = (int32_t)GM.sb[i] + EM->sb[i];
-                GM.sb[i] = (tmp32s>127)?127:((tmp32s<-128)?-128:tmp32s);
-            }
+            mmx_paddsb(&GM, EM);
             NEXT;
         _0f_0xED:                   /* PADDSW Gm, Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<4; ++i) {
-                tmp32s = (int32_t)GM.sw[i] + EM->sw[i];
-                GM.sw[i] = (tmp32s>32767)?32767:((tmp32s<-32768)?-32768:tmp32s);
-            }
+            mmx_paddsw(&GM, EM);
             NEXT;
         _0f_0xEE:                   /* PMAXSW Gm,Em */
             nextop = F8;
             GET_EM;
-            for (int i=0; i<4; ++i)
-                GM.sw[i] = (GM.sw[i]>EM->sw[i])?GM.sw[i]:EM->sw[i];
+            mmx_pmaxsw(&GM, EM);
             NEXT;
         _0f_0xEF:                   /* PXOR Gm, Em */
             nextop = F8;
@@ -1305,21 +1217,12 @@
         _0f_0xF5:                   /* PMADDWD Gm, Em */
             nextop = F8;
             GET_EM;
-            for (int i=0; i<2; ++i) {
-                int offset = i * 2;
-
-                tmp32s = (int32_t)GM.sw[offset + 0] * EM->sw[offset + 0];
-                tmp32s2 = (int32_t)GM.sw[offset + 1] * EM->sw[offset + 1];
-                GM.sd[i] = tmp32s + tmp32s2;
-            }
+            mmx_pmaddwd(&GM, EM);
             NEXT;
         _0f_0xF6:                   /* PSADBW Gm, Em */
             nextop = F8;
             GET_EM;
-            tmp32u = 0;
-            for (int i=0; i<8; ++i)
-                tmp32u += (GM.ub[i]>EM->ub[i])?(GM.ub[i] - EM->ub[i]):(EM->ub[i] - GM.ub[i]);
-            GM.q = tmp32u;
+            mmx_psadbw(&GM, EM);
             NEXT;
         _0f_0xF7:                   /* MASKMOVQ Gm, Em */
             nextop = F8;
@@ -1333,37 +1236,31 @@
         _0f_0xF8:                   /* PSUBB Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<8; ++i)
-                GM.sb[i] -= EM->sb[i];
+            mmx_psubb(&GM, EM);
             NEXT;
         _0f_0xF9:                   /* PSUBW Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<4; ++i)
-                GM.sw[i] -= EM->sw[i];
+            mmx_psubw(&GM, EM);
             NEXT;
         _0f_0xFA:                   /* PSUBD Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<2; ++i)
-                GM.sd[i] -= EM->sd[i];
+            mmx_psubd(&GM, EM);
             NEXT;
 
         _0f_0xFC:                   /* PADDB Gm, Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<8; ++i)
-                GM.sb[i] += EM->sb[i];
+            mmx_paddb(&GM, EM);
             NEXT;
         _0f_0xFD:                   /* PADDW Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<4; ++i)
-                GM.sw[i] += EM->sw[i];
+            mmx_paddw(&GM, EM);
             NEXT;
         _0f_0xFE:                   /* PADDD Gm,Em */
             nextop = F8;
             GET_EM;
-            for(int i=0; i<2; ++i)
-                GM.sd[i] += EM->sd[i];
+            mmx_paddd(&GM, EM);
             NEXT;
@@ -0,0 +1,43 @@
+#include <stdint.h>
+#include <sched.h>
+
+#include "x86atomic.h"
+
+// striped locks for the misaligned atomic operands. One stripe per 64 bytes line of the operand address
+#define STRIPES_BITS    8
+#define STRIPES_SHIFT   6
+
+static uint32_t stripes[1<<STRIPES_BITS] __attribute__((aligned(64))) = {0};
+
+#define STRIPE(A)   &stripes[(((uintptr_t)(A))>>STRIPES_SHIFT)&((1<<STRIPES_BITS)-1)]
+
+void x86atomic_lock(void* p)
+{
+    uint32_t* l = STRIPE(p);
+    while(__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE)) {
+        while(__atomic_load_n(l, __ATOMIC_RELAXED))
+            sched_yield();
+    }
+}
+
+void x86atomic_unlock(void* p)
+{
+    __atomic_store_n(STRIPE(p), 0, __ATOMIC_RELEASE);
+}
+
+#define GO(N, T)                                        \
+int x86atomic_cas_##N##_slow(void* p, T old, T val)     \
+{                                                       \
+    int ret = 0;                                        \
+    x86atomic_lock(p);                                  \
+    if(*(volatile T*)p == old) {                        \
+        *(volatile T*)p = val;                          \
+        ret = 1;                                        \
+    }                                                   \
+    x86atomic_unlock(p);                                \
+    return ret;                                         \
+}
+
+GO(d, uint32_t)
+GO(dd, uint64_t)
+#undef GO
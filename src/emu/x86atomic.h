@@ -0,0 +1,73 @@
+#ifndef __X86ATOMIC_H_
+#define __X86ATOMIC_H_
+#include <stdint.h>
+
+// Host atomics for LOCK prefixed opcodes and XCHG, when there is no dynarec (that use ldrex/strex).
+// Naturally aligned operands use the __atomic builtins, misaligned ones (that may cross
+// a cache line) use a striped lock table indexed by the address, so the same operand
+// always uses the same lock.
+
+void x86atomic_lock(void* p);
+void x86atomic_unlock(void* p);
+int x86atomic_cas_d_slow(void* p, uint32_t old, uint32_t val);
+int x86atomic_cas_dd_slow(void* p, uint64_t old, uint64_t val);
+
+// read the operand, to be used with a cas. The cas will check the value anyway
+static inline uint8_t x86atomic_read_b(void* p)
+{
+    return __atomic_load_n((uint8_t*)p, __ATOMIC_RELAXED);
+}
+static inline uint32_t x86atomic_read_d(void* p)
+{
+    if(((uintptr_t)p)&3)
+        return *(volatile uint32_t*)p;
+    return __atomic_load_n((uint32_t*)p, __ATOMIC_RELAXED);
+}
+static inline uint64_t x86atomic_read_dd(void* p)
+{
+    if(((uintptr_t)p)&7) {
+        uint64_t ret;
+        x86atomic_lock(p);
+        ret = *(volatile uint64_t*)p;
+        x86atomic_unlock(p);
+        return ret;
+    }
+    return __atomic_load_n((uint64_t*)p, __ATOMIC_RELAXED);
+}
+
+// compare and swap, return 1 if the value was old and has been replaced by val (like a x86 lock cmpxchg)
+static inline int x86atomic_cas_b(void* p, uint8_t old, uint8_t val)
+{
+    return __atomic_compare_exchange_n((uint8_t*)p, &old, val, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+static inline int x86atomic_cas_d(void* p, uint32_t old, uint32_t val)
+{
+    if(((uintptr_t)p)&3)
+        return x86atomic_cas_d_slow(p, old, val);
+    return __atomic_compare_exchange_n((uint32_t*)p, &old, val, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+static inline int x86atomic_cas_dd(void* p, uint64_t old, uint64_t val)
+{
+    if(((uintptr_t)p)&7)
+        return x86atomic_cas_dd_slow(p, old, val);
+    return __atomic_compare_exchange_n((uint64_t*)p, &old, val, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// exchange, return the old value
+static inline uint8_t x86atomic_xchg_b(void* p, uint8_t val)
+{
+    return __atomic_exchange_n((uint8_t*)p, val, __ATOMIC_SEQ_CST);
+}
+static inline uint32_t x86atomic_xchg_d(void* p, uint32_t val)
+{
+    if(((uintptr_t)p)&3) {
+        uint32_t old;
+        do {
+            old = x86atomic_read_d(p);
+        } while(!x86atomic_cas_d_slow(p, old, val));
+        return old;
+    }
+    return __atomic_exchange_n((uint32_t*)p, val, __ATOMIC_SEQ_CST);
+}
+
+#endif //__X86ATOMIC_H_
@@ -85,6 +85,14 @@ typedef struct x86emu_s {
 
     int         type;       // EMUTYPE_xxx define
 
+    #ifdef BOX86CORE
+    // libbox86core run control
+    uint64_t    core_icount;    // instructions executed
+    uint64_t    core_ilimit;    // stop when core_icount reach this (0 for no limit)
+    int         core_nbp;       // number of breakpoints
+    uint32_t    core_bp[16];    // BOX86CORE_MAXBP
+    int         core_stop;      // BOX86CORE_xxx reason of the stop
+    #endif
 } x86emu_t;
 
 #define EMUTYPE_NONE    0
@@ -0,0 +1,527 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "box86context.h"
+#include "x86predecode.h"
+
+#define PD_MAXINST  64      // maximum number of instructions in a block
+#define PD_HASHBITS 16
+#define PD_PAGESHIFT 12
+#define PD_PAGESIZE (1<<PD_PAGESHIFT)
+#define PD_PAGES    (1<<(32-PD_PAGESHIFT))
+#define PD_DIRBITS  10
+#define PD_RELEASE  16      // try to free the retired blocks every PD_RELEASE retirements
+
+typedef struct pdpage_s {
+    predecode_t*    blocks;                 // blocks starting in the page
+    uint8_t         slow[PD_PAGESIZE/8];    // addresses where the first instruction is not pre-decoded
+} pdpage_t;
+
+// epoch of the threads running pre-decoded blocks, like for the dynablocks: a retired block
+// is freed once all the threads running pre-decoded blocks have started after its retirement
+typedef struct pdepoch_s {
+    volatile uint32_t   epoch;  // 0 when thread is not running pre-decoded blocks
+    volatile int        used;
+    struct pdepoch_s*   next;
+} pdepoch_t;
+
+static predecode_t* pd_hash[1<<PD_HASHBITS] = {0};
+static pdpage_t** pd_dir[PD_PAGES>>PD_DIRBITS] = {0};  // pages with pre-decoded blocks or slow addresses, created on demand
+static predecode_t* pd_retired = NULL;     // invalidated blocks, some thread may still be running them
+static int pd_retired_since = 0;
+static pthread_mutex_t pd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t pd_protected[PD_PAGES/8] = {0};  // pages write protected because they contains pre-decoded code
+static uint8_t pd_volatile[PD_PAGES/8] = {0};   // pages written after being pre-decoded, not pre-decoded anymore
+
+static volatile uint32_t    pd_epoch = 1;
+static pdepoch_t* volatile  pd_epoch_list = NULL;
+static __thread pdepoch_t*  pd_thread_epoch = NULL;
+static __thread int         pd_thread_level = 0;
+static pthread_key_t        pd_epoch_key;
+static pthread_once_t       pd_epoch_key_once = PTHREAD_ONCE_INIT;
+
+#define PDHASH(A)   ((((uintptr_t)(A))^(((uintptr_t)(A))>>PD_HASHBITS))&((1<<PD_HASHBITS)-1))
+#define PDPAGE(A)   (((uintptr_t)(A))>>PD_PAGESHIFT)
+
+static inline int testPage(uint8_t* map, uintptr_t addr)
+{
+    uintptr_t p = PDPAGE(addr);
+    return (map[p>>3]>>(p&7))&1;
+}
+static inline void setPage(uint8_t* map, uintptr_t p)
+{
+    map[p>>3] |= 1<<(p&7);
+}
+static inline void clearPage(uint8_t* map, uintptr_t p)
+{
+    map[p>>3] &= ~(1<<(p&7));
+}
+static int testRange(uint8_t* map, uintptr_t addr, uintptr_t size)
+{
+    for(uintptr_t p=PDPAGE(addr); p<=PDPAGE(addr+size-1); ++p)
+        if((map[p>>3]>>(p&7))&1)
+            return 1;
+    return 0;
+}
+
+// page p, created if needed (need pd_mutex then), NULL if not created
+static pdpage_t* getPage(uintptr_t p, int create)
+{
+    pdpage_t** dir = pd_dir[p>>PD_DIRBITS];
+    if(!dir) {
+        if(!create)
+            return NULL;
+        dir = (pdpage_t**)calloc(1<<PD_DIRBITS, sizeof(pdpage_t*));
+        if(!dir)
+            return NULL;
+        __sync_synchronize();
+        pd_dir[p>>PD_DIRBITS] = dir;
+    }
+    pdpage_t* page = dir[p&((1<<PD_DIRBITS)-1)];
+    if(!page && create) {
+        page = (pdpage_t*)calloc(1, sizeof(pdpage_t));
+        if(!page)
+            return NULL;
+        __sync_synchronize();   // page must be clean before being visible
+        dir[p&((1<<PD_DIRBITS)-1)] = page;
+    }
+    return page;
+}
+
+static void pd_epoch_destroy(void* p)
+{
+    pdepoch_t* e = (pdepoch_t*)p;
+    e->epoch = 0;
+    __sync_synchronize();
+    e->used = 0;
+}
+static void pd_epoch_key_alloc()
+{
+    pthread_key_create(&pd_epoch_key, pd_epoch_destroy);
+}
+
+static pdepoch_t* getThreadEpoch()
+{
+    if(pd_thread_epoch)
+        return pd_thread_epoch;
+    // recycle a slot from a dead thread, or create a new one
+    pdepoch_t* e = pd_epoch_list;
+    while(e && !(!e->used && __sync_bool_compare_and_swap(&e->used, 0, 1)))
+        e = e->next;
+    if(!e) {
+        e = (pdepoch_t*)calloc(1, sizeof(pdepoch_t));
+        e->used = 1;
+        do {
+            e->next = pd_epoch_list;
+        } while(!__sync_bool_compare_and_swap(&pd_epoch_list, e->next, e));
+    }
+    pthread_once(&pd_epoch_key_once, pd_epoch_key_alloc);
+    pthread_setspecific(pd_epoch_key, e);
+    pd_thread_epoch = e;
+    return e;
+}
+
+void PredecodeEnter()
+{
+    if(!pd_thread_level++) {
+        pdepoch_t* e = getThreadEpoch();
+        e->epoch = pd_epoch;
+        __sync_synchronize();
+    }
+}
+
+void PredecodeLeave()
+{
+    if(pd_thread_level && !--pd_thread_level) {
+        __sync_synchronize();
+        pd_thread_epoch->epoch = 0;
+    }
+}
+
+int PredecodeGetLevel()
+{
+    return pd_thread_level;
+}
+
+void PredecodeSetLevel(int level)
+{
+    pd_thread_level = level;
+    if(!level && pd_thread_epoch)
+        pd_thread_epoch->epoch = 0;
+}
+
+// free the retired blocks no thread can be running anymore, need pd_mutex
+static void releaseRetired()
+{
+    __sync_synchronize();
+    uint32_t oldest = 0;
+    for(pdepoch_t* e = pd_epoch_list; e; e = e->next) {
+        uint32_t epoch = e->epoch;
+        if(epoch && (!oldest || epoch<oldest))
+            oldest = epoch;
+    }
+    predecode_t** prev = &pd_retired;
+    while(*prev) {
+        predecode_t* block = *prev;
+        if(!oldest || block->epoch<oldest) {
+            *prev = block->retired;
+            free(block);
+        } else
+            prev = &block->retired;
+    }
+    pd_retired_since = 0;
+}
+
+// decode the ModRM byte (and SIB / displacement) at p, like GET_ED does, return the size of it
+static int decodeModRM(uint8_t* p, pdinst_t* inst)
+{
+    uint8_t nextop = p[0];
+    int sz = 1;
+    inst->g = (nextop>>3)&7;
+    inst->rm = nextop&7;
+    inst->index = 4;
+    inst->scale = 0;
+    inst->disp = 0;
+    if((nextop&0xC0)==0xC0) {
+        inst->ea = PDEA_REG;
+        return sz;
+    }
+    inst->ea = PDEA_MEM;
+    if((nextop&7)==4) {
+        uint8_t sib = p[sz++];
+        inst->rm = sib&7;
+        inst->index = (sib>>3)&7;
+        inst->scale = sib>>6;
+        if(!(nextop&0xC0) && (sib&7)==5) {
+            inst->rm = PD_NOREG;
+            inst->disp = *(int32_t*)(p+sz);
+            sz+=4;
+        }
+    } else if(!(nextop&0xC0) && (nextop&7)==5) {
+        inst->rm = PD_NOREG;
+        inst->disp = *(int32_t*)(p+sz);
+        sz+=4;
+    }
+    if((nextop&0xC0)==0x40) {
+        inst->disp = *(int8_t*)(p+sz);
+        sz+=1;
+    } else if((nextop&0xC0)==0x80) {
+        inst->disp = *(int32_t*)(p+sz);
+        sz+=4;
+    }
+    return sz;
+}
+
+// decode the instruction at addr, return the PD_xxx handler (PD_SLOW if the instruction is not pre-decoded)
+static int decodeInst(uintptr_t addr, pdinst_t* inst)
+{
+    uint8_t* p = (uint8_t*)addr;
+    uint8_t opcode = p[0];
+    int sz = 1;
+    int ret = PD_SLOW;
+    memset(inst, 0, sizeof(pdinst_t));
+    if(opcode<0x40 && opcode!=0x0F) {
+        switch(opcode&7) {
+            case 1:
+                sz += decodeModRM(p+sz, inst);
+                ret = PD_ALU_EDGD(opcode>>3);
+                break;
+            case 3:
+                sz += decodeModRM(p+sz, inst);
+                ret = PD_ALU_GDED(opcode>>3);
+                break;
+            case 5:
+                inst->imm = *(uint32_t*)(p+sz);
+                sz += 4;
+                ret = PD_ALU_EAXID(opcode>>3);
+                break;
+        }
+    } else switch(opcode) {
+        case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
+            inst->g = opcode&7;
+            ret = PD_INC;
+            break;
+        case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F:
+            inst->g = opcode&7;
+            ret = PD_DEC;
+            break;
+        case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57:
+            inst->g = opcode&7;
+            ret = PD_PUSH;
+            break;
+        case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F:
+            inst->g = opcode&7;
+            ret = PD_POP;
+            break;
+        case 0x68:
+            inst->imm = *(uint32_t*)(p+sz);
+            sz += 4;
+            ret = PD_PUSHI;
+            break;
+        case 0x6A:
+            inst->imm = (uint32_t)(int32_t)*(int8_t*)(p+sz);
+            sz += 1;
+            ret = PD_PUSHI;
+            break;
+        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+        case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7E: case 0x7F:
+            inst->g = opcode&15;
+            sz += 1;
+            inst->imm = addr + sz + *(int8_t*)(p+1);
+            ret = PD_JCC;
+            break;
+        case 0x81:
+        case 0x83:
+            sz += decodeModRM(p+sz, inst);
+            if(opcode==0x81) {
+                inst->imm = *(uint32_t*)(p+sz);
+                sz += 4;
+            } else {
+                inst->imm = (uint32_t)(int32_t)*(int8_t*)(p+sz);
+                sz += 1;
+            }
+            ret = PD_ALU_EDID(inst->g);
+            break;
+        case 0x85:
+            sz += decodeModRM(p+sz, inst);
+            ret = PD_TEST_EDGD;
+            break;
+        case 0x89:
+            sz += decodeModRM(p+sz, inst);
+            ret = PD_MOV_EDGD;
+            break;
+        case 0x8B:
+            sz += decodeModRM(p+sz, inst);
+            ret = PD_MOV_GDED;
+            break;
+        case 0x8D:
+            if((p[1]&0xC0)==0xC0)
+                break;
+            sz += decodeModRM(p+sz, inst);
+            ret = PD_LEA;
+            break;
+        case 0x90:
+            ret = PD_NOP;
+            break;
+        case 0xA9:
+            inst->imm = *(uint32_t*)(p+sz);
+            sz += 4;
+            ret = PD_TEST_EAXID;
+            break;
+        case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBE: case 0xBF:
+            inst->g = opcode&7;
+            inst->imm = *(uint32_t*)(p+sz);
+            sz += 4;
+            ret = PD_MOV_GDID;
+            break;
+        case 0xC3:
+            ret = PD_RET;
+            break;
+        case 0xC7:
+            if(((p[1]>>3)&7)!=0)
+                break;
+            sz += decodeModRM(p+sz, inst);
+            inst->imm = *(uint32_t*)(p+sz);
+            sz += 4;
+            ret = PD_MOV_EDID;
+            break;
+        case 0xE8:
+        case 0xE9:
+            sz += 4;
+            inst->imm = addr + sz + *(int32_t*)(p+1);
+            ret = (opcode==0xE8)?PD_CALL:PD_JMP;
+            break;
+        case 0xEB:
+            sz += 1;
+            inst->imm = addr + sz + *(int8_t*)(p+1);
+            ret = PD_JMP;
+            break;
+        case 0x0F:
+            if(p[1]>=0x80 && p[1]<=0x8F) {
+                inst->g = p[1]&15;
+                sz += 5;
+                inst->imm = addr + sz + *(int32_t*)(p+2);
+                ret = PD_JCC;
+            }
+            break;
+    }
+    inst->len = (ret==PD_SLOW)?0:sz;
+    return ret;
+}
+
+predecode_t* GetPredecode(uintptr_t addr, const void** handlers)
+{
+    // outermost level only, the thread is between 2 blocks: move to the current epoch
+    if(pd_thread_level==1 && pd_thread_epoch->epoch!=pd_epoch) {
+        pd_thread_epoch->epoch = pd_epoch;
+        __sync_synchronize();
+    }
+    pdpage_t* page = getPage(PDPAGE(addr), 0);
+    uintptr_t offs = addr&(PD_PAGESIZE-1);
+    if(page && ((page->slow[offs>>3]>>(offs&7))&1))
+        return NULL;
+    int h = PDHASH(addr);
+    predecode_t* block = pd_hash[h];
+    while(block && block->addr!=addr)
+        block = block->next;
+    if(block)
+        return block;
+    if(testPage(pd_volatile, addr))
+        return NULL;
+    // decode the block
+    pdinst_t insts[PD_MAXINST];
+    int n = 0;
+    uintptr_t ip = addr;
+    while(n<PD_MAXINST && !testPage(pd_volatile, ip)) {
+        int op = decodeInst(ip, &insts[n]);
+        if(op!=PD_SLOW && testPage(pd_volatile, ip+insts[n].len-1)) {
+            op = PD_SLOW;   // crossing a volatile page
+            insts[n].len = 0;
+        }
+        insts[n].handler = handlers[op];
+        ip += insts[n].len;
+        ++n;
+        if(op==PD_SLOW || op>=PD_JCC)
+            break;
+    }
+    if(ip==addr) {
+        // the first instruction is not pre-decoded: no block, just remember the address is slow
+        pthread_mutex_lock(&pd_mutex);
+        page = getPage(PDPAGE(addr), 1);
+        if(page)
+            page->slow[offs>>3] |= 1<<(offs&7);
+        pthread_mutex_unlock(&pd_mutex);
+        return NULL;
+    }
+    block = (predecode_t*)malloc(sizeof(predecode_t)+n*sizeof(pdinst_t));
+    if(!block)
+        return NULL;
+    block->addr = addr;
+    block->size = ip-addr;
+    block->n = n;
+    block->retired = NULL;
+    block->epoch = 0;
+    memcpy(block->insts, insts, n*sizeof(pdinst_t));
+    pthread_mutex_lock(&pd_mutex);
+    // check again, another thread may have done the same, or the memory has been written meanwhile
+    predecode_t* other = pd_hash[h];
+    while(other && other->addr!=addr)
+        other = other->next;
+    page = other?NULL:getPage(PDPAGE(addr), 1);
+    if(other || !page || testRange(pd_volatile, addr, block->size)) {
+        pthread_mutex_unlock(&pd_mutex);
+        free(block);
+        return other;
+    }
+    // write protect the x86 code, like for dynablocks
+    uintptr_t start = addr&~(box86_pagesize-1);
+    uintptr_t end = (addr+block->size+(box86_pagesize-1))&~(box86_pagesize-1);
+    for(uintptr_t p=PDPAGE(start); p<PDPAGE(end); ++p)
+        setPage(pd_protected, p);
+    protectDB(addr, block->size);
+    block->pnext = page->blocks;
+    page->blocks = block;
+    block->next = pd_hash[h];
+    __sync_synchronize();   // block must be complete before being visible
+    pd_hash[h] = block;
+    if(pd_retired && pd_retired_since>=PD_RELEASE)
+        releaseRetired();
+    pthread_mutex_unlock(&pd_mutex);
+    return block;
+}
+
+int isPredecoded(uintptr_t addr)
+{
+    return testPage(pd_protected, addr);
+}
+
+// retire the blocks overlapping the range, need pd_mutex. No log and no free, as it can be executed inside a signal handler
+static void retireRange(uintptr_t addr, uintptr_t size)
+{
+    // a block is smaller than a page, so only the blocks starting in the range or in the page before can overlap it
+    uintptr_t first = PDPAGE(addr);
+    if(first)
+        --first;
+    for(uintptr_t p=first; p<=PDPAGE(addr+size-1); ++p) {
+        pdpage_t* page = getPage(p, 0);
+        if(!page)
+            continue;
+        predecode_t** pprev = &page->blocks;
+        while(*pprev) {
+            predecode_t* block = *pprev;
+            if(block->addr<addr+size && block->addr+block->size>addr) {
+                *pprev = block->pnext;
+                predecode_t** prev = &pd_hash[PDHASH(block->addr)];
+                while(*prev!=block)
+                    prev = &(*prev)->next;
+                *prev = block->next;    // block->next is kept, in case a thread is looking at the bucket
+                block->epoch = __sync_fetch_and_add(&pd_epoch, 1);
+                block->retired = pd_retired;
+                pd_retired = block;
+                ++pd_retired_since;
+            } else
+                pprev = &block->pnext;
+        }
+    }
+}
+
+// no log, as it can be executed inside a signal handler
+void cleanPredecodeRange(uintptr_t addr, uintptr_t size)
+{
+    if(!size || !testRange(pd_protected, addr, size))
+        return;
+    pthread_mutex_lock(&pd_mutex);
+    for(uintptr_t p=PDPAGE(addr); p<=PDPAGE(addr+size-1); ++p)
+        if((pd_protected[p>>3]>>(p&7))&1) {
+            clearPage(pd_protected, p);
+            setPage(pd_volatile, p);
+        }
+    retireRange(addr, size);
+    pthread_mutex_unlock(&pd_mutex);
+}
+
+void forgetPredecodeRange(uintptr_t addr, uintptr_t size)
+{
+    if(!size)
+        return;
+    pthread_mutex_lock(&pd_mutex);
+    for(uintptr_t p=PDPAGE(addr); p<=PDPAGE(addr+size-1); ++p) {
+        clearPage(pd_protected, p);
+        clearPage(pd_volatile, p);
+        pdpage_t* page = getPage(p, 0);
+        if(page)
+            memset(page->slow, 0, sizeof(page->slow));
+    }
+    retireRange(addr, size);
+    pthread_mutex_unlock(&pd_mutex);
+}
+
+void FreePredecode()
+{
+    pthread_mutex_lock(&pd_mutex);
+    for(int i=0; i<(1<<PD_HASHBITS); ++i) {
+        predecode_t* block = pd_hash[i];
+        pd_hash[i] = NULL;
+        while(block) {
+            predecode_t* next = block->next;
+            free(block);
+            block = next;
+        }
+    }
+    while(pd_retired) {
+        predecode_t* next = pd_retired->retired;
+        free(pd_retired);
+        pd_retired = next;
+    }
+    for(int i=0; i<(PD_PAGES>>PD_DIRBITS); ++i)
+        if(pd_dir[i]) {
+            for(int j=0; j<(1<<PD_DIRBITS); ++j)
+                free(pd_dir[i][j]);
+            free(pd_dir[i]);
+            pd_dir[i] = NULL;
+        }
+    pthread_mutex_unlock(&pd_mutex);
+}
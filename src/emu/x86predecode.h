@@ -0,0 +1,81 @@
+#ifndef __X86PREDECODE_H_
+#define __X86PREDECODE_H_
+#include <stdint.h>
+
+// Pre-decoded basic blocks for the interpreter: the hot and simple 32bits opcodes are decoded once
+// into a compact array (handler, effective address form, immediate) that Run() dispatch from.
+// Anything else ends the block with a PD_SLOW instruction, executed with the regular decoder.
+// Decoded code is write protected like the dynarec blocks, any write invalidates it.
+
+// handlers (index in the label table given by Run)
+#define PD_SLOW         0                           // not pre-decoded, use regular decoder (always last)
+#define PD_ALU          1                           // 8 alu operations (add/or/adc/sbb/and/sub/xor/cmp) x 4 forms
+#define PD_ALU_EDGD(op) (PD_ALU+(op)*4+0)           // OP Ed, Gd
+#define PD_ALU_GDED(op) (PD_ALU+(op)*4+1)           // OP Gd, Ed
+#define PD_ALU_EAXID(op) (PD_ALU+(op)*4+2)          // OP EAX, Id
+#define PD_ALU_EDID(op) (PD_ALU+(op)*4+3)           // OP Ed, Id/Ib
+#define PD_TEST_EDGD    (PD_ALU+32)
+#define PD_TEST_EAXID   (PD_ALU+33)
+#define PD_INC          (PD_ALU+34)
+#define PD_DEC          (PD_ALU+35)
+#define PD_PUSH         (PD_ALU+36)
+#define PD_POP          (PD_ALU+37)
+#define PD_PUSHI        (PD_ALU+38)
+#define PD_MOV_EDGD     (PD_ALU+39)
+#define PD_MOV_GDED     (PD_ALU+40)
+#define PD_MOV_GDID     (PD_ALU+41)
+#define PD_MOV_EDID     (PD_ALU+42)
+#define PD_LEA          (PD_ALU+43)
+#define PD_NOP          (PD_ALU+44)
+#define PD_JCC          (PD_ALU+45)                 // these ones end the block
+#define PD_JMP          (PD_ALU+46)
+#define PD_CALL         (PD_ALU+47)
+#define PD_RET          (PD_ALU+48)
+#define PD_LAST         (PD_ALU+49)
+
+// effective address forms of Ed
+#define PDEA_REG        0   // register rm
+#define PDEA_MEM        1   // [rm + index<<scale + disp], rm is PD_NOREG if no base
+#define PD_NOREG        8
+
+typedef struct pdinst_s {
+    const void* handler;    // label of the handler in Run
+    uint8_t     len;        // size of the x86 instruction
+    uint8_t     ea;         // PDEA_xxx form of Ed
+    uint8_t     rm;         // register of Ed, or base register
+    uint8_t     index;      // index register (4 is none, like in SIB byte)
+    uint8_t     scale;
+    uint8_t     g;          // Gd register, or register of the opcode, or condition for PD_JCC
+    int32_t     disp;
+    uint32_t    imm;        // immediate, or absolute x86 address for jumps/calls
+} pdinst_t;
+
+typedef struct predecode_s {
+    uintptr_t           addr;       // x86 address of the block
+    uint32_t            size;       // x86 size of the pre-decoded instructions (a PD_SLOW one is not included), never 0
+    int                 n;          // number of instructions
+    struct predecode_s* next;       // next in the hash bucket
+    struct predecode_s* pnext;      // next in the list of the page of addr
+    struct predecode_s* retired;    // next in the retired list, once invalidated
+    uint32_t            epoch;      // epoch of the retirement
+    pdinst_t            insts[0];
+} predecode_t;
+
+// get (or create) the pre-decoded block at addr. handlers are the PD_LAST labels of Run. NULL if not possible
+// (or if the first instruction is not pre-decoded). Must be called between PredecodeEnter and PredecodeLeave
+predecode_t* GetPredecode(uintptr_t addr, const void** handlers);
+// is the page of addr write protected because of a pre-decoded block
+int isPredecoded(uintptr_t addr);
+// invalidate pre-decoded blocks in the range (memory has been unprotected), the pages will not be pre-decoded anymore
+void cleanPredecodeRange(uintptr_t addr, uintptr_t size);
+// invalidate pre-decoded blocks in the range (memory has been replaced), the pages can be pre-decoded again
+void forgetPredecodeRange(uintptr_t addr, uintptr_t size);
+void FreePredecode();
+
+// Epoch of the thread running pre-decoded blocks, a retired block is only freed when no thread can run it anymore
+void PredecodeEnter();      // thread start running pre-decoded blocks (can be nested)
+void PredecodeLeave();
+int PredecodeGetLevel();
+void PredecodeSetLevel(int level);  // restore level after a longjmp
+
+#endif //__X86PREDECODE_H_
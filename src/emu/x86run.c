@@ -19,14 +19,25 @@
 #include "x87emu_private.h"
 #include "box86context.h"
 #include "my_cpuid.h"
+#include "x86predecode.h"
+#include "x86simd.h"
 #ifdef DYNAREC
 #include "../dynarec/arm_lock_helper.h"
+#else
+#include "x86atomic.h"
 #endif
 
 int my_setcontext(x86emu_t* emu, void* ucp);
 
+#ifdef TEST_INTERPRETER
+// same interpreter, but running only one instruction (x86run.c built a 2nd time with TEST_INTERPRETER), for BOX86_DYNAREC_TEST
+int RunTest(x86emu_t *emu)
+{
+    const int step = 1;
+#else
 int Run(x86emu_t *emu, int step)
 {
+#endif
     uint8_t opcode;
     uint8_t nextop;
     reg32_t *oped;
@@ -34,8 +45,8 @@ int Run(x86emu_t *emu, int step)
     int8_t tmp8s;
     uint16_t tmp16u, tmp16u2;
     int16_t tmp16s;
-    uint32_t tmp32u, tmp32u2, tmp32u3;
-    int32_t tmp32s, tmp32s2;
+    uint32_t tmp32u, tmp32u2;
+    int32_t tmp32s;
     uint64_t tmp64u;
     int64_t tmp64s;
     uintptr_t ip;
@@ -44,9 +55,17 @@ int Run(x86emu_t *emu, int step)
     int64_t ll;
     sse_regs_t *opex, eax1;
     mmx_regs_t *opem, eam1;
+    pdinst_t *pdi = NULL, *pdend = NULL;    // current pre-decoded instruction, and end of the pre-decoded block
+#ifdef TEST_INTERPRETER
+    const int pd = 0;
+#else
+    int pd = box86_predecode && !my_context->dec;
+#endif
 
     if(emu->quit)
         return 0;
+    if(pd)
+        PredecodeEnter();
 
     //ref opcode: http://ref.x86asm.net/geek32.html#xA1
     printf_log(LOG_DEBUG, "Run X86 (%p), EIP=%p, Stack=%p\n", emu, (void*)R_EIP, emu->context->stack);
@@ -167,6 +186,21 @@ int Run(x86emu_t *emu, int step)
     &&_66_0xF8, &&_66_0xF9, &&_default, &&_default, &&_default, &&_default, &&_default, &&_66_0xFF
     };
 
+    static const void* pdopcodes[PD_LAST] = {
+    &&_pd_slow,
+    &&_pd_0_0, &&_pd_0_1, &&_pd_0_2, &&_pd_0_3,
+    &&_pd_1_0, &&_pd_1_1, &&_pd_1_2, &&_pd_1_3,
+    &&_pd_2_0, &&_pd_2_1, &&_pd_2_2, &&_pd_2_3,
+    &&_pd_3_0, &&_pd_3_1, &&_pd_3_2, &&_pd_3_3,
+    &&_pd_4_0, &&_pd_4_1, &&_pd_4_2, &&_pd_4_3,
+    &&_pd_5_0, &&_pd_5_1, &&_pd_5_2, &&_pd_5_3,
+    &&_pd_6_0, &&_pd_6_1, &&_pd_6_2, &&_pd_6_3,
+    &&_pd_7_0, &&_pd_7_1, &&_pd_7_2, &&_pd_7_3,
+    &&_pd_test_edgd, &&_pd_test_eaxid, &&_pd_inc, &&_pd_dec, &&_pd_push, &&_pd_pop,
+    &&_pd_pushi, &&_pd_mov_edgd, &&_pd_mov_gded, &&_pd_mov_gdid, &&_pd_mov_edid, &&_pd_lea,
+    &&_pd_nop, &&_pd_jcc, &&_pd_jmp, &&_pd_call, &&_pd_ret
+    };
+
 x86emurun:
     ip = R_EIP;
 //    UnpackFlags(emu);
@@ -182,12 +216,21 @@ _trace:
             PrintTrace(emu, ip, 0);
 
     #define NEXT    goto _trace
+#elif defined(BOX86CORE)
+    // libbox86core: count the instructions, and check the breakpoints, before the next one
+    #define NEXT    if(++emu->core_icount==emu->core_ilimit || (emu->core_nbp && CoreBreakpoint(emu, ip))) goto corestop; \
+                    else if(pd) goto _pd_next; else goto *baseopcodes[(R_EIP=ip, opcode=F8)]
 #else
-    #define NEXT    goto *baseopcodes[(R_EIP=ip, opcode=F8)]
+    #define NEXT    if(pd) goto _pd_next; else goto *baseopcodes[(R_EIP=ip, opcode=F8)]
+#endif
+#ifdef TEST_INTERPRETER
+    #undef NEXT
+    #define NEXT    goto stepout
 #endif
 
 #include "modrm.h"
 
+    if(pd) goto _pd_next;
     opcode = F8;
     goto *baseopcodes[opcode];
 
@@ -618,13 +661,12 @@ _trace:
             // dynarec use need it's own mecanism
 #else
             GET_EB;
-            if((nextop&0xC0)!=0xC0)
-                pthread_mutex_lock(&emu->context->mutex_lock); // XCHG always LOCK (but when accessing memory only)
-            tmp8u = GB;
-            GB = EB->byte[0];
-            EB->byte[0] = tmp8u;
-            if((nextop&0xC0)!=0xC0)
-                pthread_mutex_unlock(&emu->context->mutex_lock);
+            if((nextop&0xC0)==0xC0) {
+                tmp8u = GB;
+                GB = EB->byte[0];
+                EB->byte[0] = tmp8u;
+            } else
+                GB = x86atomic_xchg_b(EB, GB);  // XCHG always LOCK (but when accessing memory only)
 #endif                
             NEXT;
         _0x87:                      /* XCHG Ed,Gd */
@@ -651,13 +693,12 @@ _trace:
             }
 #else
             GET_ED;
-            if((nextop&0xC0)!=0xC0)
-                pthread_mutex_lock(&emu->context->mutex_lock); // XCHG always LOCK (but when accessing memory only)
-            tmp32u = GD.dword[0];
-            GD.dword[0] = ED->dword[0];
-            ED->dword[0] = tmp32u;
-            if((nextop&0xC0)!=0xC0)
-                pthread_mutex_unlock(&emu->context->mutex_lock);
+            if((nextop&0xC0)==0xC0) {
+                tmp32u = GD.dword[0];
+                GD.dword[0] = ED->dword[0];
+                ED->dword[0] = tmp32u;
+            } else
+                GD.dword[0] = x86atomic_xchg_d(ED, GD.dword[0]);  // XCHG always LOCK (but when accessing memory only)
 #endif
             NEXT;
         _0x88:                      /* MOV Eb,Gb */
@@ -1136,74 +1177,19 @@ _trace:
                 NEXT;
             } else if(nextop==0x66) {
                 nextop = F8;
-                tmp8s = ACCESS_FLAG(F_DF)?-1:+1;
                 tmp32u = R_ECX;
                 switch(nextop) {
                     case 0xA5:              /* REP MOVSW */
-                        tmp8s *= 2;
-                        while(tmp32u) {
-                            --tmp32u;
-                            *(uint16_t*)R_EDI = *(uint16_t*)R_ESI;
-                            R_EDI += tmp8s;
-                            R_ESI += tmp8s;
-                        }
+                        tmp32u = RepMovs(emu, tmp32u, 2);
                         break;
                     case 0xAB:              /* REP STOSW */
-                        tmp8s *= 2;
-                        while(tmp32u) {
-                            --tmp32u;
-                            *(uint16_t*)R_EDI = R_AX;
-                            R_EDI += tmp8s;
-                        }
+                        tmp32u = RepStos(emu, tmp32u, 2);
                         break;
                     case 0xA7:              /* REP(N)Z CMPSW */
-                        tmp16u = 0;
-                        tmp16u2 = 0;
-                        tmp8s *= 2;
-                        if(opcode==0xF2) {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp16u2 = *(uint16_t*)R_EDI;
-                                tmp16u  = *(uint16_t*)R_ESI;
-                                R_EDI += tmp8s;
-                                R_ESI += tmp8s;
-                                if(tmp16u2==tmp16u)
-                                    break;
-                            }
-                        } else {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp16u2 = *(uint16_t*)R_EDI;
-                                tmp16u  = *(uint16_t*)R_ESI;
-                                R_EDI += tmp8s;
-                                R_ESI += tmp8s;
-                                if(tmp16u2!=tmp16u)
-                                    break;
-                            }
-                        }
-                        if(R_ECX) cmp16(emu, tmp16u, tmp16u2);
+                        tmp32u = RepCmps(emu, tmp32u, 2, opcode==0xF3);
                         break;
                     case 0xAF:              /* REP(N)Z SCASW */
-                        tmp16u = 0;
-                        tmp8s *= 2;
-                        if(opcode==0xF2) {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp16u = *(uint16_t*)R_EDI;
-                                R_EDI += tmp8s;
-                                if(R_AX==tmp16u)
-                                    break;
-                            }
-                        } else {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp16u = *(uint16_t*)R_EDI;
-                                R_EDI += tmp8s;
-                                if(R_AX!=tmp16u)
-                                    break;
-                            }
-                        }
-                        if(R_ECX) cmp16(emu, R_AX, tmp16u);
+                        tmp32u = RepScas(emu, tmp32u, 2, opcode==0xF3);
                         break;
                     default:
                         goto _default;
@@ -1267,89 +1253,22 @@ _trace:
                     case 0x90:              /* PAUSE */
                         NEXT;
                     case 0xA4:              /* REP MOVSB */
-                        while(tmp32u) {
-                            --tmp32u;
-                            *(uint8_t*)R_EDI = *(uint8_t*)R_ESI;
-                            R_EDI += tmp8s;
-                            R_ESI += tmp8s;
-                        }
+                        tmp32u = RepMovs(emu, tmp32u, 1);
                         break;
                     case 0xA5:              /* REP MOVSD */
-                        tmp8s *= 4;
-                        while(tmp32u) {
-                            --tmp32u;
-                            *(uint32_t*)R_EDI = *(uint32_t*)R_ESI;
-                            R_EDI += tmp8s;
-                            R_ESI += tmp8s;
-                        }
+                        tmp32u = RepMovs(emu, tmp32u, 4);
                         break;
                     case 0xA6:              /* REP(N)Z CMPSB */
-                        tmp8u = 0;
-                        tmp8u2 = 0;
-                        if(opcode==0xF2) {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp8u  = *(uint8_t*)R_EDI;
-                                tmp8u2 = *(uint8_t*)R_ESI;
-                                R_EDI += tmp8s;
-                                R_ESI += tmp8s;
-                                if(tmp8u==tmp8u2)
-                                    break;
-                            }
-                        } else {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp8u  = *(uint8_t*)R_EDI;
-                                tmp8u2 = *(uint8_t*)R_ESI;
-                                R_EDI += tmp8s;
-                                R_ESI += tmp8s;
-                                if(tmp8u!=tmp8u2)
-                                    break;
-                            }
-                        }
-                        if(R_ECX) cmp8(emu, tmp8u2, tmp8u);
+                        tmp32u = RepCmps(emu, tmp32u, 1, opcode==0xF3);
                         break;
                     case 0xA7:              /* REP(N)Z CMPSD */
-                        tmp32u2 = 0;
-                        tmp32u3 = 0;
-                        tmp8s *= 4;
-                        if(opcode==0xF2) {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp32u3 = *(uint32_t*)R_EDI;
-                                tmp32u2 = *(uint32_t*)R_ESI;
-                                R_EDI += tmp8s;
-                                R_ESI += tmp8s;
-                                if(tmp32u3==tmp32u2)
-                                    break;
-                            }
-                        } else {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp32u3 = *(uint32_t*)R_EDI;
-                                tmp32u2 = *(uint32_t*)R_ESI;
-                                R_EDI += tmp8s;
-                                R_ESI += tmp8s;
-                                if(tmp32u3!=tmp32u2)
-                                    break;
-                            }
-                        }
-                        if(R_ECX) cmp32(emu, tmp32u2, tmp32u3);
+                        tmp32u = RepCmps(emu, tmp32u, 4, opcode==0xF3);
                         break;
                     case 0xAA:              /* REP STOSB */
-                        while(tmp32u) {
-                            --tmp32u;
-                            *(uint8_t*)R_EDI = R_AL;
-                            R_EDI += tmp8s;
-                        }
+                        tmp32u = RepStos(emu, tmp32u, 1);
                         break;
                     case 0xAB:              /* REP STOSD */
-                        tmp8s *= 4;
-                        while(tmp32u) {
-                            --tmp32u;
-                            *(uint32_t*)R_EDI = R_EAX;
-                            R_EDI += tmp8s;
-                        }
+                        tmp32u = RepStos(emu, tmp32u, 4);
                         break;
                     case 0xAC:              /* REP LODSB */
                         while(tmp32u) {
@@ -1367,47 +1286,10 @@ _trace:
                         }
                         break;
                     case 0xAE:              /* REP(N)Z SCASB */
-                        tmp8u = 0;
-                        if(opcode==0xF2) {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp8u = *(uint8_t*)R_EDI;
-                                R_EDI += tmp8s;
-                                if(R_AL==tmp8u)
-                                    break;
-                            }
-                        } else {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp8u = *(uint8_t*)R_EDI;
-                                R_EDI += tmp8s;
-                                if(R_AL!=tmp8u)
-                                    break;
-                            }
-                        }
-                        if(R_ECX) cmp8(emu, R_AL, tmp8u);
+                        tmp32u = RepScas(emu, tmp32u, 1, opcode==0xF3);
                         break;
                     case 0xAF:              /* REP(N)Z SCASD */
-                        tmp32u2 = 0;
-                        tmp8s *= 4;
-                        if(opcode==0xF2) {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp32u2 = *(uint32_t*)R_EDI;
-                                R_EDI += tmp8s;
-                                if(R_EAX==tmp32u2)
-                                    break;
-                            }
-                        } else {
-                            while(tmp32u) {
-                                --tmp32u;
-                                tmp32u2 = *(uint32_t*)R_EDI;
-                                R_EDI += tmp8s;
-                                if(R_EAX!=tmp32u2)
-                                    break;
-                            }
-                        }
-                        if(R_ECX) cmp32(emu, R_EAX, tmp32u2);
+                        tmp32u = RepScas(emu, tmp32u, 4, opcode==0xF3);
                         break;
                     default:
                         goto _default;
@@ -1580,6 +1462,154 @@ _trace:
             }
             NEXT;
 
+        // pre-decoded blocks
+        #define PDED    ((pdi->ea==PDEA_REG)?&emu->regs[pdi->rm]:(reg32_t*)(((pdi->rm==PD_NOREG)?0:emu->regs[pdi->rm].dword[0]) \
+                            + (emu->sbiidx[pdi->index]->dword[0]<<pdi->scale) + pdi->disp))
+        #define PDGD    emu->regs[pdi->g]
+#ifdef BOX86CORE
+        #define PDNEXT  ip += pdi->len; ++pdi; NEXT
+#else
+        #define PDNEXT  ip += pdi->len; if(++pdi!=pdend) {R_EIP = ip; goto *pdi->handler;} NEXT
+#endif
+        _pd_next:
+            R_EIP = ip;
+            if(pdi==pdend) {    // end of the block (or of an instruction not pre-decoded)
+                predecode_t* pdb = GetPredecode(ip, pdopcodes);
+                if(!pdb)
+                    goto *baseopcodes[(opcode=F8)];
+                pdi = pdb->insts;
+                pdend = pdi + pdb->n;
+            }
+            goto *pdi->handler;
+        _pd_slow:
+            pdi = pdend;
+            goto *baseopcodes[(opcode=F8)];
+
+        #define GO(N, OP)                       \
+        _pd_##N##_0:                            \
+            oped = PDED;                        \
+            ED->dword[0] = OP##32(emu, ED->dword[0], PDGD.dword[0]); \
+            PDNEXT;                             \
+        _pd_##N##_1:                            \
+            oped = PDED;                        \
+            PDGD.dword[0] = OP##32(emu, PDGD.dword[0], ED->dword[0]); \
+            PDNEXT;                             \
+        _pd_##N##_2:                            \
+            R_EAX = OP##32(emu, R_EAX, pdi->imm); \
+            PDNEXT;                             \
+        _pd_##N##_3:                            \
+            oped = PDED;                        \
+            ED->dword[0] = OP##32(emu, ED->dword[0], pdi->imm); \
+            PDNEXT;
+
+        GO(0, add)
+        GO(1, or)
+        GO(2, adc)
+        GO(3, sbb)
+        GO(4, and)
+        GO(5, sub)
+        GO(6, xor)
+        #undef GO
+        _pd_7_0:
+            oped = PDED;
+            cmp32(emu, ED->dword[0], PDGD.dword[0]);
+            PDNEXT;
+        _pd_7_1:
+            oped = PDED;
+            cmp32(emu, PDGD.dword[0], ED->dword[0]);
+            PDNEXT;
+        _pd_7_2:
+            cmp32(emu, R_EAX, pdi->imm);
+            PDNEXT;
+        _pd_7_3:
+            oped = PDED;
+            cmp32(emu, ED->dword[0], pdi->imm);
+            PDNEXT;
+        _pd_test_edgd:
+            oped = PDED;
+            test32(emu, ED->dword[0], PDGD.dword[0]);
+            PDNEXT;
+        _pd_test_eaxid:
+            test32(emu, R_EAX, pdi->imm);
+            PDNEXT;
+        _pd_inc:
+            PDGD.dword[0] = inc32(emu, PDGD.dword[0]);
+            PDNEXT;
+        _pd_dec:
+            PDGD.dword[0] = dec32(emu, PDGD.dword[0]);
+            PDNEXT;
+        _pd_push:
+            Push(emu, PDGD.dword[0]);
+            PDNEXT;
+        _pd_pop:
+            PDGD.dword[0] = Pop(emu);
+            PDNEXT;
+        _pd_pushi:
+            Push(emu, pdi->imm);
+            PDNEXT;
+        _pd_mov_edgd:
+            oped = PDED;
+            ED->dword[0] = PDGD.dword[0];
+            PDNEXT;
+        _pd_mov_gded:
+            oped = PDED;
+            PDGD.dword[0] = ED->dword[0];
+            PDNEXT;
+        _pd_mov_gdid:
+            PDGD.dword[0] = pdi->imm;
+            PDNEXT;
+        _pd_mov_edid:
+            oped = PDED;
+            ED->dword[0] = pdi->imm;
+            PDNEXT;
+        _pd_lea:
+            PDGD.dword[0] = (uint32_t)PDED;
+            PDNEXT;
+        _pd_nop:
+            PDNEXT;
+        _pd_jcc:
+            CHECK_FLAGS(emu);
+            switch(pdi->g) {
+                case 0x0: tmp8u = ACCESS_FLAG(F_OF); break;
+                case 0x1: tmp8u = !ACCESS_FLAG(F_OF); break;
+                case 0x2: tmp8u = ACCESS_FLAG(F_CF); break;
+                case 0x3: tmp8u = !ACCESS_FLAG(F_CF); break;
+                case 0x4: tmp8u = ACCESS_FLAG(F_ZF); break;
+                case 0x5: tmp8u = !ACCESS_FLAG(F_ZF); break;
+                case 0x6: tmp8u = (ACCESS_FLAG(F_ZF) || ACCESS_FLAG(F_CF)); break;
+                case 0x7: tmp8u = !(ACCESS_FLAG(F_ZF) || ACCESS_FLAG(F_CF)); break;
+                case 0x8: tmp8u = ACCESS_FLAG(F_SF); break;
+                case 0x9: tmp8u = !ACCESS_FLAG(F_SF); break;
+                case 0xA: tmp8u = ACCESS_FLAG(F_PF); break;
+                case 0xB: tmp8u = !ACCESS_FLAG(F_PF); break;
+                case 0xC: tmp8u = (ACCESS_FLAG(F_SF) != ACCESS_FLAG(F_OF)); break;
+                case 0xD: tmp8u = (ACCESS_FLAG(F_SF) == ACCESS_FLAG(F_OF)); break;
+                case 0xE: tmp8u = (ACCESS_FLAG(F_ZF) || (ACCESS_FLAG(F_SF) != ACCESS_FLAG(F_OF))); break;
+                default:  tmp8u = (!ACCESS_FLAG(F_ZF) && (ACCESS_FLAG(F_SF) == ACCESS_FLAG(F_OF))); break;
+            }
+            ip = tmp8u?pdi->imm:(ip+pdi->len);
+            pdi = pdend;
+            NEXT;
+        _pd_jmp:
+            ip = pdi->imm;
+            pdi = pdend;
+            STEP
+            NEXT;
+        _pd_call:
+            Push(emu, ip+pdi->len);
+            ip = pdi->imm;
+            pdi = pdend;
+            STEP
+            NEXT;
+        _pd_ret:
+            ip = Pop(emu);
+            pdi = pdend;
+            STEP
+            NEXT;
+        #undef PDED
+        #undef PDGD
+        #undef PDNEXT
+
         _default:
             emu->old_ip = R_EIP;
             R_EIP = ip;
@@ -1589,6 +1619,16 @@ _trace:
 stepout:
     emu->old_ip = R_EIP;
     R_EIP = ip;
+    if(pd)
+        PredecodeLeave();
+    return 0;
+#endif
+#ifdef BOX86CORE
+corestop:
+    R_EIP = ip;
+    emu->core_stop = (emu->core_icount==emu->core_ilimit)?0:1;  // BOX86CORE_COUNT or BOX86CORE_BREAKPOINT
+    if(pd)
+        PredecodeLeave();
     return 0;
 #endif
 
@@ -1596,8 +1636,11 @@ fini:
 //    PackFlags(emu);
     // fork handling
     if(emu->fork) {
-        if(step)
+        if(step) {
+            if(pd)
+                PredecodeLeave();
             return 0;
+        }
         int forktype = emu->fork;
         emu->quit = 0;
         emu->fork = 0;
@@ -1610,5 +1653,7 @@ fini:
         my_setcontext(emu, emu->uc_link);
         goto x86emurun;
     }
+    if(pd)
+        PredecodeLeave();
     return 0;
 }
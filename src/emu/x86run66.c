@@ -13,6 +13,8 @@
 #include "box86context.h"
 #ifdef DYNAREC
 #include "../dynarec/arm_lock_helper.h"
+#else
+#include "x86atomic.h"
 #endif
 
 
@@ -164,12 +166,12 @@ void RunLock(x86emu_t *emu)
     uint8_t opcode = F8;
     uint8_t nextop;
     reg32_t *oped;
-    uint8_t tmp8u;
-#ifdef DYNAREC
-    uint8_t tmp8u2;
-#endif
+    uint8_t tmp8u, tmp8u2;
     uint32_t tmp32u, tmp32u2;
     int32_t tmp32s;
+#ifndef DYNAREC
+    uint64_t tmp64u;
+#endif
     switch(opcode) {
 #ifdef DYNAREC
         #define GO(B, OP)                      \
@@ -210,40 +212,34 @@ void RunLock(x86emu_t *emu)
         case B+0: \
             nextop = F8;               \
             GET_EB;             \
-            pthread_mutex_lock(&emu->context->mutex_lock);\
-            EB->byte[0] = OP##8(emu, EB->byte[0], GB);  \
-            pthread_mutex_unlock(&emu->context->mutex_lock);\
+            do {                \
+            tmp8u = x86atomic_read_b(EB);     \
+            tmp8u2 = OP##8(emu, tmp8u, GB);  \
+            } while (!x86atomic_cas_b(EB, tmp8u, tmp8u2));   \
             break;                              \
         case B+1: \
             nextop = F8;               \
             GET_ED;             \
-            pthread_mutex_lock(&emu->context->mutex_lock);\
-            ED->dword[0] = OP##32(emu, ED->dword[0], GD.dword[0]); \
-            pthread_mutex_unlock(&emu->context->mutex_lock);\
+            do {                \
+            tmp32u = x86atomic_read_d(ED);     \
+            tmp32u2 = OP##32(emu, tmp32u, GD.dword[0]);  \
+            } while (!x86atomic_cas_d(ED, tmp32u, tmp32u2));   \
             break;                              \
         case B+2: \
             nextop = F8;               \
             GET_EB;                   \
-            pthread_mutex_lock(&emu->context->mutex_lock);\
             GB = OP##8(emu, GB, EB->byte[0]); \
-            pthread_mutex_unlock(&emu->context->mutex_lock);\
             break;                              \
         case B+3: \
             nextop = F8;               \
             GET_ED;         \
-            pthread_mutex_lock(&emu->context->mutex_lock);\
             GD.dword[0] = OP##32(emu, GD.dword[0], ED->dword[0]); \
-            pthread_mutex_unlock(&emu->context->mutex_lock);\
             break;                              \
         case B+4: \
-            pthread_mutex_lock(&emu->context->mutex_lock);\
             R_AL = OP##8(emu, R_AL, F8); \
-            pthread_mutex_unlock(&emu->context->mutex_lock);\
             break;                              \
         case B+5: \
-            pthread_mutex_lock(&emu->context->mutex_lock);\
             R_EAX = OP##32(emu, R_EAX, F32); \
-            pthread_mutex_unlock(&emu->context->mutex_lock);\
             break;
 #endif
         GO(0x00, add)                   /* ADD 0x00 -> 0x05 */
@@ -258,6 +254,41 @@ void RunLock(x86emu_t *emu)
         case 0x0f:
             opcode = F8;
             switch (opcode) { 
+                case 0xAB:                      /* BTS Ed,Gd */
+                    CHECK_FLAGS(emu);
+                    nextop = F8;
+                    GET_ED;
+                    tmp8u = GD.byte[0];
+                    if((nextop&0xC0)!=0xC0)
+                    {
+                        ED=(reg32_t*)(((uint32_t*)(ED))+(tmp8u>>5));
+                    }
+                    tmp8u&=31;
+#ifdef DYNAREC
+                    do {
+                        tmp32u = arm_lock_read_d(ED);
+                        if(tmp32u & (1<<tmp8u)) {
+                            SET_FLAG(F_CF);
+                            tmp32s = 0;
+                        } else {
+                            CLEAR_FLAG(F_CF);
+                            tmp32u ^= (1<<tmp8u);
+                            tmp32s = arm_lock_write_d(ED, tmp32u);
+                        }
+                    } while(tmp32s);
+#else
+                    do {
+                        tmp32u = x86atomic_read_d(ED);
+                        if(tmp32u & (1<<tmp8u)) {
+                            SET_FLAG(F_CF);
+                            tmp32s = 0;
+                        } else {
+                            CLEAR_FLAG(F_CF);
+                            tmp32s = !x86atomic_cas_d(ED, tmp32u, tmp32u|(1<<tmp8u));
+                        }
+                    } while(tmp32s);
+#endif
+                    break;
                 case 0xB0:                      /* CMPXCHG Eb,Gb */
                     CHECK_FLAGS(emu);
                     nextop = F8;
@@ -274,14 +305,16 @@ void RunLock(x86emu_t *emu)
                         }
                     } while(tmp32s);
 #else
-                    pthread_mutex_lock(&emu->context->mutex_lock);
-                    cmp8(emu, R_AL, EB->byte[0]);
-                    if(ACCESS_FLAG(F_ZF)) {
-                        EB->byte[0] = GB;
-                    } else {
-                        R_AL = EB->byte[0];
-                    }
-                    pthread_mutex_unlock(&emu->context->mutex_lock);
+                    do {
+                        tmp8u = x86atomic_read_b(EB);
+                        cmp8(emu, R_AL, tmp8u);
+                        if(ACCESS_FLAG(F_ZF)) {
+                            tmp32s = !x86atomic_cas_b(EB, tmp8u, GB);
+                        } else {
+                            R_AL = tmp8u;
+                            tmp32s = 0;
+                        }
+                    } while(tmp32s);
 #endif
                     break;
                 case 0xB1:                      /* CMPXCHG Ed,Gd */
@@ -299,14 +332,16 @@ void RunLock(x86emu_t *emu)
                         }
                     } while(tmp32s);
 #else
-                    pthread_mutex_lock(&emu->context->mutex_lock);
-                    cmp32(emu, R_EAX, ED->dword[0]);
-                    if(ACCESS_FLAG(F_ZF)) {
-                        ED->dword[0] = GD.dword[0];
-                    } else {
-                        R_EAX = ED->dword[0];
-                    }
-                    pthread_mutex_unlock(&emu->context->mutex_lock);
+                    do {
+                        tmp32u = x86atomic_read_d(ED);
+                        cmp32(emu, R_EAX, tmp32u);
+                        if(ACCESS_FLAG(F_ZF)) {
+                            tmp32s = !x86atomic_cas_d(ED, tmp32u, GD.dword[0]);
+                        } else {
+                            R_EAX = tmp32u;
+                            tmp32s = 0;
+                        }
+                    } while(tmp32s);
 #endif
                     break;
                 case 0xB3:                      /* BTR Ed,Gd */
@@ -332,13 +367,16 @@ void RunLock(x86emu_t *emu)
                         }
                     } while(tmp32s);
 #else
-                    pthread_mutex_lock(&emu->context->mutex_lock);
-                    if(ED->dword[0] & (1<<tmp8u)) {
-                        SET_FLAG(F_CF);
-                        ED->dword[0] ^= (1<<tmp8u);
-                    } else
-                        CLEAR_FLAG(F_CF);
-                    pthread_mutex_unlock(&emu->context->mutex_lock);
+                    do {
+                        tmp32u = x86atomic_read_d(ED);
+                        if(tmp32u & (1<<tmp8u)) {
+                            SET_FLAG(F_CF);
+                            tmp32s = !x86atomic_cas_d(ED, tmp32u, tmp32u^(1<<tmp8u));
+                        } else {
+                            CLEAR_FLAG(F_CF);
+                            tmp32s = 0;
+                        }
+                    } while(tmp32s);
 #endif
                     break;
                 case 0xBA:                      
@@ -359,12 +397,10 @@ void RunLock(x86emu_t *emu)
                             else
                                 CLEAR_FLAG(F_CF);
 #else
-                            pthread_mutex_lock(&emu->context->mutex_lock);
-                            if(ED->dword[0] & (1<<tmp8u))
+                            if(x86atomic_read_d(ED) & (1<<tmp8u))
                                 SET_FLAG(F_CF);
                             else
                                 CLEAR_FLAG(F_CF);
-                            pthread_mutex_unlock(&emu->context->mutex_lock);
 #endif
                             break;
                         case 6:             /* BTR Ed, Ib */
@@ -389,13 +425,80 @@ void RunLock(x86emu_t *emu)
                                 }
                             } while(tmp32s);
 #else
-                            pthread_mutex_lock(&emu->context->mutex_lock);
-                            if(ED->dword[0] & (1<<tmp8u)) {
-                                SET_FLAG(F_CF);
-                                ED->dword[0] ^= (1<<tmp8u);
-                            } else
-                                CLEAR_FLAG(F_CF);
-                            pthread_mutex_unlock(&emu->context->mutex_lock);
+                            do {
+                                tmp32u = x86atomic_read_d(ED);
+                                if(tmp32u & (1<<tmp8u)) {
+                                    SET_FLAG(F_CF);
+                                    tmp32s = !x86atomic_cas_d(ED, tmp32u, tmp32u^(1<<tmp8u));
+                                } else {
+                                    CLEAR_FLAG(F_CF);
+                                    tmp32s = 0;
+                                }
+                            } while(tmp32s);
+#endif
+                            break;
+                        case 5:             /* BTS Ed, Ib */
+                            CHECK_FLAGS(emu);
+                            GET_ED;
+                            tmp8u = F8;
+                            if((nextop&0xC0)!=0xC0)
+                            {
+                                ED=(reg32_t*)(((uint32_t*)(ED))+(tmp8u>>5));
+                            }
+                            tmp8u&=31;
+#ifdef DYNAREC
+                            do {
+                                tmp32u = arm_lock_read_d(ED);
+                                if(tmp32u & (1<<tmp8u)) {
+                                    SET_FLAG(F_CF);
+                                    tmp32s = 0;
+                                } else {
+                                    CLEAR_FLAG(F_CF);
+                                    tmp32u ^= (1<<tmp8u);
+                                    tmp32s = arm_lock_write_d(ED, tmp32u);
+                                }
+                            } while(tmp32s);
+#else
+                            do {
+                                tmp32u = x86atomic_read_d(ED);
+                                if(tmp32u & (1<<tmp8u)) {
+                                    SET_FLAG(F_CF);
+                                    tmp32s = 0;
+                                } else {
+                                    CLEAR_FLAG(F_CF);
+                                    tmp32s = !x86atomic_cas_d(ED, tmp32u, tmp32u|(1<<tmp8u));
+                                }
+                            } while(tmp32s);
+#endif
+                            break;
+                        case 7:             /* BTC Ed, Ib */
+                            CHECK_FLAGS(emu);
+                            GET_ED;
+                            tmp8u = F8;
+                            if((nextop&0xC0)!=0xC0)
+                            {
+                                ED=(reg32_t*)(((uint32_t*)(ED))+(tmp8u>>5));
+                            }
+                            tmp8u&=31;
+#ifdef DYNAREC
+                            do {
+                                tmp32u = arm_lock_read_d(ED);
+                                if(tmp32u & (1<<tmp8u)) {
+                                    SET_FLAG(F_CF);
+                                } else {
+                                    CLEAR_FLAG(F_CF);
+                                }
+                                tmp32u ^= (1<<tmp8u);
+                            } while(arm_lock_write_d(ED, tmp32u));
+#else
+                            do {
+                                tmp32u = x86atomic_read_d(ED);
+                                if(tmp32u & (1<<tmp8u)) {
+                                    SET_FLAG(F_CF);
+                                } else {
+                                    CLEAR_FLAG(F_CF);
+                                }
+                            } while(!x86atomic_cas_d(ED, tmp32u, tmp32u^(1<<tmp8u)));
 #endif
                             break;
 
@@ -425,13 +528,14 @@ void RunLock(x86emu_t *emu)
                         tmp32u ^= (1<<tmp8u);
                     } while(arm_lock_write_d(ED, tmp32u));
 #else
-                    pthread_mutex_lock(&emu->context->mutex_lock);
-                    if(ED->dword[0] & (1<<tmp8u))
-                        SET_FLAG(F_CF);
-                    else
-                        CLEAR_FLAG(F_CF);
-                    ED->dword[0] ^= (1<<tmp8u);
-                    pthread_mutex_unlock(&emu->context->mutex_lock);
+                    do {
+                        tmp32u = x86atomic_read_d(ED);
+                        if(tmp32u & (1<<tmp8u)) {
+                            SET_FLAG(F_CF);
+                        } else {
+                            CLEAR_FLAG(F_CF);
+                        }
+                    } while(!x86atomic_cas_d(ED, tmp32u, tmp32u^(1<<tmp8u)));
 #endif
                     break;
                 case 0xC0:                      /* XADD Gb,Eb */
@@ -444,11 +548,11 @@ void RunLock(x86emu_t *emu)
                     } while (arm_lock_write_b(EB, tmp8u2));
                     GB = tmp8u;
 #else
-                    pthread_mutex_lock(&emu->context->mutex_lock);
-                    tmp8u = add8(emu, EB->byte[0], GB);
-                    GB = EB->byte[0];
-                    EB->byte[0] = tmp8u;
-                    pthread_mutex_unlock(&emu->context->mutex_lock);
+                    do {
+                        tmp8u = x86atomic_read_b(EB);
+                        tmp8u2 = add8(emu, tmp8u, GB);
+                    } while(!x86atomic_cas_b(EB, tmp8u, tmp8u2));
+                    GB = tmp8u;
 #endif
                     break;
                 case 0xC1:                      /* XADD Gd,Ed */
@@ -461,11 +565,11 @@ void RunLock(x86emu_t *emu)
                     } while(arm_lock_write_d(ED, tmp32u2));
                     GD.dword[0] = tmp32u;
 #else
-                    pthread_mutex_lock(&emu->context->mutex_lock);
-                    tmp32u = add32(emu, ED->dword[0], GD.dword[0]);
-                    GD.dword[0] = ED->dword[0];
-                    ED->dword[0] = tmp32u;
-                    pthread_mutex_unlock(&emu->context->mutex_lock);
+                    do {
+                        tmp32u = x86atomic_read_d(ED);
+                        tmp32u2 = add32(emu, tmp32u, GD.dword[0]);
+                    } while(!x86atomic_cas_d(ED, tmp32u, tmp32u2));
+                    GD.dword[0] = tmp32u;
 #endif
                     break;
                 case 0xC7:                      /* CMPXCHG8B Gq */
@@ -486,19 +590,18 @@ void RunLock(x86emu_t *emu)
                         }
                     } while(tmp32s);
 #else
-                    pthread_mutex_lock(&emu->context->mutex_lock);
-                    tmp32u = ED->dword[0];
-                    tmp32u2= ED->dword[1];
-                    if(R_EAX == tmp32u && R_EDX == tmp32u2) {
-                        SET_FLAG(F_ZF);
-                        ED->dword[0] = R_EBX;
-                        ED->dword[1] = R_ECX;
-                    } else {
-                        CLEAR_FLAG(F_ZF);
-                        R_EAX = tmp32u;
-                        R_EDX = tmp32u2;
-                    }
-                    pthread_mutex_unlock(&emu->context->mutex_lock);
+                    do {
+                        tmp64u = x86atomic_read_dd(ED);
+                        if(R_EAX == (uint32_t)tmp64u && R_EDX == (uint32_t)(tmp64u>>32)) {
+                            SET_FLAG(F_ZF);
+                            tmp32s = !x86atomic_cas_dd(ED, tmp64u, R_EBX|((uint64_t)R_ECX<<32));
+                        } else {
+                            CLEAR_FLAG(F_ZF);
+                            R_EAX = (uint32_t)tmp64u;
+                            R_EDX = (uint32_t)(tmp64u>>32);
+                            tmp32s = 0;
+                        }
+                    } while(tmp32s);
 #endif
                     break;
                 default:
@@ -529,18 +632,16 @@ void RunLock(x86emu_t *emu)
                 case 7:                cmp32(emu, ED->dword[0], tmp32u); break;
             }
 #else
-            pthread_mutex_lock(&emu->context->mutex_lock);
             switch((nextop>>3)&7) {
-                case 0: ED->dword[0] = add32(emu, ED->dword[0], tmp32u); break;
-                case 1: ED->dword[0] =  or32(emu, ED->dword[0], tmp32u); break;
-                case 2: ED->dword[0] = adc32(emu, ED->dword[0], tmp32u); break;
-                case 3: ED->dword[0] = sbb32(emu, ED->dword[0], tmp32u); break;
-                case 4: ED->dword[0] = and32(emu, ED->dword[0], tmp32u); break;
-                case 5: ED->dword[0] = sub32(emu, ED->dword[0], tmp32u); break;
-                case 6: ED->dword[0] = xor32(emu, ED->dword[0], tmp32u); break;
-                case 7:                cmp32(emu, ED->dword[0], tmp32u); break;
+                case 0: do { tmp32u2 = x86atomic_read_d(ED);} while(!x86atomic_cas_d(ED, tmp32u2, add32(emu, tmp32u2, tmp32u))); break;
+                case 1: do { tmp32u2 = x86atomic_read_d(ED);} while(!x86atomic_cas_d(ED, tmp32u2,  or32(emu, tmp32u2, tmp32u))); break;
+                case 2: do { tmp32u2 = x86atomic_read_d(ED);} while(!x86atomic_cas_d(ED, tmp32u2, adc32(emu, tmp32u2, tmp32u))); break;
+                case 3: do { tmp32u2 = x86atomic_read_d(ED);} while(!x86atomic_cas_d(ED, tmp32u2, sbb32(emu, tmp32u2, tmp32u))); break;
+                case 4: do { tmp32u2 = x86atomic_read_d(ED);} while(!x86atomic_cas_d(ED, tmp32u2, and32(emu, tmp32u2, tmp32u))); break;
+                case 5: do { tmp32u2 = x86atomic_read_d(ED);} while(!x86atomic_cas_d(ED, tmp32u2, sub32(emu, tmp32u2, tmp32u))); break;
+                case 6: do { tmp32u2 = x86atomic_read_d(ED);} while(!x86atomic_cas_d(ED, tmp32u2, xor32(emu, tmp32u2, tmp32u))); break;
+                case 7:                cmp32(emu, x86atomic_read_d(ED), tmp32u); break;
             }
-            pthread_mutex_unlock(&emu->context->mutex_lock);
 #endif
             break;
         case 0x86:                      /* XCHG Eb,Gb */
@@ -557,9 +658,9 @@ void RunLock(x86emu_t *emu)
                         tmp32u = arm_lock_read_d(ED);
                     } while(arm_lock_write_d(ED, inc32(emu, tmp32u)));
 #else
-                    pthread_mutex_lock(&emu->context->mutex_lock);
-                    ED->dword[0] = inc32(emu, ED->dword[0]);
-                    pthread_mutex_unlock(&emu->context->mutex_lock);
+                    do {
+                        tmp32u = x86atomic_read_d(ED);
+                    } while(!x86atomic_cas_d(ED, tmp32u, inc32(emu, tmp32u)));
 #endif
                     break;
                 case 1:                 /* DEC Ed */
@@ -568,9 +669,9 @@ void RunLock(x86emu_t *emu)
                         tmp32u = arm_lock_read_d(ED);
                     } while(arm_lock_write_d(ED, dec32(emu, tmp32u)));
 #else
-                    pthread_mutex_lock(&emu->context->mutex_lock);
-                    ED->dword[0] = dec32(emu, ED->dword[0]);
-                    pthread_mutex_unlock(&emu->context->mutex_lock);
+                    do {
+                        tmp32u = x86atomic_read_d(ED);
+                    } while(!x86atomic_cas_d(ED, tmp32u, dec32(emu, tmp32u)));
 #endif
                     break;
                 default:
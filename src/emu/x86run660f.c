@@ -13,6 +13,7 @@
 #include "x86primop.h"
 #include "x86trace.h"
 #include "box86context.h"
+#include "x86simd.h"
 
 #define F8      *(uint8_t*)(ip++)
 #define F8S     *(int8_t*)(ip++)
@@ -33,8 +34,6 @@ void Run660F(x86emu_t *emu)
     uint8_t tmp8u;
     int8_t tmp8s;
     uint16_t tmp16u;
-    int16_t tmp16s;
-    uint32_t tmp32u;
     int32_t tmp32s;
     sse_regs_t *opex, eax1, *opx2;
     mmx_regs_t *opem;
@@ -479,38 +478,32 @@ void Run660F(x86emu_t *emu)
     _6f_0x54:                      /* ANDPD Gx, Ex */
         nextop = F8;
         GET_EX;
-        GX.q[0] &= EX->q[0];
-        GX.q[1] &= EX->q[1];
+        sse_pand(&GX, EX);
         NEXT;
     _6f_0x55:                      /* ANDNPD Gx, Ex */
         nextop = F8;
         GET_EX;
-        GX.q[0] = (~GX.q[0]) & EX->q[0];
-        GX.q[1] = (~GX.q[1]) & EX->q[1];
+        sse_pandn(&GX, EX);
         NEXT;
     _6f_0x56:                      /* ORPD Gx, Ex */
         nextop = F8;
         GET_EX;
-        GX.q[0] |= EX->q[0];
-        GX.q[1] |= EX->q[1];
+        sse_por(&GX, EX);
         NEXT;
     _6f_0x57:                      /* XORPD Gx, Ex */
         nextop = F8;
         GET_EX;
-        GX.q[0] ^= EX->q[0];
-        GX.q[1] ^= EX->q[1];
+        sse_pxor(&GX, EX);
         NEXT;
     _6f_0x58:                      /* ADDPD Gx, Ex */
         nextop = F8;
         GET_EX;
-        GX.d[0] += EX->d[0];
-        GX.d[1] += EX->d[1];
+        sse_addpd(&GX, EX);
         NEXT;
     _6f_0x59:                      /* MULPD Gx, Ex */
         nextop = F8;
         GET_EX;
-        GX.d[0] *= EX->d[0];
-        GX.d[1] *= EX->d[1];
+        sse_mulpd(&GX, EX);
         NEXT;
     _6f_0x5A:                      /* CVTPD2PS Gx, Ex */
         nextop = F8;
@@ -530,160 +523,93 @@ void Run660F(x86emu_t *emu)
     _6f_0x5C:                      /* SUBPD Gx, Ex */
         nextop = F8;
         GET_EX;
-        GX.d[0] -= EX->d[0];
-        GX.d[1] -= EX->d[1];
+        sse_subpd(&GX, EX);
         NEXT;
     _6f_0x5D:                      /* MINPD Gx, Ex */
         nextop = F8;
         GET_EX;
-        if (isnan(GX.d[0]) || isnan(EX->d[0]) || isless(EX->d[0], GX.d[0]))
-            GX.d[0] = EX->d[0];
-        if (isnan(GX.d[1]) || isnan(EX->d[1]) || isless(EX->d[1], GX.d[1]))
-            GX.d[1] = EX->d[1];
+        sse_minpd(&GX, EX);
         NEXT;
     _6f_0x5E:                      /* DIVPD Gx, Ex */
         nextop = F8;
         GET_EX;
-        GX.d[0] /= EX->d[0];
-        GX.d[1] /= EX->d[1];
+        sse_divpd(&GX, EX);
         NEXT;
     _6f_0x5F:                      /* MAXPD Gx, Ex */
         nextop = F8;
         GET_EX;
-        if (isnan(GX.d[0]) || isnan(EX->d[0]) || isgreater(EX->d[0], GX.d[0]))
-            GX.d[0] = EX->d[0];
-        if (isnan(GX.d[1]) || isnan(EX->d[1]) || isgreater(EX->d[1], GX.d[1]))
-            GX.d[1] = EX->d[1];
+        sse_maxpd(&GX, EX);
         NEXT;
 
     _6f_0x60:  /* PUNPCKLBW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=7; i>0; --i)  // 0 is untouched
-            GX.ub[2 * i] = GX.ub[i];
-        if(&GX==EX)
-            for(int i=0; i<8; ++i)
-                GX.ub[2 * i + 1] = GX.ub[2 * i];
-        else 
-            for(int i=0; i<8; ++i)
-                GX.ub[2 * i + 1] = EX->ub[i];
+        sse_punpcklbw(&GX, EX);
         NEXT;
     _6f_0x61:  /* PUNPCKLWD Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=3; i>0; --i)
-            GX.uw[2 * i] = GX.uw[i];
-        if(&GX==EX)
-            for(int i=0; i<4; ++i)
-                GX.uw[2 * i + 1] = GX.uw[2 * i];
-        else
-            for(int i=0; i<4; ++i)
-                GX.uw[2 * i + 1] = EX->uw[i];
+        sse_punpcklwd(&GX, EX);
         NEXT;
     _6f_0x62:  /* PUNPCKLDQ Gx,Ex */
         nextop = F8;
         GET_EX;
-        GX.ud[3] = EX->ud[1];
-        GX.ud[2] = GX.ud[1];
-        GX.ud[1] = EX->ud[0];
+        sse_punpckldq(&GX, EX);
         NEXT;
     _6f_0x63:  /* PACKSSWB Gx,Ex */
         nextop = F8;
         GET_EX;
-        if(&GX==EX) {
-            for(int i=0; i<8; ++i)
-                GX.sb[i] = (EX->sw[i]<-128)?-128:((EX->sw[i]>127)?127:EX->sw[i]);
-            GX.q[1] = GX.q[0];
-        } else {
-            for(int i=0; i<8; ++i)
-                GX.sb[i] = (GX.sw[i]<-128)?-128:((GX.sw[i]>127)?127:GX.sw[i]);
-            for(int i=0; i<8; ++i)
-                GX.sb[8+i] = (EX->sw[i]<-128)?-128:((EX->sw[i]>127)?127:EX->sw[i]);
-        }
+        sse_packsswb(&GX, EX);
         NEXT;
     _6f_0x64:  /* PCMPGTB Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<16; ++i)
-            GX.ub[i] = (GX.sb[i]>EX->sb[i])?0xFF:0x00;
+        sse_pcmpgtb(&GX, EX);
         NEXT;
     _6f_0x65:  /* PCMPGTW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<8; ++i)
-            GX.uw[i] = (GX.sw[i]>EX->sw[i])?0xFFFF:0x0000;
+        sse_pcmpgtw(&GX, EX);
         NEXT;
     _6f_0x66:  /* PCMPGTD Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<4; ++i)
-            GX.ud[i] = (GX.sd[i]>EX->sd[i])?0xFFFFFFFF:0x00000000;
+        sse_pcmpgtd(&GX, EX);
         NEXT;
     _6f_0x67:  /* PACKUSWB Gx,Ex */
         nextop = F8;
         GET_EX;
-        if(&GX==EX) {
-            for(int i=0; i<8; ++i)
-                GX.ub[i] = (EX->sw[i]<0)?0:((EX->sw[i]>0xff)?0xff:EX->sw[i]);
-            GX.q[1] = GX.q[0];
-        } else {
-            for(int i=0; i<8; ++i)
-                GX.ub[i] = (GX.sw[i]<0)?0:((GX.sw[i]>0xff)?0xff:GX.sw[i]);
-            for(int i=0; i<8; ++i)
-                GX.ub[8+i] = (EX->sw[i]<0)?0:((EX->sw[i]>0xff)?0xff:EX->sw[i]);
-        }
+        sse_packuswb(&GX, EX);
         NEXT;
     _6f_0x68:  /* PUNPCKHBW Gx,Ex */
         nextop = F8;
         GET_EX;
-        if(EX==&GX) {eax1 = GX; EX = &eax1;}   // copy is needed
-        for(int i=0; i<8; ++i)
-            GX.ub[2 * i] = GX.ub[i + 8];
-        for(int i=0; i<8; ++i)
-            GX.ub[2 * i + 1] = EX->ub[i + 8];
+        sse_punpckhbw(&GX, EX);
         NEXT;
     _6f_0x69:  /* PUNPCKHWD Gx,Ex */
         nextop = F8;
         GET_EX;
-        if(EX==&GX) {eax1 = GX; EX = &eax1;}   // copy is needed
-        for(int i=0; i<4; ++i)
-            GX.uw[2 * i] = GX.uw[i + 4];
-        for(int i=0; i<4; ++i)
-            GX.uw[2 * i + 1] = EX->uw[i + 4];
+        sse_punpckhwd(&GX, EX);
         NEXT;
     _6f_0x6A:  /* PUNPCKHDQ Gx,Ex */
         nextop = F8;
         GET_EX;
-        // no copy needed if &GX==EX
-        GX.ud[0] = GX.ud[2];
-        GX.ud[1] = EX->ud[2];
-        GX.ud[2] = GX.ud[3];
-        GX.ud[3] = EX->ud[3];
+        sse_punpckhdq(&GX, EX);
         NEXT;
     _6f_0x6B:  /* PACKSSDW Gx,Ex */
         nextop = F8;
         GET_EX;
-        if(&GX==EX) {
-            for(int i=0; i<4; ++i)
-                GX.sw[i] = (EX->sd[i]<-32768)?-32768:((EX->sd[i]>32767)?32767:EX->sd[i]);
-            GX.q[1] = GX.q[0];
-        } else {
-            for(int i=0; i<4; ++i)
-                GX.sw[i] = (GX.sd[i]<-32768)?-32768:((GX.sd[i]>32767)?32767:GX.sd[i]);
-            for(int i=0; i<4; ++i)
-                GX.sw[4+i] = (EX->sd[i]<-32768)?-32768:((EX->sd[i]>32767)?32767:EX->sd[i]);
-        }
+        sse_packssdw(&GX, EX);
         NEXT;
     _6f_0x6C:  /* PUNPCKLQDQ Gx,Ex */
         nextop = F8;
         GET_EX;
-        GX.q[1] = EX->q[0];
+        sse_punpcklqdq(&GX, EX);
         NEXT;
     _6f_0x6D:  /* PUNPCKHQDQ Gx,Ex */
         nextop = F8;
         GET_EX;
-        GX.q[0] = GX.q[1];
-        GX.q[1] = EX->q[1];
+        sse_punpckhqdq(&GX, EX);
         NEXT;
     _6f_0x6E:  /* MOVD Gx, Ed */
         nextop = F8;
@@ -700,10 +626,7 @@ void Run660F(x86emu_t *emu)
     _6f_0x70:  /* PSHUFD Gx,Ex,Ib */
         nextop = F8;
         GET_EX;
-        tmp8u = F8;
-        if(EX==&GX) {eax1 = GX; EX = &eax1;}   // copy is needed
-        for (int i=0; i<4; ++i)
-            GX.ud[i] = EX->ud[(tmp8u>>(i*2))&3];
+        sse_pshufd(&GX, EX, F8);
         NEXT;
     _6f_0x71:  /* GRP */
         nextop = F8;
@@ -812,20 +735,17 @@ void Run660F(x86emu_t *emu)
     _6f_0x74:  /* PCMPEQB Gx,Ex */
         nextop = F8;
         GET_EX;
-        for (int i=0; i<16; ++i)
-            GX.ub[i] = (GX.ub[i]==EX->ub[i])?0xff:0;
+        sse_pcmpeqb(&GX, EX);
         NEXT;
     _6f_0x75:  /* PCMPEQW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for (int i=0; i<8; ++i)
-            GX.uw[i] = (GX.uw[i]==EX->uw[i])?0xffff:0;
+        sse_pcmpeqw(&GX, EX);
         NEXT;
     _6f_0x76:  /* PCMPEQD Gx,Ex */
         nextop = F8;
         GET_EX;
-        for (int i=0; i<4; ++i)
-            GX.ud[i] = (GX.ud[i]==EX->ud[i])?0xffffffff:0;
+        sse_pcmpeqd(&GX, EX);
         NEXT;
 
     _6f_0x7C:  /* HADDPD Gx, Ex */
@@ -1131,16 +1051,12 @@ void Run660F(x86emu_t *emu)
     _6f_0xD4:  /* PADDQ Gx,Ex */
         nextop = F8;
         GET_EX;
-        GX.sq[0] += EX->sq[0];
-        GX.sq[1] += EX->sq[1];
+        sse_paddq(&GX, EX);
         NEXT;
     _6f_0xD5:  /* PMULLW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<8; ++i) {
-            tmp32s = (int32_t)GX.sw[i] * EX->sw[i];
-            GX.sw[i] = tmp32s&0xffff;
-        }
+        sse_pmullw(&GX, EX);
         NEXT;
     _6f_0xD6:  /* MOVQ Ex,Gx */
         nextop = F8;
@@ -1163,64 +1079,47 @@ void Run660F(x86emu_t *emu)
     _6f_0xD8:  /* PSUBUSB Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<16; ++i) {
-            tmp16s = (int16_t)GX.ub[i] - EX->ub[i];
-            GX.ub[i] = (tmp16s<0)?0:tmp16s;
-        }
+        sse_psubusb(&GX, EX);
         NEXT;
     _6f_0xD9:  /* PSUBUSW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<8; ++i) {
-            tmp32s = (int32_t)GX.uw[i] - EX->uw[i];
-            GX.uw[i] = (tmp32s<0)?0:tmp32s;
-        }
+        sse_psubusw(&GX, EX);
         NEXT;
     _6f_0xDA:  /* PMINUB Gx, Ex */
         nextop = F8;
         GET_EX;
-        for (int i=0; i<16; ++i)
-            if(EX->ub[i]<GX.ub[i]) GX.ub[i] = EX->ub[i];
+        sse_pminub(&GX, EX);
         NEXT;
     _6f_0xDB:  /* PAND Gx,Ex */
         nextop = F8;
         GET_EX;
-        GX.q[0] &= EX->q[0];
-        GX.q[1] &= EX->q[1];
+        sse_pand(&GX, EX);
         NEXT;
     _6f_0xDC:  /* PADDUSB Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<16; ++i) {
-            tmp16s = (int16_t)GX.ub[i] + EX->ub[i];
-            GX.ub[i] = (tmp16s>255)?255:tmp16s;
-        }
+        sse_paddusb(&GX, EX);
         NEXT;
     _6f_0xDD:  /* PADDUSW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<8; ++i) {
-            tmp32s = (int32_t)GX.uw[i] + EX->uw[i];
-            GX.uw[i] = (tmp32s>65535)?65535:tmp32s;
-        }
+        sse_paddusw(&GX, EX);
         NEXT;
     _6f_0xDE:  /* PMAXUB Gx, Ex */
         nextop = F8;
         GET_EX;
-        for (int i=0; i<16; ++i)
-            if(EX->ub[i]>GX.ub[i]) GX.ub[i] = EX->ub[i];
+        sse_pmaxub(&GX, EX);
         NEXT;
     _6f_0xDF:  /* PANDN Gx,Ex */
         nextop = F8;
         GET_EX;
-        GX.q[0] = (~(GX.q[0])) & EX->q[0];
-        GX.q[1] = (~(GX.q[1])) & EX->q[1];
+        sse_pandn(&GX, EX);
         NEXT;
     _6f_0xE0:  /* PAVGB Gx, Ex */
         nextop = F8;
         GET_EX;
-        for (int i=0; i<16; ++i)
-            GX.ub[i] = ((uint16_t)GX.ub[i] + EX->ub[i] + 1)>>1;
+        sse_pavgb(&GX, EX);
         NEXT;
     _6f_0xE1:  /* PSRAW Gx, Ex */
         nextop = F8;
@@ -1239,24 +1138,17 @@ void Run660F(x86emu_t *emu)
     _6f_0xE3:  /* PAVGW Gx, Ex */
         nextop = F8;
         GET_EX;
-        for (int i=0; i<8; ++i)
-            GX.uw[i] = ((uint32_t)GX.uw[i] + EX->uw[i] + 1)>>1;
+        sse_pavgw(&GX, EX);
         NEXT;
     _6f_0xE4:  /* PMULHUW Gx, Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<8; ++i) {
-            tmp32u = (uint32_t)GX.uw[i] * EX->uw[i];
-            GX.uw[i] = (tmp32u>>16)&0xffff;
-        }
+        sse_pmulhuw(&GX, EX);
         NEXT;
     _6f_0xE5:  /* PMULHW Gx, Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<8; ++i) {
-            tmp32s = (int32_t)GX.sw[i] * EX->sw[i];
-            GX.uw[i] = (tmp32s>>16)&0xffff;
-        }
+        sse_pmulhw(&GX, EX);
         NEXT;
     _6f_0xE6:  /* CVTTPD2DQ Gx, Ex */
         nextop = F8;
@@ -1274,62 +1166,42 @@ void Run660F(x86emu_t *emu)
     _6f_0xE8:  /* PSUBSB Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<16; ++i) {
-            tmp16s = (int16_t)GX.sb[i] - EX->sb[i];
-            GX.sb[i] = (tmp16s<-128)?-128:((tmp16s>127)?127:tmp16s);
-        }
+        sse_psubsb(&GX, EX);
         NEXT;
     _6f_0xE9:  /* PSUBSW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<8; ++i) {
-            tmp32s = (int32_t)GX.sw[i] - EX->sw[i];
-            GX.sw[i] = (tmp32s>32767)?32767:((tmp32s<-32768)?-32768:tmp32s);
-        }
+        sse_psubsw(&GX, EX);
         NEXT;
     _6f_0xEA:  /* PMINSW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for (int i=0; i<8; ++i)
-            GX.sw[i] = (GX.sw[i]<EX->sw[i])?GX.sw[i]:EX->sw[i];
+        sse_pminsw(&GX, EX);
         NEXT;
     _6f_0xEB:  /* POR Gx,Ex */
         nextop = F8;
         GET_EX;
-        GX.ud[0] |= EX->ud[0];
-        GX.ud[1] |= EX->ud[1];
-        GX.ud[2] |= EX->ud[2];
-        GX.ud[3] |= EX->ud[3];
+        sse_por(&GX, EX);
         NEXT;
     _6f_0xEC:  /* PADDSB Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<16; ++i) {
-            tmp16s = (int16_t)GX.sb[i] + EX->sb[i];
-            GX.sb[i] = (tmp16s>127)?127:((tmp16s<-128)?-128:tmp16s);
-        }
+        sse_paddsb(&GX, EX);
         NEXT;
     _6f_0xED:  /* PADDSW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<8; ++i) {
-            tmp32s = (int32_t)GX.sw[i] + EX->sw[i];
-            GX.sw[i] = (tmp32s>32767)?32767:((tmp32s<-32768)?-32768:tmp32s);
-        }
+        sse_paddsw(&GX, EX);
         NEXT;
     _6f_0xEE:  /* PMAXSW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<8; ++i)
-            GX.sw[i] = (GX.sw[i]>EX->sw[i])?GX.sw[i]:EX->sw[i];
+        sse_pmaxsw(&GX, EX);
         NEXT;
     _6f_0xEF:  /* PXOR Gx,Ex */
         nextop = F8;
         GET_EX;
-        GX.ud[0] ^= EX->ud[0];
-        GX.ud[1] ^= EX->ud[1];
-        GX.ud[2] ^= EX->ud[2];
-        GX.ud[3] ^= EX->ud[3];
+        sse_pxor(&GX, EX);
         NEXT;
 
     _6f_0xF1:  /* PSLLW Gx, Ex */
@@ -1365,20 +1237,12 @@ void Run660F(x86emu_t *emu)
     _6f_0xF5:  /* PMADDWD Gx,Ex */
         nextop = F8;
         GET_EX;
-        for (int i=0; i<4; ++i)
-            GX.sd[i] = (int32_t)(GX.sw[i*2+0])*EX->sw[i*2+0] + (int32_t)(GX.sw[i*2+1])*EX->sw[i*2+1];
+        sse_pmaddwd(&GX, EX);
         NEXT;
     _6f_0xF6:  /* PSADBW Gx, Ex */
         nextop = F8;
         GET_EX;
-        tmp32u = 0;
-        for (int i=0; i<8; ++i)
-            tmp32u += (GX.ub[i]>EX->ub[i])?(GX.ub[i] - EX->ub[i]):(EX->ub[i] - GX.ub[i]);
-        GX.q[0] = tmp32u;
-        tmp32u = 0;
-        for (int i=8; i<16; ++i)
-            tmp32u += (GX.ub[i]>EX->ub[i])?(GX.ub[i] - EX->ub[i]):(EX->ub[i] - GX.ub[i]);
-        GX.q[1] = tmp32u;
+        sse_psadbw(&GX, EX);
         NEXT;
     _6f_0xF7:  /* MASKMOVDQU Gx, Ex */
         nextop = F8;
@@ -1392,48 +1256,37 @@ void Run660F(x86emu_t *emu)
     _6f_0xF8:  /* PSUBB Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<16; ++i)
-            GX.sb[i] -= EX->sb[i];
+        sse_psubb(&GX, EX);
         NEXT;
     _6f_0xF9:  /* PSUBW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<8; ++i)
-            GX.sw[i] -= EX->sw[i];
+        sse_psubw(&GX, EX);
         NEXT;
     _6f_0xFA:  /* PSUBD Gx,Ex */
         nextop = F8;
         GET_EX;
-        GX.sd[0] -= EX->sd[0];
-        GX.sd[1] -= EX->sd[1];
-        GX.sd[2] -= EX->sd[2];
-        GX.sd[3] -= EX->sd[3];
+        sse_psubd(&GX, EX);
         NEXT;
     _6f_0xFB:  /* PSUBQ Gx,Ex */
         nextop = F8;
         GET_EX;
-        GX.sq[0] -= EX->sq[0];
-        GX.sq[1] -= EX->sq[1];
+        sse_psubq(&GX, EX);
         NEXT;
     _6f_0xFC:  /* PADDB Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<16; ++i)
-            GX.sb[i] += EX->sb[i];
+        sse_paddb(&GX, EX);
         NEXT;
     _6f_0xFD:  /* PADDW Gx,Ex */
         nextop = F8;
         GET_EX;
-        for(int i=0; i<8; ++i)
-            GX.sw[i] += EX->sw[i];
+        sse_paddw(&GX, EX);
         NEXT;
     _6f_0xFE:  /* PADDD Gx,Ex */
         nextop = F8;
         GET_EX;
-        GX.sd[0] += EX->sd[0];
-        GX.sd[1] += EX->sd[1];
-        GX.sd[2] += EX->sd[2];
-        GX.sd[3] += EX->sd[3];
+        sse_paddd(&GX, EX);
         NEXT;
  
     _fini:
@@ -23,6 +23,7 @@
 #include "x86trace.h"
 #endif
 #include "x86tls.h"
+#include "x86primop.h"
 
 #define PARITY(x)   (((emu->x86emu_parity_tab[(x) / 32] >> ((x) % 32)) & 1) == 0)
 #define XOR2(x) 	(((x) ^ ((x)>>1)) & 0x1)
@@ -752,17 +753,149 @@ uintptr_t GetSegmentBaseEmu(x86emu_t* emu, int seg)
 }
 
 
+// fill p[period..size) repeating p[0..period), doubling the copied size each time
+static void fillPattern(uint8_t* p, uintptr_t period, uintptr_t size)
+{
+    uintptr_t filled = period;
+    while(filled<size) {
+        uintptr_t n = (filled<size-filled)?filled:(size-filled);
+        memcpy(p+filled, p, n);
+        filled += n;
+    }
+}
+
+static inline uint32_t loadElem(uintptr_t p, int sz)
+{
+    switch(sz) {
+        case 1: return *(uint8_t*)p;
+        case 2: return *(uint16_t*)p;
+        default: return *(uint32_t*)p;
+    }
+}
+
+static inline void cmpElem(x86emu_t* emu, uint32_t d, uint32_t s, int sz)
+{
+    switch(sz) {
+        case 1: cmp8(emu, d, s); break;
+        case 2: cmp16(emu, d, s); break;
+        default: cmp32(emu, d, s); break;
+    }
+}
+
+// Bulk REP MOVS/STOS/CMPS/SCAS. cnt is ECX, sz the size of the elements (1, 2 or 4).
+// ESI/EDI (and flags) are updated, the new ECX is returned. Writes on write protected pages
+// (translated or pre-decoded code) fault inside the libc function, and the signal handler
+// unprotects them, just like for a regular write.
+uint32_t RepMovs(x86emu_t* emu, uint32_t cnt, int sz)
+{
+    if(!cnt)
+        return 0;
+    uintptr_t len = (uintptr_t)cnt*sz;
+    intptr_t step = ACCESS_FLAG(F_DF)?-sz:sz;
+    uintptr_t src = R_ESI;
+    uintptr_t dst = R_EDI;
+    if(step<0) {
+        src -= len-sz;  // lowest addresses
+        dst -= len-sz;
+    }
+    if(step>0 && dst>src && dst-src<len) {
+        // forward overlap: the element by element copy repeats src[0..dst-src)
+        if(dst-src<(uintptr_t)sz) {
+            for(uintptr_t i=0; i<len; i+=sz)
+                memmove((void*)(dst+i), (void*)(src+i), sz);
+        } else
+            fillPattern((uint8_t*)src, dst-src, dst-src+len);
+    } else if(step<0 && src>dst && src-dst<len) {
+        // backward overlap, same thing but from the end
+        for(uintptr_t i=len; i; i-=sz)
+            memmove((void*)(dst+i-sz), (void*)(src+i-sz), sz);
+    } else
+        memmove((void*)dst, (void*)src, len);
+    R_ESI += cnt*step;
+    R_EDI += cnt*step;
+    return 0;
+}
+
+uint32_t RepStos(x86emu_t* emu, uint32_t cnt, int sz)
+{
+    if(!cnt)
+        return 0;
+    uintptr_t len = (uintptr_t)cnt*sz;
+    intptr_t step = ACCESS_FLAG(F_DF)?-sz:sz;
+    uint8_t* dst = (uint8_t*)(uintptr_t)R_EDI;
+    if(step<0)
+        dst -= len-sz;
+    uint32_t val = R_EAX;
+    if(sz==1 || (sz==2 && (val&0xff)==((val>>8)&0xff)) || (sz==4 && val==(val&0xff)*0x01010101U))
+        memset(dst, val&0xff, len);
+    else {
+        memcpy(dst, &val, sz);
+        fillPattern(dst, sz, len);
+    }
+    R_EDI += cnt*step;
+    return 0;
+}
+
+uint32_t RepCmps(x86emu_t* emu, uint32_t cnt, int sz, int repz)
+{
+    if(!cnt)
+        return 0;
+    intptr_t step = ACCESS_FLAG(F_DF)?-sz:sz;
+    uintptr_t src = R_ESI;
+    uintptr_t dst = R_EDI;
+    uint32_t n = 0;
+    uint32_t s, d;
+    if(repz && step>0) {
+        // skip the identical part using memcmp
+        const uint32_t chunk = 256/sz;
+        while(cnt-n>chunk && !memcmp((void*)(src+n*sz), (void*)(dst+n*sz), chunk*sz))
+            n += chunk;
+    }
+    do {
+        s = loadElem(src+n*step, sz);
+        d = loadElem(dst+n*step, sz);
+        ++n;
+    } while(n<cnt && ((s==d)==repz));
+    R_ESI = src+n*step;
+    R_EDI = dst+n*step;
+    cmpElem(emu, s, d, sz);
+    return cnt-n;
+}
+
+uint32_t RepScas(x86emu_t* emu, uint32_t cnt, int sz, int repz)
+{
+    if(!cnt)
+        return 0;
+    intptr_t step = ACCESS_FLAG(F_DF)?-sz:sz;
+    uintptr_t dst = R_EDI;
+    uint32_t val = R_EAX&((sz==4)?0xffffffffU:((1U<<(sz*8))-1));
+    uint32_t n = 0;
+    uint32_t d;
+    if(!repz && sz==1 && step>0) {
+        uint8_t* f = (uint8_t*)memchr((void*)dst, val, cnt);
+        n = f?(uint32_t)(f-(uint8_t*)dst)+1:cnt;
+        d = ((uint8_t*)dst)[n-1];
+    } else do {
+        d = loadElem(dst+n*step, sz);
+        ++n;
+    } while(n<cnt && ((d==val)==repz));
+    R_EDI = dst+n*step;
+    cmpElem(emu, val, d, sz);
+    return cnt-n;
+}
+
 const char* getAddrFunctionName(uintptr_t addr)
 {
-    static char ret[1000];
+    static __thread char ret[1000];
     uint32_t sz = 0;
     uintptr_t start = 0;
-    const char* symbname = FindNearestSymbolName(FindElfAddress(my_context, addr), (void*)addr, &start, &sz);
+    elfheader_t* h = FindElfAddress(my_context, addr);
+    const char* symbname = FindNearestSymbolName(h, (void*)addr, &start, &sz);
     if(symbname && addr>=start && (addr<(start+sz) || !sz)) {
         if(addr==start)
-            sprintf(ret, "%s/%s", ElfName(FindElfAddress(my_context, addr)), symbname);
+            sprintf(ret, "%s/%s", ElfName(h), symbname);
         else
-            sprintf(ret, "%s/%s + %d", ElfName(FindElfAddress(my_context, addr)), symbname, addr - start);
+            sprintf(ret, "%s/%s + %d", ElfName(h), symbname, addr - start);
     } else
         sprintf(ret, "???");
     return ret;
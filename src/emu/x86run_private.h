@@ -206,10 +206,19 @@ void RunLock(x86emu_t *emu);
 void x86Syscall(x86emu_t *emu);
 void x86Int3(x86emu_t* emu);
 x86emu_t* x86emu_fork(x86emu_t* e, int forktype);
+#ifdef BOX86CORE
+int CoreBreakpoint(x86emu_t* emu, uintptr_t addr);
+#endif
 
 void PackFlags(x86emu_t* emu);
 void UnpackFlags(x86emu_t* emu);
 
+// bulk REP string opcodes, sz is the size of the elements. ESI/EDI/flags are updated, return the new ECX
+uint32_t RepMovs(x86emu_t* emu, uint32_t cnt, int sz);
+uint32_t RepStos(x86emu_t* emu, uint32_t cnt, int sz);
+uint32_t RepCmps(x86emu_t* emu, uint32_t cnt, int sz, int repz);
+uint32_t RepScas(x86emu_t* emu, uint32_t cnt, int sz, int repz);
+
 uintptr_t GetSegmentBaseEmu(x86emu_t* emu, int seg);
 #define GetGSBaseEmu(emu)    GetSegmentBaseEmu(emu, _GS)
 #define GetFSBaseEmu(emu)    GetSegmentBaseEmu(emu, _FS)
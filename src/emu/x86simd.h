@@ -0,0 +1,515 @@
+#ifndef __X86SIMD_H_
+#define __X86SIMD_H_
+#include <stdint.h>
+#include "regs.h"
+
+// Packed operations of the SSE/SSE2 (sse_xxx) and MMX (mmx_xxx) opcodes of the interpreter, d = op(d, s).
+// They use SSE2 on x86 hosts, and plain per-lane loops else (or with NOSIMD defined).
+// The NEON version for ARM is only used with NEONSIMD defined, as it has not been validated with tests/extensions yet.
+// d and s can be the same register.
+// Packed float stay scalar on ARM: ARMv7 NEON flush denormals to zero, and has no double nor divide.
+
+#if !defined(NOSIMD) && defined(NEONSIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define SIMD_NEON
+#elif !defined(NOSIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_SSE2
+#endif
+
+static inline int8_t   sat_s8 (int32_t v) {return (v<-128)?-128:((v>127)?127:v);}
+static inline uint8_t  sat_u8 (int32_t v) {return (v<0)?0:((v>255)?255:v);}
+static inline int16_t  sat_s16(int32_t v) {return (v<-32768)?-32768:((v>32767)?32767:v);}
+static inline uint16_t sat_u16(int32_t v) {return (v<0)?0:((v>65535)?65535:v);}
+
+// *** generators ***
+// per-lane: EXPR uses A for the lane of d and B for the lane of s
+#define SCALARX(NAME, T, N, EXPR)                                       \
+static inline void sse_##NAME(sse_regs_t* d, const sse_regs_t* s)      \
+{ for(int i=0; i<N; ++i) { d->T[i] = EXPR; } }
+#define SCALARM(NAME, T, N, EXPR)                                       \
+static inline void mmx_##NAME(mmx_regs_t* d, const mmx_regs_t* s)      \
+{ for(int i=0; i<N; ++i) { d->T[i] = EXPR; } }
+
+#ifdef SIMD_NEON
+#define NEONX(NAME, T, OP)                                              \
+static inline void sse_##NAME(sse_regs_t* d, const sse_regs_t* s)      \
+{ vst1q_##T((void*)d, OP(vld1q_##T((const void*)d), vld1q_##T((const void*)s))); }
+#define NEONM(NAME, T, OP)                                              \
+static inline void mmx_##NAME(mmx_regs_t* d, const mmx_regs_t* s)      \
+{ vst1_##T((void*)d, OP(vld1_##T((const void*)d), vld1_##T((const void*)s))); }
+// result type RT different from operand type T (compares)
+#define NEONX2(NAME, T, RT, OP)                                         \
+static inline void sse_##NAME(sse_regs_t* d, const sse_regs_t* s)      \
+{ vst1q_##RT((void*)d, OP(vld1q_##T((const void*)d), vld1q_##T((const void*)s))); }
+#define NEONM2(NAME, T, RT, OP)                                         \
+static inline void mmx_##NAME(mmx_regs_t* d, const mmx_regs_t* s)      \
+{ vst1_##RT((void*)d, OP(vld1_##T((const void*)d), vld1_##T((const void*)s))); }
+#define BOTH(NAME, T, MMXT, N, OP, EXPR)    NEONX(NAME, T, v##OP##q_##T) NEONM(NAME, T, v##OP##_##T)
+#define BOTH2(NAME, T, RT, MMXT, N, OP, EXPR)    NEONX2(NAME, T, RT, v##OP##q_##T) NEONM2(NAME, T, RT, v##OP##_##T)
+#elif defined(SIMD_SSE2)
+#define SSE2X(NAME, OP)                                                 \
+static inline void sse_##NAME(sse_regs_t* d, const sse_regs_t* s)      \
+{ _mm_storeu_si128((__m128i*)d, OP(_mm_loadu_si128((const __m128i*)d), _mm_loadu_si128((const __m128i*)s))); }
+#define SSE2M(NAME, OP)                                                 \
+static inline void mmx_##NAME(mmx_regs_t* d, const mmx_regs_t* s)      \
+{ _mm_storel_epi64((__m128i*)d, OP(_mm_loadl_epi64((const __m128i*)d), _mm_loadl_epi64((const __m128i*)s))); }
+#define BOTH(NAME, T, MMXT, N, OP, EXPR)    SSE2X(NAME, OP) SSE2M(NAME, OP)
+#define BOTH2(NAME, T, RT, MMXT, N, OP, EXPR)    SSE2X(NAME, OP) SSE2M(NAME, OP)
+#else
+#define BOTH(NAME, T, MMXT, N, OP, EXPR)    SCALARX(NAME, MMXT, N, EXPR) SCALARM(NAME, MMXT, N/2, EXPR)
+#define BOTH2(NAME, T, RT, MMXT, N, OP, EXPR)    SCALARX(NAME, MMXT, N, EXPR) SCALARM(NAME, MMXT, N/2, EXPR)
+#endif
+
+#ifdef SIMD_NEON
+#define GO(NAME, T, MMXT, N, NEONOP, SSE2OP, EXPR)  BOTH(NAME, T, MMXT, N, NEONOP, EXPR)
+#define GO2(NAME, T, RT, MMXT, N, NEONOP, SSE2OP, EXPR)  BOTH2(NAME, T, RT, MMXT, N, NEONOP, EXPR)
+#else
+#define GO(NAME, T, MMXT, N, NEONOP, SSE2OP, EXPR)  BOTH(NAME, T, MMXT, N, SSE2OP, EXPR)
+#define GO2(NAME, T, RT, MMXT, N, NEONOP, SSE2OP, EXPR)  BOTH2(NAME, T, RT, MMXT, N, SSE2OP, EXPR)
+#endif
+// T is the NEON lane type, MMXT the member of sse_regs_t/mmx_regs_t used by the plain version
+
+// *** packed integer ***
+#define A   (d->ub[i])
+#define B   (s->ub[i])
+GO(paddb,   u8,  ub, 16, add,   _mm_add_epi8,   A+B)
+GO(psubb,   u8,  ub, 16, sub,   _mm_sub_epi8,   A-B)
+GO(paddusb, u8,  ub, 16, qadd,  _mm_adds_epu8,  sat_u8((int32_t)A+B))
+GO(psubusb, u8,  ub, 16, qsub,  _mm_subs_epu8,  sat_u8((int32_t)A-B))
+GO(pavgb,   u8,  ub, 16, rhadd, _mm_avg_epu8,   ((uint32_t)A+B+1)>>1)
+GO(pminub,  u8,  ub, 16, min,   _mm_min_epu8,   (A<B)?A:B)
+GO(pmaxub,  u8,  ub, 16, max,   _mm_max_epu8,   (A>B)?A:B)
+GO(pand,    u8,  ub, 16, and,   _mm_and_si128,  A&B)
+GO(por,     u8,  ub, 16, orr,   _mm_or_si128,   A|B)
+GO(pxor,    u8,  ub, 16, eor,   _mm_xor_si128,  A^B)
+GO2(pcmpeqb, u8, u8, ub, 16, ceq, _mm_cmpeq_epi8, (A==B)?0xff:0)
+#undef A
+#undef B
+#define A   (d->sb[i])
+#define B   (s->sb[i])
+GO(paddsb,  s8,  sb, 16, qadd,  _mm_adds_epi8,  sat_s8((int32_t)A+B))
+GO(psubsb,  s8,  sb, 16, qsub,  _mm_subs_epi8,  sat_s8((int32_t)A-B))
+GO2(pcmpgtb, s8, u8, sb, 16, cgt, _mm_cmpgt_epi8, (A>B)?-1:0)
+#undef A
+#undef B
+#define A   (d->uw[i])
+#define B   (s->uw[i])
+GO(paddw,   u16, uw, 8,  add,   _mm_add_epi16,  A+B)
+GO(psubw,   u16, uw, 8,  sub,   _mm_sub_epi16,  A-B)
+GO(paddusw, u16, uw, 8,  qadd,  _mm_adds_epu16, sat_u16((int32_t)A+B))
+GO(psubusw, u16, uw, 8,  qsub,  _mm_subs_epu16, sat_u16((int32_t)A-B))
+GO(pavgw,   u16, uw, 8,  rhadd, _mm_avg_epu16,  ((uint32_t)A+B+1)>>1)
+GO2(pcmpeqw, u16, u16, uw, 8, ceq, _mm_cmpeq_epi16, (A==B)?0xffff:0)
+#undef A
+#undef B
+#define A   (d->sw[i])
+#define B   (s->sw[i])
+GO(paddsw,  s16, sw, 8,  qadd,  _mm_adds_epi16, sat_s16((int32_t)A+B))
+GO(psubsw,  s16, sw, 8,  qsub,  _mm_subs_epi16, sat_s16((int32_t)A-B))
+GO(pmullw,  s16, sw, 8,  mul,   _mm_mullo_epi16, (int32_t)A*B)
+GO(pminsw,  s16, sw, 8,  min,   _mm_min_epi16,  (A<B)?A:B)
+GO(pmaxsw,  s16, sw, 8,  max,   _mm_max_epi16,  (A>B)?A:B)
+GO2(pcmpgtw, s16, u16, sw, 8, cgt, _mm_cmpgt_epi16, (A>B)?-1:0)
+#undef A
+#undef B
+#define A   (d->ud[i])
+#define B   (s->ud[i])
+GO(paddd,   u32, ud, 4,  add,   _mm_add_epi32,  A+B)
+GO(psubd,   u32, ud, 4,  sub,   _mm_sub_epi32,  A-B)
+GO2(pcmpeqd, u32, u32, ud, 4, ceq, _mm_cmpeq_epi32, (A==B)?0xffffffff:0)
+#undef A
+#undef B
+#define A   (d->sd[i])
+#define B   (s->sd[i])
+GO2(pcmpgtd, s32, u32, sd, 4, cgt, _mm_cmpgt_epi32, (A>B)?-1:0)
+#undef A
+#undef B
+// mmx_regs_t has no array of 64bits lanes, so mmx_paddq/psubq are not generated (they are trivial anyway)
+#if defined(SIMD_NEON)
+NEONX(paddq, s64, vaddq_s64)
+NEONX(psubq, s64, vsubq_s64)
+#elif defined(SIMD_SSE2)
+SSE2X(paddq, _mm_add_epi64)
+SSE2X(psubq, _mm_sub_epi64)
+#else
+#define A   (d->q[i])
+#define B   (s->q[i])
+SCALARX(paddq, q, 2, A+B)
+SCALARX(psubq, q, 2, A-B)
+#undef A
+#undef B
+#endif
+
+// d = ~d & s
+#if defined(SIMD_NEON)
+static inline void sse_pandn(sse_regs_t* d, const sse_regs_t* s)
+{
+    vst1q_u8(d->ub, vbicq_u8(vld1q_u8(s->ub), vld1q_u8(d->ub)));
+}
+static inline void mmx_pandn(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    vst1_u8(d->ub, vbic_u8(vld1_u8(s->ub), vld1_u8(d->ub)));
+}
+#elif defined(SIMD_SSE2)
+SSE2X(pandn, _mm_andnot_si128)
+SSE2M(pandn, _mm_andnot_si128)
+#else
+static inline void sse_pandn(sse_regs_t* d, const sse_regs_t* s)
+{
+    d->q[0] = (~d->q[0]) & s->q[0];
+    d->q[1] = (~d->q[1]) & s->q[1];
+}
+static inline void mmx_pandn(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    d->q = (~d->q) & s->q;
+}
+#endif
+
+// high part of the 16bits multiplication, and multiply-add of 16bits pairs to 32bits
+#if defined(SIMD_NEON)
+static inline void sse_pmulhw(sse_regs_t* d, const sse_regs_t* s)
+{
+    int16x8_t a = vld1q_s16(d->sw), b = vld1q_s16(s->sw);
+    int32x4_t lo = vmull_s16(vget_low_s16(a), vget_low_s16(b));
+    int32x4_t hi = vmull_s16(vget_high_s16(a), vget_high_s16(b));
+    vst1q_s16(d->sw, vcombine_s16(vshrn_n_s32(lo, 16), vshrn_n_s32(hi, 16)));
+}
+static inline void mmx_pmulhw(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    vst1_s16(d->sw, vshrn_n_s32(vmull_s16(vld1_s16(d->sw), vld1_s16(s->sw)), 16));
+}
+static inline void sse_pmulhuw(sse_regs_t* d, const sse_regs_t* s)
+{
+    uint16x8_t a = vld1q_u16(d->uw), b = vld1q_u16(s->uw);
+    uint32x4_t lo = vmull_u16(vget_low_u16(a), vget_low_u16(b));
+    uint32x4_t hi = vmull_u16(vget_high_u16(a), vget_high_u16(b));
+    vst1q_u16(d->uw, vcombine_u16(vshrn_n_u32(lo, 16), vshrn_n_u32(hi, 16)));
+}
+static inline void mmx_pmulhuw(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    vst1_u16(d->uw, vshrn_n_u32(vmull_u16(vld1_u16(d->uw), vld1_u16(s->uw)), 16));
+}
+static inline void sse_pmaddwd(sse_regs_t* d, const sse_regs_t* s)
+{
+    int16x8_t a = vld1q_s16(d->sw), b = vld1q_s16(s->sw);
+    int32x4_t lo = vmull_s16(vget_low_s16(a), vget_low_s16(b));
+    int32x4_t hi = vmull_s16(vget_high_s16(a), vget_high_s16(b));
+    vst1q_s32(d->sd, vcombine_s32(vpadd_s32(vget_low_s32(lo), vget_high_s32(lo)), vpadd_s32(vget_low_s32(hi), vget_high_s32(hi))));
+}
+static inline void mmx_pmaddwd(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    int32x4_t p = vmull_s16(vld1_s16(d->sw), vld1_s16(s->sw));
+    vst1_s32(d->sd, vpadd_s32(vget_low_s32(p), vget_high_s32(p)));
+}
+#elif defined(SIMD_SSE2)
+SSE2X(pmulhw, _mm_mulhi_epi16)
+SSE2M(pmulhw, _mm_mulhi_epi16)
+SSE2X(pmulhuw, _mm_mulhi_epu16)
+SSE2M(pmulhuw, _mm_mulhi_epu16)
+SSE2X(pmaddwd, _mm_madd_epi16)
+SSE2M(pmaddwd, _mm_madd_epi16)
+#else
+#define A   (d->sw[i])
+#define B   (s->sw[i])
+SCALARX(pmulhw, sw, 8, ((int32_t)A*B)>>16)
+SCALARM(pmulhw, sw, 4, ((int32_t)A*B)>>16)
+#undef A
+#undef B
+#define A   (d->uw[i])
+#define B   (s->uw[i])
+SCALARX(pmulhuw, uw, 8, ((uint32_t)A*B)>>16)
+SCALARM(pmulhuw, uw, 4, ((uint32_t)A*B)>>16)
+#undef A
+#undef B
+#define A   (d->sd[i])
+#define B   (s->sd[i])
+SCALARX(pmaddwd, sd, 4, (int32_t)((uint32_t)((int32_t)d->sw[i*2]*s->sw[i*2]) + (uint32_t)((int32_t)d->sw[i*2+1]*s->sw[i*2+1])))
+SCALARM(pmaddwd, sd, 2, (int32_t)((uint32_t)((int32_t)d->sw[i*2]*s->sw[i*2]) + (uint32_t)((int32_t)d->sw[i*2+1]*s->sw[i*2+1])))
+#undef A
+#undef B
+#endif
+
+// sum of absolute differences of the 8 bytes of each 64bits lanes
+#if defined(SIMD_NEON)
+static inline void sse_psadbw(sse_regs_t* d, const sse_regs_t* s)
+{
+    uint8x16_t ad = vabdq_u8(vld1q_u8(d->ub), vld1q_u8(s->ub));
+    vst1q_u64(d->q, vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(ad))));
+}
+static inline void mmx_psadbw(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    uint8x8_t ad = vabd_u8(vld1_u8(d->ub), vld1_u8(s->ub));
+    vst1_u64(&d->q, vpaddl_u32(vpaddl_u16(vpaddl_u8(ad))));
+}
+#elif defined(SIMD_SSE2)
+SSE2X(psadbw, _mm_sad_epu8)
+SSE2M(psadbw, _mm_sad_epu8)
+#else
+static inline void sse_psadbw(sse_regs_t* d, const sse_regs_t* s)
+{
+    for(int j=0; j<2; ++j) {
+        uint32_t sum = 0;
+        for (int i=j*8; i<j*8+8; ++i)
+            sum += (d->ub[i]>s->ub[i])?(d->ub[i] - s->ub[i]):(s->ub[i] - d->ub[i]);
+        d->q[j] = sum;
+    }
+}
+static inline void mmx_psadbw(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    uint32_t sum = 0;
+    for (int i=0; i<8; ++i)
+        sum += (d->ub[i]>s->ub[i])?(d->ub[i] - s->ub[i]):(s->ub[i] - d->ub[i]);
+    d->q = sum;
+}
+#endif
+
+// *** pack / unpack ***
+#if defined(SIMD_NEON)
+static inline void sse_packsswb(sse_regs_t* d, const sse_regs_t* s)
+{
+    vst1q_s8(d->sb, vcombine_s8(vqmovn_s16(vld1q_s16(d->sw)), vqmovn_s16(vld1q_s16(s->sw))));
+}
+static inline void mmx_packsswb(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    vst1_s8(d->sb, vqmovn_s16(vcombine_s16(vld1_s16(d->sw), vld1_s16(s->sw))));
+}
+static inline void sse_packuswb(sse_regs_t* d, const sse_regs_t* s)
+{
+    vst1q_u8(d->ub, vcombine_u8(vqmovun_s16(vld1q_s16(d->sw)), vqmovun_s16(vld1q_s16(s->sw))));
+}
+static inline void mmx_packuswb(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    vst1_u8(d->ub, vqmovun_s16(vcombine_s16(vld1_s16(d->sw), vld1_s16(s->sw))));
+}
+static inline void sse_packssdw(sse_regs_t* d, const sse_regs_t* s)
+{
+    vst1q_s16(d->sw, vcombine_s16(vqmovn_s32(vld1q_s32(d->sd)), vqmovn_s32(vld1q_s32(s->sd))));
+}
+static inline void mmx_packssdw(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    vst1_s16(d->sw, vqmovn_s32(vcombine_s32(vld1_s32(d->sd), vld1_s32(s->sd))));
+}
+#define GOUNPCK(N, T)                                                           \
+static inline void sse_punpckl##N(sse_regs_t* d, const sse_regs_t* s)          \
+{ vst1q_##T((void*)d, vzipq_##T(vld1q_##T((const void*)d), vld1q_##T((const void*)s)).val[0]); } \
+static inline void sse_punpckh##N(sse_regs_t* d, const sse_regs_t* s)          \
+{ vst1q_##T((void*)d, vzipq_##T(vld1q_##T((const void*)d), vld1q_##T((const void*)s)).val[1]); } \
+static inline void mmx_punpckl##N(mmx_regs_t* d, const mmx_regs_t* s)          \
+{ vst1_##T((void*)d, vzip_##T(vld1_##T((const void*)d), vld1_##T((const void*)s)).val[0]); } \
+static inline void mmx_punpckh##N(mmx_regs_t* d, const mmx_regs_t* s)          \
+{ vst1_##T((void*)d, vzip_##T(vld1_##T((const void*)d), vld1_##T((const void*)s)).val[1]); }
+GOUNPCK(bw, u8)
+GOUNPCK(wd, u16)
+GOUNPCK(dq, u32)
+#undef GOUNPCK
+static inline void sse_punpcklqdq(sse_regs_t* d, const sse_regs_t* s)
+{
+    vst1q_u64(d->q, vcombine_u64(vld1_u64(&d->q[0]), vld1_u64(&s->q[0])));
+}
+static inline void sse_punpckhqdq(sse_regs_t* d, const sse_regs_t* s)
+{
+    vst1q_u64(d->q, vcombine_u64(vld1_u64(&d->q[1]), vld1_u64(&s->q[1])));
+}
+#elif defined(SIMD_SSE2)
+// for mmx, the 2 registers are packed in the same 128bits register
+static inline __m128i mmx_packs_epi16(__m128i a, __m128i b)  {return _mm_packs_epi16(_mm_unpacklo_epi64(a, b), a);}
+static inline __m128i mmx_packus_epi16(__m128i a, __m128i b) {return _mm_packus_epi16(_mm_unpacklo_epi64(a, b), a);}
+static inline __m128i mmx_packs_epi32(__m128i a, __m128i b)  {return _mm_packs_epi32(_mm_unpacklo_epi64(a, b), a);}
+SSE2X(packsswb, _mm_packs_epi16)
+SSE2M(packsswb, mmx_packs_epi16)
+SSE2X(packuswb, _mm_packus_epi16)
+SSE2M(packuswb, mmx_packus_epi16)
+SSE2X(packssdw, _mm_packs_epi32)
+SSE2M(packssdw, mmx_packs_epi32)
+// for mmx, the high part of the interleaved low halves
+static inline __m128i mmx_unpackhi_epi8(__m128i a, __m128i b)  {return _mm_srli_si128(_mm_unpacklo_epi8(a, b), 8);}
+static inline __m128i mmx_unpackhi_epi16(__m128i a, __m128i b) {return _mm_srli_si128(_mm_unpacklo_epi16(a, b), 8);}
+static inline __m128i mmx_unpackhi_epi32(__m128i a, __m128i b) {return _mm_srli_si128(_mm_unpacklo_epi32(a, b), 8);}
+SSE2X(punpcklbw, _mm_unpacklo_epi8)
+SSE2X(punpckhbw, _mm_unpackhi_epi8)
+SSE2M(punpcklbw, _mm_unpacklo_epi8)
+SSE2M(punpckhbw, mmx_unpackhi_epi8)
+SSE2X(punpcklwd, _mm_unpacklo_epi16)
+SSE2X(punpckhwd, _mm_unpackhi_epi16)
+SSE2M(punpcklwd, _mm_unpacklo_epi16)
+SSE2M(punpckhwd, mmx_unpackhi_epi16)
+SSE2X(punpckldq, _mm_unpacklo_epi32)
+SSE2X(punpckhdq, _mm_unpackhi_epi32)
+SSE2M(punpckldq, _mm_unpacklo_epi32)
+SSE2M(punpckhdq, mmx_unpackhi_epi32)
+SSE2X(punpcklqdq, _mm_unpacklo_epi64)
+SSE2X(punpckhqdq, _mm_unpackhi_epi64)
+#else
+static inline void sse_packsswb(sse_regs_t* d, const sse_regs_t* s)
+{
+    sse_regs_t a = *d, b = *s;
+    for(int i=0; i<8; ++i) {
+        d->sb[i] = sat_s8(a.sw[i]);
+        d->sb[8+i] = sat_s8(b.sw[i]);
+    }
+}
+static inline void mmx_packsswb(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    mmx_regs_t a = *d, b = *s;
+    for(int i=0; i<4; ++i) {
+        d->sb[i] = sat_s8(a.sw[i]);
+        d->sb[4+i] = sat_s8(b.sw[i]);
+    }
+}
+static inline void sse_packuswb(sse_regs_t* d, const sse_regs_t* s)
+{
+    sse_regs_t a = *d, b = *s;
+    for(int i=0; i<8; ++i) {
+        d->ub[i] = sat_u8(a.sw[i]);
+        d->ub[8+i] = sat_u8(b.sw[i]);
+    }
+}
+static inline void mmx_packuswb(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    mmx_regs_t a = *d, b = *s;
+    for(int i=0; i<4; ++i) {
+        d->ub[i] = sat_u8(a.sw[i]);
+        d->ub[4+i] = sat_u8(b.sw[i]);
+    }
+}
+static inline void sse_packssdw(sse_regs_t* d, const sse_regs_t* s)
+{
+    sse_regs_t a = *d, b = *s;
+    for(int i=0; i<4; ++i) {
+        d->sw[i] = sat_s16(a.sd[i]);
+        d->sw[4+i] = sat_s16(b.sd[i]);
+    }
+}
+static inline void mmx_packssdw(mmx_regs_t* d, const mmx_regs_t* s)
+{
+    mmx_regs_t a = *d, b = *s;
+    for(int i=0; i<2; ++i) {
+        d->sw[i] = sat_s16(a.sd[i]);
+        d->sw[2+i] = sat_s16(b.sd[i]);
+    }
+}
+#define GOUNPCK(N, T, NX)                                                       \
+static inline void sse_punpckl##N(sse_regs_t* d, const sse_regs_t* s)          \
+{ sse_regs_t a = *d, b = *s; for(int i=0; i<NX/2; ++i) {d->T[i*2] = a.T[i]; d->T[i*2+1] = b.T[i];} } \
+static inline void sse_punpckh##N(sse_regs_t* d, const sse_regs_t* s)          \
+{ sse_regs_t a = *d, b = *s; for(int i=0; i<NX/2; ++i) {d->T[i*2] = a.T[NX/2+i]; d->T[i*2+1] = b.T[NX/2+i];} } \
+static inline void mmx_punpckl##N(mmx_regs_t* d, const mmx_regs_t* s)          \
+{ mmx_regs_t a = *d, b = *s; for(int i=0; i<NX/4; ++i) {d->T[i*2] = a.T[i]; d->T[i*2+1] = b.T[i];} } \
+static inline void mmx_punpckh##N(mmx_regs_t* d, const mmx_regs_t* s)          \
+{ mmx_regs_t a = *d, b = *s; for(int i=0; i<NX/4; ++i) {d->T[i*2] = a.T[NX/4+i]; d->T[i*2+1] = b.T[NX/4+i];} }
+GOUNPCK(bw, ub, 16)
+GOUNPCK(wd, uw, 8)
+GOUNPCK(dq, ud, 4)
+#undef GOUNPCK
+static inline void sse_punpcklqdq(sse_regs_t* d, const sse_regs_t* s)
+{
+    d->q[1] = s->q[0];
+}
+static inline void sse_punpckhqdq(sse_regs_t* d, const sse_regs_t* s)
+{
+    d->q[0] = d->q[1];
+    d->q[1] = s->q[1];
+}
+#endif
+
+// *** shuffle ***
+#if defined(SIMD_NEON)
+// the byte indexes of the table lookup are built from the immediate
+static inline void sse_pshufd(sse_regs_t* d, const sse_regs_t* s, uint8_t imm)
+{
+    uint32_t idx[4];
+    for(int i=0; i<4; ++i)
+        idx[i] = ((imm>>(i*2))&3)*0x04040404U + 0x03020100U;
+    uint8x16_t v = vld1q_u8(s->ub);
+    uint8x8x2_t t = {{vget_low_u8(v), vget_high_u8(v)}};
+    uint8x16_t i8 = vld1q_u8((uint8_t*)idx);
+    vst1q_u8(d->ub, vcombine_u8(vtbl2_u8(t, vget_low_u8(i8)), vtbl2_u8(t, vget_high_u8(i8))));
+}
+static inline void mmx_pshufw(mmx_regs_t* d, const mmx_regs_t* s, uint8_t imm)
+{
+    uint16_t idx[4];
+    for(int i=0; i<4; ++i)
+        idx[i] = ((imm>>(i*2))&3)*0x0202U + 0x0100U;
+    vst1_u8(d->ub, vtbl1_u8(vld1_u8(s->ub), vld1_u8((uint8_t*)idx)));
+}
+#else
+// SSE2 needs a constant immediate for a shuffle, so the plain version is used
+static inline void sse_pshufd(sse_regs_t* d, const sse_regs_t* s, uint8_t imm)
+{
+    sse_regs_t a = *s;
+    for (int i=0; i<4; ++i)
+        d->ud[i] = a.ud[(imm>>(i*2))&3];
+}
+static inline void mmx_pshufw(mmx_regs_t* d, const mmx_regs_t* s, uint8_t imm)
+{
+    mmx_regs_t a = *s;
+    for (int i=0; i<4; ++i)
+        d->uw[i] = a.uw[(imm>>(i*2))&3];
+}
+#endif
+
+// *** packed float ***
+// min/max: like x86, the 2nd operand is returned if any is NaN (or if they are equal)
+#if defined(SIMD_SSE2)
+#define GOF(NAME, OP)                                                   \
+static inline void sse_##NAME(sse_regs_t* d, const sse_regs_t* s)      \
+{ _mm_storeu_ps(d->f, OP(_mm_loadu_ps(d->f), _mm_loadu_ps(s->f))); }
+#define GOD(NAME, OP)                                                   \
+static inline void sse_##NAME(sse_regs_t* d, const sse_regs_t* s)      \
+{ _mm_storeu_pd(d->d, OP(_mm_loadu_pd(d->d), _mm_loadu_pd(s->d))); }
+GOF(addps, _mm_add_ps)
+GOF(subps, _mm_sub_ps)
+GOF(mulps, _mm_mul_ps)
+GOF(divps, _mm_div_ps)
+GOF(minps, _mm_min_ps)
+GOF(maxps, _mm_max_ps)
+GOD(addpd, _mm_add_pd)
+GOD(subpd, _mm_sub_pd)
+GOD(mulpd, _mm_mul_pd)
+GOD(divpd, _mm_div_pd)
+GOD(minpd, _mm_min_pd)
+GOD(maxpd, _mm_max_pd)
+#undef GOF
+#undef GOD
+#else
+#define A   (d->f[i])
+#define B   (s->f[i])
+SCALARX(addps, f, 4, A+B)
+SCALARX(subps, f, 4, A-B)
+SCALARX(mulps, f, 4, A*B)
+SCALARX(divps, f, 4, A/B)
+SCALARX(minps, f, 4, (A<B)?A:B)
+SCALARX(maxps, f, 4, (A>B)?A:B)
+#undef A
+#undef B
+#define A   (d->d[i])
+#define B   (s->d[i])
+SCALARX(addpd, d, 2, A+B)
+SCALARX(subpd, d, 2, A-B)
+SCALARX(mulpd, d, 2, A*B)
+SCALARX(divpd, d, 2, A/B)
+SCALARX(minpd, d, 2, (A<B)?A:B)
+SCALARX(maxpd, d, 2, (A>B)?A:B)
+#undef A
+#undef B
+#endif
+
+#undef GO
+#undef GO2
+#undef BOTH
+#undef BOTH2
+#undef SCALARX
+#undef SCALARM
+#ifdef SIMD_NEON
+#undef NEONX
+#undef NEONM
+#undef NEONX2
+#undef NEONM2
+#endif
+#ifdef SIMD_SSE2
+#undef SSE2X
+#undef SSE2M
+#endif
+
+#endif //__X86SIMD_H_
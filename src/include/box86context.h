@@ -27,11 +27,13 @@ typedef struct atfork_fnc_s {
 #ifdef DYNAREC
 typedef struct dynablocklist_s dynablocklist_t;
 typedef struct mmaplist_s      mmaplist_t;
+typedef struct mmaparena_s     mmaparena_t;
 typedef struct dynmap_s {
     dynablocklist_t* dynablocks;    // the dynabockist of the block
 } dynmap_t;
 #define DYNAMAP_SIZE (1<<20)
 #define DYNAMAP_SHIFT 12
+#define MMAPOWNER_SIZE (1<<10)
 #endif
 
 typedef void* (*procaddess_t)(const char* name);
@@ -117,9 +119,6 @@ typedef struct box86context_s {
     pthread_mutex_t     mutex_once;
     pthread_mutex_t     mutex_once2;
     pthread_mutex_t     mutex_trace;
-    #ifndef DYNAREC
-    pthread_mutex_t     mutex_lock;     // dynarec build will use their own mecanism
-    #endif
     pthread_mutex_t     mutex_tls;
     pthread_mutex_t     mutex_thread;
 
@@ -169,10 +168,9 @@ typedef struct box86context_s {
     int         clean_cap;
 #ifdef DYNAREC
     pthread_mutex_t     mutex_blocks;
-    pthread_mutex_t     mutex_mmap;
     dynablocklist_t     *dynablocks;
-    mmaplist_t          *mmaplist;
-    int                 mmapsize;
+    mmaparena_t         *mmaparenas;    // allocation arenas, threads are spread on them
+    mmaplist_t          *mmapowner[MMAPOWNER_SIZE]; // each 4MB chunk of dynarec memory, with its arena
     dynmap_t*           dynmap[DYNAMAP_SIZE];  // 4G of memory mapped by 4K block
 #endif
 #ifndef NOALIGN
@@ -212,14 +210,17 @@ int AddTLSPartition(box86context_t* context, int tlssize);
 // the nolinker specified if static map or dynamic (can be deleted) has to be used
 uintptr_t AllocDynarecMap(int size, int nolinker);
 void FreeDynarecMap(uintptr_t addr, uint32_t size);
+uint32_t SizeDynarecMap();
+void PrintDynarecMapStats(int level);
 
 dynablocklist_t* getDBFromAddress(uintptr_t addr);
 void addDBFromAddressRange(uintptr_t addr, uintptr_t size, int nolinker);
 void cleanDBFromAddressRange(uintptr_t addr, uintptr_t size, int destroy);
+#endif
 
+// write protection of x86 code (dynablocks and pre-decoded blocks)
 void protectDB(uintptr_t addr, uintptr_t size);
 void unprotectDB(uintptr_t addr, uintptr_t size);
-#endif
 
 // defined in fact in threads.c
 void thread_set_emu(x86emu_t* emu);
@@ -0,0 +1,77 @@
+#ifndef __BOX86CORE_H_
+#define __BOX86CORE_H_
+#include <stdint.h>
+
+// libbox86core: the x86 interpreter of box86, without the ELF loader nor the wrapped libs,
+// to embed it in fuzzers or benchmarks. Build with cmake -DBOX86CORE=ON.
+// The x86 memory is the host memory (no translation), so on a 64bits host,
+// everything the x86 code access must be mapped under 4GB (box86core_map does that).
+// There is no OS: INT 0x80 and INT 3 stop the run, it's up to the caller to handle them
+// and run again.
+
+typedef struct box86core_s box86core_t;
+
+// why box86core_run returned
+typedef enum {
+    BOX86CORE_COUNT = 0,    // the number of instructions to run has been reached
+    BOX86CORE_BREAKPOINT,   // EIP is on a breakpoint (not executed yet)
+    BOX86CORE_SYSCALL,      // INT 0x80, EIP is after the INT
+    BOX86CORE_INT3,         // INT 3, EIP is after the INT
+    BOX86CORE_ERROR,        // unimplemented or illegal opcode, EIP is on the opcode
+    BOX86CORE_QUIT,         // the emu stopped for another reason
+} box86core_stop_t;
+
+typedef enum {
+    BOX86CORE_EAX = 0,
+    BOX86CORE_ECX,
+    BOX86CORE_EDX,
+    BOX86CORE_EBX,
+    BOX86CORE_ESP,
+    BOX86CORE_EBP,
+    BOX86CORE_ESI,
+    BOX86CORE_EDI,
+    BOX86CORE_EIP,
+    BOX86CORE_EFLAGS,
+    BOX86CORE_FS,           // segment selectors
+    BOX86CORE_GS,
+} box86core_reg_t;
+
+#define BOX86CORE_MAXBP 16  // max number of breakpoints of a core
+
+// create an emu, with EIP=0 and a 1MB stack (ESP at its top), and free it with the memory it mapped
+box86core_t* box86core_new();
+void box86core_free(box86core_t* core);
+
+// map size bytes (anonymous, zero filled) at addr, or anywhere under 4GB if addr is 0.
+// prot is a PROT_xxx combination. Return the address, or 0 on failure
+uint32_t box86core_map(box86core_t* core, uint32_t addr, uint32_t size, int prot);
+// copy to / from the x86 memory. Return 0 if ok, -1 if the range is not inside a mapping of the core
+int box86core_write(box86core_t* core, uint32_t addr, const void* src, uint32_t size);
+int box86core_read(box86core_t* core, uint32_t addr, void* dst, uint32_t size);
+
+// registers
+uint32_t box86core_get_reg(box86core_t* core, box86core_reg_t reg);
+void box86core_set_reg(box86core_t* core, box86core_reg_t reg, uint32_t val);
+// base address of the FS or GS segment (BOX86CORE_FS or BOX86CORE_GS)
+void box86core_set_segbase(box86core_t* core, box86core_reg_t seg, uint32_t base);
+// 16 bytes of XMMi, 8 bytes of MMi, and ST(i) of the x87 stack as a double
+void box86core_get_xmm(box86core_t* core, int i, void* val);
+void box86core_set_xmm(box86core_t* core, int i, const void* val);
+void box86core_get_mmx(box86core_t* core, int i, void* val);
+double box86core_get_st(box86core_t* core, int i);
+
+// breakpoints, return 0 if ok, -1 if too many or not found.
+// The first instruction of a run is not checked, so running again resume from a breakpoint
+int box86core_add_breakpoint(box86core_t* core, uint32_t addr);
+int box86core_del_breakpoint(box86core_t* core, uint32_t addr);
+
+// run from EIP, for count instructions at most (0 for no limit)
+box86core_stop_t box86core_run(box86core_t* core, uint64_t count);
+// number of instructions executed since the creation of the core
+uint64_t box86core_icount(box86core_t* core);
+
+// process wide: use the pre-decoded blocks (off by default). There is no detection of
+// self-modifying code then: once it has been run, x86 code must only be modified with box86core_write
+void box86core_set_predecode(int on);
+
+#endif //__BOX86CORE_H_
@@ -7,12 +7,21 @@ extern int box86_log;    // log level
 extern int box86_dynarec_log;
 extern int box86_dynarec;
 extern int box86_pagesize;
+extern int box86_predecode;    // interpreter use pre-decoded blocks
+extern int box86_native_strfunc;   // redirect x86 copies of string functions to native ones
+extern char* box86_native_strfunc_list;  // white/black list of those functions (NULL for all)
 #ifdef DYNAREC
 extern int box86_dynarec_dump;
 extern int box86_dynarec_linker;
 extern int box86_dynarec_trace;
 extern int box86_dynarec_forced;
 extern int box86_dynarec_largest;
+extern char* box86_dynarec_cache;   // folder for the persistent dynarec cache (NULL if disabled)
+extern uint32_t box86_dynarec_cache_max;  // max size of translated code in memory, in bytes (0 if no limit)
+extern int box86_dynarec_profile;
+extern int box86_dynarec_tier;     // executions before a block is recompiled as a superblock (0 if disabled)
+extern char* box86_dynarec_profile_file;   // file for the folded profile (NULL if none)
+extern int box86_dynarec_test;     // compare each dynablock run with the interpretor
 #ifdef ARM
 extern int arm_vfp;     // vfp version (3 or 4), with 32 registers is mendatory
 extern int arm_swap;
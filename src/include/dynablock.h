@@ -8,7 +8,7 @@ typedef struct dynablock_s dynablock_t;
 typedef struct dynablocklist_s dynablocklist_t;
 
 uint32_t X31_hash_code(void* addr, int len);
-dynablocklist_t* NewDynablockList(uintptr_t base, uintptr_t text, int textsz, int nolinker, int direct);
+dynablocklist_t* NewDynablockList(uintptr_t text, int textsz, int nolinker);
 void FreeDynablockList(dynablocklist_t** dynablocks);
 void FreeDynablock(dynablock_t* db);
 void MarkDynablock(dynablock_t* db);
@@ -24,8 +24,6 @@ dynablock_t* FindDynablockFromNativeAddress(void* addr);
 
 uintptr_t StartDynablockList(dynablocklist_t* db);
 uintptr_t EndDynablockList(dynablocklist_t* db);
-void FreeDirectDynablock(dynablocklist_t* dynablocks, uintptr_t addr, uintptr_t size);
-void MarkDirectDynablock(dynablocklist_t* dynablocks, uintptr_t addr, uintptr_t size);
 
 // Handling of Dynarec block (i.e. an exectable chunk of x86 translated code)
 dynablock_t* DBGetBlock(x86emu_t* emu, uintptr_t addr, int create, dynablock_t** current);   // return NULL if block is not found / cannot be created. Don't create if create==0
@@ -35,6 +33,30 @@ void AddMark(dynablock_t* source, dynablock_t* dest, void** table);
 // remove a Table mark (and also remove lined info from other dynablock, if any)
 void RemoveMark(void** table);
 
+// Epoch of the thread using dynablocks: a freed dynablock is only released when all threads using dynablocks have started after it was freed
+void DynablockEnter();      // thread start using dynablocks (can be nested)
+void DynablockLeave();
+int DynablockRefresh();     // outermost level only: move to the current epoch, return 1 if dynablocks were freed since last time (so old pointers must be dropped)
+int DynablockGetLevel();
+void DynablockSetLevel(int level);  // restore level after a longjmp
+void ReleaseRetiredDynablocks(int force);   // force release all, only at exit
+
+// Eviction of cold blocks, when translated code goes over BOX86_DYNAREC_CACHE_MAX
+extern volatile int dynablock_evict;    // set when an eviction is needed
+void EvictDynablocks();     // must be called from the dispatcher loop, outside of any dynablock
+
+// Tiered compilation (BOX86_DYNAREC_TIER): recompile block as a superblock if it's hot, return the block to run
+dynablock_t* DBTierBlock(x86emu_t* emu, dynablock_t* db);
+
+// Profiling of dynablocks (BOX86_DYNAREC_PROFILE)
+void ProfileDynablockInterp(dynablock_t* db);   // count a fallback to the interpretor (db can be NULL)
+void DumpDynablockProfile(const char* filename);    // print sorted profile, and save it in folded format in filename (if not NULL)
+uint32_t* ProfileICSite(uintptr_t addr);    // counters of the inline cache of the indirect jump at addr: executions and misses
+
+// Test of dynablocks against the interpretor (BOX86_DYNAREC_TEST)
+void DynaTestBlock(x86emu_t* emu, dynablock_t* block);   // run the block, and compare it with the interpretor
+void DynaTestStats();
+
 // Create and Add an new dynablock in the list, handling direct/map
 dynablock_t *AddNewDynablock(dynablocklist_t* dynablocks, uintptr_t addr, int with_marks, int* created);
 
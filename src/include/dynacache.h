@@ -0,0 +1,18 @@
+#ifndef __DYNACACHE_H_
+#define __DYNACACHE_H_
+
+typedef struct dynablock_s dynablock_t;
+typedef struct dynacache_s dynacache_t;
+typedef struct elfheader_s elfheader_t;
+typedef struct dynarec_reloc_s dynarec_reloc_t;
+
+// Open (or create) the persistent cache file of an elf, once it's loaded in memory. return NULL if not possible
+dynacache_t* NewDynaCache(elfheader_t* h);
+void FreeDynaCache(dynacache_t** cache);
+
+// try to fill an empty block using the persistent cache. return 1 if the block is ready
+int DynaCacheLoad(dynablock_t* block);
+// save a freshly created block in the persistent cache (if block is in an elf with a cache)
+void DynaCacheStore(dynablock_t* block, dynarec_reloc_t* relocs, int relocs_sz);
+
+#endif //__DYNACACHE_H_
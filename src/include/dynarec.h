@@ -5,4 +5,11 @@ typedef struct x86emu_s x86emu_t;
 
 void DynaCall(x86emu_t* emu, uintptr_t addr); // try to use DynaRec... Fallback to EmuCall if no dynarec available
 
+#ifdef DYNAREC
+// Return stack of the dynarec (cstack): CALL push the x86 return address with the native address that follow the CALL,
+// so a RET to that address can jump straight back in the caller block
+void CStackReset(x86emu_t* emu);        // forget all entries (after a longjmp, or when dynablocks have been freed)
+extern uint32_t cstack_stats[2];        // RET using the cstack, and how many missed it (only counted with BOX86_DYNAREC_PROFILE)
+#endif
+
 #endif // __DYNAREC_H_
\ No newline at end of file
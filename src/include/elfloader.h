@@ -26,10 +26,16 @@ int LoadElfMemory(FILE* f, box86context_t* context, elfheader_t* head);
 int ReloadElfMemory(FILE* f, box86context_t* context, elfheader_t* head);
 int RelocateElf(lib_t *maplib, lib_t* local_maplib, elfheader_t* head);
 int RelocateElfPlt(lib_t *maplib, lib_t* local_maplib, elfheader_t* head);
+void PrintRelocationStats();     // count and time of relocations so far (LOG_INFO)
 void CalcStack(elfheader_t* h, uint32_t* stacksz, int* stackalign);
 uintptr_t GetEntryPoint(lib_t* maplib, elfheader_t* h);
 uintptr_t GetLastByte(elfheader_t* h);
 void AddSymbols(lib_t *maplib, kh_mapsymbols_t* mapsymbols, kh_mapsymbols_t* weaksymbols, kh_mapsymbols_t* localsymbols, elfheader_t* h);
+// lookup of the global (or weak) symbols of an emulated lib, directly with the DT_GNU_HASH / DT_HASH table of the elf, instead of AddSymbols
+int ElfHasSymbolHash(elfheader_t* h);
+int ElfGetSymbol(elfheader_t* h, const char* name, int weak, uintptr_t* offs, uint32_t* sz);
+void AddLocalSymbols(kh_mapsymbols_t* localsymbols, elfheader_t* h);  // only the local symbols
+void RedirectStrFunctions(elfheader_t* h);  // replace x86 copies of memcpy, strlen... by a bridge to the native ones (after relocation)
 int LoadNeededLibs(elfheader_t* h, lib_t *maplib, needed_libs_t* neededlibs, int local, box86context_t *box86, x86emu_t* emu);
 uintptr_t GetElfInit(elfheader_t* h);
 uintptr_t GetElfFini(elfheader_t* h);
@@ -38,10 +44,12 @@ void RunElfFini(elfheader_t* h, x86emu_t *emu);
 void RunDeferedElfInit(x86emu_t *emu);
 void* GetBaseAddress(elfheader_t* h);
 void* GetElfDelta(elfheader_t* h);
+uintptr_t GetElfGOT(elfheader_t* h);    // address of the GOT, as in ebx for the PLT of PIC code (0 if none)
 uint32_t GetBaseSize(elfheader_t* h);
 int IsAddressInElfSpace(elfheader_t* h, uintptr_t addr);
 elfheader_t* FindElfAddress(box86context_t *context, uintptr_t addr);
 const char* FindNearestSymbolName(elfheader_t* h, void* p, uintptr_t* start, uint32_t* sz);
+void SetNearestSymbolNoAlloc(int on);   // for the signal handler: FindNearestSymbolName doesn't allocate, and scans the symbols if needed
 int32_t GetTLSBase(elfheader_t* h);
 uint32_t GetTLSSize(elfheader_t* h);
 void* GetTLSPointer(box86context_t* context, elfheader_t* h);
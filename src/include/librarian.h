@@ -36,6 +36,11 @@ int GetLocalSymbolStartEnd(lib_t *maplib, const char* name, uintptr_t* start, ui
 int GetNoWeakSymbolStartEnd(lib_t *maplib, const char* name, uintptr_t* start, uintptr_t* end, elfheader_t *self);
 elfheader_t* GetGlobalSymbolElf(lib_t *maplib, const char* name);
 
+// Generation of the symbols in scope, changed each time a symbol or a lib is added or removed (so resolved symbols can be kept until then)
+uint32_t GetSymbolScope();
+void SymbolScopeChanged();
+extern uint32_t symbol_stats[2];    // global symbol lookups, and the ones found in the index
+
 void AddSymbol(kh_mapsymbols_t *mapsymbols, const char* name, uintptr_t addr, uint32_t sz); // replace if already there
 uintptr_t FindSymbol(kh_mapsymbols_t *mapsymbols, const char* name);
 void AddWeakSymbol(kh_mapsymbols_t *mapsymbols, const char* name, uintptr_t addr, uint32_t sz); // don't add if already there
@@ -5,6 +5,9 @@
 typedef struct x86emu_s x86emu_t;
 int Run(x86emu_t *emu, int step); // 0 if run was successfull, 1 if error in x86 world
 int DynaRun(x86emu_t *emu);
+#ifdef DYNAREC
+int RunTest(x86emu_t *emu); // run 1 instruction, for BOX86_DYNAREC_TEST
+#endif
 
 uint32_t LibSyscall(x86emu_t *emu);
 void PltResolver(x86emu_t* emu);
@@ -16,6 +16,30 @@
 
 KHASH_MAP_IMPL_STR(mapsymbols, onesymbol_t);
 KHASH_MAP_IMPL_INT(mapoffsets, cstr_t);
+KHASH_MAP_IMPL_STR(resolved, resolved_t);
+
+static volatile uint32_t symbol_scope = 1;
+static pthread_mutex_t  resolved_mutex = PTHREAD_MUTEX_INITIALIZER;
+uint32_t symbol_stats[2] = {0};
+
+uint32_t GetSymbolScope()
+{
+    return symbol_scope;
+}
+
+void SymbolScopeChanged()
+{
+    __sync_fetch_and_add(&symbol_scope, 1);
+}
+
+static void clearResolved(lib_t* maplib)
+{
+    const char* name;
+    kh_foreach_key(maplib->resolved, name,
+        free((char*)name);
+    );
+    kh_clear(resolved, maplib->resolved);
+}
 
 lib_t *NewLibrarian(box86context_t* context, int ownlibs)
 {
@@ -58,6 +82,10 @@ void FreeLibrarian(lib_t **maplib)
     if((*maplib)->mapoffsets) {
         kh_destroy(mapoffsets, (*maplib)->mapoffsets);
     }
+    if((*maplib)->resolved) {
+        clearResolved(*maplib);
+        kh_destroy(resolved, (*maplib)->resolved);
+    }
     (*maplib)->libsz = (*maplib)->libcap = 0;
 
     if((*maplib)->bridge)
@@ -118,6 +146,7 @@ void MapLibAddLib(lib_t* maplib, library_t* lib)
     maplib->libraries[maplib->libsz].lib = lib;
     maplib->libraries[maplib->libsz].name = GetNameLib(lib);
     ++maplib->libsz;
+    SymbolScopeChanged();
 }
 
 void MapLibAddMapLib(lib_t* dest, lib_t* src)
@@ -150,6 +179,7 @@ void MapLibRemoveLib(lib_t* maplib, library_t* lib)
         memmove(&maplib->libraries[idx], &maplib->libraries[idx+1], sizeof(onelib_t)*(maplib->libsz-idx));
     maplib->libraries[maplib->libsz].lib = NULL;
     maplib->libraries[maplib->libsz].name = NULL;
+    SymbolScopeChanged();
 }
 
 EXPORTDYN
@@ -348,15 +378,56 @@ static int GetGlobalSymbolStartEnd_internal(lib_t *maplib, const char* name, uin
 }
 void** my_GetGTKDisplay();
 void** my_GetGthreadsGotInitialized();
+// same as GetGlobalSymbolStartEnd_internal, but each name is searched only once while the symbols in scope don't change
+static int GetGlobalSymbolStartEnd_indexed(lib_t *maplib, const char* name, uintptr_t* start, uintptr_t* end)
+{
+    __sync_fetch_and_add(&symbol_stats[0], 1);
+    uint32_t scope = symbol_scope;
+    pthread_mutex_lock(&resolved_mutex);
+    if(!maplib->resolved)
+        maplib->resolved = kh_init(resolved);
+    if(maplib->resolved_gen!=scope) {
+        clearResolved(maplib);
+        maplib->resolved_gen = scope;
+    }
+    khint_t k = kh_get(resolved, maplib->resolved, name);
+    if(k!=kh_end(maplib->resolved)) {
+        resolved_t r = kh_value(maplib->resolved, k);
+        pthread_mutex_unlock(&resolved_mutex);
+        __sync_fetch_and_add(&symbol_stats[1], 1);
+        if(r.found) {
+            *start = r.start;
+            *end = r.end;
+        }
+        return r.found;
+    }
+    pthread_mutex_unlock(&resolved_mutex);
+    resolved_t r = {0};
+    r.found = GetGlobalSymbolStartEnd_internal(maplib, name, &r.start, &r.end);
+    if(r.found) {
+        *start = r.start;
+        *end = r.end;
+    }
+    pthread_mutex_lock(&resolved_mutex);
+    if(maplib->resolved_gen==scope && symbol_scope==scope) {
+        int ret;
+        k = kh_put(resolved, maplib->resolved, name, &ret);
+        if(ret)
+            kh_key(maplib->resolved, k) = strdup(name);
+        kh_value(maplib->resolved, k) = r;
+    }
+    pthread_mutex_unlock(&resolved_mutex);
+    return r.found;
+}
 int GetGlobalSymbolStartEnd(lib_t *maplib, const char* name, uintptr_t* start, uintptr_t* end)
 {
-    if(GetGlobalSymbolStartEnd_internal(maplib, name, start, end)) {
+    if(GetGlobalSymbolStartEnd_indexed(maplib, name, start, end)) {
         if(start && end && *end==*start) {  // object is of 0 sized, try to see an "_END" object of null size
             uintptr_t start2, end2;
             char* buff = (char*)malloc(strlen(name) + strlen("_END") + 1);
             strcpy(buff, name);
             strcat(buff, "_END");
-            if(GetGlobalSymbolStartEnd_internal(maplib, buff, &start2, &end2)) {
+            if(GetGlobalSymbolStartEnd_indexed(maplib, buff, &start2, &end2)) {
                 if(end2>*end && start2==end2)
                     *end = end2;
             }
@@ -481,6 +552,7 @@ void AddSymbol(kh_mapsymbols_t *mapsymbols, const char* name, uintptr_t addr, ui
     khint_t k = kh_put(mapsymbols, mapsymbols, name, &ret);
     kh_value(mapsymbols, k).offs = addr;
     kh_value(mapsymbols, k).sz = sz;
+    SymbolScopeChanged();
 }
 uintptr_t FindSymbol(kh_mapsymbols_t *mapsymbols, const char* name)
 {
@@ -497,6 +569,7 @@ void AddWeakSymbol(kh_mapsymbols_t *mapsymbols, const char* name, uintptr_t addr
         return; // Symbol already there, don't touch it
     kh_value(mapsymbols, k).offs = addr;
     kh_value(mapsymbols, k).sz = sz;
+    SymbolScopeChanged();
 }
 
 int GetSymbolStartEnd(kh_mapsymbols_t* mapsymbols, const char* name, uintptr_t* start, uintptr_t* end)
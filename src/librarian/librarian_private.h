@@ -19,8 +19,17 @@ typedef struct {
 
 typedef char* cstr_t;
 
+// a global symbol already searched (found or not)
+typedef struct resolved_s {
+    uintptr_t   start;
+    uintptr_t   end;
+    int         found;
+} resolved_t;
+
 KHASH_MAP_DECLARE_STR(mapsymbols, onesymbol_t)
 
+KHASH_MAP_DECLARE_STR(resolved, resolved_t)
+
 KHASH_MAP_DECLARE_INT(mapoffsets, cstr_t);
 
 typedef struct lib_s {
@@ -36,6 +45,9 @@ typedef struct lib_s {
     box86context_t*       context;
     
     bridge_t              *bridge;        // all x86 -> arm bridge
+
+    khash_t(resolved)     *resolved;      // index of global symbols already searched (names are owned)
+    uint32_t              resolved_gen;   // symbol scope generation of the index
 } lib_t;
 
 #endif //__LIBRARIAN_PRIVATE_H_
@@ -87,6 +87,14 @@ void EmuLib_Fini(library_t* lib)
 
 int EmuLib_Get(library_t* lib, const char* name, uintptr_t *offs, uint32_t *sz)
 {
+    if(lib->priv.n.hashed) {
+        elfheader_t *elf_header = lib->context->elfs[lib->priv.n.elf_index];
+        if(ElfGetSymbol(elf_header, name, 0, offs, sz))
+            return *offs;
+        if(ElfGetSymbol(elf_header, name, 1, offs, sz))
+            return *offs;
+        return 0;
+    }
     khint_t k;
     // symbols...
     k = kh_get(mapsymbols, lib->priv.n.mapsymbols, name);
@@ -106,6 +114,11 @@ int EmuLib_Get(library_t* lib, const char* name, uintptr_t *offs, uint32_t *sz)
 }
 int EmuLib_GetNoWeak(library_t* lib, const char* name, uintptr_t *offs, uint32_t *sz)
 {
+    if(lib->priv.n.hashed) {
+        if(ElfGetSymbol(lib->context->elfs[lib->priv.n.elf_index], name, 0, offs, sz))
+            return *offs;
+        return 0;
+    }
     khint_t k;
     k = kh_get(mapsymbols, lib->priv.n.mapsymbols, name);
     if(k!=kh_end(lib->priv.n.mapsymbols)) {
@@ -117,6 +130,10 @@ int EmuLib_GetNoWeak(library_t* lib, const char* name, uintptr_t *offs, uint32_t
 }
 int EmuLib_GetLocal(library_t* lib, const char* name, uintptr_t *offs, uint32_t *sz)
 {
+    if(!lib->priv.n.localdone) {
+        lib->priv.n.localdone = 1;
+        AddLocalSymbols(lib->priv.n.localsymbols, lib->context->elfs[lib->priv.n.elf_index]);
+    }
     khint_t k;
     k = kh_get(mapsymbols, lib->priv.n.localsymbols, name);
     if(k!=kh_end(lib->priv.n.localsymbols)) {
@@ -275,10 +292,16 @@ library_t *NewLibrary(const char* path, box86context_t* context)
 int AddSymbolsLibrary(lib_t *maplib, library_t* lib, x86emu_t* emu)
 {
     lib->active = 1;
+    SymbolScopeChanged();
     if(lib->type==1) {
         elfheader_t *elf_header = lib->context->elfs[lib->priv.n.elf_index];
-        // add symbols
-        AddSymbols(maplib, lib->priv.n.mapsymbols, lib->priv.n.weaksymbols, lib->priv.n.localsymbols, elf_header);
+        // add symbols (only if the elf has no hash table to find them directly)
+        if(ElfHasSymbolHash(elf_header)) {
+            lib->priv.n.hashed = 1;
+        } else {
+            AddSymbols(maplib, lib->priv.n.mapsymbols, lib->priv.n.weaksymbols, lib->priv.n.localsymbols, elf_header);
+            lib->priv.n.localdone = 1;
+        }
     }
     return 0;
 }
@@ -297,6 +320,7 @@ int FinalizeLibrary(library_t* lib, lib_t* local_maplib, x86emu_t* emu)
             return 1;
         }
         RelocateElfPlt(my_context->maplib, local_maplib, elf_header);
+        RedirectStrFunctions(elf_header);
         if(trace_func) {
             if (GetGlobalSymbolStartEnd(my_context->maplib, trace_func, &trace_start, &trace_end)) {
                 SetTraceEmu(trace_start, trace_end);
@@ -323,6 +347,7 @@ int FinalizeLibrary(library_t* lib, lib_t* local_maplib, x86emu_t* emu)
 int ReloadLibrary(library_t* lib, x86emu_t* emu)
 {
     lib->active = 1;
+    SymbolScopeChanged();
     if(lib->type==1) {
         elfheader_t *elf_header = lib->context->elfs[lib->priv.n.elf_index];
         // reload image in memory and re-run the mapping
@@ -358,6 +383,7 @@ int ReloadLibrary(library_t* lib, x86emu_t* emu)
             return 1;
         }
         RelocateElfPlt(lib->context->maplib, lib->maplib, elf_header);
+        RedirectStrFunctions(elf_header);
         // init (will use PltRelocator... because some other libs are not yet resolved)
         RunElfInit(elf_header, emu);
     }
@@ -367,6 +393,7 @@ int ReloadLibrary(library_t* lib, x86emu_t* emu)
 void InactiveLibrary(library_t* lib)
 {
     lib->active = 0;
+    SymbolScopeChanged();
 }
 
 void Free1Library(library_t **lib)
@@ -46,6 +46,8 @@ typedef struct nlib_s {
     kh_mapsymbols_t *mapsymbols;
     kh_mapsymbols_t *weaksymbols;
     kh_mapsymbols_t *localsymbols;
+    int             hashed;     // global and weak symbols are looked up in the hash table of the elf, not in the maps
+    int             localdone;  // localsymbols is filled (it's done on first use when hashed)
 } nlib_t;
 
 typedef struct library_s {
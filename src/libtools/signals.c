@@ -16,6 +16,7 @@
 #include "x86emu.h"
 #include "emu/x86emu_private.h"
 #include "emu/x86run_private.h"
+#include "emu/x86predecode.h"
 #include "signals.h"
 #include "box86stack.h"
 #include "dynarec.h"
@@ -426,15 +427,17 @@ void my_box86signalhandler(int32_t sig, siginfo_t* info, void * ucntx)
     void * pc = NULL;    // unknow arch...
     #warning Unhandled architecture
 #endif
+    if(sig==SIGSEGV && addr && info->si_code == SEGV_ACCERR && (
 #ifdef DYNAREC
-    if(sig==SIGSEGV && addr && info->si_code == SEGV_ACCERR && getDBFromAddress((uintptr_t)addr)) {
+        getDBFromAddress((uintptr_t)addr) ||
+#endif
+        isPredecoded((uintptr_t)addr))) {
         dynarec_log(LOG_DEBUG, "Access to protected %p from %p, unprotecting memory\n", addr, pc);
         // access error
         unprotectDB((uintptr_t)addr, 1);    // unprotect 1 byte... But then, the whole page will be unprotected
         // done
         return;
     }
-#endif
     static int old_code = -1;
     static void* old_pc = 0;
     static void* old_addr = 0;
@@ -462,6 +465,7 @@ void my_box86signalhandler(int32_t sig, siginfo_t* info, void * ucntx)
                 x86pc = R_EIP; // sadly, r12 is probably not actual eip, so try a slightly outdated one
             #endif
         }
+        SetNearestSymbolNoAlloc(1);  // the fault may be inside malloc
         x86name = getAddrFunctionName(x86pc);
         elfheader_t* elf = FindElfAddress(my_context, x86pc);
         if(elf)
@@ -489,6 +493,7 @@ void my_box86signalhandler(int32_t sig, siginfo_t* info, void * ucntx)
 #else
         printf_log(LOG_NONE, "%04d|%s @%p (%s) (x86pc=%p/%s:\"%s\"), for accessing %p (code=%d)", GetTID(), signame, pc, name, (void*)x86pc, elfname?elfname:"???", x86name?x86name:"???", addr, info->si_code);
 #endif
+        SetNearestSymbolNoAlloc(0);
         if(sig==SIGILL)
             printf_log(LOG_NONE, " opcode=%02X %02X %02X %02X %02X %02X %02X %02X\n", ((uint8_t*)pc)[0], ((uint8_t*)pc)[1], ((uint8_t*)pc)[2], ((uint8_t*)pc)[3], ((uint8_t*)pc)[4], ((uint8_t*)pc)[5], ((uint8_t*)pc)[6], ((uint8_t*)pc)[7]);
         else
@@ -37,18 +37,30 @@
 #include "library.h"
 #include "auxval.h"
 #include "wine_tools.h"
+#ifdef DYNAREC
+#include "dynablock.h"
+#endif
 
 box86context_t *my_context = NULL;
 int box86_log = LOG_NONE;
 int box86_nobanner = 0;
 int box86_dynarec_log = LOG_NONE;
 int box86_pagesize;
+int box86_predecode = 1;
+int box86_native_strfunc = 0;
+char* box86_native_strfunc_list = NULL;
 #ifdef DYNAREC
 int box86_dynarec = 1;
 int box86_dynarec_dump = 0;
 int box86_dynarec_linker = 1;
 int box86_dynarec_forced = 0;
 int box86_dynarec_largest = 0;
+char* box86_dynarec_cache = NULL;
+uint32_t box86_dynarec_cache_max = 0;
+int box86_dynarec_profile = 0;
+int box86_dynarec_tier = 0;
+char* box86_dynarec_profile_file = NULL;
+int box86_dynarec_test = 0;
 #ifdef ARM
 int arm_vfp = 0;     // vfp version (3 or 4), with 32 registers is mendatory
 int arm_swap = 0;
@@ -261,6 +273,62 @@ void LoadLogEnv()
         if(box86_dynarec_forced)
         printf_log(LOG_INFO, "Dynarec is Forced on all addresses\n");
     }
+    p = getenv("BOX86_DYNAREC_CACHE");
+    if(p && strlen(p)) {
+        if(FileExist(p, 0)) {
+            box86_dynarec_cache = strdup(p);
+            printf_log(LOG_INFO, "Dynarec persistent cache in \"%s\"\n", box86_dynarec_cache);
+        } else {
+            printf_log(LOG_INFO, "Dynarec cache folder \"%s\" not found, persistent cache disabled\n", p);
+        }
+    }
+    p = getenv("BOX86_DYNAREC_CACHE_MAX");
+    if(p) {
+        int sz = atoi(p);
+        if(sz>0 && sz<4096) {
+            box86_dynarec_cache_max = (uint32_t)sz*1024*1024;
+            printf_log(LOG_INFO, "Dynarec translated code limited to %dMB\n", sz);
+        }
+    }
+    p = getenv("BOX86_DYNAREC_TIER");
+    if(p) {
+        int n = atoi(p);
+        if(n==1)
+            box86_dynarec_tier = 1000;
+        else if(n>1)
+            box86_dynarec_tier = n;
+        if(box86_dynarec_tier)
+            printf_log(LOG_INFO, "Dynarec blocks executed %d times are recompiled as superblocks\n", box86_dynarec_tier);
+    }
+    p = getenv("BOX86_DYNAREC_PROFILE");
+    if(p && strlen(p)) {
+        if(strlen(p)==1 && p[0]>='0' && p[0]<='1')
+            box86_dynarec_profile = p[0]-'0';
+        else {
+            box86_dynarec_profile = 1;
+            box86_dynarec_profile_file = strdup(p);
+        }
+        if(box86_dynarec_profile) {
+            printf_log(LOG_INFO, "Dynarec blocks are profiled%s%s\n", box86_dynarec_profile_file?", profile saved in ":"", box86_dynarec_profile_file?box86_dynarec_profile_file:"");
+            if(box86_dynarec_cache) {
+                printf_log(LOG_INFO, "Dynarec persistent cache disabled while profiling\n");
+                free(box86_dynarec_cache);
+                box86_dynarec_cache = NULL;
+            }
+        }
+    }
+    p = getenv("BOX86_DYNAREC_TEST");
+    if(p) {
+        if(strlen(p)==1) {
+            if(p[0]>='0' && p[0]<='1')
+                box86_dynarec_test = p[0]-'0';
+        }
+        if(box86_dynarec_test) {
+            // blocks are run one by one, to be compared with the interpretor
+            box86_dynarec_linker = 0;
+            printf_log(LOG_INFO, "Dynarec blocks are compared with the interpretor (Dynarec Linker is Off)\n");
+        }
+    }
 #endif
 #ifdef HAVE_TRACE
     p = getenv("BOX86_TRACE_XMM");
@@ -315,6 +383,30 @@ void LoadLogEnv()
         printf_log(LOG_INFO, "Try to adjust X11 Color (32->16bits) : %s\n", x11color16?"Yes":"No");
     }
 #endif
+    p = getenv("BOX86_PREDECODE");
+    if(p) {
+        if(strlen(p)==1) {
+            if(p[0]>='0' && p[1]<='0'+1)
+                box86_predecode = p[0]-'0';
+        }
+        if(!box86_predecode)
+            printf_log(LOG_INFO, "Interpreter will not pre-decode x86 code\n");
+    }
+    p = getenv("BOX86_NATIVE_STRFUNC");
+    if(p && strlen(p)) {
+        if(strlen(p)==1 && p[0]>='0' && p[0]<='1')
+            box86_native_strfunc = p[0]-'0';
+        else {
+            box86_native_strfunc = 1;
+            box86_native_strfunc_list = strdup(p);
+        }
+        if(!box86_native_strfunc)
+            printf_log(LOG_INFO, "x86 string functions will not be redirected to native ones\n");
+        else if(!box86_native_strfunc_list)
+            printf_log(LOG_INFO, "x86 string functions will be redirected to native ones\n");
+        else
+            printf_log(LOG_INFO, "x86 string functions redirected to native ones are filtered with \"%s\"\n", box86_native_strfunc_list);
+    }
     p = getenv("BOX86_X11THREADS");
     if(p) {
         if(strlen(p)==1) {
@@ -489,7 +581,16 @@ void PrintHelp() {
     printf(" BOX86_DYNAREC_LOG with 0/1/2/3 or NONE/INFO/DEBUG/DUMP to set the printed dynarec info\n");
     printf(" BOX86_DYNAREC with 0/1 to disable or enable Dynarec (On by default)\n");
     printf(" BOX86_DYNAREC_LINKER with 0/1 to disable or enable Dynarec Linker (On by default, use 0 only for easier debug)\n");
+    printf(" BOX86_DYNAREC_CACHE=folder to keep translated blocks of x86 libs/programs in folder, and reuse them on next launch\n");
+    printf(" BOX86_DYNAREC_CACHE_MAX=XXX to limit translated code in memory to XXX MB, evicting cold blocks of dynamic code\n");
+    printf(" BOX86_DYNAREC_TIER with 1 to recompile hot blocks as superblocks, or with N the number of executions to be hot (default 1000)\n");
+    printf(" BOX86_DYNAREC_PROFILE with 1 to count block executions and print a profile at exit\n");
+    printf("    or with a FileName to also save the profile in FileName, in folded format (for flamegraph tools)\n");
+    printf(" BOX86_DYNAREC_TEST with 1 to run each block also with the interpretor, and report the differences (very slow)\n");
 #endif
+    printf(" BOX86_PREDECODE with 0/1 to disable or enable pre-decoding of x86 code by the interpreter (On by default)\n");
+    printf(" BOX86_NATIVE_STRFUNC with 0/1 to disable or enable redirection of x86 memcpy, strlen... to native ones (Off by default)\n");
+    printf("    or with func1:func2 to redirect only those ones, or with -func1:-func2 to redirect all but those ones\n");
 #ifdef HAVE_TRACE
     printf(" BOX86_TRACE with 1 to enable x86 execution trace\n");
     printf("    or with XXXXXX-YYYYYY to enable x86 execution trace only between address\n");
@@ -674,12 +775,32 @@ void endBox86()
     for (int i=0; i<my_context->elfsize; ++i)
         RunElfFini(my_context->elfs[i], emu);
 
+#ifdef DYNAREC
+    if(box86_dynarec_profile)
+        DumpDynablockProfile(box86_dynarec_profile_file);
+    if(box86_dynarec_test)
+        DynaTestStats();
+#endif
     // all done, free context
     FreeBox86Context(&my_context);
     if(libGL) {
         free(libGL);
         libGL = NULL;
     }
+    if(box86_native_strfunc_list) {
+        free(box86_native_strfunc_list);
+        box86_native_strfunc_list = NULL;
+    }
+#ifdef DYNAREC
+    if(box86_dynarec_cache) {
+        free(box86_dynarec_cache);
+        box86_dynarec_cache = NULL;
+    }
+    if(box86_dynarec_profile_file) {
+        free(box86_dynarec_profile_file);
+        box86_dynarec_profile_file = NULL;
+    }
+#endif
 }
 
 #ifdef BUILD_LIB
@@ -993,6 +1114,8 @@ int main(int argc, const char **argv, const char **env) {
     }
     // and handle PLT
     RelocateElfPlt(my_context->maplib, NULL, elf_header);
+    RedirectStrFunctions(elf_header);
+    PrintRelocationStats();
     // defered init
     RunDeferedElfInit(emu);
     // do some special case check, _IO_2_1_stderr_ and friends, that are setup by libc, but it's already done here, so need to do a copy
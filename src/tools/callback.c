@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "debug.h"
 #include "x86emu.h"
@@ -23,6 +25,9 @@ typedef struct onecallback_s {
     void*       arg[10];
     int         shared;
     onecallback_t *chain;
+    x86emu_t    *poolemu;   // emu and stack owned by this callback, kept when it goes back to the pool
+    void*       stack;
+    int         stsize;
 } onecallback_t;
 
 KHASH_MAP_INIT_INT(callbacks, onecallback_t*)
@@ -70,38 +75,179 @@ int IsCallback(box86context_t* context, x86emu_t* cb)
     return 1;
 }
 
+#define CALLBACK_STACK  (2*1024*1024)   // default stack size of a callback (1MB is not enough for Xenonauts)
+
+// Pool of freed callbacks, with their emu and stack, so registering a callback doesn't allocate anything in steady state
+// The stacks kept are limited in size too, as they use address space, and their pages are given back to the system
+#define CB_THREAD_CACHE 16  // callbacks kept by each thread
+#define CB_THREAD_BYTES (4*1024*1024)   // size of the stacks kept by each thread
+#define CB_POOL_MAX     64  // callbacks kept in the global pool
+#define CB_POOL_BYTES   (16*1024*1024)  // size of the stacks kept in the global pool
+
+static __thread onecallback_t* thread_cbcache[CB_THREAD_CACHE] = {0};
+static __thread int         thread_cbcache_sz = 0;
+static __thread uint32_t    thread_cbcache_bytes = 0;
+static onecallback_t*       cbpool = NULL;  // chained with "chain"
+static int                  cbpool_sz = 0;
+static uint32_t             cbpool_bytes = 0;
+static pthread_mutex_t      cbpool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t        cbpool_key;
+static pthread_once_t       cbpool_key_once = PTHREAD_ONCE_INIT;
+static uint32_t             cbpool_stats[3] = {0};  // hits, misses, stacks allocated
+
+static void destroyPoolCallback(onecallback_t* cb)
+{
+    if(cb->poolemu)
+        FreeX86Emu(&cb->poolemu);
+    if(cb->stack) {
+        int pagesize = box86_pagesize?box86_pagesize:4096;
+        munmap(cb->stack-pagesize, cb->stsize+pagesize);
+    }
+    free(cb);
+}
+
+static void releaseThreadCache(void* p)
+{
+    pthread_mutex_lock(&cbpool_mutex);
+    for(int i=0; i<thread_cbcache_sz; ++i) {
+        onecallback_t* cb = thread_cbcache[i];
+        if(cbpool_sz<CB_POOL_MAX && cbpool_bytes+cb->stsize<=CB_POOL_BYTES) {
+            cb->chain = cbpool;
+            cbpool = cb;
+            ++cbpool_sz;
+            cbpool_bytes += cb->stsize;
+        } else
+            destroyPoolCallback(cb);
+    }
+    thread_cbcache_sz = 0;
+    thread_cbcache_bytes = 0;
+    pthread_mutex_unlock(&cbpool_mutex);
+}
+static void cbpool_key_alloc()
+{
+    pthread_key_create(&cbpool_key, releaseThreadCache);
+}
+
+// can cb be used for a callback with a stack of stsize (0 for the shared ones, that have no emu and no stack)
+static int matchPoolCallback(onecallback_t* cb, int stsize)
+{
+    return cb->stsize==stsize && (cb->poolemu!=NULL)==(stsize!=0);
+}
+
+// a callback with a stack of stsize (0 for the ones without emu and stack, for shared callbacks)
+static onecallback_t* getPoolCallback(int stsize)
+{
+    for(int i=thread_cbcache_sz-1; i>=0; --i) {
+        onecallback_t* cb = thread_cbcache[i];
+        if(matchPoolCallback(cb, stsize)) {
+            thread_cbcache[i] = thread_cbcache[--thread_cbcache_sz];
+            thread_cbcache_bytes -= stsize;
+            __sync_fetch_and_add(&cbpool_stats[0], 1);
+            return cb;
+        }
+    }
+    pthread_mutex_lock(&cbpool_mutex);
+    onecallback_t** prev = &cbpool;
+    while(*prev && !matchPoolCallback(*prev, stsize))
+        prev = &(*prev)->chain;
+    onecallback_t* cb = *prev;
+    if(cb) {
+        *prev = cb->chain;
+        --cbpool_sz;
+        cbpool_bytes -= stsize;
+    }
+    pthread_mutex_unlock(&cbpool_mutex);
+    __sync_fetch_and_add(&cbpool_stats[cb?0:1], 1);
+    if(!cb)
+        cb = (onecallback_t*)calloc(1, sizeof(onecallback_t));
+    return cb;
+}
+
+static void putPoolCallback(onecallback_t* cb)
+{
+    // the stack is kept, but not the memory behind it
+    if(cb->stack)
+        madvise(cb->stack, cb->stsize, MADV_DONTNEED);
+    if(thread_cbcache_sz<CB_THREAD_CACHE && thread_cbcache_bytes+cb->stsize<=CB_THREAD_BYTES) {
+        if(!thread_cbcache_sz) {
+            // the key is only needed to give the cache back when the thread exits
+            pthread_once(&cbpool_key_once, cbpool_key_alloc);
+            pthread_setspecific(cbpool_key, thread_cbcache);
+        }
+        thread_cbcache[thread_cbcache_sz++] = cb;
+        thread_cbcache_bytes += cb->stsize;
+        return;
+    }
+    pthread_mutex_lock(&cbpool_mutex);
+    if(cbpool_sz<CB_POOL_MAX && cbpool_bytes+cb->stsize<=CB_POOL_BYTES) {
+        cb->chain = cbpool;
+        cbpool = cb;
+        ++cbpool_sz;
+        cbpool_bytes += cb->stsize;
+        cb = NULL;
+    }
+    pthread_mutex_unlock(&cbpool_mutex);
+    if(cb)
+        destroyPoolCallback(cb);
+}
+
+// stack is mmap'd, so only the pages used are commited, with a guard page under it
+static void* allocCallbackStack(int stsize)
+{
+    int pagesize = box86_pagesize?box86_pagesize:4096;
+    void* p = mmap(NULL, stsize+pagesize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if(p==MAP_FAILED)
+        return NULL;
+    mprotect(p, pagesize, PROT_NONE);
+    __sync_fetch_and_add(&cbpool_stats[2], 1);
+    return p+pagesize;
+}
+
 x86emu_t* AddVariableCallback(x86emu_t* emu, int stsize, uintptr_t fnc, int nb_args, void* arg1, void* arg2, void* arg3, void* arg4)
 {
     callbacklist_t *callbacks = emu->context->callbacks;
-    void* stack = calloc(1, stsize);
-    if(!stack) {
-        printf_log(LOG_NONE, "BOX86: Error, cannot allocate %d KB Stack for callback\n", stsize/1024);
+    int pagesize = box86_pagesize?box86_pagesize:4096;
+    if(!stsize)
+        stsize = CALLBACK_STACK;    // no size given (like g_thread_create with a 0 stack_size)
+    stsize = (stsize+pagesize-1)&~(pagesize-1);
+    onecallback_t * cb = getPoolCallback(stsize);
+    x86emu_t * newemu = cb->poolemu;
+    if(!newemu) {
+        // brand new callback
+        cb->stack = allocCallbackStack(stsize);
+        if(!cb->stack) {
+            printf_log(LOG_NONE, "BOX86: Error, cannot allocate %d KB Stack for callback\n", stsize/1024);
+        }
+        cb->stsize = stsize;
+        newemu = cb->poolemu = NewX86Emu(emu->context, fnc, (uintptr_t)cb->stack, stsize, 0);
+    } else {
+        memset(newemu, 0, sizeof(x86emu_t));
+        NewX86EmuFromStack(newemu, emu->context, fnc, (uintptr_t)cb->stack, stsize, 0);
     }
-    x86emu_t * newemu = NewX86Emu(emu->context, fnc, (uintptr_t)stack, stsize, 1);
 	SetupX86Emu(newemu);
 
-    onecallback_t * cb;
     int ret;
     khint_t k = kh_put(callbacks, callbacks->list, (uintptr_t)newemu, &ret);
-    cb = kh_value(callbacks->list, k) = (onecallback_t*)calloc(1, sizeof(onecallback_t));
+    kh_value(callbacks->list, k) = cb;
 
     cb->emu = newemu;
     cb->fnc = fnc;
     cb->nb_args = nb_args;
+    memset(cb->arg, 0, sizeof(cb->arg));
     cb->arg[0] = arg1;
     cb->arg[1] = arg2;
     cb->arg[2] = arg3;
     cb->arg[3] = arg4;
 
     cb->shared = 0;
+    cb->chain = NULL;
 
     return newemu;
 }
 
 x86emu_t* AddCallback(x86emu_t* emu, uintptr_t fnc, int nb_args, void* arg1, void* arg2, void* arg3, void* arg4)
 {
-    // 2MB stack (1MB is not enough for Xenonauts)
-    return AddVariableCallback(emu, 2*1024*1024, fnc, nb_args, arg1, arg2, arg3, arg4);
+    return AddVariableCallback(emu, CALLBACK_STACK, fnc, nb_args, arg1, arg2, arg3, arg4);
 }
 
 
@@ -122,11 +268,12 @@ x86emu_t* AddSharedCallback(x86emu_t* emu, uintptr_t fnc, int nb_args, void* arg
     
     int ret;
     khint_t k = kh_put(callbacks, callbacks->list, (uintptr_t)newemu, &ret);
-    cb = kh_value(callbacks->list, k) = (onecallback_t*)calloc(1, sizeof(onecallback_t));
+    cb = kh_value(callbacks->list, k) = getPoolCallback(0);
 
     cb->emu = newemu;
     cb->fnc = fnc;
     cb->nb_args = nb_args;
+    memset(cb->arg, 0, sizeof(cb->arg));
     cb->arg[0] = arg1;
     cb->arg[1] = arg2;
     cb->arg[2] = arg3;
@@ -158,8 +305,6 @@ x86emu_t* FreeCallback(x86emu_t* emu)
     if(k==kh_end(callbacks->list))
         return emu;
     onecallback_t* cb = kh_value(callbacks->list, k);
-    if(!cb->shared)
-        FreeX86Emu(&cb->emu);
     x86emu_t* ret = NULL;
     if(cb->chain) {
         kh_value(callbacks->list, k) = cb->chain;   // unchain, in case of shared callback inside callback
@@ -167,7 +312,8 @@ x86emu_t* FreeCallback(x86emu_t* emu)
     } else {
         kh_del(callbacks, callbacks->list, k);
     }
-    free(cb);
+    cb->emu = NULL;
+    putPoolCallback(cb);
     return ret;
 }
 
@@ -244,10 +390,26 @@ void FreeCallbackList(callbacklist_t** callbacks)
         return;
     onecallback_t* cb;
     kh_foreach_value((*callbacks)->list, cb,
-        FreeX86Emu(&cb->emu);
-        free(cb);
+        while(cb) {
+            onecallback_t* next = cb->chain;
+            destroyPoolCallback(cb);
+            cb = next;
+        }
     );
     kh_destroy(callbacks, (*callbacks)->list);
+    // empty the pool (the caches of other threads are given back when they exit)
+    releaseThreadCache(NULL);
+    pthread_mutex_lock(&cbpool_mutex);
+    while(cbpool) {
+        cb = cbpool;
+        cbpool = cb->chain;
+        destroyPoolCallback(cb);
+    }
+    cbpool_sz = 0;
+    cbpool_bytes = 0;
+    pthread_mutex_unlock(&cbpool_mutex);
+    if(cbpool_stats[0] || cbpool_stats[1])
+        printf_log(LOG_INFO, "Callback pool: %u hits, %u misses, %u stacks allocated\n", cbpool_stats[0], cbpool_stats[1], cbpool_stats[2]);
     free(*callbacks);
     *callbacks = NULL;
 }
@@ -49,6 +49,8 @@
 #include "auxval.h"
 #include "elfloader.h"
 #include "bridge.h"
+#include "dynarec.h"
+#include "emu/x86predecode.h"
 
 #ifdef PANDORA
 #ifndef __NR_preadv
@@ -2039,6 +2041,9 @@ void EXPORT my_longjmp(x86emu_t* emu, /*struct __jmp_buf_tag __env[1]*/void *p,
     // jmp to saved location, plus restore val to eax
     R_EAX = __val;
     R_EIP = jpbuff->save_eip;
+    #ifdef DYNAREC
+    CStackReset(emu);   // the frames in the cstack are gone
+    #endif
     if(emu->quitonlongjmp) {
         emu->longjmp = 1;
         emu->quit = 1;
@@ -2079,6 +2084,8 @@ EXPORT void* my_mmap(x86emu_t* emu, void *addr, unsigned long length, int prot,
     if(box86_log<LOG_DEBUG) {dynarec_log(LOG_DEBUG, "mmap(%p, %lu, 0x%x, 0x%x, %d, %d) =>", addr, length, prot, flags, fd, offset);}
     void* ret = mmap(addr, length, prot, flags, fd, offset);
     if(box86_log<LOG_DEBUG) {dynarec_log(LOG_DEBUG, "%p\n", ret);}
+    if(box86_predecode && ret!=(void*)-1)
+        forgetPredecodeRange((uintptr_t)ret, length);   // new memory, old pre-decoded code there is gone
     #ifdef DYNAREC
     if(box86_dynarec && ret!=(void*)-1) {
         if(prot& PROT_EXEC)
@@ -2095,6 +2102,8 @@ EXPORT void* my_mmap64(x86emu_t* emu, void *addr, unsigned long length, int prot
     if(box86_log<LOG_DEBUG) {dynarec_log(LOG_DEBUG, "mmap64(%p, %lu, 0x%x, 0x%x, %d, %lld) =>", addr, length, prot, flags, fd, offset);}
     void* ret = mmap64(addr, length, prot, flags, fd, offset);
     if(box86_log<LOG_DEBUG) {dynarec_log(LOG_DEBUG, "%p\n", ret);}
+    if(box86_predecode && ret!=(void*)-1)
+        forgetPredecodeRange((uintptr_t)ret, length);   // new memory, old pre-decoded code there is gone
     #ifdef DYNAREC
     if(box86_dynarec && ret!=(void*)-1) {
         if(prot& PROT_EXEC)
@@ -2113,6 +2122,8 @@ EXPORT int my_munmap(x86emu_t* emu, void* addr, unsigned long length)
     if(box86_dynarec)
         cleanDBFromAddressRange((uintptr_t)addr, length, 1);
     #endif
+    if(box86_predecode)
+        forgetPredecodeRange((uintptr_t)addr, length);
     return munmap(addr, length);
 }
 
@@ -2120,6 +2131,8 @@ EXPORT int my_mprotect(x86emu_t* emu, void *addr, unsigned long len, int prot)
 {
     dynarec_log(LOG_DEBUG, "mprotect(%p, %lu, 0x%x)\n", addr, len, prot);
     int ret = mprotect(addr, len, prot);
+    if(box86_predecode && (prot&PROT_WRITE))
+        cleanPredecodeRange((uintptr_t)addr, len);  // writes will not fault anymore
     #ifdef DYNAREC
     if(box86_dynarec) {
         if(prot& PROT_EXEC)
@@ -0,0 +1,333 @@
+/*
+** box86bench: x86 micro benchmarks, one per class of opcode, to track the speed of
+** the interpreter (Run() / x86primop.c) and of the dynarec across commits.
+**
+** To compile:  gcc -m32 -O2 -march=pentium4 -fno-pie -no-pie -o box86bench box86bench.c -lm
+**
+** box86bench --list            list the benchmarks
+** box86bench [name...]         run the benchmarks (all by default), one JSON object per line
+**
+** Each benchmark loops over a small block of x86 code for at least BENCH_MS ms (env var,
+** default 200). An "op" is one iteration of that block, "insts" is the number of x86
+** instructions of one iteration, so MIPS = ops*insts/us. The format of the lines is stable,
+** runBench.cmake collects them in a single JSON file.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+typedef uint32_t (*benchfn_t)(uint32_t n);
+
+static volatile uint32_t sink;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+// integer alu, no memory access
+static uint32_t bench_alu(uint32_t n)
+{
+    uint32_t a = 1, d = 2;
+    __asm__ volatile(
+        "1:\n\t"
+        "addl %%ecx, %%eax\n\t"
+        "xorl %%eax, %%edx\n\t"
+        "subl $3, %%edx\n\t"
+        "andl $0xffff, %%eax\n\t"
+        "orl %%edx, %%eax\n\t"
+        "shll $1, %%edx\n\t"
+        "imull $7, %%eax, %%eax\n\t"
+        "decl %%ecx\n\t"
+        "jnz 1b\n\t"
+        : "+c"(n), "+a"(a), "+d"(d) : : "cc");
+    return a^d;
+}
+
+// branches depending on flags, adc, setcc and cmovcc
+static uint32_t bench_branch(uint32_t n)
+{
+    uint32_t a = 0, d = 0, b = 0;
+    __asm__ volatile(
+        "1:\n\t"
+        "movl %%ecx, %%eax\n\t"
+        "andl $7, %%eax\n\t"
+        "cmpl $3, %%eax\n\t"
+        "jbe 2f\n\t"
+        "incl %%edx\n\t"
+        "2:\n\t"
+        "testl $1, %%ecx\n\t"
+        "jz 3f\n\t"
+        "addl %%eax, %%edx\n\t"
+        "3:\n\t"
+        "adcl $0, %%edx\n\t"
+        "cmpl %%eax, %%edx\n\t"
+        "setl %%bl\n\t"
+        "cmovgl %%eax, %%edx\n\t"
+        "decl %%ecx\n\t"
+        "jnz 1b\n\t"
+        : "+c"(n), "+a"(a), "+d"(d), "+b"(b) : : "cc");
+    return a^d^b;
+}
+
+static uint32_t buf1[1024], buf2[1024];
+
+// rep movsl of 4KB
+static uint32_t bench_repmovs(uint32_t n)
+{
+    uint32_t c, s, d;
+    while(n--) {
+        __asm__ volatile(
+            "cld\n\t"
+            "rep movsl\n\t"
+            : "=c"(c), "=S"(s), "=D"(d) : "0"(1024), "1"(buf1), "2"(buf2) : "memory");
+    }
+    return buf2[n&1023];
+}
+
+// rep stosl of 4KB
+static uint32_t bench_repstos(uint32_t n)
+{
+    uint32_t c, d;
+    while(n--) {
+        __asm__ volatile(
+            "cld\n\t"
+            "rep stosl\n\t"
+            : "=c"(c), "=D"(d) : "0"(1024), "1"(buf2), "a"(n) : "memory");
+    }
+    return buf2[5];
+}
+
+// x87 add/mul/div/sqrt on the stack
+static uint32_t bench_x87(uint32_t n)
+{
+    double r;
+    __asm__ volatile(
+        "fld1\n\t"
+        "fldz\n\t"
+        "1:\n\t"
+        "fadd %%st(1), %%st(0)\n\t"
+        "fmul %%st(0), %%st(0)\n\t"
+        "fsqrt\n\t"
+        "fdiv %%st(1), %%st(0)\n\t"
+        "decl %%ecx\n\t"
+        "jnz 1b\n\t"
+        "fstpl %1\n\t"
+        "fstp %%st(0)\n\t"
+        : "+c"(n), "=m"(r) : : "cc", "st", "st(1)");
+    return (uint32_t)r;
+}
+
+static const uint64_t mmxcst[2] = {0x0001000200030004LL, 0x00ff00ff00ff00ffLL};
+
+// mmx integer ops
+static uint32_t bench_mmx(uint32_t n)
+{
+    uint32_t r;
+    __asm__ volatile(
+        "movq %2, %%mm0\n\t"
+        "movq %3, %%mm1\n\t"
+        "movq %%mm0, %%mm2\n\t"
+        "1:\n\t"
+        "paddw %%mm0, %%mm2\n\t"
+        "pmullw %%mm0, %%mm2\n\t"
+        "pxor %%mm1, %%mm2\n\t"
+        "psrlw $1, %%mm2\n\t"
+        "pand %%mm1, %%mm2\n\t"
+        "punpcklbw %%mm0, %%mm2\n\t"
+        "decl %%ecx\n\t"
+        "jnz 1b\n\t"
+        "movd %%mm2, %1\n\t"
+        "emms\n\t"
+        : "+c"(n), "=r"(r) : "m"(mmxcst[0]), "m"(mmxcst[1]) : "cc", "mm0", "mm1", "mm2");
+    return r;
+}
+
+static const float ssecst[4] __attribute__((aligned(16))) = {1.0f, 0.5f, 0.25f, 0.125f};
+static const double sse2cst[2] __attribute__((aligned(16))) = {1.0, 0.5};
+
+// sse (single) and sse2 (double and integer) ops
+static uint32_t bench_sse(uint32_t n)
+{
+    uint32_t r;
+    __asm__ volatile(
+        "movaps %2, %%xmm0\n\t"
+        "movapd %3, %%xmm1\n\t"
+        "movaps %%xmm0, %%xmm2\n\t"
+        "movapd %%xmm1, %%xmm3\n\t"
+        "pxor %%xmm4, %%xmm4\n\t"
+        "1:\n\t"
+        "addps %%xmm0, %%xmm2\n\t"
+        "mulps %%xmm0, %%xmm2\n\t"
+        "addpd %%xmm1, %%xmm3\n\t"
+        "mulsd %%xmm1, %%xmm3\n\t"
+        "paddd %%xmm2, %%xmm4\n\t"
+        "pshufd $0x1b, %%xmm4, %%xmm4\n\t"
+        "cvttps2dq %%xmm2, %%xmm5\n\t"
+        "decl %%ecx\n\t"
+        "jnz 1b\n\t"
+        "movd %%xmm4, %1\n\t"
+        : "+c"(n), "=r"(r) : "m"(ssecst[0]), "m"(sse2cst[0])
+        : "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5");
+    return r;
+}
+
+// call/ret pairs
+static uint32_t bench_callret(uint32_t n)
+{
+    uint32_t a = 0;
+    __asm__ volatile(
+        "jmp 2f\n\t"
+        "3:\n\t"
+        "incl %%eax\n\t"
+        "ret\n\t"
+        "2:\n\t"
+        "1:\n\t"
+        "call 3b\n\t"
+        "call 3b\n\t"
+        "decl %%ecx\n\t"
+        "jnz 1b\n\t"
+        : "+c"(n), "+a"(a) : : "cc", "memory");
+    return a;
+}
+
+static uint32_t __attribute__((noinline)) ind0(uint32_t a) { return a+1; }
+static uint32_t __attribute__((noinline)) ind1(uint32_t a) { return a^3; }
+static uint32_t __attribute__((noinline)) ind2(uint32_t a) { return a<<1; }
+static uint32_t __attribute__((noinline)) ind3(uint32_t a) { return a-7; }
+static uint32_t (* volatile indtbl[4])(uint32_t) = {ind0, ind1, ind2, ind3};
+
+// indirect calls through a table, and indirect jumps of a switch
+static uint32_t bench_indirect(uint32_t n)
+{
+    uint32_t a = 0;
+    for(uint32_t i=0; i<n; ++i) {
+        a = indtbl[i&3](a);
+        switch((i*7)&7) {
+            case 0: a += 1; break;
+            case 1: a ^= 5; break;
+            case 2: a -= 3; break;
+            case 3: a |= 8; break;
+            case 4: a += 11; break;
+            case 5: a ^= 17; break;
+            case 6: a -= 19; break;
+            default: a &= 0xffffff; break;
+        }
+        sink = a;
+    }
+    return a;
+}
+
+static volatile uint32_t atomicvar;
+
+// lock prefixed atomics
+static uint32_t bench_atomic(uint32_t n)
+{
+    uint32_t a = 0;
+    while(n--) {
+        a += __sync_fetch_and_add(&atomicvar, 1);
+        __sync_bool_compare_and_swap(&atomicvar, a, a+1);
+        __sync_fetch_and_or(&atomicvar, 1);
+        __asm__ volatile("lock incl %0" : "+m"(atomicvar) : : "cc");
+    }
+    return a;
+}
+
+static char str64[65] = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+
+// calls to wrapped (native) libc functions
+static uint32_t bench_libc(uint32_t n)
+{
+    char tmp[65];
+    uint32_t a = 0;
+    while(n--) {
+        a += strlen(str64);
+        memcpy(tmp, str64, sizeof(tmp));
+        a += memcmp(tmp, str64, sizeof(tmp));
+        memset(tmp, n, sizeof(tmp));
+        a += tmp[3];
+        a += (uint32_t)sin((double)(n&255));
+    }
+    return a;
+}
+
+typedef struct bench_s {
+    const char* name;
+    const char* cls;
+    int         insts;      // x86 instructions in one op (approximated for the C ones)
+    benchfn_t   fn;
+} bench_t;
+
+static const bench_t benchs[] = {
+    {"alu",      "integer", 9,    bench_alu},
+    {"branch",   "flags",   14,   bench_branch},
+    {"repmovs",  "string",  1024, bench_repmovs},
+    {"repstos",  "string",  1024, bench_repstos},
+    {"x87",      "x87",     6,    bench_x87},
+    {"mmx",      "mmx",     8,    bench_mmx},
+    {"sse",      "sse",     9,    bench_sse},
+    {"callret",  "call",    8,    bench_callret},
+    {"indirect", "indirect",20,   bench_indirect},
+    {"atomic",   "lock",    12,   bench_atomic},
+    {"libc",     "wrapped", 40,   bench_libc},
+};
+#define NBENCH  (int)(sizeof(benchs)/sizeof(benchs[0]))
+
+static void runBench(const bench_t* b, uint64_t target)
+{
+    uint32_t n = 1000;
+    uint64_t t;
+    for(;;) {
+        uint64_t t0 = now_ns();
+        sink = b->fn(n);
+        t = now_ns() - t0;
+        if(t>=target || n>=0x40000000)
+            break;
+        // aim directly at the target once the time is significant
+        if(t>target/16)
+            n = (uint32_t)((double)n*target*1.1/t)+1;
+        else
+            n *= 16;
+    }
+    double ns_per_op = (double)t/n;
+    printf("{\"name\": \"%s\", \"class\": \"%s\", \"insts\": %d, \"ops\": %u, \"ns\": %llu, \"ns_per_op\": %.3f, \"mips\": %.2f}\n",
+        b->name, b->cls, b->insts, n, (unsigned long long)t, ns_per_op, (double)b->insts*1000./ns_per_op);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t target = 200;
+    if(getenv("BENCH_MS"))
+        target = strtoul(getenv("BENCH_MS"), NULL, 10);
+    target *= 1000000LL;
+    if(argc>1 && !strcmp(argv[1], "--list")) {
+        for(int i=0; i<NBENCH; ++i)
+            printf("%s\n", benchs[i].name);
+        return 0;
+    }
+    if(argc==1) {
+        for(int i=0; i<NBENCH; ++i)
+            runBench(&benchs[i], target);
+        return 0;
+    }
+    for(int j=1; j<argc; ++j) {
+        int found = 0;
+        for(int i=0; i<NBENCH; ++i)
+            if(!strcmp(argv[j], benchs[i].name)) {
+                runBench(&benchs[i], target);
+                found = 1;
+            }
+        if(!found) {
+            fprintf(stderr, "Unknown benchmark %s\n", argv[j]);
+            return 1;
+        }
+    }
+    return 0;
+}
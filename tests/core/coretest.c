@@ -0,0 +1,225 @@
+// libbox86core test, built and run on the host with cmake -DBOX86CORE=ON
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include "box86core.h"
+
+static int fails = 0;
+
+#define CHECK(A) do { if(!(A)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #A); ++fails; } } while(0)
+
+// mov ecx, 100 / xor eax, eax / loop: add eax, ecx / dec ecx / jnz loop / int 0x80
+static const uint8_t sumloop[] = {
+    0xB9, 0x64, 0x00, 0x00, 0x00,
+    0x31, 0xC0,
+    0x01, 0xC8,
+    0x49,
+    0x75, 0xFB,
+    0xCD, 0x80
+};
+
+static uint32_t load(box86core_t* core, const uint8_t* code, int size)
+{
+    uint32_t addr = box86core_map(core, 0, 4096, PROT_READ|PROT_WRITE|PROT_EXEC);
+    CHECK(addr);
+    CHECK(box86core_write(core, addr, code, size)==0);
+    box86core_set_reg(core, BOX86CORE_EIP, addr);
+    return addr;
+}
+
+static void test_sumloop()
+{
+    box86core_t* core = box86core_new();
+    uint32_t code = load(core, sumloop, sizeof(sumloop));
+    // run 10 instructions: mov, xor and 8 of the loop
+    CHECK(box86core_run(core, 10)==BOX86CORE_COUNT);
+    CHECK(box86core_icount(core)==10);
+    CHECK(box86core_get_reg(core, BOX86CORE_EIP)==code+10);
+    CHECK(box86core_get_reg(core, BOX86CORE_ECX)==97);
+    CHECK(box86core_get_reg(core, BOX86CORE_EAX)==100+99+98);
+    // stop on the INT 0x80
+    CHECK(box86core_add_breakpoint(core, code+12)==0);
+    CHECK(box86core_run(core, 0)==BOX86CORE_BREAKPOINT);
+    CHECK(box86core_get_reg(core, BOX86CORE_EIP)==code+12);
+    CHECK(box86core_get_reg(core, BOX86CORE_EAX)==5050);
+    CHECK(box86core_get_reg(core, BOX86CORE_EFLAGS)&0x40);  // ZF
+    CHECK(box86core_del_breakpoint(core, code+12)==0);
+    CHECK(box86core_del_breakpoint(core, code+12)==-1);
+    // and the syscall
+    CHECK(box86core_run(core, 0)==BOX86CORE_SYSCALL);
+    CHECK(box86core_get_reg(core, BOX86CORE_EIP)==code+14);
+    CHECK(box86core_icount(core)==2+3*100+1);
+    box86core_free(core);
+}
+
+static void test_predecode()
+{
+    box86core_set_predecode(1);
+    box86core_t* core = box86core_new();
+    uint32_t code = load(core, sumloop, sizeof(sumloop));
+    CHECK(box86core_run(core, 10)==BOX86CORE_COUNT);
+    CHECK(box86core_get_reg(core, BOX86CORE_EIP)==code+10);
+    CHECK(box86core_run(core, 0)==BOX86CORE_SYSCALL);
+    CHECK(box86core_get_reg(core, BOX86CORE_EAX)==5050);
+    CHECK(box86core_icount(core)==2+3*100+1);
+    box86core_free(core);
+    box86core_set_predecode(0);
+}
+
+static void test_predecode_reuse()
+{
+    // mov eax, 11 / int 0x80, then mov eax, 21 / int 0x80 and mov eax, 31 / int 0x80 at the same address
+    static const uint8_t prog1[] = { 0xB8, 0x0B, 0x00, 0x00, 0x00, 0xCD, 0x80 };
+    static const uint8_t prog2[] = { 0xB8, 0x15, 0x00, 0x00, 0x00, 0xCD, 0x80 };
+    static const uint8_t prog3[] = { 0xB8, 0x1F, 0x00, 0x00, 0x00, 0xCD, 0x80 };
+    const uint32_t addr = 0x10000000;
+    box86core_set_predecode(1);
+    box86core_t* core = box86core_new();
+    CHECK(box86core_map(core, addr, 4096, PROT_READ|PROT_WRITE|PROT_EXEC)==addr);
+    CHECK(box86core_write(core, addr, prog1, sizeof(prog1))==0);
+    box86core_set_reg(core, BOX86CORE_EIP, addr);
+    CHECK(box86core_run(core, 0)==BOX86CORE_SYSCALL);
+    CHECK(box86core_get_reg(core, BOX86CORE_EAX)==11);
+    // new code written over the old one
+    CHECK(box86core_write(core, addr, prog2, sizeof(prog2))==0);
+    box86core_set_reg(core, BOX86CORE_EIP, addr);
+    CHECK(box86core_run(core, 0)==BOX86CORE_SYSCALL);
+    CHECK(box86core_get_reg(core, BOX86CORE_EAX)==21);
+    box86core_free(core);
+    // and in a new core, at the same address
+    core = box86core_new();
+    CHECK(box86core_map(core, addr, 4096, PROT_READ|PROT_WRITE|PROT_EXEC)==addr);
+    CHECK(box86core_write(core, addr, prog3, sizeof(prog3))==0);
+    box86core_set_reg(core, BOX86CORE_EIP, addr);
+    CHECK(box86core_run(core, 0)==BOX86CORE_SYSCALL);
+    CHECK(box86core_get_reg(core, BOX86CORE_EAX)==31);
+    box86core_free(core);
+    box86core_set_predecode(0);
+}
+
+static void test_predecode_remap()
+{
+    // mov eax, 11 / int 0x80, unmapped and mapped again at the same address with mov eax, 21 / int 0x80
+    static const uint8_t prog1[] = { 0xB8, 0x0B, 0x00, 0x00, 0x00, 0xCD, 0x80 };
+    static const uint8_t prog2[] = { 0xB8, 0x15, 0x00, 0x00, 0x00, 0xCD, 0x80 };
+    const uint32_t addr = 0x10000000;
+    box86core_set_predecode(1);
+    box86core_t* core = box86core_new();
+    CHECK(box86core_map(core, addr, 4096, PROT_READ|PROT_WRITE|PROT_EXEC)==addr);
+    CHECK(box86core_write(core, addr, prog1, sizeof(prog1))==0);
+    box86core_set_reg(core, BOX86CORE_EIP, addr);
+    CHECK(box86core_run(core, 0)==BOX86CORE_SYSCALL);
+    CHECK(box86core_get_reg(core, BOX86CORE_EAX)==11);
+    box86core_free(core);
+    core = box86core_new();
+    CHECK(box86core_map(core, addr, 4096, PROT_READ|PROT_WRITE|PROT_EXEC)==addr);
+    // the new code is not written with box86core_write, only the unmap / map can drop the old blocks
+    memcpy((void*)(uintptr_t)addr, prog2, sizeof(prog2));
+    box86core_set_reg(core, BOX86CORE_EIP, addr);
+    CHECK(box86core_run(core, 0)==BOX86CORE_SYSCALL);
+    CHECK(box86core_get_reg(core, BOX86CORE_EAX)==21);
+    box86core_free(core);
+    box86core_set_predecode(0);
+}
+
+static void test_call()
+{
+    // push 7 / call f / int 0x80 / f: mov eax, [esp+4] / shl eax, 1 / ret
+    static const uint8_t prog[] = {
+        0x6A, 0x07,
+        0xE8, 0x02, 0x00, 0x00, 0x00,
+        0xCD, 0x80,
+        0x8B, 0x44, 0x24, 0x04,
+        0xD1, 0xE0,
+        0xC3
+    };
+    box86core_t* core = box86core_new();
+    load(core, prog, sizeof(prog));
+    uint32_t esp = box86core_get_reg(core, BOX86CORE_ESP);
+    CHECK(box86core_run(core, 0)==BOX86CORE_SYSCALL);
+    CHECK(box86core_get_reg(core, BOX86CORE_EAX)==14);
+    CHECK(box86core_get_reg(core, BOX86CORE_ESP)==esp-4);
+    uint32_t v = 0;
+    CHECK(box86core_read(core, esp-4, &v, 4)==0 && v==7);
+    CHECK(box86core_read(core, 0x1000, &v, 4)==-1);
+    box86core_free(core);
+}
+
+static void test_sse_x87()
+{
+    // paddd xmm0, xmm1 / fld1 / fldpi / faddp / int3
+    static const uint8_t prog[] = {
+        0x66, 0x0F, 0xFE, 0xC1,
+        0xD9, 0xE8,
+        0xD9, 0xEB,
+        0xDE, 0xC1,
+        0xCC
+    };
+    uint32_t a[4] = {1, 2, 3, 4}, b[4] = {10, 20, 30, 40}, r[4];
+    box86core_t* core = box86core_new();
+    uint32_t code = load(core, prog, sizeof(prog));
+    box86core_set_xmm(core, 0, a);
+    box86core_set_xmm(core, 1, b);
+    CHECK(box86core_run(core, 0)==BOX86CORE_INT3);
+    CHECK(box86core_get_reg(core, BOX86CORE_EIP)==code+sizeof(prog));
+    box86core_get_xmm(core, 0, r);
+    CHECK(r[0]==11 && r[1]==22 && r[2]==33 && r[3]==44);
+    CHECK(fabs(box86core_get_st(core, 0)-(1.0+M_PI))<1e-12);
+    box86core_free(core);
+}
+
+static void test_segments()
+{
+    // mov eax, fs:[0] / mov ebx, gs:[4] / int 0x80
+    static const uint8_t prog[] = {
+        0x64, 0xA1, 0x00, 0x00, 0x00, 0x00,
+        0x65, 0x8B, 0x1D, 0x04, 0x00, 0x00, 0x00,
+        0xCD, 0x80
+    };
+    uint32_t tls[2] = {0x12345678, 0x9abcdef0};
+    box86core_t* core = box86core_new();
+    load(core, prog, sizeof(prog));
+    uint32_t data = box86core_map(core, 0, 4096, PROT_READ|PROT_WRITE);
+    CHECK(box86core_write(core, data, tls, sizeof(tls))==0);
+    box86core_set_reg(core, BOX86CORE_FS, 0x43);
+    box86core_set_reg(core, BOX86CORE_GS, 0x4b);
+    box86core_set_segbase(core, BOX86CORE_FS, data);
+    box86core_set_segbase(core, BOX86CORE_GS, data);
+    CHECK(box86core_run(core, 0)==BOX86CORE_SYSCALL);
+    CHECK(box86core_get_reg(core, BOX86CORE_EAX)==tls[0]);
+    CHECK(box86core_get_reg(core, BOX86CORE_EBX)==tls[1]);
+    box86core_free(core);
+}
+
+static void test_error()
+{
+    // inc eax / ud2
+    static const uint8_t prog[] = { 0x40, 0x0F, 0x0B };
+    box86core_t* core = box86core_new();
+    uint32_t code = load(core, prog, sizeof(prog));
+    CHECK(box86core_run(core, 0)==BOX86CORE_ERROR);
+    CHECK(box86core_get_reg(core, BOX86CORE_EIP)==code+1);
+    CHECK(box86core_get_reg(core, BOX86CORE_EAX)==1);
+    box86core_free(core);
+}
+
+int main(int argc, const char** argv)
+{
+    test_sumloop();
+    test_predecode();
+    test_predecode_reuse();
+    test_predecode_remap();
+    test_call();
+    test_sse_x87();
+    test_segments();
+    test_error();
+    if(fails) {
+        printf("%d check(s) failed\n", fails);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
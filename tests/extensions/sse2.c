@@ -0,0 +1,290 @@
+// Conformance of the packed integer / float, shuffle, pack/unpack, compare and min/max
+// opcodes of SSE, SSE2 and MMX. Each opcode is run on a fixed set of operands and the
+// results are printed, sse2.txt is the output of a real x86 cpu.
+// build with gcc -m32 -O1 -msse2 sse2.c -o sse2
+#include<stdint.h>
+#include<stdio.h>
+#include<string.h>
+#include<math.h>
+#include<emmintrin.h>
+
+typedef uint8_t u8;
+typedef uint64_t u64;
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+// integer operands: lanes limits, sign changes and random values
+static const u64 int_data[][2] = {
+	{ 0x0000000000000000ULL, 0xFFFFFFFFFFFFFFFFULL },
+	{ 0x7F807FFF80007FFFULL, 0x800000007FFFFFFFULL },
+	{ 0x0123456789ABCDEFULL, 0xFEDCBA9876543210ULL },
+	{ 0x8080808080808080ULL, 0x7F7F7F7F01010101ULL },
+	{ 0xFF00FF0000FF00FFULL, 0x0001000100010001ULL },
+	{ 0x5A3C96E1D2074B88ULL, 0x19F0A5C37E2D6B04ULL },
+	{ 0x8000800080008000ULL, 0xFFFF0001FFFF8000ULL },
+	{ 0xC3D2E1F00F1E2D3CULL, 0x4B5A69788796A5B4ULL },
+};
+
+// float operands: signed zeros, denormals, infinities and usual values (no NaN)
+static const float float_data[][4] = {
+	{ 0.0f, -0.0f, 1.5f, -2.25f },
+	{ -0.0f, 0.0f, 3.0f, 1e-40f },
+	{ 1e38f, -1e38f, 1e-45f, 100.0f },
+	{ 10.0f, 1e-3f, -1e-40f, -3.0f },
+	{ INFINITY, -7.5f, 0.1f, 12345.678f },
+	{ 2.0f, 3.0f, 1e-20f, -INFINITY },
+};
+static const double double_data[][2] = {
+	{ 0.0, -0.0 },
+	{ -0.0, 0.0 },
+	{ 1.5, -2.25 },
+	{ 1e308, 4.9e-324 },
+	{ 1e-310, -1e300 },
+	{ 0.1, 3.0 },
+	{ INFINITY, -7.5 },
+	{ 2.0, -INFINITY },
+};
+
+// the empty asm prevent the compiler to compute the results at build time
+static __m128i load_int(int i)
+{
+	__m128i r = _mm_loadu_si128((const __m128i*)int_data[i]);
+	__asm__ volatile("" : "+x"(r));
+	return r;
+}
+
+static __m64 load_mmx(int i)
+{
+	__m64 r;
+	memcpy(&r, &int_data[i][0], 8);
+	__asm__ volatile("" : "+y"(r));
+	return r;
+}
+
+static __m128 load_ps(int i)
+{
+	__m128 r = _mm_loadu_ps(float_data[i]);
+	__asm__ volatile("" : "+x"(r));
+	return r;
+}
+
+static __m128d load_pd(int i)
+{
+	__m128d r = _mm_loadu_pd(double_data[i]);
+	__asm__ volatile("" : "+x"(r));
+	return r;
+}
+
+static void print128(const char* name, int a, int b, __m128i r)
+{
+	u64 v[2];
+	_mm_storeu_si128((__m128i*)v, r);
+	printf("%s %d,%d: %016llx %016llx\n", name, a, b, (unsigned long long)v[1], (unsigned long long)v[0]);
+}
+
+static void print64(const char* name, int a, int b, __m64 r)
+{
+	u64 v;
+	memcpy(&v, &r, 8);
+	printf("%s %d,%d: %016llx\n", name, a, b, (unsigned long long)v);
+}
+
+// each operand with 2 others (J is the offset of the 2nd operand), and with itself
+static const int J[] = { 0, 1, 3 };
+#define FOR_PAIRS(data) \
+	for (int i = 0; i < ARRAY_SIZE(data); i++) \
+		for (int k = 0, j; k < ARRAY_SIZE(J) && (j = (i + J[k]) % ARRAY_SIZE(data), 1); k++)
+
+// with itself, the 2 operands are the same register
+#define SSE_INT_TEST(name, op) \
+static void test_sse_##name() { \
+	printf("TEST: " #name "\n"); \
+	FOR_PAIRS(int_data) { \
+		if (i == j) { \
+			__m128i a = load_int(i); \
+			print128(#name, i, j, op(a, a)); \
+		} else \
+			print128(#name, i, j, op(load_int(i), load_int(j))); \
+	} \
+}
+
+#define MMX_INT_TEST(name, op) \
+static void test_mmx_##name() { \
+	printf("TEST: mmx_" #name "\n"); \
+	FOR_PAIRS(int_data) \
+		print64("mmx_" #name, i, j, op(load_mmx(i), load_mmx(j))); \
+	_mm_empty(); \
+}
+
+#define SSE_PS_TEST(name, op) \
+static void test_sse_##name() { \
+	printf("TEST: " #name "\n"); \
+	FOR_PAIRS(float_data) \
+		print128(#name, i, j, _mm_castps_si128(op(load_ps(i), load_ps(j)))); \
+}
+
+#define SSE_PD_TEST(name, op) \
+static void test_sse_##name() { \
+	printf("TEST: " #name "\n"); \
+	FOR_PAIRS(double_data) \
+		print128(#name, i, j, _mm_castpd_si128(op(load_pd(i), load_pd(j)))); \
+}
+
+// shuffles with a few immediates (on the 2nd operand, like pshufd Gx, Ex, Ib)
+static __m128i pshufd_1b(__m128i a, __m128i b) { return _mm_shuffle_epi32(b, 0x1B); }
+static __m128i pshufd_00(__m128i a, __m128i b) { return _mm_shuffle_epi32(b, 0x00); }
+static __m128i pshufd_e4(__m128i a, __m128i b) { return _mm_shuffle_epi32(b, 0xE4); }
+static __m128i pshufd_72(__m128i a, __m128i b) { return _mm_shuffle_epi32(b, 0x72); }
+static __m64 pshufw_1b(__m64 a, __m64 b) { return _mm_shuffle_pi16(b, 0x1B); }
+static __m64 pshufw_55(__m64 a, __m64 b) { return _mm_shuffle_pi16(b, 0x55); }
+static __m64 pshufw_d8(__m64 a, __m64 b) { return _mm_shuffle_pi16(b, 0xD8); }
+
+#define SSE_INT_OPS \
+	GO(paddb, _mm_add_epi8) \
+	GO(paddw, _mm_add_epi16) \
+	GO(paddd, _mm_add_epi32) \
+	GO(paddq, _mm_add_epi64) \
+	GO(psubb, _mm_sub_epi8) \
+	GO(psubw, _mm_sub_epi16) \
+	GO(psubd, _mm_sub_epi32) \
+	GO(psubq, _mm_sub_epi64) \
+	GO(paddsb, _mm_adds_epi8) \
+	GO(paddsw, _mm_adds_epi16) \
+	GO(paddusb, _mm_adds_epu8) \
+	GO(paddusw, _mm_adds_epu16) \
+	GO(psubsb, _mm_subs_epi8) \
+	GO(psubsw, _mm_subs_epi16) \
+	GO(psubusb, _mm_subs_epu8) \
+	GO(psubusw, _mm_subs_epu16) \
+	GO(pmullw, _mm_mullo_epi16) \
+	GO(pmulhw, _mm_mulhi_epi16) \
+	GO(pmulhuw, _mm_mulhi_epu16) \
+	GO(pmaddwd, _mm_madd_epi16) \
+	GO(pavgb, _mm_avg_epu8) \
+	GO(pavgw, _mm_avg_epu16) \
+	GO(psadbw, _mm_sad_epu8) \
+	GO(pminub, _mm_min_epu8) \
+	GO(pmaxub, _mm_max_epu8) \
+	GO(pminsw, _mm_min_epi16) \
+	GO(pmaxsw, _mm_max_epi16) \
+	GO(pand, _mm_and_si128) \
+	GO(pandn, _mm_andnot_si128) \
+	GO(por, _mm_or_si128) \
+	GO(pxor, _mm_xor_si128) \
+	GO(pcmpeqb, _mm_cmpeq_epi8) \
+	GO(pcmpeqw, _mm_cmpeq_epi16) \
+	GO(pcmpeqd, _mm_cmpeq_epi32) \
+	GO(pcmpgtb, _mm_cmpgt_epi8) \
+	GO(pcmpgtw, _mm_cmpgt_epi16) \
+	GO(pcmpgtd, _mm_cmpgt_epi32) \
+	GO(packsswb, _mm_packs_epi16) \
+	GO(packssdw, _mm_packs_epi32) \
+	GO(packuswb, _mm_packus_epi16) \
+	GO(punpcklbw, _mm_unpacklo_epi8) \
+	GO(punpcklwd, _mm_unpacklo_epi16) \
+	GO(punpckldq, _mm_unpacklo_epi32) \
+	GO(punpcklqdq, _mm_unpacklo_epi64) \
+	GO(punpckhbw, _mm_unpackhi_epi8) \
+	GO(punpckhwd, _mm_unpackhi_epi16) \
+	GO(punpckhdq, _mm_unpackhi_epi32) \
+	GO(punpckhqdq, _mm_unpackhi_epi64) \
+	GO(pshufd_1b, pshufd_1b) \
+	GO(pshufd_00, pshufd_00) \
+	GO(pshufd_e4, pshufd_e4) \
+	GO(pshufd_72, pshufd_72)
+
+#define MMX_INT_OPS \
+	GO(paddb, _mm_add_pi8) \
+	GO(paddw, _mm_add_pi16) \
+	GO(paddd, _mm_add_pi32) \
+	GO(psubb, _mm_sub_pi8) \
+	GO(psubw, _mm_sub_pi16) \
+	GO(psubd, _mm_sub_pi32) \
+	GO(paddsb, _mm_adds_pi8) \
+	GO(paddsw, _mm_adds_pi16) \
+	GO(paddusb, _mm_adds_pu8) \
+	GO(paddusw, _mm_adds_pu16) \
+	GO(psubsb, _mm_subs_pi8) \
+	GO(psubsw, _mm_subs_pi16) \
+	GO(psubusb, _mm_subs_pu8) \
+	GO(psubusw, _mm_subs_pu16) \
+	GO(pmullw, _mm_mullo_pi16) \
+	GO(pmulhw, _mm_mulhi_pi16) \
+	GO(pmulhuw, _mm_mulhi_pu16) \
+	GO(pmaddwd, _mm_madd_pi16) \
+	GO(pavgb, _mm_avg_pu8) \
+	GO(psadbw, _mm_sad_pu8) \
+	GO(pminsw, _mm_min_pi16) \
+	GO(pmaxsw, _mm_max_pi16) \
+	GO(pand, _mm_and_si64) \
+	GO(pandn, _mm_andnot_si64) \
+	GO(por, _mm_or_si64) \
+	GO(pxor, _mm_xor_si64) \
+	GO(pcmpeqb, _mm_cmpeq_pi8) \
+	GO(pcmpeqw, _mm_cmpeq_pi16) \
+	GO(pcmpeqd, _mm_cmpeq_pi32) \
+	GO(pcmpgtb, _mm_cmpgt_pi8) \
+	GO(pcmpgtw, _mm_cmpgt_pi16) \
+	GO(pcmpgtd, _mm_cmpgt_pi32) \
+	GO(packsswb, _mm_packs_pi16) \
+	GO(packssdw, _mm_packs_pi32) \
+	GO(packuswb, _mm_packs_pu16) \
+	GO(punpcklbw, _mm_unpacklo_pi8) \
+	GO(punpcklwd, _mm_unpacklo_pi16) \
+	GO(punpckldq, _mm_unpacklo_pi32) \
+	GO(punpckhbw, _mm_unpackhi_pi8) \
+	GO(punpckhwd, _mm_unpackhi_pi16) \
+	GO(punpckhdq, _mm_unpackhi_pi32) \
+	GO(pshufw_1b, pshufw_1b) \
+	GO(pshufw_55, pshufw_55) \
+	GO(pshufw_d8, pshufw_d8)
+
+#define SSE_PS_OPS \
+	GO(addps, _mm_add_ps) \
+	GO(subps, _mm_sub_ps) \
+	GO(mulps, _mm_mul_ps) \
+	GO(divps, _mm_div_ps) \
+	GO(minps, _mm_min_ps) \
+	GO(maxps, _mm_max_ps) \
+	GO(andps, _mm_and_ps) \
+	GO(andnps, _mm_andnot_ps) \
+	GO(orps, _mm_or_ps) \
+	GO(xorps, _mm_xor_ps)
+
+#define SSE_PD_OPS \
+	GO(addpd, _mm_add_pd) \
+	GO(subpd, _mm_sub_pd) \
+	GO(mulpd, _mm_mul_pd) \
+	GO(divpd, _mm_div_pd) \
+	GO(minpd, _mm_min_pd) \
+	GO(maxpd, _mm_max_pd) \
+	GO(andpd, _mm_and_pd) \
+	GO(andnpd, _mm_andnot_pd) \
+	GO(orpd, _mm_or_pd) \
+	GO(xorpd, _mm_xor_pd)
+
+#define GO(name, op) SSE_INT_TEST(name, op)
+SSE_INT_OPS
+#undef GO
+#define GO(name, op) MMX_INT_TEST(name, op)
+MMX_INT_OPS
+#undef GO
+#define GO(name, op) SSE_PS_TEST(name, op)
+SSE_PS_OPS
+#undef GO
+#define GO(name, op) SSE_PD_TEST(name, op)
+SSE_PD_OPS
+#undef GO
+
+int main(int argc, char** argv)
+{
+	#define GO(name, op) test_sse_##name();
+	SSE_INT_OPS
+	SSE_PS_OPS
+	SSE_PD_OPS
+	#undef GO
+	#define GO(name, op) test_mmx_##name();
+	MMX_INT_OPS
+	#undef GO
+	return 0;
+}
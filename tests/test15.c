@@ -0,0 +1,130 @@
+// Contention on LOCK prefixed opcodes (and XCHG) from several threads
+// build with gcc -m32 -O2 -march=pentium4 test15.c -o test15 -lpthread
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define THREADS 4
+#define LOOPS   100000
+
+static volatile uint32_t add_counter = 0;
+static volatile uint32_t xadd_counter = 0;
+static volatile uint32_t incdec_counter = 0;
+static volatile uint32_t cmpxchg_counter = 0;
+static volatile uint64_t cmpxchg8b_counter = 0;
+static volatile uint32_t spinlock = 0;
+static uint32_t protected_counter = 0;      // only modified with spinlock held
+static volatile uint32_t bitlock = 0;
+static uint32_t bit_counter = 0;            // only modified with bit 5 of bitlock set
+
+// misaligned operand, to test atomics crossing the natural alignment
+static uint8_t misaligned_buf[8] __attribute__((aligned(8)));
+#define misaligned_value (*(volatile uint32_t*)(misaligned_buf+3))
+
+static void lock_add(volatile uint32_t* p, uint32_t v)
+{
+    __asm__ volatile("lock addl %1, %0" : "+m"(*p) : "ri"(v) : "cc", "memory");
+}
+
+static uint32_t lock_xadd(volatile uint32_t* p, uint32_t v)
+{
+    __asm__ volatile("lock xaddl %1, %0" : "+m"(*p), "+r"(v) : : "cc", "memory");
+    return v;
+}
+
+static void lock_inc(volatile uint32_t* p)
+{
+    __asm__ volatile("lock incl %0" : "+m"(*p) : : "cc", "memory");
+}
+
+static void lock_dec(volatile uint32_t* p)
+{
+    __asm__ volatile("lock decl %0" : "+m"(*p) : : "cc", "memory");
+}
+
+// return 1 if *p was old and is now val
+static int lock_cmpxchg(volatile uint32_t* p, uint32_t old, uint32_t val)
+{
+    uint8_t ok;
+    __asm__ volatile("lock cmpxchgl %3, %1\n\tsetz %0"
+        : "=q"(ok), "+m"(*p), "+a"(old) : "r"(val) : "cc", "memory");
+    return ok;
+}
+
+static int lock_cmpxchg8b(volatile uint64_t* p, uint64_t old, uint64_t val)
+{
+    uint8_t ok;
+    __asm__ volatile("lock cmpxchg8b %1\n\tsetz %0"
+        : "=q"(ok), "+m"(*p), "+A"(old) : "b"((uint32_t)val), "c"((uint32_t)(val>>32)) : "cc", "memory");
+    return ok;
+}
+
+static uint32_t xchg(volatile uint32_t* p, uint32_t v)
+{
+    __asm__ volatile("xchgl %1, %0" : "+m"(*p), "+r"(v) : : "memory");
+    return v;
+}
+
+// return the old bit
+static int lock_bts(volatile uint32_t* p, int bit)
+{
+    uint8_t old;
+    __asm__ volatile("lock btsl %2, %1\n\tsetc %0" : "=q"(old), "+m"(*p) : "Ir"(bit) : "cc", "memory");
+    return old;
+}
+
+static int lock_btr(volatile uint32_t* p, int bit)
+{
+    uint8_t old;
+    __asm__ volatile("lock btrl %2, %1\n\tsetc %0" : "=q"(old), "+m"(*p) : "Ir"(bit) : "cc", "memory");
+    return old;
+}
+
+static void* worker(void* arg)
+{
+    for(int i=0; i<LOOPS; ++i) {
+        lock_add(&add_counter, 3);
+        lock_add(&misaligned_value, 1);
+        lock_xadd(&xadd_counter, 2);
+        lock_inc(&incdec_counter);
+        lock_inc(&incdec_counter);
+        lock_dec(&incdec_counter);
+        uint32_t old;
+        do {
+            old = cmpxchg_counter;
+        } while(!lock_cmpxchg(&cmpxchg_counter, old, old+1));
+        uint64_t old64;
+        do {
+            old64 = cmpxchg8b_counter;
+        } while(!lock_cmpxchg8b(&cmpxchg8b_counter, old64, old64+0x100000001LL));
+        // spinlock with xchg
+        while(xchg(&spinlock, 1))
+            ;
+        ++protected_counter;
+        xchg(&spinlock, 0);
+        // spinlock with bts / btr
+        while(lock_bts(&bitlock, 5))
+            ;
+        ++bit_counter;
+        lock_btr(&bitlock, 5);
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    pthread_t tid[THREADS];
+    for(int i=0; i<THREADS; ++i)
+        pthread_create(&tid[i], NULL, worker, NULL);
+    for(int i=0; i<THREADS; ++i)
+        pthread_join(tid[i], NULL);
+    printf("lock add: %u\n", add_counter);
+    printf("lock add (misaligned): %u\n", misaligned_value);
+    printf("lock xadd: %u\n", xadd_counter);
+    printf("lock inc/dec: %u\n", incdec_counter);
+    printf("lock cmpxchg: %u\n", cmpxchg_counter);
+    printf("lock cmpxchg8b: 0x%llx\n", (unsigned long long)cmpxchg8b_counter);
+    printf("xchg spinlock: %u\n", protected_counter);
+    printf("bts/btr spinlock: %u (bitlock=%u)\n", bit_counter, bitlock);
+    return 0;
+}